@@ -0,0 +1,96 @@
+/* Abstract syntax tree
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+
+#define NODE_CHUNK 1024
+
+typedef struct NodeChunk {
+  struct NodeChunk *previous;
+  AstNode nodes[NODE_CHUNK];
+} NodeChunk;
+
+NodeChunk *nodeChunk;
+int nodeChunkUsed = NODE_CHUNK;
+
+AstNode *builtins[BUILTIN_COUNT + 1];
+
+/******************************************************************/
+
+AstNode* newNode(NodeKind kind, int lineNo, int colNo) {
+  NodeChunk *chunk;
+  AstNode *node;
+
+  if ((nodeChunk == NULL) || (nodeChunkUsed == NODE_CHUNK)) {
+    chunk = (NodeChunk*)malloc(sizeof(NodeChunk));
+    chunk->previous = nodeChunk;
+    nodeChunk = chunk;
+    nodeChunkUsed = 0;
+  }
+  node = &nodeChunk->nodes[nodeChunkUsed++];
+  memset(node, 0, sizeof(AstNode));
+  node->kind = kind;
+  node->lineNo = lineNo;
+  node->colNo = colNo;
+  return node;
+}
+
+void freeAst(void) {
+  NodeChunk *previous;
+  while (nodeChunk != NULL) {
+    previous = nodeChunk->previous;
+    free(nodeChunk);
+    nodeChunk = previous;
+  }
+  nodeChunkUsed = NODE_CHUNK;
+}
+
+AstNode* makeBuiltin(Builtin builtin, NodeKind kind, char *name, Type *type, Type *paramType) {
+  AstNode *node = (AstNode*)calloc(1, sizeof(AstNode));
+  node->kind = kind;
+  strcpy(node->name, name);
+  node->type = type;
+  node->builtin = builtin;
+  if (paramType != NULL) {
+    node->list = (AstNode*)calloc(1, sizeof(AstNode));
+    node->list->kind = N_PARAM;
+    node->list->type = paramType;
+  }
+  return node;
+}
+
+// The standard I/O subroutines, made on first use
+AstNode* builtinNode(Builtin builtin) {
+  if (builtins[BUILTIN_READC] == NULL) {
+    builtins[BUILTIN_READC] = makeBuiltin(BUILTIN_READC, N_FUNCTION, "READC", charType, NULL);
+    builtins[BUILTIN_READI] = makeBuiltin(BUILTIN_READI, N_FUNCTION, "READI", intType, NULL);
+    builtins[BUILTIN_WRITEI] = makeBuiltin(BUILTIN_WRITEI, N_PROCEDURE, "WRITEI", NULL, intType);
+    builtins[BUILTIN_WRITEC] = makeBuiltin(BUILTIN_WRITEC, N_PROCEDURE, "WRITEC", NULL, charType);
+    builtins[BUILTIN_WRITELN] = makeBuiltin(BUILTIN_WRITELN, N_PROCEDURE, "WRITELN", NULL, NULL);
+  }
+  return builtins[builtin];
+}
+
+int listLength(AstNode *list) {
+  int n = 0;
+  for (; list != NULL; list = list->next) n ++;
+  return n;
+}
+
+int binarySpine(AstNode *expr, AstNode ***spine) {
+  AstNode *node;
+  int count = 0, i;
+
+  for (node = expr; node->kind == N_BINARY; node = node->left)
+    count ++;
+  *spine = (AstNode**)malloc((count + 1) * sizeof(AstNode*));
+  for (i = count - 1, node = expr; i >= 0; i--, node = node->left)
+    (*spine)[i] = node;
+  return count;
+}
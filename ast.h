@@ -0,0 +1,87 @@
+/* Abstract syntax tree
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __AST_H__
+#define __AST_H__
+
+#include "token.h"
+#include "types.h"
+
+typedef enum {
+  // declarations
+  N_PROGRAM,      // name; body: N_BLOCK
+  N_BLOCK,        // list: declarations in source order; body: N_GROUP
+  N_CONST,        // name; type; value, folded while parsing
+  N_TYPE,         // name; type
+  N_VAR,          // name; type
+  N_PARAM,        // name; type; isVarParam
+  N_FUNCTION,     // name; list: N_PARAMs; type: result; body: N_BLOCK
+  N_PROCEDURE,    // name; list: N_PARAMs; body: N_BLOCK
+  // statements
+  N_ASSIGN,       // left: N_VARIABLE; right: expression
+  N_CALL,         // name; decl; list: arguments
+  N_GROUP,        // list: statements
+  N_IF,           // left: N_COMPARE; body: then part; right: else part or NULL
+  N_WHILE,        // left: N_COMPARE; body
+  N_FOR,          // left: N_VARIABLE; right: initial value; list: final value; body
+  // expressions
+  N_NUMBER,       // value
+  N_CHARCONST,    // value
+  N_VARIABLE,     // name; decl; list: indexes
+  N_FUNCALL,      // name; decl; list: arguments
+  N_UNARY,        // op: SB_PLUS or SB_MINUS; left
+  N_BINARY,       // op: SB_PLUS, SB_MINUS, SB_TIMES or SB_SLASH; left; right
+  N_COMPARE       // op: SB_EQ ... SB_GE; left; right
+} NodeKind;
+
+typedef enum {
+  BUILTIN_NONE,
+  BUILTIN_READC,
+  BUILTIN_READI,
+  BUILTIN_WRITEI,
+  BUILTIN_WRITEC,
+  BUILTIN_WRITELN
+} Builtin;
+
+#define BUILTIN_COUNT BUILTIN_WRITELN
+
+typedef struct AstNode {
+  NodeKind kind;
+  int lineNo, colNo;
+  char name[MAX_IDENT_LEN + 1];
+  int value;
+  TokenType op;
+  Type *type;
+  struct AstNode *decl;        // the declaration an identifier refers to
+  struct AstNode *left, *right, *body, *list;
+  struct AstNode *next;        // next in the enclosing list
+  int isVarParam;
+  Builtin builtin;
+  // set by the code generator: for variables and parameters the depth of
+  // the declaring body and the cell offset in its frame; for subroutines
+  // the depth of their own body and their procedure number
+  int level, offset;
+  // set by the IR builder: the SSA variable of a scalar that never leaves
+  // the body declaring it, or -1 when it lives in memory
+  int variable;
+  // set by the C translator: how evaluating an expression may fail, plus
+  // one, or 0 until it is known
+  int risk;
+} AstNode;
+
+// Nodes come from an arena; freeAst() releases every node made since the
+// last call. The builtin declarations live outside it.
+AstNode* newNode(NodeKind kind, int lineNo, int colNo);
+void freeAst(void);
+
+AstNode* builtinNode(Builtin builtin);
+int listLength(AstNode *list);
+// The operations of the left-associative chain at expr, an N_BINARY node,
+// innermost first: spine[0]->left is its first operand and spine[i]->right
+// the one after. Returns their count; the caller frees *spine.
+int binarySpine(AstNode *expr, AstNode ***spine);
+
+#endif
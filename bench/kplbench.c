@@ -0,0 +1,392 @@
+/* Scanner and parser throughput benchmark
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "pipeline.h"
+#include "push.h"
+#include "parallel.h"
+#include "json.h"
+
+#define MODE_COUNT 9
+#define MAX_FILES 64
+// Bytes a push parse is fed at a time
+#define PUSH_CHUNK 4096
+
+typedef struct {
+  char *name;
+  char *description;
+} BenchMode;
+
+typedef struct {
+  char *fileName;
+  long bytes;
+  long tokens;
+  double seconds[MODE_COUNT];
+  int status[MODE_COUNT];
+} BenchResult;
+
+BenchMode modes[MODE_COUNT] = {
+  { "lex", "scanner only" },
+  { "parse", "parser, no output" },
+  { "trace", "parser with trace to /dev/null" },
+  { "check", "parser with symbol table checks, no output" },
+  { "semantic", "parser building the tree, then the semantic analysis" },
+  { "pipeline", "parser, no output, fed by a lexer thread" },
+  { "buffer", "parser, no output, over the whole file in memory" },
+  { "push", "parser, no output, pushed the same memory in chunks" },
+  { "parallel", "parser, no output, top-level subroutines on worker threads" }
+};
+
+extern __thread FILE *outputStream;
+extern int traceEnabled;
+extern int checkSymbols;
+extern int checkSemantics;
+extern __thread Token *lookAhead;
+extern void (*tokenSource)(Token *token);
+
+long tokenCount;
+
+// The tokens of a file, scanned once for --advance
+Token *replayTokens;
+long replayCount, replayNext;
+
+/******************************************************************/
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void lexAll(void) {
+  tokenCount = 1;
+  while (lookAhead->tokenType != TK_EOF) {
+    scan();
+    tokenCount ++;
+  }
+}
+
+// Modes over the source in memory; the time to read it is counted in neither
+int runMemoryMode(int mode, char *source, long length) {
+  PushParser *parser;
+  long offset;
+  int status = PARSE_MORE;
+
+  traceEnabled = 0;
+  if (mode == 6) {
+    openInputBuffer(source, length, 1, 1);
+    status = compileWith(compileProgram);
+    closeInputStream();
+  } else {
+    parser = openPushParser();
+    for (offset = 0; (offset < length) && (status == PARSE_MORE); offset += PUSH_CHUNK)
+      status = feedParser(parser, source + offset, length - offset < PUSH_CHUNK ? length - offset : PUSH_CHUNK);
+    status = finishParser(parser);
+    closePushParser(parser);
+  }
+  traceEnabled = 1;
+  return status;
+}
+
+int runMode(int mode, char *fileName) {
+  FILE *devNull = NULL;
+  int status;
+
+  if (mode == 8) {
+    // reads the file itself, as the parser does
+    traceEnabled = 0;
+    status = compileParallel(fileName);
+    traceEnabled = 1;
+    return status;
+  }
+  if (openInputStream(fileName) == IO_ERROR)
+    return IO_ERROR;
+
+  switch (mode) {
+  case 0:
+    status = compileWith(lexAll);
+    break;
+  case 1:
+    traceEnabled = 0;
+    status = compileWith(compileProgram);
+    traceEnabled = 1;
+    break;
+  case 2:
+    devNull = fopen("/dev/null", "w");
+    outputStream = devNull;
+    status = compileWith(compileProgram);
+    outputStream = stdout;
+    fclose(devNull);
+    break;
+  case 3:
+    traceEnabled = 0;
+    checkSymbols = 1;
+    status = compileWith(compileProgram);
+    checkSymbols = 0;
+    traceEnabled = 1;
+    break;
+  case 4:
+    traceEnabled = 0;
+    checkSemantics = 1;
+    status = compileSource();
+    checkSemantics = 0;
+    checkSymbols = 0;
+    traceEnabled = 1;
+    break;
+  default:
+    traceEnabled = 0;
+    startPipeline();
+    status = compileWith(compileProgram);
+    stopPipeline();
+    traceEnabled = 1;
+    break;
+  }
+  closeInputStream();
+  return status;
+}
+
+void runBench(BenchResult *r, int repeat) {
+  struct stat st;
+  double start, elapsed;
+  char *source;
+  FILE *f;
+  int mode, i;
+
+  stat(r->fileName, &st);
+  r->bytes = st.st_size;
+  source = (char*)malloc(r->bytes + 1);
+  f = fopen(r->fileName, "rb");
+  if ((f == NULL) || ((long)fread(source, 1, r->bytes, f) != r->bytes))
+    r->bytes = 0;
+  if (f != NULL)
+    fclose(f);
+  for (mode = 0; mode < MODE_COUNT; mode++) {
+    r->seconds[mode] = -1;
+    for (i = 0; i < repeat; i++) {
+      start = now();
+      if ((mode == 6) || (mode == 7))
+        r->status[mode] = runMemoryMode(mode, source, r->bytes);
+      else r->status[mode] = runMode(mode, r->fileName);
+      elapsed = now() - start;
+      if (r->seconds[mode] < 0 || elapsed < r->seconds[mode])
+        r->seconds[mode] = elapsed;
+      if (mode == 0)
+        r->tokens = tokenCount;
+    }
+  }
+  free(source);
+}
+
+void writeResults(FILE *f, BenchResult *results, int count) {
+  int i, mode;
+  time_t t = time(NULL);
+  char date[32];
+
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+  fprintf(f, "{\n  \"parserVersion\": \"%s\",\n  \"date\": \"%s\",\n  \"files\": [\n", PARSER_VERSION, date);
+  for (i = 0; i < count; i++) {
+    fprintf(f, "    {\"file\": ");
+    writeJsonString(f, results[i].fileName, strlen(results[i].fileName));
+    fprintf(f, ", \"bytes\": %ld, \"tokens\": %ld,\n     \"modes\": {", results[i].bytes, results[i].tokens);
+    for (mode = 0; mode < MODE_COUNT; mode++) {
+      double s = results[i].seconds[mode];
+      fprintf(f, "%s\n       \"%s\": {\"seconds\": %.6f, \"mbPerSec\": %.2f, \"tokensPerSec\": %.0f, \"ok\": %s}",
+              mode ? "," : "", modes[mode].name, s,
+              results[i].bytes / s / 1e6, results[i].tokens / s,
+              results[i].status[mode] == IO_SUCCESS ? "true" : "false");
+    }
+    fprintf(f, "}}%s\n", (i + 1 < count) ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+// Prints each result against the matching file and mode of a stored run.
+// Returns the number of entries more than threshold percent slower.
+int compareBaseline(char *baselineName, BenchResult *results, int count, double threshold) {
+  FILE *f = fopen(baselineName, "rb");
+  JsonValue *baseline, *file, *old;
+  char *text;
+  long length;
+  int i, mode, regressions = 0;
+  double was, change;
+
+  if (f == NULL) {
+    fprintf(stderr, "kplbench: can't read baseline %s\n", baselineName);
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  text = (char*)malloc(length + 1);
+  length = fread(text, 1, length, f);
+  text[length] = '\0';
+  fclose(f);
+  baseline = parseJson(text, length);
+  free(text);
+
+  printf("\n%-32s %-8s %10s %10s %8s\n", "vs baseline", "mode", "MB/s was", "MB/s now", "change");
+  for (i = 0; i < count; i++) {
+    file = jsonMember(baseline, "files");
+    for (file = (file != NULL) ? file->child : NULL; file != NULL; file = file->next) {
+      old = jsonMember(file, "file");
+      if ((old != NULL) && (old->type == JSON_STRING) && (strcmp(old->string, results[i].fileName) == 0))
+        break;
+    }
+    if (file == NULL) continue;
+    for (mode = 0; mode < MODE_COUNT; mode++) {
+      old = jsonMember(jsonMember(file, "modes"), modes[mode].name);
+      was = (old != NULL && jsonMember(old, "mbPerSec") != NULL) ? jsonMember(old, "mbPerSec")->number : 0;
+      if (was <= 0) continue;
+      change = (results[i].bytes / results[i].seconds[mode] / 1e6 - was) / was * 100;
+      printf("%-32s %-8s %10.2f %10.2f %+7.1f%%%s\n", results[i].fileName, modes[mode].name, was,
+             results[i].bytes / results[i].seconds[mode] / 1e6, change,
+             (change < -threshold) ? "  REGRESSION" : "");
+      if (change < -threshold) regressions ++;
+    }
+  }
+  freeJson(baseline);
+  return regressions;
+}
+
+/******************************************************************/
+
+// Token advance alone, the scanning left out: the tokens of fileName are
+// scanned into memory, then walked by the parser's scan() over its ring and
+// by the scan() it had before, which freed a token and malloc'd one per step
+void replayToken(Token *token) {
+  *token = replayTokens[replayNext < replayCount ? replayNext++ : replayCount - 1];
+}
+
+Token* replayHeapToken(void) {
+  Token *token = (Token*)malloc(sizeof(Token));
+  replayToken(token);
+  return token;
+}
+
+void advanceAll(void) {
+  while (lookAhead->tokenType != TK_EOF)
+    scan();
+}
+
+void benchAdvance(char *fileName, int repeat) {
+  Token *current, *next;
+  double start, ring = -1, heap = -1, elapsed;
+  long capacity = 1024;
+  int i;
+
+  if (openInputStream(fileName) == IO_ERROR)
+    return;
+  replayTokens = (Token*)malloc(capacity * sizeof(Token));
+  replayCount = 0;
+  do {
+    if (replayCount == capacity) {
+      capacity *= 2;
+      replayTokens = (Token*)realloc(replayTokens, capacity * sizeof(Token));
+    }
+    scanValidToken(&replayTokens[replayCount]);
+  } while (replayTokens[replayCount++].tokenType != TK_EOF);
+  closeInputStream();
+
+  for (i = 0; i < repeat; i++) {
+    replayNext = 0;
+    tokenSource = replayToken;
+    start = now();
+    compileWith(advanceAll);
+    elapsed = now() - start;
+    tokenSource = scanValidToken;
+    if (ring < 0 || elapsed < ring)
+      ring = elapsed;
+
+    replayNext = 0;
+    start = now();
+    current = NULL;
+    next = replayHeapToken();
+    while (next->tokenType != TK_EOF) {
+      free(current);
+      current = next;
+      next = replayHeapToken();
+    }
+    free(current);
+    free(next);
+    elapsed = now() - start;
+    if (heap < 0 || elapsed < heap)
+      heap = elapsed;
+  }
+  printf("%-32s %10ld tokens  ring %6.2f ns/token  heap %6.2f ns/token\n", fileName, replayCount,
+         ring * 1e9 / replayCount, heap * 1e9 / replayCount);
+  free(replayTokens);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: kplbench [--repeat N] [-o RESULTS.json] [--baseline FILE] [--threshold PCT] [--advance] file...\n");
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  BenchResult results[MAX_FILES];
+  char *resultName = NULL, *baselineName = NULL;
+  int count = 0, repeat = 3, i, mode, regressions = 0;
+  double threshold = 10;
+  int advance = 0;
+  FILE *f;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) resultName = argv[++i];
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baselineName = argv[++i];
+    else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+    else if (strcmp(argv[i], "--advance") == 0) advance = 1;
+    else if (argv[i][0] == '-') usage();
+    else if (count < MAX_FILES) {
+      memset(&results[count], 0, sizeof(BenchResult));
+      results[count++].fileName = argv[i];
+    }
+  }
+  if (count == 0) usage();
+
+  outputStream = stdout;
+  if (advance) {
+    for (i = 0; i < count; i++)
+      benchAdvance(results[i].fileName, repeat);
+    return 0;
+  }
+
+  printf("%-32s %10s %10s %-8s %10s %10s %12s\n", "file", "bytes", "tokens", "mode", "seconds", "MB/s", "tokens/s");
+  for (i = 0; i < count; i++) {
+    runBench(&results[i], repeat);
+    for (mode = 0; mode < MODE_COUNT; mode++)
+      printf("%-32s %10ld %10ld %-8s %10.4f %10.2f %12.0f%s\n", results[i].fileName, results[i].bytes,
+             results[i].tokens, modes[mode].name, results[i].seconds[mode],
+             results[i].bytes / results[i].seconds[mode] / 1e6,
+             results[i].tokens / results[i].seconds[mode],
+             results[i].status[mode] == IO_SUCCESS ? "" : "  (failed)");
+    printf("%-32s parallel parse %.2f times as fast as the serial one\n", results[i].fileName,
+           results[i].seconds[1] / results[i].seconds[8]);
+  }
+
+  if (resultName != NULL) {
+    f = fopen(resultName, "w");
+    if (f == NULL) {
+      fprintf(stderr, "kplbench: can't write %s\n", resultName);
+      return -1;
+    }
+    writeResults(f, results, count);
+    fclose(f);
+    printf("results written to %s\n", resultName);
+  }
+
+  if (baselineName != NULL)
+    regressions = compareBaseline(baselineName, results, count, threshold);
+  return regressions ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+/* Synthetic KPL program generator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MAX_IDENT_LEN 15
+#define MAX_DEPTH 16
+#define GLOBAL_ARRAYS 4
+#define ARRAY_SIZE 100
+
+typedef struct {
+  long size;            // approximate output size in bytes
+  int depth;            // deepest nesting of subroutines
+  int arrays;           // percentage of statements and factors touching arrays
+  int exprTerms;        // average number of terms in an expression
+  int comments;         // percentage of statements preceded by a comment
+  int identLen;         // length identifiers are padded to
+  int globals;          // INTEGER variables declared by the program
+  int locals;           // most INTEGER variables declared by a subroutine
+  unsigned long long seed;
+} GenOptions;
+
+typedef struct {
+  char name[MAX_IDENT_LEN + 1];
+  int isFunction;
+} Subroutine;
+
+GenOptions opt = { 1 << 20, 3, 20, 4, 10, 6, 8, 4, 1 };
+FILE *out;
+long written;
+unsigned long long rng;
+
+Subroutine *subs;
+int subCount, subCapacity;
+int nameCounter;
+
+// variables visible in the subroutine being generated
+char (*scopeVars[MAX_DEPTH + 2])[MAX_IDENT_LEN + 1];
+int scopeVarCount[MAX_DEPTH + 2], scopeVarCapacity[MAX_DEPTH + 2];
+int scopeLevel;
+
+/******************************************************************/
+
+unsigned long long nextRandom(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+int randomBelow(int n) {
+  return (int)(nextRandom() % (unsigned long long)n);
+}
+
+int chance(int percent) {
+  return randomBelow(100) < percent;
+}
+
+void emit(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  written += vfprintf(out, fmt, ap);
+  va_end(ap);
+}
+
+void indent(int level) {
+  int i;
+  for (i = 0; i < level; i++) emit("  ");
+}
+
+// prefix and a serial number, padded with the prefix letter; the digits keep
+// generated names clear of keywords
+void makeName(char *name, char prefix) {
+  int len = snprintf(name, MAX_IDENT_LEN + 1, "%c%d", prefix, nameCounter++);
+  while (len < opt.identLen) name[len++] = prefix;
+  name[len] = '\0';
+}
+
+char* randomVar(void) {
+  int level = randomBelow(scopeLevel + 1), tries;
+  for (tries = 0; tries <= scopeLevel && scopeVarCount[level] == 0; tries++)
+    level = (level + 1) % (scopeLevel + 1);
+  return scopeVars[level][randomBelow(scopeVarCount[level])];
+}
+
+void addVar(char *name) {
+  int n = scopeVarCount[scopeLevel];
+  if (n == scopeVarCapacity[scopeLevel]) {
+    scopeVarCapacity[scopeLevel] = n ? n * 2 : 64;
+    scopeVars[scopeLevel] = realloc(scopeVars[scopeLevel], scopeVarCapacity[scopeLevel] * sizeof(*scopeVars[0]));
+  }
+  strcpy(scopeVars[scopeLevel][n], name);
+  scopeVarCount[scopeLevel] = n + 1;
+}
+
+void comment(int level) {
+  static const char *words[] = { "update", "the", "counter", "loop", "index", "sum", "check", "bound", "value" };
+  int i, n = 2 + randomBelow(6);
+  indent(level);
+  emit("(*");
+  for (i = 0; i < n; i++) emit(" %s", words[randomBelow(9)]);
+  emit(" *)\n");
+}
+
+/******************************************************************/
+
+void expression(int depth);
+
+void arrayElement(int depth) {
+  emit("G%d(.", randomBelow(GLOBAL_ARRAYS));
+  if (depth > 2) emit("%d", 1 + randomBelow(ARRAY_SIZE));
+  else expression(depth + 1);
+  emit(".)");
+}
+
+// Returns whether the factor was a number. Two numbers are never neighbours
+// and none is zero, so folding them can neither overflow nor divide by zero.
+int factor(int depth, int afterNumber) {
+  int k = randomBelow(100);
+  if (afterNumber) emit("%s", randomVar());
+  else if (k < opt.arrays) arrayElement(depth);
+  else if (k < opt.arrays + 30) {
+    emit("%d", 1 + randomBelow(999));
+    return 1;
+  }
+  else if (k < opt.arrays + 40 && depth < 3) {
+    emit("(");
+    expression(depth + 1);
+    emit(")");
+    // it may fold to a number too
+    return 1;
+  } else if (k < opt.arrays + 45 && depth < 3 && subCount > 0) {
+    Subroutine *s = &subs[randomBelow(subCount)];
+    if (s->isFunction) {
+      emit("%s(", s->name);
+      expression(depth + 1);
+      emit(", %s)", randomVar());
+    } else emit("%s", randomVar());
+  } else emit("%s", randomVar());
+  return 0;
+}
+
+void expression(int depth) {
+  static const char *ops[] = { " + ", " - ", " * ", " / " };
+  int terms = 1 + randomBelow(opt.exprTerms * 2 - 1), i, number;
+  if (depth > 0) terms = 1 + randomBelow(2);
+  if (chance(10)) emit("-");
+  number = factor(depth, 0);
+  for (i = 1; i < terms; i++) {
+    emit("%s", ops[randomBelow(4)]);
+    number = factor(depth, number);
+  }
+}
+
+void condition(void) {
+  static const char *ops[] = { " = ", " != ", " < ", " <= ", " > ", " >= " };
+  expression(1);
+  emit("%s", ops[randomBelow(6)]);
+  expression(1);
+}
+
+void statement(int level, int depth, char *function);
+
+void statementList(int level, int depth, int count, char *function) {
+  int i;
+  for (i = 0; i < count; i++) {
+    if (chance(opt.comments)) comment(level);
+    statement(level, depth, function);
+    emit(i + 1 < count ? ";\n" : "\n");
+  }
+}
+
+void statement(int level, int depth, char *function) {
+  int k = (depth >= 3) ? randomBelow(50) : randomBelow(100);
+
+  indent(level);
+  if (k < 45) {
+    if (function != NULL && chance(20)) emit("%s", function);
+    else if (chance(opt.arrays)) arrayElement(1);
+    else emit("%s", randomVar());
+    emit(" := ");
+    expression(0);
+  } else if (k < 55 && subCount > 0) {
+    Subroutine *s = &subs[randomBelow(subCount)];
+    if (s->isFunction) {
+      emit("%s := %s(", randomVar(), s->name);
+      expression(1);
+      emit(", %s)", randomVar());
+    } else {
+      emit("CALL %s(", s->name);
+      expression(1);
+      emit(", %s)", randomVar());
+    }
+  } else if (k < 55) {
+    emit("CALL WRITEI(");
+    expression(1);
+    emit(")");
+  } else if (k < 70) {
+    emit("IF ");
+    condition();
+    emit(" THEN\n");
+    statement(level + 1, depth + 1, function);
+    if (chance(50)) {
+      emit("\n");
+      indent(level);
+      emit("ELSE\n");
+      statement(level + 1, depth + 1, function);
+    }
+  } else if (k < 80) {
+    emit("WHILE ");
+    condition();
+    emit(" DO\n");
+    statement(level + 1, depth + 1, function);
+  } else if (k < 90) {
+    emit("FOR %s := ", randomVar());
+    expression(1);
+    emit(" TO ");
+    expression(1);
+    emit(" DO\n");
+    statement(level + 1, depth + 1, function);
+  } else {
+    emit("BEGIN\n");
+    statementList(level + 1, depth + 1, 1 + randomBelow(4), function);
+    indent(level);
+    emit("END");
+  }
+}
+
+void subroutine(int level, int depth) {
+  char name[MAX_IDENT_LEN + 1], a[MAX_IDENT_LEN + 1], b[MAX_IDENT_LEN + 1], v[MAX_IDENT_LEN + 1];
+  int isFunction = chance(40), nested = 0, i, locals;
+  Subroutine *s;
+
+  makeName(name, isFunction ? 'F' : 'P');
+  makeName(a, 'A');
+  makeName(b, 'B');
+
+  indent(level);
+  if (isFunction)
+    emit("FUNCTION %s(%s : INTEGER; VAR %s : INTEGER) : INTEGER;\n", name, a, b);
+  else emit("PROCEDURE %s(%s : INTEGER; VAR %s : INTEGER);\n", name, a, b);
+
+  scopeLevel ++;
+  scopeVarCount[scopeLevel] = 0;
+  addVar(a);
+  addVar(b);
+
+  locals = 1 + randomBelow(opt.locals);
+  indent(level);
+  emit("VAR ");
+  for (i = 0; i < locals; i++) {
+    makeName(v, 'L');
+    addVar(v);
+    if (i > 0) indent(level + 2);
+    emit("%s : INTEGER;\n", v);
+  }
+
+  if (depth < opt.depth) nested = randomBelow(3);
+  for (i = 0; i < nested; i++)
+    subroutine(level + 1, depth + 1);
+
+  indent(level);
+  emit("BEGIN\n");
+  statementList(level + 1, 0, 2 + randomBelow(8), isFunction ? name : NULL);
+  indent(level);
+  emit("END;\n");
+  scopeLevel --;
+
+  // visible to the subroutines that follow it in the same block
+  if (subCount == subCapacity) {
+    subCapacity = subCapacity ? subCapacity * 2 : 256;
+    subs = (Subroutine*)realloc(subs, subCapacity * sizeof(Subroutine));
+  }
+  s = &subs[subCount++];
+  strcpy(s->name, name);
+  s->isFunction = isFunction;
+  if (depth > 0)
+    subCount --;
+}
+
+void program(void) {
+  char v[MAX_IDENT_LEN + 1];
+  int i;
+
+  emit("PROGRAM GENERATED;  (* kplgen seed %llu *)\n", opt.seed);
+  emit("CONST MAXN = %d;\n      LETTER = 'k';\n", ARRAY_SIZE);
+  emit("TYPE ROW = ARRAY(.%d.) OF INTEGER;\n     GRID = ARRAY(.10.) OF ARRAY(.10.) OF INTEGER;\n", ARRAY_SIZE);
+  emit("VAR ");
+  for (i = 0; i < GLOBAL_ARRAYS; i++)
+    emit("%sG%d : ARRAY(.%d.) OF INTEGER;\n", i ? "    " : "", i, ARRAY_SIZE);
+  scopeLevel = 0;
+  scopeVarCount[0] = 0;
+  for (i = 0; i < opt.globals; i++) {
+    makeName(v, 'V');
+    addVar(v);
+    emit("    %s : INTEGER;\n", v);
+  }
+  emit("    C : CHAR;\n\n");
+
+  while (written < opt.size - 512)
+    subroutine(0, 0);
+
+  emit("\nBEGIN\n");
+  statementList(1, 0, 8, NULL);
+  emit("END.  (* GENERATED *)\n");
+}
+
+long parseSize(char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  switch (*end) {
+  case 'k': case 'K': v *= 1024; break;
+  case 'm': case 'M': v *= 1024 * 1024; break;
+  case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+  }
+  return (long)v;
+}
+
+void usage(void) {
+  fprintf(stderr,
+          "usage: kplgen [--size N[K|M|G]] [--depth N] [--arrays PCT] [--expr-terms N]\n"
+          "              [--comments PCT] [--ident-len N] [--globals N] [--locals N]\n"
+          "              [--seed N] [-o FILE]\n");
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  char *fileName = NULL;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage();
+    if (strcmp(argv[i], "--size") == 0) opt.size = parseSize(argv[++i]);
+    else if (strcmp(argv[i], "--depth") == 0) opt.depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--arrays") == 0) opt.arrays = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--expr-terms") == 0) opt.exprTerms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--comments") == 0) opt.comments = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ident-len") == 0) opt.identLen = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--globals") == 0) opt.globals = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--locals") == 0) opt.locals = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0) opt.seed = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-o") == 0) fileName = argv[++i];
+    else usage();
+  }
+  if (opt.depth > MAX_DEPTH) opt.depth = MAX_DEPTH;
+  if (opt.identLen > MAX_IDENT_LEN) opt.identLen = MAX_IDENT_LEN;
+  if (opt.exprTerms < 1) opt.exprTerms = 1;
+  if (opt.arrays > 50) opt.arrays = 50;
+  if (opt.globals < 1) opt.globals = 1;
+  if (opt.locals < 1) opt.locals = 1;
+
+  out = (fileName != NULL) ? fopen(fileName, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "kplgen: can't write %s\n", fileName);
+    return -1;
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  rng = opt.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  program();
+  fclose(out);
+  return 0;
+}
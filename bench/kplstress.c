@@ -0,0 +1,376 @@
+/* Worst-case input suite: checks that parse time and memory grow linearly
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "parser.h"
+#include "error.h"
+
+#define MAX_STEPS 16
+#define GROWTH 4
+// time and memory below these are dominated by process start-up
+#define MIN_SECONDS 0.02
+#define MIN_MEMORY_KB 4096
+// where the shapes run through the C translator write it
+#define C_OUTPUT_PATH "bench/corpus/stress.c"
+
+typedef struct {
+  char *name;
+  void (*generate)(FILE *f, long n);
+  int deep;             // each unit nests one level deeper
+  char *options[3];     // for the parser, to run the shape past the front end
+} Shape;
+
+// A way of running the parser, checked against MAX_NESTING_DEPTH
+typedef struct {
+  char *name;
+  char *options[3];
+} Mode;
+
+typedef struct {
+  long units;
+  long bytes;
+  double seconds;
+  long memoryKB;
+  int signal;
+  char diagnostic[128];
+  int tooDeep;          // some line of output is the nesting error
+} Run;
+
+char *parserPath = "./parser";
+char *xrefPath = NULL;
+char *inputPath = "bench/corpus/stress.kpl";
+char *outputPath = "bench/corpus/stress.out";
+char *indexPath = "bench/corpus/stress.kplxref";
+
+/******************************************************************/
+
+void repeat(FILE *f, char *s, long n) {
+  long i;
+  for (i = 0; i < n; i++) fputs(s, f);
+}
+
+void unterminatedComment(FILE *f, long n) {
+  fputs("PROGRAM P; (*", f);
+  repeat(f, "comment text ", n / 13 + 1);
+}
+
+void commentRun(FILE *f, long n) {
+  fputs("PROGRAM P;\n", f);
+  repeat(f, "(**) ", n);
+  fputs("BEGIN END.\n", f);
+}
+
+void longIdent(FILE *f, long n) {
+  fputs("PROGRAM P; VAR ", f);
+  repeat(f, "X", n);
+  fputs(" : INTEGER; BEGIN END.\n", f);
+}
+
+void longNumber(FILE *f, long n) {
+  fputs("PROGRAM P; CONST C = ", f);
+  repeat(f, "9", n);
+  fputs("; BEGIN END.\n", f);
+}
+
+void nestedParens(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN X := ", f);
+  repeat(f, "(", n);
+  fputs("1", f);
+  repeat(f, ")", n);
+  fputs(" END.\n", f);
+}
+
+void ifElseChain(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN\n", f);
+  repeat(f, "IF X = 1 THEN X := 2 ELSE\n", n);
+  fputs("X := 0 END.\n", f);
+}
+
+void nestedBlocks(FILE *f, long n) {
+  fputs("PROGRAM P;\n", f);
+  repeat(f, "PROCEDURE Q;\n", n);
+  repeat(f, "BEGIN END;\n", n);
+  fputs("BEGIN END.\n", f);
+}
+
+void nestedArrayType(FILE *f, long n) {
+  fputs("PROGRAM P; TYPE T = ", f);
+  repeat(f, "ARRAY(.2.) OF ", n);
+  fputs("INTEGER; BEGIN END.\n", f);
+}
+
+void statementList(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN\n", f);
+  repeat(f, "X := 1;\n", n);
+  fputs("X := 0 END.\n", f);
+}
+
+void longExpression(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN X := 1", f);
+  repeat(f, " + X * 2", n);
+  fputs(" END.\n", f);
+}
+
+void flatSum(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN X := 1", f);
+  repeat(f, " + X", n);
+  fputs(" END.\n", f);
+}
+
+void loopSum(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; I : INTEGER; BEGIN FOR I := 1 TO 1", f);
+  repeat(f, " + X", n);
+  fputs(" DO X := I", f);
+  repeat(f, " + X", n);
+  fputs(" END.\n", f);
+}
+
+// Each subroutine is parsed from a buffer of its own under --parallel
+void manySubroutines(FILE *f, long n) {
+  long i;
+  fputs("PROGRAM P; VAR X : INTEGER;\n", f);
+  for (i = 0; i < n; i++)
+    fprintf(f, "PROCEDURE Q%ld; BEGIN X := 1 END;\n", i);
+  fputs("BEGIN X := 0 END.\n", f);
+}
+
+void longArguments(FILE *f, long n) {
+  fputs("PROGRAM P; VAR X : INTEGER; BEGIN CALL Q(1", f);
+  repeat(f, ", X", n);
+  fputs(") END.\n", f);
+}
+
+Shape shapes[] = {
+  { "unterminated-comment", unterminatedComment, 0 },
+  { "comment-run", commentRun, 0 },
+  { "long-ident", longIdent, 0 },
+  { "long-number", longNumber, 0 },
+  { "nested-parens", nestedParens, 1 },
+  { "if-else-chain", ifElseChain, 1 },
+  { "nested-blocks", nestedBlocks, 1 },
+  { "nested-array-type", nestedArrayType, 1 },
+  { "statement-list", statementList, 0 },
+  { "long-expression", longExpression, 0 },
+  { "flat-sum/c", flatSum, 0, { "--c", C_OUTPUT_PATH, NULL } },
+  { "loop-sum/run", loopSum, 0, { "--run", NULL } },
+  { "loop-sum/c", loopSum, 0, { "--c", C_OUTPUT_PATH, NULL } },
+  { "many-subroutines/parallel", manySubroutines, 0, { "--parallel", NULL } },
+  { "long-arguments", longArguments, 0 }
+};
+
+#define SHAPE_COUNT (int)(sizeof(shapes) / sizeof(Shape))
+
+// Each parses on a stack or into tables of its own
+Mode modes[] = {
+  { "", { NULL } },
+  { "push", { "--push", "4096", NULL } },
+  { "parallel", { "--parallel", NULL } },
+  { "semantic", { "--semantic", NULL } }
+};
+
+#define MODE_COUNT (int)(sizeof(modes) / sizeof(Mode))
+
+/******************************************************************/
+
+// Runs argv in a child process and records its CPU time, peak resident
+// size, the signal that killed it if any, and its last line of output.
+void runCommand(Run *run, char **argv) {
+  struct rusage usage;
+  char line[128];
+  int status, fd;
+  pid_t pid;
+  FILE *f;
+
+  pid = fork();
+  if (pid == 0) {
+    fd = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  wait4(pid, &status, 0, &usage);
+
+  run->seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+  run->memoryKB = usage.ru_maxrss;
+  run->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+
+  run->diagnostic[0] = '\0';
+  run->tooDeep = 0;
+  f = fopen(outputPath, "r");
+  while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    strcpy(run->diagnostic, line);
+    if (strstr(line, ERM_NESTINGTOODEEP) != NULL)
+      run->tooDeep = 1;
+  }
+  if (f != NULL) fclose(f);
+}
+
+// Runs the parser with options on inputPath. With --quiet the last line of
+// its output is the diagnostic.
+void runParser(Run *run, char **options) {
+  char *argv[8];
+  int argc = 0;
+
+  argv[argc++] = parserPath;
+  argv[argc++] = "--quiet";
+  while ((options != NULL) && (*options != NULL))
+    argv[argc++] = *options++;
+  argv[argc++] = inputPath;
+  argv[argc] = NULL;
+  runCommand(run, argv);
+}
+
+// Indexes inputPath with kpl-xref, which reports errors on stderr
+void runXref(Run *run) {
+  char *argv[] = { xrefPath, "--index", indexPath, inputPath, NULL };
+  unlink(indexPath);
+  runCommand(run, argv);
+}
+
+// Growth over the smallest run is compared step by step. A step is
+// super-linear when that growth rises more than twice as fast as the input;
+// amounts under floor are too small to judge.
+int superLinear(double first, double previous, double current, double floor) {
+  double grown = current - first, before = previous - first;
+  if (grown < floor) return 0;
+  if (before < floor / GROWTH) before = floor / GROWTH;
+  return grown > 2 * GROWTH * before;
+}
+
+int runShape(Shape *shape, long minUnits, long maxUnits) {
+  Run runs[MAX_STEPS];
+  int count = 0, problems = 0;
+  char *verdict;
+  long units;
+  FILE *f;
+
+  for (units = minUnits; units <= maxUnits && count < MAX_STEPS; units *= GROWTH) {
+    Run *run = &runs[count];
+    f = fopen(inputPath, "w");
+    if (f == NULL) {
+      fprintf(stderr, "kplstress: can't write %s\n", inputPath);
+      exit(-1);
+    }
+    shape->generate(f, units);
+    run->bytes = ftell(f);
+    fclose(f);
+    run->units = units;
+    runParser(run, shape->options);
+
+    verdict = "ok";
+    if (run->signal == SIGSEGV || run->signal == SIGBUS) verdict = "STACK OVERFLOW";
+    else if (run->signal != 0) verdict = "CRASH";
+    else if (count > 0 && superLinear(runs[0].seconds, runs[count - 1].seconds, run->seconds, MIN_SECONDS))
+      verdict = "SUPER-LINEAR TIME";
+    else if (count > 0 && superLinear(runs[0].memoryKB, runs[count - 1].memoryKB, run->memoryKB, MIN_MEMORY_KB))
+      verdict = "SUPER-LINEAR MEMORY";
+    if (strcmp(verdict, "ok") != 0) problems ++;
+
+    printf("%-26s %10ld %11ld %9.3f %9ld  %-20s", shape->name, units, run->bytes,
+           run->seconds, run->memoryKB, verdict);
+    if (run->signal != 0) printf(" signal %d\n", run->signal);
+    else printf(" %s\n", run->diagnostic);
+    fflush(stdout);
+    count ++;
+    if (run->signal != 0) break;
+  }
+  return problems;
+}
+
+// The linear runs stop short of MAX_NESTING_DEPTH, so each deep shape is
+// also run just below it, where it must parse, and just past it, where it
+// must stop at the nesting error rather than crash, in every mode
+int checkNestingCap(Shape *shape) {
+  long units[2] = { MAX_NESTING_DEPTH - 16, MAX_NESTING_DEPTH };
+  char name[64];
+  char *verdict;
+  int problems = 0, i, m;
+  Run run;
+  FILE *f;
+
+  for (m = 0; m <= MODE_COUNT; m++) {
+    if ((m == MODE_COUNT) && (xrefPath == NULL))
+      break;
+    for (i = 0; i < 2; i++) {
+      f = fopen(inputPath, "w");
+      if (f == NULL) {
+        fprintf(stderr, "kplstress: can't write %s\n", inputPath);
+        exit(-1);
+      }
+      shape->generate(f, units[i]);
+      run.bytes = ftell(f);
+      fclose(f);
+      run.units = units[i];
+      if (m < MODE_COUNT)
+        runParser(&run, modes[m].options);
+      else runXref(&run);
+
+      verdict = "ok";
+      if (run.signal == SIGSEGV || run.signal == SIGBUS) verdict = "STACK OVERFLOW";
+      else if (run.signal != 0) verdict = "CRASH";
+      else if ((i == 0) && run.tooDeep) verdict = "REJECTED BELOW CAP";
+      else if ((i == 1) && !run.tooDeep) verdict = "NO NESTING ERROR";
+      if (strcmp(verdict, "ok") != 0) problems ++;
+
+      snprintf(name, sizeof(name), "%s%s%s", shape->name, (m < MODE_COUNT) && (modes[m].name[0] == '\0') ? "" : "/",
+               (m < MODE_COUNT) ? modes[m].name : "xref");
+      printf("%-26s %10ld %11ld %9.3f %9ld  %-20s", name, run.units, run.bytes,
+             run.seconds, run.memoryKB, verdict);
+      if (run.signal != 0) printf(" signal %d\n", run.signal);
+      else printf(" %s\n", run.diagnostic);
+      fflush(stdout);
+    }
+  }
+  return problems;
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: kplstress [--parser PATH] [--xref PATH] [--min N] [--max N] [--only SHAPE]\n");
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  long minUnits = 1 << 12, maxUnits = 1 << 20;
+  char *only = NULL;
+  int i, problems = 0;
+
+  for (i = 1; i < argc; i++) {
+    if (i + 1 >= argc) usage();
+    if (strcmp(argv[i], "--parser") == 0) parserPath = argv[++i];
+    else if (strcmp(argv[i], "--xref") == 0) xrefPath = argv[++i];
+    else if (strcmp(argv[i], "--min") == 0) minUnits = atol(argv[++i]);
+    else if (strcmp(argv[i], "--max") == 0) maxUnits = atol(argv[++i]);
+    else if (strcmp(argv[i], "--only") == 0) only = argv[++i];
+    else usage();
+  }
+  if (minUnits < 1) minUnits = 1;
+
+  printf("%-26s %10s %11s %9s %9s  %-20s %s\n", "shape", "units", "bytes", "cpu s", "max KB", "verdict", "diagnostic");
+  for (i = 0; i < SHAPE_COUNT; i++)
+    if (only == NULL || strcmp(only, shapes[i].name) == 0)
+      problems += runShape(&shapes[i], minUnits, maxUnits);
+  for (i = 0; i < SHAPE_COUNT; i++)
+    if (shapes[i].deep && (only == NULL || strcmp(only, shapes[i].name) == 0))
+      problems += checkNestingCap(&shapes[i]);
+
+  unlink(inputPath);
+  unlink(outputPath);
+  unlink(indexPath);
+  unlink(C_OUTPUT_PATH);
+  printf("%d problem%s found\n", problems, problems == 1 ? "" : "s");
+  return problems ? 1 : 0;
+}
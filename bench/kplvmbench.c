@@ -0,0 +1,471 @@
+/* Bytecode interpreter benchmark
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "codegen.h"
+#include "vm.h"
+#include "image.h"
+#include "cache.h"
+#include "ir.h"
+#include "iropt.h"
+#include "irexec.h"
+#include "native.h"
+#include "transpile.h"
+
+#define MAX_FILES 64
+
+extern __thread FILE *outputStream;
+extern int traceEnabled;
+extern int checkSemantics;
+extern int (*programHook)(AstNode *program);
+
+// The code of the program being compiled, kept past the tree
+CodeBlock *compiled;
+// Or its IR, after the passes in irPassPrefix
+IrProgram *compiledIr;
+char irPassPrefix[256];
+// Or the C it translates to
+char *cSourceName;
+
+/******************************************************************/
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int keepCode(AstNode *program) {
+  compiled = generateCode(program);
+  return IO_SUCCESS;
+}
+
+CodeBlock* compileProgramFile(char *fileName) {
+  compiled = NULL;
+  traceEnabled = 0;
+  checkSemantics = 1;
+  programHook = keepCode;
+  if (compile(fileName) != IO_SUCCESS) {
+    freeCodeBlock(compiled);
+    compiled = NULL;
+  }
+  return compiled;
+}
+
+int keepIr(AstNode *program) {
+  compiledIr = buildIr(program);
+  runPasses(compiledIr, irPassPrefix, NULL);
+  return IO_SUCCESS;
+}
+
+IrProgram* compileIrFile(char *fileName) {
+  compiledIr = NULL;
+  traceEnabled = 0;
+  checkSemantics = 1;
+  programHook = keepIr;
+  if (compile(fileName) != IO_SUCCESS) {
+    freeIr(compiledIr);
+    compiledIr = NULL;
+  }
+  return compiledIr;
+}
+
+int keepC(AstNode *program) {
+  FILE *f = fopen(cSourceName, "w");
+  int result = (f != NULL) ? writeCProgram(program, f) : IO_ERROR;
+  if (f != NULL)
+    fclose(f);
+  compiled = (result == IO_SUCCESS) ? generateCode(program) : NULL;
+  return IO_SUCCESS;
+}
+
+// Writes the C of a program to cFile; returns its bytecode too
+CodeBlock* translateFile(char *fileName, char *cFile) {
+  compiled = NULL;
+  cSourceName = cFile;
+  traceEnabled = 0;
+  checkSemantics = 1;
+  programHook = keepC;
+  if (compile(fileName) != IO_SUCCESS) {
+    freeCodeBlock(compiled);
+    compiled = NULL;
+  }
+  return compiled;
+}
+
+// Compiling from source against mapping the image saved from it
+void timeStartup(char *fileName, CodeBlock *block, int repeat) {
+  char imageName[64];
+  struct stat st;
+  CodeBlock *loaded;
+  double source = -1, image = -1, start, elapsed;
+  long length;
+  char *text;
+  unsigned long long hash;
+  int i;
+
+  text = readWholeFile(fileName, &length);
+  if (text == NULL)
+    return;
+  hash = hashBytes(text, length);
+  free(text);
+  snprintf(imageName, sizeof(imageName), "/tmp/kplvmbench.%ld%s", (long)getpid(), IMAGE_EXTENSION);
+  if (saveImage(block, imageName, hash, length) != IO_SUCCESS)
+    return;
+  stat(imageName, &st);
+
+  for (i = 0; i < repeat; i++) {
+    start = now();
+    freeCodeBlock(compileProgramFile(fileName));
+    elapsed = now() - start;
+    if (source < 0 || elapsed < source)
+      source = elapsed;
+    start = now();
+    loaded = loadImage(imageName, hash, length);
+    elapsed = now() - start;
+    if (image < 0 || elapsed < image)
+      image = elapsed;
+    freeCodeBlock(loaded);
+  }
+  unlink(imageName);
+  printf("%-32s %-6s %10ld %10.6f\n", fileName, "source", length, source);
+  printf("%-32s %-6s %10ld %10.6f\n", fileName, "image", (long)st.st_size, image);
+}
+
+// Best of repeat runs, with the program's output thrown away
+double timeRuns(CodeBlock *block, int repeat, long long *instructions, int *status) {
+  FILE *devNull = fopen("/dev/null", "w");
+  double best = -1, start, elapsed;
+  int i;
+
+  outputStream = devNull;
+  for (i = 0; i < repeat; i++) {
+    start = now();
+    *status = runCode(block, instructions);
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+  outputStream = stdout;
+  fclose(devNull);
+  return best;
+}
+
+double timeIrRuns(IrProgram *program, int repeat, long long *instructions, int *status) {
+  FILE *devNull = fopen("/dev/null", "w");
+  double best = -1, start, elapsed;
+  int i;
+
+  outputStream = devNull;
+  for (i = 0; i < repeat; i++) {
+    start = now();
+    *status = runIr(program, instructions);
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+  outputStream = stdout;
+  fclose(devNull);
+  return best;
+}
+
+// The IR after each of the default passes in turn, so every pass shows
+// what it saves in instructions left and instructions executed
+int benchIr(char *fileName, int repeat) {
+  IrProgram *program;
+  char *passes = DEFAULT_PASSES, pass[32] = "build";
+  long long instructions;
+  double seconds;
+  int start, end = 0, failures = 0, status;
+
+  for (;;) {
+    snprintf(irPassPrefix, sizeof(irPassPrefix), "%.*s", end, passes);
+    program = compileIrFile(fileName);
+    if (program == NULL) {
+      printf("%-32s does not compile\n", fileName);
+      return 1;
+    }
+    seconds = timeIrRuns(program, repeat, &instructions, &status);
+    printf("%-32s %-6s %8d %14lld %10.4f %14.0f%s\n", fileName, pass, instructionCount(program),
+           instructions, seconds, instructions / seconds, status == IO_SUCCESS ? "" : "  (failed)");
+    if (status != IO_SUCCESS)
+      failures ++;
+    freeIr(program);
+    if (passes[end] == '\0')
+      break;
+    start = end ? end + 1 : 0;
+    end = start + strcspn(passes + start, ",");
+    snprintf(pass, sizeof(pass), "%.*s", end - start, passes + start);
+  }
+  return failures;
+}
+
+double timeNativeRuns(NativeCode *code, int repeat, int *status) {
+  FILE *devNull = fopen("/dev/null", "w");
+  double best = -1, start, elapsed;
+  int i;
+
+  outputStream = devNull;
+  for (i = 0; i < repeat; i++) {
+    start = now();
+    *status = runNative(code);
+    elapsed = now() - start;
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+  outputStream = stdout;
+  fclose(devNull);
+  return best;
+}
+
+// What one run printed, read back from a temporary file
+char* capturedOutput(CodeBlock *block, IrProgram *program, NativeCode *code) {
+  FILE *f = tmpfile();
+  char *text;
+  long length;
+
+  if (f == NULL)
+    return NULL;
+  outputStream = f;
+  if (block != NULL) runCode(block, NULL);
+  else if (program != NULL) runIr(program, NULL);
+  else runNative(code);
+  outputStream = stdout;
+  length = ftell(f);
+  text = (char*)malloc(length + 1);
+  rewind(f);
+  length = fread(text, 1, length, f);
+  text[length] = '\0';
+  fclose(f);
+  return text;
+}
+
+// The fused bytecode, the optimized IR and its native code, side by side,
+// with the outputs of the three compared
+int benchNative(char *fileName, int repeat) {
+  CodeBlock *block;
+  IrProgram *program;
+  NativeCode *code;
+  char *outputs[3];
+  long long instructions;
+  double seconds[3];
+  int status[3], failures = 0, i;
+
+  fuseInstructions = 1;
+  block = compileProgramFile(fileName);
+  snprintf(irPassPrefix, sizeof(irPassPrefix), "%s", DEFAULT_PASSES);
+  program = compileIrFile(fileName);
+  if ((block == NULL) || (program == NULL)) {
+    printf("%-32s does not compile\n", fileName);
+    freeCodeBlock(block);
+    freeIr(program);
+    return 1;
+  }
+  code = generateNative(program);
+
+  seconds[0] = timeRuns(block, repeat, &instructions, &status[0]);
+  seconds[1] = timeIrRuns(program, repeat, &instructions, &status[1]);
+  seconds[2] = timeNativeRuns(code, repeat, &status[2]);
+  outputs[0] = capturedOutput(block, NULL, NULL);
+  outputs[1] = capturedOutput(NULL, program, NULL);
+  outputs[2] = capturedOutput(NULL, NULL, code);
+
+  printf("%-32s %-6s %8d %10.4f %8.2f%s\n", fileName, "vm", block->size, seconds[0], 1.0,
+         status[0] == IO_SUCCESS ? "" : "  (failed)");
+  printf("%-32s %-6s %8d %10.4f %8.2f%s\n", fileName, "ir", instructionCount(program), seconds[1],
+         seconds[0] / seconds[1], status[1] == IO_SUCCESS ? "" : "  (failed)");
+  printf("%-32s %-6s %8d %10.4f %8.2f%s\n", fileName, "native", code->size, seconds[2],
+         seconds[0] / seconds[2], status[2] == IO_SUCCESS ? "" : "  (failed)");
+  for (i = 0; i < 3; i++)
+    if (status[i] != IO_SUCCESS)
+      failures ++;
+  if ((outputs[0] == NULL) || (outputs[1] == NULL) || (outputs[2] == NULL) ||
+      strcmp(outputs[0], outputs[1]) != 0 || strcmp(outputs[0], outputs[2]) != 0) {
+    printf("%-32s outputs differ\n", fileName);
+    failures ++;
+  }
+  for (i = 0; i < 3; i++)
+    free(outputs[i]);
+  freeNativeCode(code);
+  freeIr(program);
+  freeCodeBlock(block);
+  return failures;
+}
+
+// What a command printed; the first run of each program is checked by it
+char* commandOutput(char *command) {
+  FILE *f = popen(command, "r");
+  char *text = NULL;
+  size_t length = 0, capacity = 0, n;
+
+  if (f == NULL)
+    return NULL;
+  do {
+    if (length + 4096 > capacity) {
+      capacity = capacity ? capacity * 2 : 65536;
+      text = (char*)realloc(text, capacity + 1);
+    }
+    n = fread(text + length, 1, 4096, f);
+    length += n;
+  } while (n > 0);
+  text[length] = '\0';
+  pclose(f);
+  return text;
+}
+
+// The fused bytecode against its translation to C built by ${CC:-cc} -O2
+int benchC(char *fileName, int repeat) {
+  char cFile[64], binary[64], command[256];
+  CodeBlock *block;
+  char *expected, *output;
+  struct stat st;
+  long long instructions;
+  double vm, native = -1, build, start, elapsed;
+  int status, failures = 0, i;
+
+  snprintf(cFile, sizeof(cFile), "/tmp/kplvmbench.%ld.c", (long)getpid());
+  snprintf(binary, sizeof(binary), "/tmp/kplvmbench.%ld", (long)getpid());
+  fuseInstructions = 1;
+  block = translateFile(fileName, cFile);
+  if (block == NULL) {
+    printf("%-32s does not compile\n", fileName);
+    return 1;
+  }
+  stat(cFile, &st);
+  snprintf(command, sizeof(command), "%s -O2 -pthread -o %s %s",
+           getenv("CC") != NULL ? getenv("CC") : "cc", binary, cFile);
+  start = now();
+  status = system(command);
+  build = now() - start;
+  unlink(cFile);
+  if (status != 0) {
+    printf("%-32s does not build as C\n", fileName);
+    freeCodeBlock(block);
+    return 1;
+  }
+
+  vm = timeRuns(block, repeat, &instructions, &status);
+  if (status != IO_SUCCESS)
+    failures ++;
+  expected = capturedOutput(block, NULL, NULL);
+  output = commandOutput(binary);
+  snprintf(command, sizeof(command), "%s > /dev/null", binary);
+  for (i = 0; i < repeat; i++) {
+    start = now();
+    if (system(command) != 0)
+      failures ++;
+    elapsed = now() - start;
+    if (native < 0 || elapsed < native)
+      native = elapsed;
+  }
+  unlink(binary);
+
+  printf("%-32s %-6s %8d %10.4f %8.2f%s\n", fileName, "vm", block->size, vm, 1.0,
+         status == IO_SUCCESS ? "" : "  (failed)");
+  printf("%-32s %-6s %8ld %10.4f %8.2f  (built in %.2fs)\n", fileName, "c", (long)st.st_size, native,
+         vm / native, build);
+  if ((expected == NULL) || (output == NULL) || (strcmp(expected, output) != 0)) {
+    printf("%-32s outputs differ\n", fileName);
+    failures ++;
+  }
+  free(expected);
+  free(output);
+  freeCodeBlock(block);
+  return failures;
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: kplvmbench [--repeat N] [--startup | --ir | --native | --c] file...\n");
+  exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+  char *files[MAX_FILES];
+  CodeBlock *block;
+  long long instructions;
+  double seconds;
+  int count = 0, repeat = 3, failures = 0, startup = 0, ir = 0, native = 0, c = 0, status, fused, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--startup") == 0) startup = 1;
+    else if (strcmp(argv[i], "--ir") == 0) ir = 1;
+    else if (strcmp(argv[i], "--native") == 0) native = 1;
+    else if (strcmp(argv[i], "--c") == 0) c = 1;
+    else if (argv[i][0] == '-') usage();
+    else if (count < MAX_FILES) files[count++] = argv[i];
+  }
+  if (count == 0) usage();
+
+  outputStream = stdout;
+  // startup only: the bytes of the source or image and the time to get its code
+  if (startup) {
+    printf("%-32s %-6s %10s %10s\n", "file", "from", "bytes", "seconds");
+    for (i = 0; i < count; i++) {
+      block = compileProgramFile(files[i]);
+      if (block == NULL) {
+        printf("%-32s does not compile\n", files[i]);
+        failures ++;
+        continue;
+      }
+      timeStartup(files[i], block, repeat);
+      freeCodeBlock(block);
+    }
+    return failures ? 1 : 0;
+  }
+
+  // the IR interpreter, pass by pass: its size after the pass, then the run
+  if (ir) {
+    printf("%-32s %-6s %8s %14s %10s %14s\n", "file", "pass", "instrs", "instructions", "seconds", "instr/s");
+    for (i = 0; i < count; i++)
+      failures += benchIr(files[i], repeat);
+    return failures ? 1 : 0;
+  }
+
+  // the native code against both interpreters: its bytes, the time and the speedup
+  if (native) {
+    printf("%-32s %-6s %8s %10s %8s\n", "file", "run", "size", "seconds", "speedup");
+    for (i = 0; i < count; i++)
+      failures += benchNative(files[i], repeat);
+    return failures ? 1 : 0;
+  }
+
+  // the translation to C, the bytes of its source and the time of a whole process
+  if (c) {
+    printf("%-32s %-6s %8s %10s %8s\n", "file", "run", "size", "seconds", "speedup");
+    for (i = 0; i < count; i++)
+      failures += benchC(files[i], repeat);
+    return failures ? 1 : 0;
+  }
+
+  printf("%-32s %-6s %8s %14s %10s %14s\n", "file", "code", "words", "instructions", "seconds", "instr/s");
+  for (i = 0; i < count; i++)
+    // each program without and then with superinstructions
+    for (fused = 0; fused < 2; fused++) {
+      fuseInstructions = fused;
+      block = compileProgramFile(files[i]);
+      if (block == NULL) {
+        printf("%-32s does not compile\n", files[i]);
+        failures ++;
+        break;
+      }
+      seconds = timeRuns(block, repeat, &instructions, &status);
+      printf("%-32s %-6s %8d %14lld %10.4f %14.0f%s\n", files[i], fused ? "fused" : "plain", block->size,
+             instructions, seconds, instructions / seconds, status == IO_SUCCESS ? "" : "  (failed)");
+      if (status != IO_SUCCESS)
+        failures ++;
+      freeCodeBlock(block);
+    }
+  return failures ? 1 : 0;
+}
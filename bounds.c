@@ -0,0 +1,206 @@
+/* Index range analysis
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "bounds.h"
+
+#define MAX_LOOP_DEPTH 64
+
+typedef struct {
+  long long lo, hi;
+} Bounds;
+
+// The FOR statements being compiled, innermost last. var is NULL where
+// nothing is known of the loop variable.
+struct {
+  AstNode *var;
+  Bounds bounds;
+} loops[MAX_LOOP_DEPTH];
+int loopCount;
+
+int indexChecks, indexChecksRemoved;
+
+/******************************************************************/
+
+void resetIndexChecks(void) {
+  loopCount = 0;
+  indexChecks = 0;
+  indexChecksRemoved = 0;
+}
+
+// What an int computation may wrap to is not known
+Bounds makeBounds(long long lo, long long hi) {
+  Bounds b;
+
+  if ((lo < INT_MIN) || (hi > INT_MAX)) {
+    lo = INT_MIN;
+    hi = INT_MAX;
+  }
+  b.lo = lo;
+  b.hi = hi;
+  return b;
+}
+
+Bounds boundsOf(AstNode *expr);
+
+// What l op r may be, where l and r are the bounds of its operands
+Bounds arithmeticBounds(TokenType op, Bounds l, Bounds r) {
+  long long p[4];
+  int i;
+
+  switch (op) {
+  case SB_PLUS:
+    return makeBounds(l.lo + r.lo, l.hi + r.hi);
+  case SB_MINUS:
+    return makeBounds(l.lo - r.hi, l.hi - r.lo);
+  case SB_TIMES:
+    p[0] = l.lo * r.lo;
+    p[1] = l.lo * r.hi;
+    p[2] = l.hi * r.lo;
+    p[3] = l.hi * r.hi;
+    l.lo = l.hi = p[0];
+    for (i = 1; i < 4; i++) {
+      if (p[i] < l.lo) l.lo = p[i];
+      if (p[i] > l.hi) l.hi = p[i];
+    }
+    return makeBounds(l.lo, l.hi);
+  case SB_SLASH:
+    // truncating division by a positive constant keeps the order
+    if ((r.lo == r.hi) && (r.lo > 0))
+      return makeBounds(l.lo / r.lo, l.hi / r.lo);
+    break;
+  default:
+    break;
+  }
+  return makeBounds(LLONG_MIN, LLONG_MAX);
+}
+
+Bounds binaryBounds(AstNode *expr) {
+  AstNode **spine;
+  Bounds b;
+  int count = binarySpine(expr, &spine), i;
+
+  b = boundsOf(spine[0]->left);
+  for (i = 0; i < count; i++)
+    b = arithmeticBounds(spine[i]->op, b, boundsOf(spine[i]->right));
+  free(spine);
+  return b;
+}
+
+Bounds boundsOf(AstNode *expr) {
+  Bounds l;
+  int i;
+
+  switch (expr->kind) {
+  case N_NUMBER:
+  case N_CHARCONST:
+    return makeBounds(expr->value, expr->value);
+  case N_VARIABLE:
+    if (expr->decl->kind == N_CONST)
+      return makeBounds(expr->decl->value, expr->decl->value);
+    for (i = (loopCount < MAX_LOOP_DEPTH ? loopCount : MAX_LOOP_DEPTH) - 1; i >= 0; i--)
+      if (loops[i].var == expr->decl)
+        return loops[i].bounds;
+    break;
+  case N_UNARY:
+    l = boundsOf(expr->left);
+    return (expr->op == SB_MINUS) ? makeBounds(-l.hi, -l.lo) : l;
+  case N_BINARY:
+    return binaryBounds(expr);
+  default:
+    break;
+  }
+  return makeBounds(LLONG_MIN, LLONG_MAX);
+}
+
+/******************************************************************/
+
+int isReferenceTo(AstNode *expr, AstNode *var) {
+  return (expr->kind == N_VARIABLE) && (expr->decl == var) && (expr->list == NULL);
+}
+
+// Whether running node, or a node following it in its list, may store into
+// var, a variable of the body at depth: by assigning it, by a FOR over it, by
+// passing it to a VAR parameter, or by calling a subroutine nested in that
+// body, which sees its frame
+int changes(AstNode *node, AstNode *var, int depth) {
+  AstNode **spine;
+  AstNode *arg;
+  int count, found, i;
+
+  for (; node != NULL; node = node->next) {
+    switch (node->kind) {
+    case N_ASSIGN:
+    case N_FOR:
+      if (node->left->decl == var)
+        return 1;
+      break;
+    case N_CALL:
+    case N_FUNCALL:
+      if ((node->decl->builtin == BUILTIN_NONE) && (node->decl->level > depth))
+        return 1;
+      for (arg = node->list; arg != NULL; arg = arg->next)
+        if (isReferenceTo(arg, var))
+          return 1;
+      break;
+    case N_BINARY:
+      count = binarySpine(node, &spine);
+      found = changes(spine[0]->left, var, depth);
+      for (i = 0; (i < count) && !found; i++)
+        found = changes(spine[i]->right, var, depth);
+      free(spine);
+      if (found)
+        return 1;
+      continue;
+    default:
+      break;
+    }
+    if (changes(node->left, var, depth) || changes(node->right, var, depth) ||
+        changes(node->body, var, depth) || changes(node->list, var, depth))
+      return 1;
+  }
+  return 0;
+}
+
+void enterLoop(AstNode *statement, int depth) {
+  AstNode *var = statement->left->decl;
+  Bounds first, last;
+
+  if (loopCount < MAX_LOOP_DEPTH) {
+    // the variable runs from the initial value up to the final one, each
+    // computed once before the body; past INT_MAX the increment would wrap
+    first = boundsOf(statement->right);
+    last = boundsOf(statement->list);
+    loops[loopCount].var = NULL;
+    if (!var->isVarParam && (var->level == depth) && (last.hi < INT_MAX) &&
+        !changes(statement->body, var, depth)) {
+      loops[loopCount].var = var;
+      loops[loopCount].bounds = makeBounds(first.lo, last.hi);
+    }
+  }
+  loopCount++;
+}
+
+void leaveLoop(void) {
+  loopCount--;
+}
+
+int isIndexInRange(AstNode *index, Type *type) {
+  Bounds b = boundsOf(index);
+
+  return (b.lo >= 1) && (b.hi <= type->arraySize);
+}
+
+int needsIndexCheck(AstNode *index, Type *type) {
+  indexChecks++;
+  if (isIndexInRange(index, type)) {
+    indexChecksRemoved++;
+    return 0;
+  }
+  return 1;
+}
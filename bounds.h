@@ -0,0 +1,30 @@
+/* Index range analysis
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __BOUNDS_H__
+#define __BOUNDS_H__
+
+#include "ast.h"
+
+// Index checks asked about since resetIndexChecks(), and those found useless
+extern int indexChecks, indexChecksRemoved;
+
+void resetIndexChecks(void);
+
+// Code generators call these around the body of every FOR statement they
+// compile in a body at depth. Inside, a loop variable that the body cannot
+// change, directly or through a call, stays within constant bounds.
+void enterLoop(AstNode *statement, int depth);
+void leaveLoop(void);
+
+// Whether index, an index of an array of type, is known to lie in 1..size
+// where it is compiled
+int isIndexInRange(AstNode *index, Type *type);
+// The same question, asked once for every index a generator compiles and
+// counted: whether it must still be checked
+int needsIndexCheck(AstNode *index, Type *type);
+
+#endif
@@ -0,0 +1,219 @@
+/* Parse result cache
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "cache.h"
+
+#define CACHE_MAGIC "KPLC"
+// The parser that wrote an entry. PARSER_VERSION is not bumped for every
+// change to what the parser prints, so the build is part of it as well.
+#ifndef PARSER_BUILD
+#define PARSER_BUILD "unknown"
+#endif
+#define CACHE_VERSION PARSER_VERSION "+" PARSER_BUILD
+#define MAX_PATH_LEN 4096
+
+extern __thread FILE *outputStream;
+extern int traceEnabled;
+extern int checkSymbols;
+extern int checkSemantics;
+
+typedef struct {
+  char name[64];
+  long size;
+  time_t used;
+} CacheEntry;
+
+/******************************************************************/
+
+// 64-bit FNV-1a
+unsigned long long hashBytes(const char *data, long length) {
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  long i;
+  for (i = 0; i < length; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+char *readWholeFile(char *fileName, long *length) {
+  FILE *f = fopen(fileName, "rb");
+  char *data;
+  long size;
+
+  if (f == NULL) return NULL;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = (char*)malloc(size + 1);
+  if (data == NULL || (long)fread(data, 1, size, f) != size) {
+    free(data);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+  *length = size;
+  return data;
+}
+
+// Replays a cached entry to stdout. Returns its compile() status, or -1 if
+// the entry is missing or was written by another parser version.
+int replayEntry(char *path, long sourceLength) {
+  FILE *f = fopen(path, "rb");
+  char magic[8], version[32];
+  char buf[8192];
+  long length;
+  int status;
+  size_t n;
+
+  if (f == NULL) return -1;
+  if (fscanf(f, "%4s %31s %ld %d", magic, version, &length, &status) != 4 ||
+      fgetc(f) != '\n' ||
+      strcmp(magic, CACHE_MAGIC) != 0 ||
+      strcmp(version, CACHE_VERSION) != 0 ||
+      length != sourceLength) {
+    fclose(f);
+    return -1;
+  }
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    fwrite(buf, 1, n, stdout);
+  fclose(f);
+
+  // the modification time doubles as the last-use time for eviction
+  utime(path, NULL);
+  return status;
+}
+
+// Entries are published with rename(), so a concurrent reader sees either
+// no entry or a complete one, never a partial write.
+void storeEntry(char *cacheDir, char *path, long sourceLength, int status,
+                char *output, size_t outputLength) {
+  char tmpPath[MAX_PATH_LEN];
+  FILE *f;
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s/.tmp.%ld", cacheDir, (long)getpid());
+  f = fopen(tmpPath, "wb");
+  if (f == NULL) return;
+
+  fprintf(f, "%s %s %ld %d\n", CACHE_MAGIC, CACHE_VERSION, sourceLength, status);
+  fwrite(output, 1, outputLength, f);
+  if (fclose(f) != 0 || rename(tmpPath, path) != 0)
+    unlink(tmpPath);
+}
+
+int compareEntryUse(const void *a, const void *b) {
+  const CacheEntry *x = (const CacheEntry*)a;
+  const CacheEntry *y = (const CacheEntry*)b;
+  if (x->used != y->used) return (x->used < y->used) ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+// Drops least recently used entries until the directory fits in sizeLimit.
+// Only one process trims at a time; the others skip it rather than wait.
+void evictEntries(char *cacheDir, long sizeLimit) {
+  char path[MAX_PATH_LEN];
+  CacheEntry *entries = NULL;
+  int count = 0, capacity = 0, i, lockFd;
+  long total = 0;
+  struct dirent *d;
+  struct stat st;
+  DIR *dir;
+
+  snprintf(path, sizeof(path), "%s/.lock", cacheDir);
+  lockFd = open(path, O_RDWR | O_CREAT, 0644);
+  if (lockFd < 0) return;
+  if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+    close(lockFd);
+    return;
+  }
+
+  dir = opendir(cacheDir);
+  while (dir != NULL && (d = readdir(dir)) != NULL) {
+    if (d->d_name[0] == '.' || strlen(d->d_name) >= sizeof(entries->name))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", cacheDir, d->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      entries = (CacheEntry*)realloc(entries, capacity * sizeof(CacheEntry));
+    }
+    strcpy(entries[count].name, d->d_name);
+    entries[count].size = st.st_size;
+    entries[count].used = st.st_mtime;
+    total += st.st_size;
+    count ++;
+  }
+  if (dir != NULL) closedir(dir);
+
+  if (total > sizeLimit) {
+    qsort(entries, count, sizeof(CacheEntry), compareEntryUse);
+    for (i = 0; i < count && total > sizeLimit; i++) {
+      snprintf(path, sizeof(path), "%s/%s", cacheDir, entries[i].name);
+      if (unlink(path) == 0)
+        total -= entries[i].size;
+    }
+  }
+
+  free(entries);
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+}
+
+int compileCached(char *fileName, char *cacheDir, long sizeLimit) {
+  char path[MAX_PATH_LEN];
+  char *source, *output = NULL;
+  size_t outputLength = 0;
+  long sourceLength;
+  unsigned long long key;
+  FILE *savedOutput;
+  int status;
+
+  source = readWholeFile(fileName, &sourceLength);
+  if (source == NULL)
+    return IO_ERROR;
+  key = hashBytes(source, sourceLength) ^ hashBytes(CACHE_VERSION, strlen(CACHE_VERSION));
+  // quiet, checked and analyzed runs store different output for the same source
+  if (!traceEnabled) key = ~key;
+  if (checkSymbols) key ^= 0x9e3779b97f4a7c15ULL;
+  if (checkSemantics) key ^= 0xc2b2ae3d27d4eb4fULL;
+  free(source);
+
+  mkdir(cacheDir, 0755);
+  snprintf(path, sizeof(path), "%s/%016llx", cacheDir, key);
+
+  status = replayEntry(path, sourceLength);
+  if (status >= 0)
+    return status;
+
+  savedOutput = outputStream;
+  outputStream = open_memstream(&output, &outputLength);
+  status = compile(fileName);
+  fclose(outputStream);
+  outputStream = savedOutput;
+
+  if (status != IO_ERROR) {
+    storeEntry(cacheDir, path, sourceLength, status, output, outputLength);
+    evictEntries(cacheDir, sizeLimit);
+    fwrite(output, 1, outputLength, stdout);
+  }
+  free(output);
+  return status;
+}
@@ -0,0 +1,21 @@
+/* Parse result cache
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_DEFAULT_LIMIT (64L * 1024 * 1024)
+
+// Like compile(), but the output of an unchanged input is replayed from
+// cacheDir instead of parsing it again. Entries are keyed by a hash of the
+// file contents and the build of the parser; the directory is trimmed to
+// sizeLimit bytes, least recently used entries first.
+int compileCached(char *fileName, char *cacheDir, long sizeLimit);
+
+unsigned long long hashBytes(const char *data, long length);
+char *readWholeFile(char *fileName, long *length);
+
+#endif
@@ -0,0 +1,254 @@
+/* Call graph
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "json.h"
+
+// The graph being built
+CallGraph *callGraph;
+int callGraphCapacity;
+
+void walkNode(int caller, AstNode *node);
+
+/******************************************************************/
+
+void addCall(int caller, int callee) {
+  CallNode *node = &callGraph->nodes[caller];
+  int i;
+
+  callGraph->nodes[callee].callers ++;
+  for (i = 0; i < node->callCount; i++)
+    if (node->calls[i].callee == callee) {
+      node->calls[i].sites ++;
+      return;
+    }
+  if (node->callCount == node->callCapacity) {
+    node->callCapacity = node->callCapacity ? node->callCapacity * 2 : 4;
+    node->calls = (CallEdge*)realloc(node->calls, node->callCapacity * sizeof(CallEdge));
+  }
+  node->calls[node->callCount].callee = callee;
+  node->calls[node->callCount].sites = 1;
+  node->callCount ++;
+}
+
+void walkList(int caller, AstNode *list) {
+  for (; list != NULL; list = list->next)
+    walkNode(caller, list);
+}
+
+void walkNode(int caller, AstNode *node) {
+  AstNode **spine;
+  int count, i;
+
+  if (node == NULL)
+    return;
+  if (node->kind == N_BINARY) {
+    count = binarySpine(node, &spine);
+    callGraph->nodes[caller].size += count;
+    for (i = count - 1; i >= 0; i--)
+      walkNode(caller, spine[i]->right);
+    walkNode(caller, spine[0]->left);
+    free(spine);
+    return;
+  }
+  callGraph->nodes[caller].size ++;
+  if (((node->kind == N_CALL) || (node->kind == N_FUNCALL)) && (node->decl->builtin == BUILTIN_NONE))
+    addCall(caller, node->decl->offset);
+  walkNode(caller, node->left);
+  walkNode(caller, node->right);
+  walkNode(caller, node->body);
+  walkList(caller, node->list);
+}
+
+// Adds owner and, after it, the subroutines nested in its body
+void addBodies(AstNode *owner, AstNode *block, int depth) {
+  AstNode *decl;
+
+  if (callGraph->count == callGraphCapacity) {
+    callGraphCapacity = callGraphCapacity ? callGraphCapacity * 2 : 16;
+    callGraph->nodes = (CallNode*)realloc(callGraph->nodes, callGraphCapacity * sizeof(CallNode));
+  }
+  memset(&callGraph->nodes[callGraph->count], 0, sizeof(CallNode));
+  callGraph->nodes[callGraph->count].decl = owner;
+  callGraph->nodes[callGraph->count].depth = depth;
+  callGraph->count ++;
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE)) {
+      decl->level = depth + 1;
+      decl->offset = callGraph->count;
+      addBodies(decl, decl->body, depth + 1);
+    }
+}
+
+// Tarjan's strongly connected components, with an explicit stack so that a
+// long chain of calls cannot overflow. Components complete callees first.
+void findComponents(void) {
+  int *index = (int*)malloc(callGraph->count * sizeof(int));
+  int *low = (int*)malloc(callGraph->count * sizeof(int));
+  int *onStack = (int*)calloc(callGraph->count, sizeof(int));
+  int *stack = (int*)malloc(callGraph->count * sizeof(int));
+  int *path = (int*)malloc(callGraph->count * sizeof(int));
+  int *nextCall = (int*)calloc(callGraph->count, sizeof(int));
+  int counter = 0, components = 0, ordered = 0, top = 0, depth, root, v, w, size;
+
+  for (v = 0; v < callGraph->count; v++)
+    index[v] = -1;
+  for (root = 0; root < callGraph->count; root++) {
+    if (index[root] >= 0)
+      continue;
+    depth = 0;
+    path[depth++] = root;
+    index[root] = low[root] = counter++;
+    stack[top++] = root;
+    onStack[root] = 1;
+    while (depth > 0) {
+      v = path[depth - 1];
+      if (nextCall[v] < callGraph->nodes[v].callCount) {
+        w = callGraph->nodes[v].calls[nextCall[v]++].callee;
+        if (index[w] < 0) {
+          index[w] = low[w] = counter++;
+          stack[top++] = w;
+          onStack[w] = 1;
+          path[depth++] = w;
+        } else if (onStack[w] && (index[w] < low[v]))
+          low[v] = index[w];
+        continue;
+      }
+      depth --;
+      if ((depth > 0) && (low[v] < low[path[depth - 1]]))
+        low[path[depth - 1]] = low[v];
+      if (low[v] != index[v])
+        continue;
+      size = 0;
+      do {
+        w = stack[--top];
+        onStack[w] = 0;
+        callGraph->nodes[w].component = components;
+        callGraph->order[ordered++] = w;
+        size ++;
+      } while (w != v);
+      components ++;
+      if (size > 1)
+        for (w = ordered - size; w < ordered; w++)
+          callGraph->nodes[callGraph->order[w]].isRecursive = 1;
+    }
+  }
+  for (v = 0; v < callGraph->count; v++)
+    for (w = 0; w < callGraph->nodes[v].callCount; w++)
+      if (callGraph->nodes[v].calls[w].callee == v)
+        callGraph->nodes[v].isRecursive = 1;
+  free(index);
+  free(low);
+  free(onStack);
+  free(stack);
+  free(path);
+  free(nextCall);
+}
+
+void findReachable(void) {
+  int *work = (int*)malloc(callGraph->count * sizeof(int));
+  int count = 0, v, i;
+
+  callGraph->nodes[0].isReachable = 1;
+  work[count++] = 0;
+  while (count > 0) {
+    v = work[--count];
+    for (i = 0; i < callGraph->nodes[v].callCount; i++)
+      if (!callGraph->nodes[callGraph->nodes[v].calls[i].callee].isReachable) {
+        callGraph->nodes[callGraph->nodes[v].calls[i].callee].isReachable = 1;
+        work[count++] = callGraph->nodes[v].calls[i].callee;
+      }
+  }
+  free(work);
+}
+
+CallGraph* buildCallGraph(AstNode *program) {
+  int i;
+
+  callGraph = (CallGraph*)calloc(1, sizeof(CallGraph));
+  callGraphCapacity = 0;
+  program->level = 0;
+  program->offset = 0;
+  addBodies(program, program->body, 0);
+  for (i = 0; i < callGraph->count; i++)
+    walkNode(i, callGraph->nodes[i].decl->body->body);
+  callGraph->order = (int*)malloc(callGraph->count * sizeof(int));
+  findComponents();
+  findReachable();
+  return callGraph;
+}
+
+void freeCallGraph(CallGraph *g) {
+  int i;
+
+  if (g == NULL)
+    return;
+  for (i = 0; i < g->count; i++)
+    free(g->nodes[i].calls);
+  free(g->nodes);
+  free(g->order);
+  free(g);
+}
+
+/******************************************************************/
+
+char* kindName(AstNode *decl) {
+  switch (decl->kind) {
+  case N_PROGRAM: return "program";
+  case N_FUNCTION: return "function";
+  default: return "procedure";
+  }
+}
+
+// Unreachable bodies are dashed, recursive ones bold; an edge carries its
+// number of call sites when there are several
+void writeCallGraphDot(CallGraph *g, FILE *f) {
+  CallNode *node;
+  int i, j;
+
+  fprintf(f, "digraph \"%s\" {\n", g->nodes[0].decl->name);
+  fprintf(f, "  node [shape=box];\n");
+  for (i = 0; i < g->count; i++) {
+    node = &g->nodes[i];
+    fprintf(f, "  n%d [label=\"%s %s\\nsize %d, %d callers\"", i, kindName(node->decl), node->decl->name,
+            node->size, node->callers);
+    if (!node->isReachable)
+      fprintf(f, ", style=dashed");
+    else if (node->isRecursive)
+      fprintf(f, ", style=bold");
+    fprintf(f, "];\n");
+  }
+  for (i = 0; i < g->count; i++)
+    for (j = 0; j < g->nodes[i].callCount; j++) {
+      fprintf(f, "  n%d -> n%d", i, g->nodes[i].calls[j].callee);
+      if (g->nodes[i].calls[j].sites > 1)
+        fprintf(f, " [label=\"%d\"]", g->nodes[i].calls[j].sites);
+      fprintf(f, ";\n");
+    }
+  fprintf(f, "}\n");
+}
+
+void writeCallGraphJson(CallGraph *g, FILE *f) {
+  CallNode *node;
+  int i, j;
+
+  fprintf(f, "{\"bodies\": [");
+  for (i = 0; i < g->count; i++) {
+    node = &g->nodes[i];
+    fprintf(f, "%s\n  {\"index\": %d, \"name\": ", i ? "," : "", i);
+    writeJsonString(f, node->decl->name, strlen(node->decl->name));
+    fprintf(f, ", \"kind\": \"%s\", \"depth\": %d, \"size\": %d, \"callers\": %d, "
+            "\"recursive\": %s, \"reachable\": %s, \"calls\": [", kindName(node->decl), node->depth,
+            node->size, node->callers, node->isRecursive ? "true" : "false", node->isReachable ? "true" : "false");
+    for (j = 0; j < node->callCount; j++)
+      fprintf(f, "%s{\"callee\": %d, \"sites\": %d}", j ? ", " : "", node->calls[j].callee, node->calls[j].sites);
+    fprintf(f, "]}");
+  }
+  fprintf(f, "\n]}\n");
+}
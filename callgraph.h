@@ -0,0 +1,46 @@
+/* Call graph
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CALLGRAPH_H__
+#define __CALLGRAPH_H__
+
+#include <stdio.h>
+#include "ast.h"
+
+typedef struct {
+  int callee;
+  int sites;                   // calls written in the caller's body
+} CallEdge;
+
+// A body: the main program is 0 and the subroutines are numbered as the
+// bytecode numbers procedures
+typedef struct {
+  AstNode *decl;               // N_PROGRAM, N_FUNCTION or N_PROCEDURE
+  int depth;
+  int size;                    // nodes in its statements
+  CallEdge *calls;
+  int callCount, callCapacity;
+  int callers;                 // call sites naming it anywhere
+  int component;               // strongly connected component
+  int isRecursive;             // it may call itself, directly or not
+  int isReachable;             // from the main program
+} CallNode;
+
+typedef struct {
+  CallNode *nodes;
+  int count;
+  int *order;                  // every body, callees before their callers
+} CallGraph;
+
+// Builds the graph of a program that passed the semantic analysis; numbers
+// its subroutines on the way
+CallGraph* buildCallGraph(AstNode *program);
+void freeCallGraph(CallGraph *graph);
+
+void writeCallGraphDot(CallGraph *graph, FILE *f);
+void writeCallGraphJson(CallGraph *graph, FILE *f);
+
+#endif
@@ -4,6 +4,7 @@
  * @version 1.0
  */
 
+#include <stdio.h>
 #include "charcode.h"
 
 CharCode charCodes[256] = {
@@ -47,3 +48,60 @@ CharCode charCodes[256] = {
   CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN,
   CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN, CHAR_UNKNOWN
 };
+
+/******************************************************************/
+
+// Puts the UTF-8 bytes of codePoint in bytes and returns how many there are
+int encodeChar(int codePoint, char *bytes) {
+  if ((codePoint < 0x80) || (codePoint > 0x10FFFF) || ((codePoint >= 0xD800) && (codePoint <= 0xDFFF))) {
+    bytes[0] = (char)codePoint;
+    return 1;
+  }
+  if (codePoint < 0x800) {
+    bytes[0] = (char)(0xC0 | (codePoint >> 6));
+    bytes[1] = (char)(0x80 | (codePoint & 0x3F));
+    return 2;
+  }
+  if (codePoint < 0x10000) {
+    bytes[0] = (char)(0xE0 | (codePoint >> 12));
+    bytes[1] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+    bytes[2] = (char)(0x80 | (codePoint & 0x3F));
+    return 3;
+  }
+  bytes[0] = (char)(0xF0 | (codePoint >> 18));
+  bytes[1] = (char)(0x80 | ((codePoint >> 12) & 0x3F));
+  bytes[2] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+  bytes[3] = (char)(0x80 | (codePoint & 0x3F));
+  return 4;
+}
+
+void writeCodePoint(FILE *f, int codePoint) {
+  char bytes[MAX_CHAR_BYTES];
+  if ((codePoint >= 0) && (codePoint < 0x80))
+    fputc(codePoint, f);
+  else fwrite(bytes, 1, encodeChar(codePoint, bytes), f);
+}
+
+// A byte that does not start a UTF-8 sequence reads as itself
+int readCodePoint(FILE *f) {
+  char c;
+  int codePoint, length, b;
+
+  if (fscanf(f, " %c", &c) != 1)
+    return 0;
+  codePoint = (unsigned char)c;
+  if ((codePoint >= 0xC2) && (codePoint <= 0xDF)) length = 1;
+  else if ((codePoint >= 0xE0) && (codePoint <= 0xEF)) length = 2;
+  else if ((codePoint >= 0xF0) && (codePoint <= 0xF4)) length = 3;
+  else return codePoint;
+  codePoint &= 0x3F >> length;
+  while (length-- > 0) {
+    b = getc(f);
+    if ((b == EOF) || ((b & 0xC0) != 0x80)) {
+      ungetc(b, f);
+      return (unsigned char)c;
+    }
+    codePoint = (codePoint << 6) | (b & 0x3F);
+  }
+  return codePoint;
+}
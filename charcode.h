@@ -7,6 +7,11 @@
 #ifndef __CHARCODE_H__
 #define __CHARCODE_H__
 
+#include <stdio.h>
+
+// Bytes of the longest UTF-8 character
+#define MAX_CHAR_BYTES 4
+
 typedef enum {
   CHAR_SPACE,
   CHAR_LETTER,
@@ -29,4 +34,11 @@ typedef enum {
   CHAR_UNKNOWN
 } CharCode;
 
+// The characters of the language are code points, read and written as UTF-8.
+// A value that is not one is written as the byte it used to be.
+int encodeChar(int codePoint, char *bytes);
+void writeCodePoint(FILE *f, int codePoint);
+// Skips blanks and reads a character, 0 at the end of f
+int readCodePoint(FILE *f);
+
 #endif
@@ -0,0 +1,255 @@
+/* Stack bytecode
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "code.h"
+
+const char *opNames[OP_COUNT] = {
+  "LA", "LV", "LC", "LI", "ST", "INT", "DCT", "CV", "J", "FJ",
+  "CALL", "ENTER", "EP", "EF", "HL", "RC", "RI", "WRC", "WRI", "WLN",
+  "AD", "SB", "ML", "DV", "NEG", "EQ", "NE", "GT", "LT", "GE", "LE", "IDX",
+  "LAL", "LVL", "STL", "LAG", "LVG", "STG",
+  "ADC", "INCL", "INCG", "FJEQ", "FJNE", "FJGT", "FJLT", "FJGE", "FJLE",
+  "IXU"
+};
+
+const int opLengths[OP_COUNT] = {
+  3, 3, 2, 1, 1, 2, 2, 1, 2, 2,
+  3, 3, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3,
+  2, 2, 2, 2, 2, 2,
+  2, 3, 3, 2, 2, 2, 2, 2, 2,
+  3
+};
+
+// Cleared to emit every instruction as written, to measure what fusing buys
+int fuseInstructions = 1;
+
+/******************************************************************/
+
+CodeBlock* newCodeBlock(void) {
+  CodeBlock *block = (CodeBlock*)calloc(1, sizeof(CodeBlock));
+  block->history[0] = block->history[1] = block->history[2] = -1;
+  return block;
+}
+
+void freeCodeBlock(CodeBlock *block) {
+  if (block == NULL)
+    return;
+  if (block->mapping != NULL)
+    munmap(block->mapping, block->mappingSize);
+  else {
+    free(block->code);
+    free(block->procedures);
+    free(block->lines);
+    free(block->pool);
+  }
+  free(block);
+}
+
+void ensureCode(CodeBlock *block, int words) {
+  if (block->size + words > block->capacity) {
+    block->capacity = block->capacity ? block->capacity * 2 : 1024;
+    block->code = (int*)realloc(block->code, block->capacity * sizeof(int));
+  }
+}
+
+// The instruction n back, or -1 when a label or statement lies in between
+int recent(CodeBlock *block, int n) {
+  int address = block->history[n];
+  return (address >= block->barrier) ? address : -1;
+}
+
+int fuse(CodeBlock *block, OpCode op, int operand1) {
+  int *code = block->code;
+  int last = recent(block, 0), before = recent(block, 1);
+
+  if (last < 0)
+    return -1;
+
+  switch (op) {
+  case OP_AD:
+  case OP_SB:
+    if ((code[last] == OP_LC) && !(op == OP_SB && code[last + 1] == INT_MIN)) {
+      code[last] = OP_ADC;
+      if (op == OP_SB)
+        code[last + 1] = -code[last + 1];
+      return last;
+    }
+    break;
+  case OP_FJ:
+    if ((code[last] >= OP_EQ) && (code[last] <= OP_LE)) {
+      code[last] = OP_FJEQ + (code[last] - OP_EQ);
+      code[last + 1] = operand1;
+      block->size = last + 2;
+      return last;
+    }
+    break;
+  case OP_STL:
+  case OP_STG:
+    if ((before >= 0) && (code[last] == OP_ADC) &&
+        (code[before] == (op == OP_STL ? OP_LVL : OP_LVG)) && (code[before + 1] == operand1)) {
+      code[before] = (op == OP_STL) ? OP_INCL : OP_INCG;
+      code[before + 2] = code[last + 1];
+      block->size = before + 3;
+      block->history[0] = before;
+      block->history[1] = block->history[2];
+      block->history[2] = -1;
+      return before;
+    }
+    break;
+  default:
+    break;
+  }
+  return -1;
+}
+
+int emit(CodeBlock *block, OpCode op, int operand1, int operand2) {
+  int address;
+
+  ensureCode(block, 3);
+  if (fuseInstructions) {
+    address = fuse(block, op, operand1);
+    if (address >= 0)
+      return address;
+  }
+
+  address = block->size;
+  block->code[block->size++] = op;
+  if (opLengths[op] > 1)
+    block->code[block->size++] = operand1;
+  if (opLengths[op] > 2)
+    block->code[block->size++] = operand2;
+  block->history[2] = block->history[1];
+  block->history[1] = block->history[0];
+  block->history[0] = address;
+  return address;
+}
+
+int codeLabel(CodeBlock *block) {
+  block->barrier = block->size;
+  return block->size;
+}
+
+// address is that of a J, FJ or FJcc instruction
+void patchJump(CodeBlock *block, int address, int target) {
+  block->code[address + 1] = target;
+}
+
+int addProcedure(CodeBlock *block, char *name, int paramCount) {
+  Procedure *proc;
+  int length = strlen(name) + 1;
+
+  if (block->poolSize + length > block->poolCapacity) {
+    block->poolCapacity = block->poolCapacity ? block->poolCapacity * 2 : 256;
+    if (block->poolCapacity < block->poolSize + length)
+      block->poolCapacity = block->poolSize + length;
+    block->pool = (char*)realloc(block->pool, block->poolCapacity);
+  }
+  if (block->procedureCount == block->procedureCapacity) {
+    block->procedureCapacity = block->procedureCapacity ? block->procedureCapacity * 2 : 16;
+    block->procedures = (Procedure*)realloc(block->procedures, block->procedureCapacity * sizeof(Procedure));
+  }
+  proc = &block->procedures[block->procedureCount];
+  memset(proc, 0, sizeof(Procedure));
+  proc->name = block->poolSize;
+  memcpy(block->pool + block->poolSize, name, length);
+  block->poolSize += length;
+  proc->paramCount = paramCount;
+  return block->procedureCount ++;
+}
+
+void addLine(CodeBlock *block, int lineNo, int colNo) {
+  LineEntry *line;
+  if (block->lineCount == block->lineCapacity) {
+    block->lineCapacity = block->lineCapacity ? block->lineCapacity * 2 : 256;
+    block->lines = (LineEntry*)realloc(block->lines, block->lineCapacity * sizeof(LineEntry));
+  }
+  line = &block->lines[block->lineCount++];
+  line->address = codeLabel(block);
+  line->lineNo = lineNo;
+  line->colNo = colNo;
+}
+
+// The statement whose code holds address
+LineEntry* findLine(CodeBlock *block, int address) {
+  int low = 0, high = block->lineCount - 1, middle;
+  LineEntry *found = NULL;
+  while (low <= high) {
+    middle = (low + high) / 2;
+    if (block->lines[middle].address <= address) {
+      found = &block->lines[middle];
+      low = middle + 1;
+    } else high = middle - 1;
+  }
+  return found;
+}
+
+char* procedureName(CodeBlock *block, int procedure) {
+  return block->pool + block->procedures[procedure].name;
+}
+
+int isJump(int op) {
+  return (op == OP_J) || (op == OP_FJ) || ((op >= OP_FJEQ) && (op <= OP_FJLE));
+}
+
+int verifyCode(CodeBlock *block) {
+  char *starts = (char*)calloc(block->size + 1, 1);
+  Procedure *proc;
+  int address, op, i, ok = 0;
+
+  // mark where instructions start, then check every target is one of them
+  for (address = 0; address < block->size; address += opLengths[op]) {
+    op = block->code[address];
+    if ((op < 0) || (op >= OP_COUNT) || (address + opLengths[op] > block->size))
+      goto done;
+    starts[address] = 1;
+  }
+  for (address = 0; address < block->size; address += opLengths[op]) {
+    op = block->code[address];
+    if (isJump(op) && ((block->code[address + 1] < 0) || (block->code[address + 1] >= block->size) ||
+                         !starts[block->code[address + 1]]))
+      goto done;
+    if ((op == OP_CALL) && ((block->code[address + 2] < 0) || (block->code[address + 2] >= block->procedureCount)))
+      goto done;
+  }
+  for (i = 0; i < block->procedureCount; i++) {
+    proc = &block->procedures[i];
+    if ((proc->entry < 0) || (proc->entry >= block->size) || !starts[proc->entry] ||
+        (block->code[proc->entry] != OP_ENTER) || (proc->paramCount < 0) ||
+        (proc->name < 0) || (proc->name >= block->poolSize))
+      goto done;
+  }
+  ok = (block->size > 0) && (block->procedureCount > 0) &&
+    ((block->poolSize == 0) || (block->pool[block->poolSize - 1] == '\0'));
+ done:
+  free(starts);
+  return ok;
+}
+
+void dumpCode(CodeBlock *block, FILE *f) {
+  int address = 0, i, op, checked = 0, unchecked = 0;
+
+  for (i = 0; i < block->procedureCount; i++)
+    fprintf(f, "; %d %s: entry %d, %d parameters, %d locals, stack %d\n", i, procedureName(block, i),
+            block->procedures[i].entry, block->procedures[i].paramCount, block->procedures[i].localCount,
+            block->procedures[i].maxStack);
+  while (address < block->size) {
+    op = block->code[address];
+    fprintf(f, "%6d  %s", address, opNames[op]);
+    for (i = 1; i < opLengths[op]; i++)
+      fprintf(f, "%s%d", i == 1 ? " " : ", ", block->code[address + i]);
+    fprintf(f, "\n");
+    checked += (op == OP_IDX);
+    unchecked += (op == OP_IXU);
+    address += opLengths[op];
+  }
+  fprintf(f, "; index checks: %d of %d removed\n", unchecked, checked + unchecked);
+}
@@ -0,0 +1,133 @@
+/* Stack bytecode
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CODE_H__
+#define __CODE_H__
+
+#include <stdio.h>
+#include "token.h"
+
+// Each instruction is an opcode word followed by its operands. p counts the
+// static links to follow from the current frame, q is a cell offset within
+// a frame, a is a code address and k an integer.
+typedef enum {
+  OP_LA,          // p q    push the address of a variable
+  OP_LV,          // p q    push the value of a variable
+  OP_LC,          // k      push a constant
+  OP_LI,          //        replace an address by the value it holds
+  OP_ST,          //        pop a value and an address, store the value
+  OP_INT,         // k      reserve k cells
+  OP_DCT,         // k      drop k cells
+  OP_CV,          //        push a copy of the top
+  OP_J,           // a      jump
+  OP_FJ,          // a      pop, jump when it is false
+  OP_CALL,        // p i    call procedure i with the arguments on the stack
+  OP_ENTER,       // k m    reserve and clear k cells for the locals, with room for m more
+  OP_EP,          //        return from a procedure
+  OP_EF,          //        return from a function, leaving its result
+  OP_HL,          //        stop
+  OP_RC,          //        push a character read from the input
+  OP_RI,          //        push an integer read from the input
+  OP_WRC,         //        pop and write a character
+  OP_WRI,         //        pop and write an integer
+  OP_WLN,         //        write a new line
+  OP_AD,
+  OP_SB,
+  OP_ML,
+  OP_DV,
+  OP_NEG,
+  OP_EQ,
+  OP_NE,
+  OP_GT,
+  OP_LT,
+  OP_GE,
+  OP_LE,
+  OP_IDX,         // n s    pop an index in 1..n, add (index - 1) * s to the address below
+  // variables of the current frame and of the program
+  OP_LAL,         // q
+  OP_LVL,         // q
+  OP_STL,         // q      pop into a variable
+  OP_LAG,         // q
+  OP_LVG,         // q
+  OP_STG,         // q
+  // superinstructions, formed as the code is emitted
+  OP_ADC,         // k      LC k; AD    and    LC -k; SB
+  OP_INCL,        // q k    LVL q; ADC k; STL q
+  OP_INCG,        // q k    LVG q; ADC k; STG q
+  OP_FJEQ,        // a      EQ; FJ a
+  OP_FJNE,        // a
+  OP_FJGT,        // a
+  OP_FJLT,        // a
+  OP_FJGE,        // a
+  OP_FJLE,        // a
+  OP_IXU,         // n s    IDX for an index proven in 1..n, unchecked
+  OP_COUNT
+} OpCode;
+
+// Cells 0 to 3 of every frame
+#define FRAME_RESULT 0
+#define FRAME_DYNAMIC_LINK 1
+#define FRAME_RETURN_ADDRESS 2
+#define FRAME_STATIC_LINK 3
+#define FRAME_HEADER 4
+
+typedef struct {
+  int entry;                   // code address of the body
+  int paramCount;
+  int localCount;              // cells after the parameters
+  int maxStack;                // deepest the body's own temporaries go
+  int name;                    // offset of the name in the pool
+} Procedure;
+
+typedef struct {
+  int address;
+  int lineNo, colNo;
+} LineEntry;
+
+// Procedure 0 is the main program; the code starts with a jump to it. The
+// sections hold no pointers, so a block can be saved and mapped back as is.
+typedef struct {
+  int *code;
+  int size, capacity;
+  Procedure *procedures;
+  int procedureCount, procedureCapacity;
+  LineEntry *lines;            // first address of each statement, ascending
+  int lineCount, lineCapacity;
+  char *pool;                  // constant pool: the NUL-terminated names
+  int poolSize, poolCapacity;
+  int barrier;                 // no superinstruction reaches back past this
+  int history[3];              // start of the last three instructions
+  void *mapping;               // when loaded from an image, the sections live here
+  long mappingSize;
+} CodeBlock;
+
+extern const char *opNames[OP_COUNT];
+extern const int opLengths[OP_COUNT];
+extern int fuseInstructions;
+
+CodeBlock* newCodeBlock(void);
+void freeCodeBlock(CodeBlock *block);
+
+// Appends an instruction and returns its address, which may be that of an
+// earlier instruction it was fused with
+int emit(CodeBlock *block, OpCode op, int operand1, int operand2);
+// Address of the next instruction; jumps may target it, so nothing emitted
+// afterwards fuses with what came before
+int codeLabel(CodeBlock *block);
+void patchJump(CodeBlock *block, int address, int target);
+int addProcedure(CodeBlock *block, char *name, int paramCount);
+void addLine(CodeBlock *block, int lineNo, int colNo);
+LineEntry* findLine(CodeBlock *block, int address);
+char* procedureName(CodeBlock *block, int procedure);
+int isJump(int op);
+// Checks that a block read from a file is well formed and only jumps and
+// calls within itself. The cells it addresses are not checked: images are
+// written by this parser and trusted like the source they came from.
+int verifyCode(CodeBlock *block);
+
+void dumpCode(CodeBlock *block, FILE *f);
+
+#endif
@@ -0,0 +1,377 @@
+/* Code generator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "codegen.h"
+#include "bounds.h"
+
+CodeBlock *code;
+// Depth of the body being generated; the main program is 0
+int currentDepth;
+// Its procedure number, and how many temporaries it has on the stack
+int currentProc;
+int stackDepth;
+
+void genExpression(AstNode *expr);
+void genStatement(AstNode *statement);
+
+/******************************************************************/
+
+// Cells taken by a variable of this type
+long long typeSize(Type *type) {
+  if ((type == NULL) || (type->typeClass != TP_ARRAY))
+    return 1;
+  return type->arraySize * typeSize(type->elementType);
+}
+
+int stackEffect(OpCode op, int operand) {
+  switch (op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_CV: case OP_RC: case OP_RI:
+  case OP_LAL: case OP_LVL: case OP_LAG: case OP_LVG:
+    return 1;
+  case OP_INT:
+    return operand;
+  case OP_DCT:
+    return -operand;
+  case OP_ST:
+    return -2;
+  case OP_FJ: case OP_WRC: case OP_WRI: case OP_IDX: case OP_IXU: case OP_STL: case OP_STG:
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+void adjustStack(int effect) {
+  stackDepth += effect;
+  if (stackDepth > code->procedures[currentProc].maxStack)
+    code->procedures[currentProc].maxStack = stackDepth;
+}
+
+int gen(OpCode op, int operand1, int operand2) {
+  adjustStack(stackEffect(op, operand1));
+  return emit(code, op, operand1, operand2);
+}
+
+// Hops along the static links from the current frame to that of depth
+int hopsTo(int depth) {
+  return currentDepth - depth;
+}
+
+// A variable reached without an address: not indexed, not a VAR parameter,
+// and in the current frame or the program's
+int isDirect(AstNode *ref) {
+  AstNode *decl = ref->decl;
+  if ((ref->list != NULL) || decl->isVarParam)
+    return 0;
+  return (decl->level == 0) || (decl->level == currentDepth);
+}
+
+void genLoadCell(AstNode *decl) {
+  if (decl->level == 0)
+    gen(OP_LVG, decl->offset, 0);
+  else if (decl->level == currentDepth)
+    gen(OP_LVL, decl->offset, 0);
+  else gen(OP_LV, hopsTo(decl->level), decl->offset);
+}
+
+void genAddressCell(AstNode *decl) {
+  if (decl->level == 0)
+    gen(OP_LAG, decl->offset, 0);
+  else if (decl->level == currentDepth)
+    gen(OP_LAL, decl->offset, 0);
+  else gen(OP_LA, hopsTo(decl->level), decl->offset);
+}
+
+// Pushes the address of a variable, parameter or array element
+void genAddress(AstNode *ref) {
+  AstNode *decl = ref->decl;
+  AstNode *index;
+  Type *type = decl->type;
+
+  // a VAR parameter holds the address
+  if (decl->isVarParam)
+    genLoadCell(decl);
+  else genAddressCell(decl);
+  for (index = ref->list; index != NULL; index = index->next) {
+    genExpression(index);
+    gen(needsIndexCheck(index, type) ? OP_IDX : OP_IXU, type->arraySize, (int)typeSize(type->elementType));
+    type = type->elementType;
+  }
+}
+
+void genLoad(AstNode *ref) {
+  if (ref->decl->kind == N_CONST)
+    gen(OP_LC, ref->decl->value, 0);
+  else if (isDirect(ref))
+    genLoadCell(ref->decl);
+  else {
+    genAddress(ref);
+    gen(OP_LI, 0, 0);
+  }
+}
+
+void genAssign(AstNode *target, AstNode *value) {
+  AstNode *decl = target->decl;
+
+  if (decl->kind == N_FUNCTION) {
+    // the result cell of the current frame
+    genExpression(value);
+    gen(OP_STL, FRAME_RESULT, 0);
+  } else if (isDirect(target)) {
+    genExpression(value);
+    gen(decl->level == 0 ? OP_STG : OP_STL, decl->offset, 0);
+  } else {
+    genAddress(target);
+    genExpression(value);
+    gen(OP_ST, 0, 0);
+  }
+}
+
+// Calls a builtin or a subroutine; a function leaves its result
+void genCall(AstNode *call) {
+  AstNode *decl = call->decl;
+  AstNode *arg, *param;
+
+  switch (decl->builtin) {
+  case BUILTIN_READC:
+    gen(OP_RC, 0, 0);
+    return;
+  case BUILTIN_READI:
+    gen(OP_RI, 0, 0);
+    return;
+  case BUILTIN_WRITEI:
+    genExpression(call->list);
+    gen(OP_WRI, 0, 0);
+    return;
+  case BUILTIN_WRITEC:
+    genExpression(call->list);
+    gen(OP_WRC, 0, 0);
+    return;
+  case BUILTIN_WRITELN:
+    gen(OP_WLN, 0, 0);
+    return;
+  default:
+    break;
+  }
+
+  gen(OP_INT, FRAME_HEADER, 0);
+  for (arg = call->list, param = decl->list; arg != NULL; arg = arg->next, param = param->next)
+    if (param->isVarParam)
+      genAddress(arg);
+    else genExpression(arg);
+  // the callee's static link is the frame of the body declaring it
+  emit(code, OP_CALL, hopsTo(decl->level - 1), decl->offset);
+  adjustStack(-(FRAME_HEADER + listLength(decl->list)) + (decl->kind == N_FUNCTION ? 1 : 0));
+}
+
+OpCode compareOp(TokenType op) {
+  switch (op) {
+  case SB_EQ: return OP_EQ;
+  case SB_NEQ: return OP_NE;
+  case SB_GT: return OP_GT;
+  case SB_LT: return OP_LT;
+  case SB_GE: return OP_GE;
+  default: return OP_LE;
+  }
+}
+
+OpCode arithmeticOp(TokenType op) {
+  switch (op) {
+  case SB_PLUS: return OP_AD;
+  case SB_MINUS: return OP_SB;
+  case SB_TIMES: return OP_ML;
+  default: return OP_DV;
+  }
+}
+
+void genBinary(AstNode *expr) {
+  AstNode **spine;
+  int count = binarySpine(expr, &spine), i;
+
+  genExpression(spine[0]->left);
+  for (i = 0; i < count; i++) {
+    genExpression(spine[i]->right);
+    gen(arithmeticOp(spine[i]->op), 0, 0);
+  }
+  free(spine);
+}
+
+void genExpression(AstNode *expr) {
+  switch (expr->kind) {
+  case N_NUMBER:
+  case N_CHARCONST:
+    gen(OP_LC, expr->value, 0);
+    break;
+  case N_VARIABLE:
+    genLoad(expr);
+    break;
+  case N_FUNCALL:
+    genCall(expr);
+    break;
+  case N_UNARY:
+    genExpression(expr->left);
+    if (expr->op == SB_MINUS)
+      gen(OP_NEG, 0, 0);
+    break;
+  case N_BINARY:
+    genBinary(expr);
+    break;
+  default:
+    break;
+  }
+}
+
+// Returns the jump taken when the condition is false
+int genCondition(AstNode *condition) {
+  genExpression(condition->left);
+  genExpression(condition->right);
+  gen(compareOp(condition->op), 0, 0);
+  return gen(OP_FJ, 0, 0);
+}
+
+void genFor(AstNode *statement) {
+  AstNode *var = statement->left;
+  int top, exit;
+
+  genAssign(var, statement->right);
+  // the final value is computed once and kept on the stack
+  genExpression(statement->list);
+  top = codeLabel(code);
+  gen(OP_CV, 0, 0);
+  genLoad(var);
+  gen(OP_GE, 0, 0);
+  exit = gen(OP_FJ, 0, 0);
+  enterLoop(statement, currentDepth);
+  genStatement(statement->body);
+  leaveLoop();
+  if (isDirect(var)) {
+    genLoadCell(var->decl);
+    gen(OP_ADC, 1, 0);
+    gen(var->decl->level == 0 ? OP_STG : OP_STL, var->decl->offset, 0);
+  } else {
+    genAddress(var);
+    genLoad(var);
+    gen(OP_ADC, 1, 0);
+    gen(OP_ST, 0, 0);
+  }
+  gen(OP_J, top, 0);
+  patchJump(code, exit, codeLabel(code));
+  gen(OP_DCT, 1, 0);
+}
+
+void genStatement(AstNode *statement) {
+  AstNode *st;
+  int jump, exit, top;
+
+  if (statement == NULL)
+    return;
+  if (statement->kind != N_GROUP)
+    addLine(code, statement->lineNo, statement->colNo);
+
+  switch (statement->kind) {
+  case N_ASSIGN:
+    genAssign(statement->left, statement->right);
+    break;
+  case N_CALL:
+    genCall(statement);
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      genStatement(st);
+    break;
+  case N_IF:
+    jump = genCondition(statement->left);
+    genStatement(statement->body);
+    if (statement->right != NULL) {
+      exit = gen(OP_J, 0, 0);
+      patchJump(code, jump, codeLabel(code));
+      genStatement(statement->right);
+      patchJump(code, exit, codeLabel(code));
+    } else patchJump(code, jump, codeLabel(code));
+    break;
+  case N_WHILE:
+    top = codeLabel(code);
+    exit = genCondition(statement->left);
+    genStatement(statement->body);
+    gen(OP_J, top, 0);
+    patchJump(code, exit, codeLabel(code));
+    break;
+  case N_FOR:
+    genFor(statement);
+    break;
+  default:
+    break;
+  }
+}
+
+int layoutFrame(AstNode *owner, AstNode *block, int depth) {
+  AstNode *decl;
+  long long offset = FRAME_HEADER;
+
+  if (owner->kind != N_PROGRAM)
+    for (decl = owner->list; decl != NULL; decl = decl->next) {
+      decl->level = depth;
+      decl->offset = (int)offset++;
+    }
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if (decl->kind == N_VAR) {
+      decl->level = depth;
+      decl->offset = (int)offset;
+      offset += typeSize(decl->type);
+      if (offset > INT_MAX / 2)
+        offset = INT_MAX / 2;
+    }
+  return (int)offset;
+}
+
+// Lays out the frame of a body at depth, generates its nested subroutines
+// and then the body itself
+void genBody(AstNode *owner, AstNode *block, int depth, int proc) {
+  AstNode *decl;
+  int frameSize = layoutFrame(owner, block, depth);
+  int paramCount = (owner->kind != N_PROGRAM) ? listLength(owner->list) : 0;
+
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE)) {
+      decl->level = depth + 1;
+      decl->offset = addProcedure(code, decl->name, listLength(decl->list));
+      genBody(decl, decl->body, depth + 1, decl->offset);
+    }
+
+  currentDepth = depth;
+  currentProc = proc;
+  stackDepth = 0;
+  code->procedures[proc].localCount = frameSize - FRAME_HEADER - paramCount;
+  code->procedures[proc].entry = codeLabel(code);
+  addLine(code, owner->lineNo, owner->colNo);
+  // patched below, once the deepest temporaries are known
+  emit(code, OP_ENTER, code->procedures[proc].localCount, 0);
+  genStatement(block->body);
+  code->code[code->procedures[proc].entry + 2] = code->procedures[proc].maxStack;
+  if (owner->kind == N_PROGRAM)
+    emit(code, OP_HL, 0, 0);
+  else if (owner->kind == N_FUNCTION)
+    emit(code, OP_EF, 0, 0);
+  else emit(code, OP_EP, 0, 0);
+}
+
+CodeBlock* generateCode(AstNode *program) {
+  int start;
+
+  code = newCodeBlock();
+  resetIndexChecks();
+  program->level = 0;
+  program->offset = addProcedure(code, program->name, 0);
+  start = emit(code, OP_J, 0, 0);
+  genBody(program, program->body, 0, program->offset);
+  patchJump(code, start, code->procedures[program->offset].entry);
+  return code;
+}
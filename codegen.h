@@ -0,0 +1,22 @@
+/* Code generator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CODEGEN_H__
+#define __CODEGEN_H__
+
+#include "ast.h"
+#include "code.h"
+
+// Cells taken by a variable of this type
+long long typeSize(Type *type);
+// Gives the parameters and variables of a body at depth their frame cells;
+// returns the size of the frame
+int layoutFrame(AstNode *owner, AstNode *block, int depth);
+
+// Lowers a program that passed the semantic analysis to stack bytecode
+CodeBlock* generateCode(AstNode *program);
+
+#endif
@@ -6,61 +6,92 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 #include "error.h"
+#include "probes.h"
 
-void error(ErrorCode err, int lineNo, int colNo) {
+// Every thread that parses has its own output and trap
+__thread FILE *outputStream;
+__thread jmp_buf *errorTrap;
+// When cleared only diagnostics are printed, not the token and production trace
+int traceEnabled = 1;
+
+// Position and text of the last error reported
+__thread int lastErrorLineNo, lastErrorColNo;
+__thread char lastErrorMessage[64];
+
+// Parsing stops at the first error. When compile() has set a trap we unwind
+// back to it, otherwise the whole process ends as it always did.
+void leaveOnError(void) {
+  if (errorTrap != NULL)
+    longjmp(*errorTrap, 1);
+  exit(0);
+}
+
+char *errorMessage(ErrorCode err) {
   switch (err) {
-  case ERR_ENDOFCOMMENT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_ENDOFCOMMENT);
-    break;
-  case ERR_IDENTTOOLONG:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_IDENTTOOLONG);
-    break;
-  case ERR_INVALIDCHARCONSTANT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCHARCONSTANT);
-    break;
-  case ERR_INVALIDSYMBOL:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSYMBOL);
-    break;
-  case ERR_INVALIDCONSTANT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCONSTANT);
-    break;
-  case ERR_INVALIDTYPE:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTYPE);
-    break;
-  case ERR_INVALIDBASICTYPE:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDBASICTYPE);
-    break;
-  case ERR_INVALIDPARAM:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDPARAM);
-    break;
-  case ERR_INVALIDSTATEMENT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSTATEMENT);
-    break;
-  case ERR_INVALIDARGUMENTS:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDARGUMENTS);
-    break;
-  case ERR_INVALIDCOMPARATOR:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCOMPARATOR);
-    break;
-  case ERR_INVALIDEXPRESSION:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDEXPRESSION);
-    break;
-  case ERR_INVALIDTERM:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTERM);
-    break;
-  case ERR_INVALIDFACTOR:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDFACTOR);
-    break;
+  case ERR_ENDOFCOMMENT: return ERM_ENDOFCOMMENT;
+  case ERR_IDENTTOOLONG: return ERM_IDENTTOOLONG;
+  case ERR_INVALIDCHARCONSTANT: return ERM_INVALIDCHARCONSTANT;
+  case ERR_INVALIDSYMBOL: return ERM_INVALIDSYMBOL;
+  case ERR_INVALIDENCODING: return ERM_INVALIDENCODING;
+  case ERR_INVALIDCONSTANT: return ERM_INVALIDCONSTANT;
+  case ERR_INVALIDTYPE: return ERM_INVALIDTYPE;
+  case ERR_INVALIDBASICTYPE: return ERM_INVALIDBASICTYPE;
+  case ERR_INVALIDPARAM: return ERM_INVALIDPARAM;
+  case ERR_INVALIDSTATEMENT: return ERM_INVALIDSTATEMENT;
+  case ERR_INVALIDARGUMENTS: return ERM_INVALIDARGUMENTS;
+  case ERR_INVALIDCOMPARATOR: return ERM_INVALIDCOMPARATOR;
+  case ERR_INVALIDEXPRESSION: return ERM_INVALIDEXPRESSION;
+  case ERR_INVALIDTERM: return ERM_INVALIDTERM;
+  case ERR_INVALIDFACTOR: return ERM_INVALIDFACTOR;
+  case ERR_NUMBERTOOLONG: return ERM_NUMBERTOOLONG;
+  case ERR_NESTINGTOODEEP: return ERM_NESTINGTOODEEP;
+  case ERR_UNDECLAREDIDENT: return ERM_UNDECLAREDIDENT;
+  case ERR_DUPLICATEIDENT: return ERM_DUPLICATEIDENT;
+  case ERR_TYPEINCONSISTENCY: return ERM_TYPEINCONSISTENCY;
+  case ERR_INTEGEREXPECTED: return ERM_INTEGEREXPECTED;
+  case ERR_NOTAVARIABLE: return ERM_NOTAVARIABLE;
+  case ERR_NOTACONSTANT: return ERM_NOTACONSTANT;
+  case ERR_NOTAFUNCTION: return ERM_NOTAFUNCTION;
+  case ERR_NOTAPROCEDURE: return ERM_NOTAPROCEDURE;
+  case ERR_ARGUMENTCOUNT: return ERM_ARGUMENTCOUNT;
+  case ERR_INDEXCOUNT: return ERM_INDEXCOUNT;
+  case ERR_INTEGEROVERFLOW: return ERM_INTEGEROVERFLOW;
+  case ERR_DIVISIONBYZERO: return ERM_DIVISIONBYZERO;
+  case ERR_INVALIDARRAYSIZE: return ERM_INVALIDARRAYSIZE;
+  case ERR_INDEXOUTOFRANGE: return ERM_INDEXOUTOFRANGE;
+  case ERR_STACKOVERFLOW: return ERM_STACKOVERFLOW;
   }
-  exit(0);
+  return "";
+}
+
+void reportError(char *message, int lineNo, int colNo) {
+  PROBE3(error, lineNo, colNo, message);
+  fprintf(outputStream, "%d-%d:%s\n", lineNo, colNo, message);
+  lastErrorLineNo = lineNo;
+  lastErrorColNo = colNo;
+  snprintf(lastErrorMessage, sizeof(lastErrorMessage), "%s", message);
+  leaveOnError();
+}
+
+void error(ErrorCode err, int lineNo, int colNo) {
+  reportError(errorMessage(err), lineNo, colNo);
+}
+
+// Reports an error and carries on, for passes that collect all of them
+void noteError(ErrorCode err, int lineNo, int colNo) {
+  PROBE3(error, lineNo, colNo, errorMessage(err));
+  fprintf(outputStream, "%d-%d:%s\n", lineNo, colNo, errorMessage(err));
 }
 
 void missingToken(TokenType tokenType, int lineNo, int colNo) {
-  printf("%d-%d:Missing %s\n", lineNo, colNo, tokenToString(tokenType));
-  exit(0);
+  char message[64];
+  snprintf(message, sizeof(message), "Missing %s", tokenToString(tokenType));
+  reportError(message, lineNo, colNo);
 }
 
 void assert(char *msg) {
-  printf("%s\n", msg);
+  if (traceEnabled)
+    fprintf(outputStream, "%s\n", msg);
 }
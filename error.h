@@ -13,6 +13,7 @@ typedef enum {
   ERR_IDENTTOOLONG,
   ERR_INVALIDCHARCONSTANT,
   ERR_INVALIDSYMBOL,
+  ERR_INVALIDENCODING,
   ERR_INVALIDCONSTANT,
   ERR_INVALIDTYPE,
   ERR_INVALIDBASICTYPE,
@@ -22,7 +23,24 @@ typedef enum {
   ERR_INVALIDCOMPARATOR,
   ERR_INVALIDEXPRESSION,
   ERR_INVALIDTERM,
-  ERR_INVALIDFACTOR
+  ERR_INVALIDFACTOR,
+  ERR_NUMBERTOOLONG,
+  ERR_NESTINGTOODEEP,
+  ERR_UNDECLAREDIDENT,
+  ERR_DUPLICATEIDENT,
+  ERR_TYPEINCONSISTENCY,
+  ERR_INTEGEREXPECTED,
+  ERR_NOTAVARIABLE,
+  ERR_NOTACONSTANT,
+  ERR_NOTAFUNCTION,
+  ERR_NOTAPROCEDURE,
+  ERR_ARGUMENTCOUNT,
+  ERR_INDEXCOUNT,
+  ERR_INTEGEROVERFLOW,
+  ERR_DIVISIONBYZERO,
+  ERR_INVALIDARRAYSIZE,
+  ERR_INDEXOUTOFRANGE,
+  ERR_STACKOVERFLOW
 } ErrorCode;
 
 
@@ -30,6 +48,7 @@ typedef enum {
 #define ERM_IDENTTOOLONG "Identification too long!"
 #define ERM_INVALIDCHARCONSTANT "Invalid const char!"
 #define ERM_INVALIDSYMBOL "Invalid symbol!"
+#define ERM_INVALIDENCODING "Invalid UTF-8 sequence!"
 #define ERM_INVALIDCONSTANT "Invalid constant!"
 #define ERM_INVALIDTYPE "Invalid type!"
 #define ERM_INVALIDBASICTYPE "Invalid basic type!"
@@ -40,8 +59,29 @@ typedef enum {
 #define ERM_INVALIDEXPRESSION "Invalid expression!"
 #define ERM_INVALIDTERM "Invalid term!"
 #define ERM_INVALIDFACTOR "Invalid factor!"
+#define ERM_NUMBERTOOLONG "Number too long!"
+#define ERM_NESTINGTOODEEP "Nesting too deep!"
+#define ERM_UNDECLAREDIDENT "Undeclared identifier!"
+#define ERM_DUPLICATEIDENT "Duplicate identifier!"
+#define ERM_TYPEINCONSISTENCY "Type inconsistency!"
+#define ERM_INTEGEREXPECTED "An integer expected!"
+#define ERM_NOTAVARIABLE "A variable expected!"
+#define ERM_NOTACONSTANT "A constant expected!"
+#define ERM_NOTAFUNCTION "A function expected!"
+#define ERM_NOTAPROCEDURE "A procedure expected!"
+#define ERM_ARGUMENTCOUNT "Wrong number of arguments!"
+#define ERM_INDEXCOUNT "Wrong number of indexes!"
+#define ERM_INTEGEROVERFLOW "Integer overflow!"
+#define ERM_DIVISIONBYZERO "Division by zero!"
+#define ERM_INVALIDARRAYSIZE "Invalid array size!"
+#define ERM_INDEXOUTOFRANGE "Index out of range!"
+#define ERM_STACKOVERFLOW "Stack overflow!"
 
+void leaveOnError(void);
+char *errorMessage(ErrorCode err);
+void reportError(char *message, int lineNo, int colNo);
 void error(ErrorCode err, int lineNo, int colNo);
+void noteError(ErrorCode err, int lineNo, int colNo);
 void missingToken(TokenType tokenType, int lineNo, int colNo);
 void assert(char *msg);
 
@@ -0,0 +1,198 @@
+/* Precompiled bytecode images
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "cache.h"
+#include "codegen.h"
+#include "image.h"
+
+#define MAX_PATH_LEN 4096
+#define BYTE_ORDER_MARK 0x01020304
+
+extern int checkSymbols;
+extern int checkSemantics;
+extern int (*programHook)(AstNode *program);
+
+// The code generated by the compile loadProgram() runs
+CodeBlock *generated;
+
+/******************************************************************/
+
+long alignSection(long offset) {
+  return (offset + 7) & ~7L;
+}
+
+int writeSection(FILE *f, void *data, long length) {
+  static const char padding[8];
+  long at = ftell(f);
+  if (fwrite(padding, 1, alignSection(at) - at, f) != (size_t)(alignSection(at) - at))
+    return 0;
+  return (length == 0) || (fwrite(data, 1, length, f) == (size_t)length);
+}
+
+int saveImage(CodeBlock *block, char *fileName, unsigned long long sourceHash, long sourceLength) {
+  char tmpName[MAX_PATH_LEN];
+  ImageHeader header;
+  long offset;
+  FILE *f;
+  int ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.sourceHash = sourceHash;
+  header.sourceLength = sourceLength;
+  header.codeSize = block->size;
+  header.procedureCount = block->procedureCount;
+  header.lineCount = block->lineCount;
+  header.poolSize = block->poolSize;
+  offset = alignSection(sizeof(ImageHeader));
+  header.codeOffset = offset;
+  offset = alignSection(offset + block->size * sizeof(int));
+  header.procedureOffset = offset;
+  offset = alignSection(offset + block->procedureCount * sizeof(Procedure));
+  header.lineOffset = offset;
+  offset = alignSection(offset + block->lineCount * sizeof(LineEntry));
+  header.poolOffset = offset;
+
+  // published with rename(), so a concurrent run maps a complete image or none
+  snprintf(tmpName, sizeof(tmpName), "%s.%ld", fileName, (long)getpid());
+  f = fopen(tmpName, "wb");
+  if (f == NULL)
+    return IO_ERROR;
+  ok = writeSection(f, &header, sizeof(header)) &&
+    writeSection(f, block->code, block->size * sizeof(int)) &&
+    writeSection(f, block->procedures, block->procedureCount * sizeof(Procedure)) &&
+    writeSection(f, block->lines, block->lineCount * sizeof(LineEntry)) &&
+    writeSection(f, block->pool, block->poolSize);
+  if ((fclose(f) != 0) || !ok || (rename(tmpName, fileName) != 0)) {
+    unlink(tmpName);
+    return IO_ERROR;
+  }
+  return IO_SUCCESS;
+}
+
+// A section of count items of size bytes must lie within the file
+int sectionFits(long fileSize, int offset, int count, long size) {
+  return (offset >= (long)sizeof(ImageHeader)) && (offset % 8 == 0) && (count >= 0) &&
+    (offset + count * size <= fileSize);
+}
+
+CodeBlock* loadImage(char *fileName, unsigned long long sourceHash, long sourceLength) {
+  struct stat st;
+  ImageHeader *header;
+  CodeBlock *block;
+  char *mapping;
+  int fd;
+
+  fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if ((fstat(fd, &st) != 0) || (st.st_size < (long)sizeof(ImageHeader))) {
+    close(fd);
+    return NULL;
+  }
+  mapping = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  header = (ImageHeader*)mapping;
+  if ((memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) ||
+      (header->version != IMAGE_VERSION) || (header->byteOrder != BYTE_ORDER_MARK) ||
+      (header->sourceHash != sourceHash) || (header->sourceLength != sourceLength) ||
+      !sectionFits(st.st_size, header->codeOffset, header->codeSize, sizeof(int)) ||
+      !sectionFits(st.st_size, header->procedureOffset, header->procedureCount, sizeof(Procedure)) ||
+      !sectionFits(st.st_size, header->lineOffset, header->lineCount, sizeof(LineEntry)) ||
+      !sectionFits(st.st_size, header->poolOffset, header->poolSize, 1)) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  // the block points into the mapping; nothing is copied
+  block = newCodeBlock();
+  block->code = (int*)(mapping + header->codeOffset);
+  block->size = block->capacity = header->codeSize;
+  block->procedures = (Procedure*)(mapping + header->procedureOffset);
+  block->procedureCount = block->procedureCapacity = header->procedureCount;
+  block->lines = (LineEntry*)(mapping + header->lineOffset);
+  block->lineCount = block->lineCapacity = header->lineCount;
+  block->pool = mapping + header->poolOffset;
+  block->poolSize = block->poolCapacity = header->poolSize;
+  block->mapping = mapping;
+  block->mappingSize = st.st_size;
+  if (!verifyCode(block)) {
+    freeCodeBlock(block);
+    return NULL;
+  }
+  return block;
+}
+
+int keepGenerated(AstNode *program) {
+  generated = generateCode(program);
+  return IO_SUCCESS;
+}
+
+CodeBlock* loadProgram(char *fileName, int *status) {
+  char imageName[MAX_PATH_LEN];
+  int (*savedHook)(AstNode *program) = programHook;
+  unsigned long long hash;
+  struct stat st;
+  char *source;
+  int fd;
+
+  fd = open(fileName, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    if (fd >= 0)
+      close(fd);
+    *status = IO_ERROR;
+    return NULL;
+  }
+  if (st.st_size > 0) {
+    source = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (source == MAP_FAILED) {
+      close(fd);
+      *status = IO_ERROR;
+      return NULL;
+    }
+    hash = hashBytes(source, st.st_size);
+    munmap(source, st.st_size);
+  } else hash = hashBytes("", 0);
+  close(fd);
+
+  // foo.kpl is compiled to foo.kplc, anything else gets the extension added
+  if ((strlen(fileName) > 4) && (strcmp(fileName + strlen(fileName) - 4, ".kpl") == 0))
+    snprintf(imageName, sizeof(imageName), "%sc", fileName);
+  else snprintf(imageName, sizeof(imageName), "%s%s", fileName, IMAGE_EXTENSION);
+
+  generated = loadImage(imageName, hash, st.st_size);
+  if (generated != NULL) {
+    *status = IO_SUCCESS;
+    return generated;
+  }
+
+  checkSymbols = checkSemantics = 1;
+  programHook = keepGenerated;
+  *status = compile(fileName);
+  programHook = savedHook;
+  if (*status != IO_SUCCESS) {
+    freeCodeBlock(generated);
+    return NULL;
+  }
+  // a failed save only costs the next run a compile
+  saveImage(generated, imageName, hash, st.st_size);
+  return generated;
+}
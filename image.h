@@ -0,0 +1,43 @@
+/* Precompiled bytecode images
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include "code.h"
+
+#define IMAGE_MAGIC "KPLCODE"
+// Bumped whenever the instruction set or the layout below changes
+#define IMAGE_VERSION 2
+#define IMAGE_EXTENSION ".kplc"
+
+// A .kplc file is this header followed by the sections of a CodeBlock, each
+// aligned to 8 bytes, in the byte order of the machine that wrote it. The
+// offsets are in bytes from the start of the file.
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;        // 0x01020304 as written
+  unsigned long long sourceHash; // of the .kpl the code was compiled from
+  long long sourceLength;
+  int codeSize, codeOffset;      // in words
+  int procedureCount, procedureOffset;
+  int lineCount, lineOffset;
+  int poolSize, poolOffset;      // constant pool, in bytes
+} ImageHeader;
+
+// Writes block to fileName; returns IO_SUCCESS or IO_ERROR
+int saveImage(CodeBlock *block, char *fileName, unsigned long long sourceHash, long sourceLength);
+// Maps an image compiled from a source with this hash and length. Returns
+// NULL when it is missing, stale, from another version or malformed.
+CodeBlock* loadImage(char *fileName, unsigned long long sourceHash, long sourceLength);
+
+// The code of a .kpl file, mapped from the .kplc beside it when that is up
+// to date and otherwise compiled and saved there. Compile errors are
+// reported as usual; status receives the compile() result.
+CodeBlock* loadProgram(char *fileName, int *status);
+
+#endif
@@ -0,0 +1,420 @@
+/* Incremental reparsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "incremental.h"
+
+typedef struct {
+  TokenType tokenType;
+  int lineNo, colNo;
+  size_t outputLength;
+  long readPosition;
+} RegionMark;
+
+extern __thread FILE *outputStream;
+extern __thread Token *lookAhead;
+extern __thread int blockLevel;
+extern __thread int nestingDepth;
+extern void (*subDeclHook)(void);
+extern __thread int lastErrorLineNo, lastErrorColNo;
+extern __thread char lastErrorMessage[];
+
+RegionMark *regionMarks;
+int markCount, markCapacity;
+size_t *markOutputLength;
+
+int stopped;
+int stopLineNo, stopColNo;
+
+/******************************************************************/
+
+void markRegion(void) {
+  fflush(outputStream);
+  if (markCount == markCapacity) {
+    markCapacity = markCapacity ? markCapacity * 2 : 64;
+    regionMarks = (RegionMark*)realloc(regionMarks, markCapacity * sizeof(RegionMark));
+  }
+  regionMarks[markCount].tokenType = lookAhead->tokenType;
+  regionMarks[markCount].lineNo = lookAhead->lineNo;
+  regionMarks[markCount].colNo = lookAhead->colNo;
+  regionMarks[markCount].outputLength = *markOutputLength;
+  regionMarks[markCount].readPosition = inputPosition();
+  markCount ++;
+}
+
+void reparseSubroutine(void) {
+  blockLevel = 1;
+  nestingDepth = 1;
+  stopped = 0;
+  if (lookAhead->tokenType == KW_FUNCTION)
+    compileFuncDecl();
+  else if (lookAhead->tokenType == KW_PROCEDURE)
+    compileProcDecl();
+  else return;
+  stopped = 1;
+  stopLineNo = lookAhead->lineNo;
+  stopColNo = lookAhead->colNo;
+}
+
+// Columns count characters, so the bytes that go on a UTF-8 one do not
+int columnsIn(char *bytes, long length) {
+  int columns = 0;
+  long i;
+  for (i = 0; i < length; i++)
+    if ((bytes[i] & 0xC0) != 0x80) columns ++;
+  return columns;
+}
+
+// Offset of the character columns characters after the one at from
+long skipColumns(Document *doc, long from, int columns) {
+  while ((columns > 0) && (from < doc->length)) {
+    from ++;
+    while ((from < doc->length) && ((doc->source[from] & 0xC0) == 0x80)) from ++;
+    columns --;
+  }
+  return from;
+}
+
+// Byte offset of lineNo/colNo, walking forward from a known position
+long offsetOf(Document *doc, long from, int fromLineNo, int fromColNo, int lineNo, int colNo) {
+  char *p;
+  if (lineNo == fromLineNo)
+    return skipColumns(doc, from, colNo - fromColNo);
+  while (fromLineNo < lineNo) {
+    p = (char*)memchr(doc->source + from, '\n', doc->length - from);
+    if (p == NULL) return doc->length;
+    from = p - doc->source + 1;
+    fromLineNo ++;
+  }
+  return skipColumns(doc, from, colNo - 1);
+}
+
+// Column of the byte at offset, counting from the start of its line
+int columnOf(char *source, long offset) {
+  long i = offset;
+  while ((i > 0) && (source[i - 1] != '\n')) i --;
+  return columnsIn(source + i, offset - i) + 1;
+}
+
+void freeRegions(Document *doc, int from) {
+  int i;
+  for (i = from; i < doc->regionCount; i++)
+    free(doc->regions[i].output);
+  doc->regionCount = from;
+}
+
+Region* appendRegion(Document *doc) {
+  Region *region;
+  if (doc->regionCount == doc->regionCapacity) {
+    doc->regionCapacity = doc->regionCapacity ? doc->regionCapacity * 2 : 16;
+    doc->regions = (Region*)realloc(doc->regions, doc->regionCapacity * sizeof(Region));
+  }
+  region = &doc->regions[doc->regionCount++];
+  memset(region, 0, sizeof(Region));
+  return region;
+}
+
+void updateStatus(Document *doc) {
+  int i;
+  doc->status = IO_SUCCESS;
+  for (i = 0; i < doc->regionCount; i++)
+    if (doc->regions[i].status != IO_SUCCESS) {
+      doc->status = doc->regions[i].status;
+      break;
+    }
+}
+
+void keepError(Region *region, int status) {
+  region->status = status;
+  if (status != IO_SUCCESS) {
+    region->errorLineNo = lastErrorLineNo;
+    region->errorColNo = lastErrorColNo;
+    strcpy(region->errorMessage, lastErrorMessage);
+  }
+}
+
+// Parses everything from region `from` to the end of the program and
+// rebuilds the regions from the top-level boundaries met on the way.
+void parseFrom(Document *doc, int from) {
+  FILE *savedOutput = outputStream;
+  char *output = NULL;
+  size_t outputLength = 0, begin;
+  long start = 0, extent, position;
+  int lineNo = 1, colNo = 1, status, i;
+  RegionKind kind = REGION_PROLOGUE;
+  Region *region;
+
+  if (from > 0) {
+    start = doc->regions[from].start;
+    lineNo = doc->regions[from].lineNo;
+    colNo = doc->regions[from].colNo;
+    kind = doc->regions[from].kind;
+  }
+  freeRegions(doc, from);
+
+  markCount = 0;
+  outputStream = open_memstream(&output, &outputLength);
+  markOutputLength = &outputLength;
+  subDeclHook = markRegion;
+  openInputBuffer(doc->source + start, doc->length - start, lineNo, colNo);
+  status = compileWith(from == 0 ? compileProgram : compileProgramRest);
+  extent = start + inputPosition();
+  closeInputStream();
+  subDeclHook = NULL;
+  fclose(outputStream);
+  outputStream = savedOutput;
+
+  region = appendRegion(doc);
+  region->kind = kind;
+  region->start = start;
+  region->lineNo = lineNo;
+  region->colNo = colNo;
+
+  position = start;
+  for (i = 0; i < markCount; i++) {
+    position = offsetOf(doc, position, lineNo, colNo, regionMarks[i].lineNo, regionMarks[i].colNo);
+    // when resuming, the first boundary is the start of the region itself
+    if (regionMarks[i].outputLength > 0 || from == 0 || i > 0) {
+      region->outputLength = regionMarks[i].outputLength;
+      region->extent = start + regionMarks[i].readPosition;
+      region = appendRegion(doc);
+    }
+    region->start = position;
+    region->kind = (regionMarks[i].tokenType == KW_FUNCTION || regionMarks[i].tokenType == KW_PROCEDURE) ?
+      REGION_SUBROUTINE : REGION_MAIN;
+    lineNo = region->lineNo = regionMarks[i].lineNo;
+    colNo = region->colNo = regionMarks[i].colNo;
+  }
+  region->outputLength = outputLength;
+  region->extent = extent;
+
+  begin = 0;
+  for (i = from; i < doc->regionCount; i++) {
+    region = &doc->regions[i];
+    region->outputLength -= begin;
+    region->output = (char*)malloc(region->outputLength + 1);
+    memcpy(region->output, output + begin, region->outputLength);
+    begin += region->outputLength;
+    region->outputLineNo = region->lineNo;
+    region->outputColNo = region->colNo;
+    region->status = IO_SUCCESS;
+  }
+  keepError(&doc->regions[doc->regionCount - 1], status);
+  doc->reparsedRegions += doc->regionCount - from;
+  free(output);
+}
+
+// Parses a single subroutine region again. Fails when the edit moved the
+// region's end, in which case the caller has to parse on from there.
+int reparseRegion(Document *doc, int r) {
+  Region *region = &doc->regions[r];
+  FILE *savedOutput = outputStream;
+  char *output = NULL;
+  size_t outputLength = 0;
+  long end = (r + 1 < doc->regionCount) ? doc->regions[r + 1].start : doc->length;
+  long extent;
+  int status;
+
+  if (region->kind != REGION_SUBROUTINE)
+    return 0;
+
+  outputStream = open_memstream(&output, &outputLength);
+  openInputBuffer(doc->source + region->start, doc->length - region->start, region->lineNo, region->colNo);
+  status = compileWith(reparseSubroutine);
+  extent = region->start + inputPosition();
+  closeInputStream();
+  fclose(outputStream);
+  outputStream = savedOutput;
+
+  if ((status == IO_SUCCESS) &&
+      (!stopped || offsetOf(doc, region->start, region->lineNo, region->colNo, stopLineNo, stopColNo) != end)) {
+    free(output);
+    return 0;
+  }
+
+  free(region->output);
+  region->output = output;
+  region->outputLength = outputLength;
+  region->outputLineNo = region->lineNo;
+  region->outputColNo = region->colNo;
+  region->extent = extent;
+  keepError(region, status);
+  doc->reparsedRegions ++;
+  return 1;
+}
+
+// Index of the region holding offset
+int findRegion(Document *doc, long offset) {
+  int lo = 0, hi = doc->regionCount - 1, mid;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (doc->regions[mid].start <= offset) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+/******************************************************************/
+
+Document* openDocument(char *source, long length) {
+  Document *doc = (Document*)calloc(1, sizeof(Document));
+  doc->source = (char*)malloc(length + 1);
+  memcpy(doc->source, source, length);
+  doc->length = length;
+  parseFrom(doc, 0);
+  updateStatus(doc);
+  return doc;
+}
+
+// Replaces `removed` bytes at offset with text and brings the parse up to
+// date, reparsing only the top-level regions the edit can have affected.
+int editDocument(Document *doc, long offset, long removed, char *text, long textLength) {
+  long end = offset + removed, delta = textLength - removed;
+  int r, first, spans, i, deltaLines = 0, deltaCols, newColNo;
+  char *p;
+
+  if ((offset < 0) || (removed < 0) || (end > doc->length))
+    return IO_ERROR;
+
+  doc->reparsedRegions = 0;
+  r = findRegion(doc, offset);
+  spans = (r + 1 < doc->regionCount) && (doc->regions[r + 1].start < end);
+  // Regions before r are affected too when their parse read into the edit,
+  // e.g. the prologue ending on the token that follows the declarations, or
+  // a subroutine scanning the first token after its closing ';'.
+  first = r;
+  for (i = 0; i < r; i++)
+    if (doc->regions[i].extent > offset) {
+      first = i;
+      break;
+    }
+
+  // shift the regions after the edit
+  for (i = 0; i < removed; i++)
+    if (doc->source[offset + i] == '\n') deltaLines --;
+  for (i = 0; i < textLength; i++)
+    if (text[i] == '\n') deltaLines ++;
+  p = (char*)memrchr(text, '\n', textLength);
+  newColNo = (p != NULL) ? columnsIn(p + 1, text + textLength - p - 1) + 1
+                         : columnOf(doc->source, offset) + columnsIn(text, textLength);
+  deltaCols = newColNo - columnOf(doc->source, end);
+  for (i = r + 1; i < doc->regionCount; i++) {
+    Region *region = &doc->regions[i];
+    if (region->start < end)
+      continue;
+    if (memchr(doc->source + end, '\n', region->start - end) == NULL)
+      region->colNo += deltaCols;
+    region->start += delta;
+    region->extent += delta;
+    region->lineNo += deltaLines;
+  }
+
+  if (delta > 0)
+    doc->source = (char*)realloc(doc->source, doc->length + delta + 1);
+  memmove(doc->source + end + delta, doc->source + end, doc->length - end);
+  memcpy(doc->source + offset, text, textLength);
+  doc->length += delta;
+
+  if (spans)
+    parseFrom(doc, first);
+  else for (i = first; i <= r; i++)
+    if ((i == 0) || !reparseRegion(doc, i)) {
+      parseFrom(doc, i);
+      break;
+    }
+  updateStatus(doc);
+  return doc->status;
+}
+
+int replaceDocument(Document *doc, char *source, long length) {
+  long prefix = 0, suffix = 0;
+  long shorter = (length < doc->length) ? length : doc->length;
+
+  // skip equal blocks with memcmp before narrowing down byte by byte
+  while ((prefix + 256 <= shorter) && (memcmp(source + prefix, doc->source + prefix, 256) == 0))
+    prefix += 256;
+  while ((prefix < shorter) && (source[prefix] == doc->source[prefix]))
+    prefix ++;
+  while ((suffix + 256 <= shorter - prefix) &&
+         (memcmp(source + length - suffix - 256, doc->source + doc->length - suffix - 256, 256) == 0))
+    suffix += 256;
+  while ((suffix < shorter - prefix) &&
+         (source[length - 1 - suffix] == doc->source[doc->length - 1 - suffix]))
+    suffix ++;
+  return editDocument(doc, prefix, doc->length - prefix - suffix,
+                      source + prefix, length - prefix - suffix);
+}
+
+// Prints the output the whole program would produce, moving the positions
+// of regions that shifted since they were parsed.
+void printDocument(Document *doc, FILE *f) {
+  Region *region;
+  char *p, *end, *q, *r;
+  int i, lineShift, colShift, lineNo;
+
+  for (i = 0; i < doc->regionCount; i++) {
+    region = &doc->regions[i];
+    lineShift = region->lineNo - region->outputLineNo;
+    colShift = region->colNo - region->outputColNo;
+    if ((lineShift == 0) && (colShift == 0))
+      fwrite(region->output, 1, region->outputLength, f);
+    else {
+      p = region->output;
+      end = p + region->outputLength;
+      while (p < end) {
+        q = p;
+        while ((q < end) && isdigit((unsigned char)*q)) q ++;
+        if ((q > p) && (q < end) && (*q == '-')) {
+          lineNo = atoi(p);
+          r = q + 1;
+          while ((r < end) && isdigit((unsigned char)*r)) r ++;
+          fprintf(f, "%d-%d", lineNo + lineShift,
+                  atoi(q + 1) + ((lineNo == region->outputLineNo) ? colShift : 0));
+          p = r;
+        }
+        q = (char*)memchr(p, '\n', end - p);
+        q = (q == NULL) ? end : q + 1;
+        fwrite(p, 1, q - p, f);
+        p = q;
+      }
+    }
+    if (region->status != IO_SUCCESS)
+      break;
+  }
+}
+
+// Position and message of the error that stops the parse, if there is one
+int documentError(Document *doc, int *lineNo, int *colNo, char **message) {
+  Region *region;
+  int i;
+
+  for (i = 0; i < doc->regionCount; i++) {
+    region = &doc->regions[i];
+    if (region->status == IO_SUCCESS)
+      continue;
+    *lineNo = region->errorLineNo + region->lineNo - region->outputLineNo;
+    *colNo = region->errorColNo;
+    if (region->errorLineNo == region->outputLineNo)
+      *colNo += region->colNo - region->outputColNo;
+    *message = region->errorMessage;
+    return 1;
+  }
+  return 0;
+}
+
+void closeDocument(Document *doc) {
+  freeRegions(doc, 0);
+  free(doc->regions);
+  free(doc->source);
+  free(doc);
+}
@@ -0,0 +1,52 @@
+/* Incremental reparsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+
+#include <stdio.h>
+#include "token.h"
+
+typedef enum {
+  REGION_PROLOGUE,      // PROGRAM header and global declarations
+  REGION_SUBROUTINE,    // one top-level FUNCTION or PROCEDURE
+  REGION_MAIN           // main BEGIN ... END. block
+} RegionKind;
+
+// A top-level slice of the source together with the output its parse
+// produced. A region runs from its first token up to the first token of the
+// next region, so comments and blanks belong to the region before them.
+typedef struct {
+  RegionKind kind;
+  long start;
+  int lineNo, colNo;
+  char *output;
+  size_t outputLength;
+  int outputLineNo;     // lineNo/colNo at the time output was printed
+  int outputColNo;
+  int status;           // IO_SUCCESS or COMPILE_ERROR
+  long extent;          // end of the source the parse had to read
+  int errorLineNo, errorColNo;
+  char errorMessage[64];
+} Region;
+
+typedef struct {
+  char *source;
+  long length;
+  Region *regions;
+  int regionCount, regionCapacity;
+  int status;
+  int reparsedRegions;  // regions parsed again by the last update
+} Document;
+
+Document* openDocument(char *source, long length);
+int editDocument(Document *doc, long offset, long removed, char *text, long textLength);
+int replaceDocument(Document *doc, char *source, long length);
+void printDocument(Document *doc, FILE *f);
+int documentError(Document *doc, int *lineNo, int *colNo, char **message);
+void closeDocument(Document *doc);
+
+#endif
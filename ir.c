@@ -0,0 +1,1036 @@
+/* SSA intermediate representation
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "code.h"
+#include "codegen.h"
+
+#define IR_CHUNK 1024
+
+// Instructions and blocks of a function come from chunks it owns
+typedef struct InstrChunk {
+  struct InstrChunk *previous;
+  int used;
+  IrInstr items[IR_CHUNK];
+} InstrChunk;
+
+typedef struct BlockChunk {
+  struct BlockChunk *previous;
+  int used;
+  IrBlock items[IR_CHUNK];
+} BlockChunk;
+
+typedef struct {
+  IrFunction function;
+  InstrChunk *instrs;
+  BlockChunk *blocks;
+} OwnedFunction;
+
+typedef struct {
+  int variable;
+  IrInstr *value;
+} TrailEntry;
+
+const char *irOpNames[IR_OP_COUNT] = {
+  "const", "frame", "copy", "phi", "add", "sub", "mul", "div", "neg",
+  "eq", "ne", "lt", "le", "gt", "ge", "check", "load", "store", "call",
+  "readc", "readi", "writec", "writei", "writeln", "jump", "branch", "return"
+};
+
+// The function being built, the block code goes into and the statement
+// being lowered
+IrProgram *irProgram;
+IrFunction *fn;
+IrBlock *cur;
+AstNode *irOwner;
+int irLineNo, irColNo;
+
+// Current value of every SSA variable of the function, and the trail of
+// assignments to undo when leaving a branch
+IrInstr **current;
+int variableCount;
+TrailEntry *trail;
+int trailSize, trailCapacity;
+// Stamps mark variables already collected without clearing between uses
+int *stamps;
+int stamp;
+
+IrInstr* irExpression(AstNode *expr);
+void irStatement(AstNode *statement);
+
+/******************************************************************/
+
+IrInstr* newInstr(IrFunction *function, IrOp op, int value) {
+  OwnedFunction *owned = (OwnedFunction*)function;
+  InstrChunk *chunk = owned->instrs;
+  IrInstr *instr;
+
+  if ((chunk == NULL) || (chunk->used == IR_CHUNK)) {
+    chunk = (InstrChunk*)malloc(sizeof(InstrChunk));
+    chunk->previous = owned->instrs;
+    chunk->used = 0;
+    owned->instrs = chunk;
+  }
+  instr = &chunk->items[chunk->used++];
+  memset(instr, 0, sizeof(IrInstr));
+  instr->op = op;
+  instr->value = value;
+  instr->id = function->valueCount ++;
+  instr->args = instr->inlineArgs;
+  instr->argCapacity = 2;
+  return instr;
+}
+
+IrBlock* newBlock(IrFunction *function) {
+  OwnedFunction *owned = (OwnedFunction*)function;
+  BlockChunk *chunk = owned->blocks;
+  IrBlock *block;
+
+  if ((chunk == NULL) || (chunk->used == IR_CHUNK)) {
+    chunk = (BlockChunk*)malloc(sizeof(BlockChunk));
+    chunk->previous = owned->blocks;
+    chunk->used = 0;
+    owned->blocks = chunk;
+  }
+  block = &chunk->items[chunk->used++];
+  memset(block, 0, sizeof(IrBlock));
+  block->id = function->blockCount ++;
+  block->order = -1;
+  if (function->lastBlock != NULL)
+    function->lastBlock->next = block;
+  else function->entry = block;
+  function->lastBlock = block;
+  return block;
+}
+
+void addArg(IrInstr *instr, IrInstr *arg) {
+  if (instr->argCount == instr->argCapacity) {
+    instr->argCapacity *= 2;
+    if (instr->args == instr->inlineArgs) {
+      instr->args = (IrInstr**)malloc(instr->argCapacity * sizeof(IrInstr*));
+      memcpy(instr->args, instr->inlineArgs, sizeof(instr->inlineArgs));
+    } else instr->args = (IrInstr**)realloc(instr->args, instr->argCapacity * sizeof(IrInstr*));
+  }
+  instr->args[instr->argCount++] = arg;
+}
+
+void addEdge(IrBlock *from, IrBlock *to) {
+  from->succs[from->succCount++] = to;
+  if (to->predCount == to->predCapacity) {
+    to->predCapacity = to->predCapacity ? to->predCapacity * 2 : 2;
+    to->preds = (IrBlock**)realloc(to->preds, to->predCapacity * sizeof(IrBlock*));
+  }
+  to->preds[to->predCount++] = from;
+}
+
+void appendInstr(IrBlock *block, IrInstr *instr) {
+  instr->block = block;
+  instr->prev = block->last;
+  instr->next = NULL;
+  if (block->last != NULL)
+    block->last->next = instr;
+  else block->first = instr;
+  block->last = instr;
+}
+
+void insertBefore(IrInstr *instr, IrInstr *at) {
+  instr->block = at->block;
+  instr->next = at;
+  instr->prev = at->prev;
+  if (at->prev != NULL)
+    at->prev->next = instr;
+  else at->block->first = instr;
+  at->prev = instr;
+}
+
+void removeInstr(IrInstr *instr) {
+  IrBlock *block = instr->block;
+  if (instr->prev != NULL)
+    instr->prev->next = instr->next;
+  else block->first = instr->next;
+  if (instr->next != NULL)
+    instr->next->prev = instr->prev;
+  else block->last = instr->prev;
+  instr->prev = instr->next = NULL;
+  instr->block = NULL;
+}
+
+IrInstr* resolveInstr(IrInstr *instr) {
+  while ((instr != NULL) && (instr->replacement != NULL))
+    instr = instr->replacement;
+  return instr;
+}
+
+void resolveArgs(IrFunction *function) {
+  IrBlock *block;
+  IrInstr *instr;
+  int i;
+
+  for (block = function->entry; block != NULL; block = block->next)
+    for (instr = block->first; instr != NULL; instr = instr->next)
+      for (i = 0; i < instr->argCount; i++)
+        instr->args[i] = resolveInstr(instr->args[i]);
+}
+
+// Computes a value from its arguments alone, and cannot stop the program
+int isPure(IrOp op) {
+  switch (op) {
+  case IR_CONST: case IR_FRAME: case IR_COPY:
+  case IR_ADD: case IR_SUB: case IR_MUL: case IR_NEG:
+  case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+int isTerminator(IrOp op) {
+  return (op == IR_JUMP) || (op == IR_BRANCH) || (op == IR_RETURN);
+}
+
+int instructionCount(IrProgram *program) {
+  IrBlock *block;
+  IrInstr *instr;
+  int count = 0, i;
+
+  for (i = 0; i < program->count; i++)
+    for (block = program->functions[i]->entry; block != NULL; block = block->next)
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        count ++;
+  return count;
+}
+
+int checkCount(IrProgram *program) {
+  IrBlock *block;
+  IrInstr *instr;
+  int count = 0, i;
+
+  for (i = 0; i < program->count; i++)
+    for (block = program->functions[i]->entry; block != NULL; block = block->next)
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        count += (instr->op == IR_CHECK);
+  return count;
+}
+
+/******************************************************************/
+// Lowering
+
+IrInstr* emit0(IrOp op, int value) {
+  IrInstr *instr = newInstr(fn, op, value);
+  instr->lineNo = irLineNo;
+  instr->colNo = irColNo;
+  appendInstr(cur, instr);
+  return instr;
+}
+
+IrInstr* emit1(IrOp op, int value, IrInstr *a) {
+  IrInstr *instr = emit0(op, value);
+  addArg(instr, a);
+  return instr;
+}
+
+IrInstr* emit2(IrOp op, int value, IrInstr *a, IrInstr *b) {
+  IrInstr *instr = emit1(op, value, a);
+  addArg(instr, b);
+  return instr;
+}
+
+void jumpTo(IrBlock *target) {
+  emit0(IR_JUMP, 0);
+  addEdge(cur, target);
+}
+
+void setVariable(int variable, IrInstr *value) {
+  if (trailSize == trailCapacity) {
+    trailCapacity = trailCapacity ? trailCapacity * 2 : 256;
+    trail = (TrailEntry*)realloc(trail, trailCapacity * sizeof(TrailEntry));
+  }
+  trail[trailSize].variable = variable;
+  trail[trailSize].value = current[variable];
+  trailSize ++;
+  current[variable] = value;
+}
+
+void undoTrail(int mark) {
+  while (trailSize > mark) {
+    trailSize --;
+    current[trail[trailSize].variable] = trail[trailSize].value;
+  }
+}
+
+// The variables assigned since mark with their current values, each once
+int changedSince(int mark, int **variables, IrInstr ***values) {
+  int count = 0, i, v;
+
+  stamp ++;
+  *variables = (int*)malloc((trailSize - mark + 1) * sizeof(int));
+  *values = (IrInstr**)malloc((trailSize - mark + 1) * sizeof(IrInstr*));
+  for (i = mark; i < trailSize; i++) {
+    v = trail[i].variable;
+    if (stamps[v] == stamp)
+      continue;
+    stamps[v] = stamp;
+    (*variables)[count] = v;
+    (*values)[count] = current[v];
+    count ++;
+  }
+  return count;
+}
+
+// The SSA variable an assignment to ref sets, or -1 when it goes to memory
+int variableOf(AstNode *ref) {
+  AstNode *decl = ref->decl;
+  if (decl->kind == N_FUNCTION)
+    return 0;
+  if ((ref->list != NULL) || decl->isVarParam)
+    return -1;
+  return decl->variable;
+}
+
+IrInstr* frameCell(AstNode *decl) {
+  IrInstr *instr = emit0(IR_FRAME, decl->offset);
+  instr->hops = fn->depth - decl->level;
+  return instr;
+}
+
+// The address of a variable, parameter or array element
+IrInstr* irAddress(AstNode *ref) {
+  AstNode *decl = ref->decl;
+  AstNode *index;
+  Type *type = decl->type;
+  IrInstr *address, *i;
+  int size;
+
+  // a VAR parameter holds the address; those of this body are loaded once
+  if (decl->isVarParam && (decl->level == fn->depth))
+    address = current[decl->variable];
+  else if (decl->isVarParam)
+    address = emit1(IR_LOAD, 0, frameCell(decl));
+  else address = frameCell(decl);
+  for (index = ref->list; index != NULL; index = index->next) {
+    i = irExpression(index);
+    emit1(IR_CHECK, type->arraySize, i);
+    size = (int)typeSize(type->elementType);
+    // base - size + i * size, so that base - size is invariant in a loop over i
+    address = emit2(IR_ADD, 0, emit2(IR_ADD, 0, address, emit0(IR_CONST, -size)),
+                    emit2(IR_MUL, 0, i, emit0(IR_CONST, size)));
+    type = type->elementType;
+  }
+  return address;
+}
+
+IrInstr* irCall(AstNode *call) {
+  AstNode *decl = call->decl;
+  AstNode *arg, *param;
+  IrInstr *instr;
+
+  switch (decl->builtin) {
+  case BUILTIN_READC:
+    return emit0(IR_READC, 0);
+  case BUILTIN_READI:
+    return emit0(IR_READI, 0);
+  case BUILTIN_WRITEI:
+    return emit1(IR_WRITEI, 0, irExpression(call->list));
+  case BUILTIN_WRITEC:
+    return emit1(IR_WRITEC, 0, irExpression(call->list));
+  case BUILTIN_WRITELN:
+    return emit0(IR_WRITELN, 0);
+  default:
+    break;
+  }
+
+  instr = newInstr(fn, IR_CALL, decl->offset);
+  instr->hops = fn->depth - (decl->level - 1);
+  instr->lineNo = irLineNo;
+  instr->colNo = irColNo;
+  for (arg = call->list, param = decl->list; arg != NULL; arg = arg->next, param = param->next)
+    addArg(instr, param->isVarParam ? irAddress(arg) : irExpression(arg));
+  appendInstr(cur, instr);
+  return instr;
+}
+
+IrOp irCompareOp(TokenType op) {
+  switch (op) {
+  case SB_EQ: return IR_EQ;
+  case SB_NEQ: return IR_NE;
+  case SB_GT: return IR_GT;
+  case SB_LT: return IR_LT;
+  case SB_GE: return IR_GE;
+  default: return IR_LE;
+  }
+}
+
+IrOp irArithmeticOp(TokenType op) {
+  switch (op) {
+  case SB_PLUS: return IR_ADD;
+  case SB_MINUS: return IR_SUB;
+  case SB_TIMES: return IR_MUL;
+  default: return IR_DIV;
+  }
+}
+
+IrInstr* irBinary(AstNode *expr) {
+  AstNode **spine;
+  IrInstr *value;
+  int count = binarySpine(expr, &spine), i;
+
+  value = irExpression(spine[0]->left);
+  for (i = 0; i < count; i++)
+    value = emit2(irArithmeticOp(spine[i]->op), 0, value, irExpression(spine[i]->right));
+  free(spine);
+  return value;
+}
+
+IrInstr* irLoad(AstNode *ref) {
+  int variable;
+
+  if (ref->decl->kind == N_CONST)
+    return emit0(IR_CONST, ref->decl->value);
+  variable = variableOf(ref);
+  if (variable >= 0)
+    return current[variable];
+  return emit1(IR_LOAD, 0, irAddress(ref));
+}
+
+IrInstr* irExpression(AstNode *expr) {
+  IrInstr *value;
+
+  switch (expr->kind) {
+  case N_NUMBER:
+  case N_CHARCONST:
+    return emit0(IR_CONST, expr->value);
+  case N_VARIABLE:
+    return irLoad(expr);
+  case N_FUNCALL:
+    return irCall(expr);
+  case N_UNARY:
+    value = irExpression(expr->left);
+    return (expr->op == SB_MINUS) ? emit1(IR_NEG, 0, value) : value;
+  case N_BINARY:
+    return irBinary(expr);
+  default:
+    return emit0(IR_CONST, 0);
+  }
+}
+
+void irAssign(AstNode *target, IrInstr *address, IrInstr *value) {
+  int variable = variableOf(target);
+  if (variable >= 0)
+    setVariable(variable, emit1(IR_COPY, 0, value));
+  else emit2(IR_STORE, 0, address, value);
+}
+
+// Marks the SSA variables a statement may assign
+void collectAssigned(AstNode *statement, int *variables, int *count) {
+  AstNode *st;
+  int variable = -1;
+
+  if (statement == NULL)
+    return;
+  switch (statement->kind) {
+  case N_ASSIGN:
+    variable = variableOf(statement->left);
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      collectAssigned(st, variables, count);
+    break;
+  case N_IF:
+    collectAssigned(statement->body, variables, count);
+    collectAssigned(statement->right, variables, count);
+    break;
+  case N_WHILE:
+    collectAssigned(statement->body, variables, count);
+    break;
+  case N_FOR:
+    variable = variableOf(statement->left);
+    collectAssigned(statement->body, variables, count);
+    break;
+  default:
+    break;
+  }
+  if ((variable >= 0) && (stamps[variable] != stamp)) {
+    stamps[variable] = stamp;
+    variables[(*count)++] = variable;
+  }
+}
+
+void irIf(AstNode *statement) {
+  IrBlock *thenBlock, *elseBlock, *join;
+  IrInstr *condition = irExpression(statement->left->left);
+  IrInstr **thenValues, **elseValues, *a, *b, *phi;
+  int *thenVariables, *elseVariables;
+  int thenCount, elseCount, mark = trailSize, i, v;
+
+  condition = emit2(irCompareOp(statement->left->op), 0, condition, irExpression(statement->left->right));
+  thenBlock = newBlock(fn);
+  elseBlock = newBlock(fn);
+  emit1(IR_BRANCH, 0, condition);
+  addEdge(cur, thenBlock);
+  addEdge(cur, elseBlock);
+
+  cur = thenBlock;
+  irStatement(statement->body);
+  thenBlock = cur;
+  thenCount = changedSince(mark, &thenVariables, &thenValues);
+  undoTrail(mark);
+
+  cur = elseBlock;
+  irStatement(statement->right);
+  elseBlock = cur;
+  elseCount = changedSince(mark, &elseVariables, &elseValues);
+  undoTrail(mark);
+
+  join = newBlock(fn);
+  cur = thenBlock;
+  jumpTo(join);
+  cur = elseBlock;
+  jumpTo(join);
+  cur = join;
+
+  // a phi for each variable either branch assigned; stamps index the else values
+  stamp ++;
+  for (i = 0; i < elseCount; i++)
+    stamps[elseVariables[i]] = -2 - i;
+  for (i = 0; i < thenCount; i++) {
+    v = thenVariables[i];
+    a = thenValues[i];
+    b = (stamps[v] <= -2) ? elseValues[-2 - stamps[v]] : current[v];
+    stamps[v] = stamp;
+    if (a == b)
+      setVariable(v, a);
+    else {
+      phi = newInstr(fn, IR_PHI, 0);
+      addArg(phi, a);
+      addArg(phi, b);
+      appendInstr(join, phi);
+      setVariable(v, phi);
+    }
+  }
+  for (i = 0; i < elseCount; i++) {
+    v = elseVariables[i];
+    if (stamps[v] == stamp)
+      continue;
+    stamps[v] = stamp;
+    phi = newInstr(fn, IR_PHI, 0);
+    addArg(phi, current[v]);
+    addArg(phi, elseValues[i]);
+    appendInstr(join, phi);
+    setVariable(v, phi);
+  }
+  free(thenVariables);
+  free(thenValues);
+  free(elseVariables);
+  free(elseValues);
+}
+
+// Opens a loop: a header with a phi for every variable the body assigns.
+// Returns how many there are; the phis are the current values.
+int openLoop(AstNode *body, AstNode *forVariable, IrBlock **header, int **variables, IrInstr ***phis) {
+  int count = 0, i, v = -1;
+
+  *variables = (int*)malloc((variableCount + 1) * sizeof(int));
+  stamp ++;
+  if (forVariable != NULL)
+    v = variableOf(forVariable);
+  if (v >= 0) {
+    stamps[v] = stamp;
+    (*variables)[count++] = v;
+  }
+  collectAssigned(body, *variables, &count);
+
+  *header = newBlock(fn);
+  jumpTo(*header);
+  cur = *header;
+  *phis = (IrInstr**)malloc((count + 1) * sizeof(IrInstr*));
+  for (i = 0; i < count; i++) {
+    (*phis)[i] = newInstr(fn, IR_PHI, 0);
+    addArg((*phis)[i], current[(*variables)[i]]);
+    appendInstr(*header, (*phis)[i]);
+    setVariable((*variables)[i], (*phis)[i]);
+  }
+  return count;
+}
+
+// Closes a loop from the end of its body back to the header
+void closeLoop(IrBlock *header, int count, int *variables, IrInstr **phis, int mark) {
+  int i;
+
+  jumpTo(header);
+  for (i = 0; i < count; i++)
+    addArg(phis[i], current[variables[i]]);
+  // after the loop the variables hold what the header gave them
+  undoTrail(mark);
+  free(variables);
+  free(phis);
+}
+
+void irWhile(AstNode *statement) {
+  IrBlock *header, *body, *exit;
+  IrInstr **phis, *condition;
+  int *variables;
+  int count, mark;
+
+  count = openLoop(statement->body, NULL, &header, &variables, &phis);
+  mark = trailSize;
+  condition = irExpression(statement->left->left);
+  condition = emit2(irCompareOp(statement->left->op), 0, condition, irExpression(statement->left->right));
+  body = newBlock(fn);
+  exit = newBlock(fn);
+  emit1(IR_BRANCH, 0, condition);
+  addEdge(cur, body);
+  addEdge(cur, exit);
+  cur = body;
+  irStatement(statement->body);
+  closeLoop(header, count, variables, phis, mark);
+  cur = exit;
+}
+
+void irFor(AstNode *statement) {
+  AstNode *var = statement->left;
+  IrBlock *header, *body, *exit;
+  IrInstr **phis, *address = NULL, *final, *condition;
+  int *variables;
+  int count, mark, variable = variableOf(var);
+
+  if (variable < 0)
+    address = irAddress(var);
+  irAssign(var, address, irExpression(statement->right));
+  // the final value is computed once
+  final = irExpression(statement->list);
+
+  count = openLoop(statement->body, var, &header, &variables, &phis);
+  mark = trailSize;
+  condition = emit2(IR_LE, 0, irLoad(var), final);
+  body = newBlock(fn);
+  exit = newBlock(fn);
+  emit1(IR_BRANCH, 0, condition);
+  addEdge(cur, body);
+  addEdge(cur, exit);
+  cur = body;
+  irStatement(statement->body);
+  if (variable >= 0)
+    setVariable(variable, emit2(IR_ADD, 0, current[variable], emit0(IR_CONST, 1)));
+  else {
+    address = irAddress(var);
+    emit2(IR_STORE, 0, address, emit2(IR_ADD, 0, emit1(IR_LOAD, 0, address), emit0(IR_CONST, 1)));
+  }
+  closeLoop(header, count, variables, phis, mark);
+  cur = exit;
+}
+
+void irStatement(AstNode *statement) {
+  AstNode *st;
+  IrInstr *address = NULL;
+
+  if (statement == NULL)
+    return;
+  if (statement->kind != N_GROUP) {
+    irLineNo = statement->lineNo;
+    irColNo = statement->colNo;
+  }
+
+  switch (statement->kind) {
+  case N_ASSIGN:
+    if (variableOf(statement->left) < 0)
+      address = irAddress(statement->left);
+    irAssign(statement->left, address, irExpression(statement->right));
+    break;
+  case N_CALL:
+    irCall(statement);
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      irStatement(st);
+    break;
+  case N_IF:
+    irIf(statement);
+    break;
+  case N_WHILE:
+    irWhile(statement);
+    break;
+  case N_FOR:
+    irFor(statement);
+    break;
+  default:
+    break;
+  }
+}
+
+/******************************************************************/
+// Which scalars can be SSA values
+
+void markEscapes(AstNode *node, int depth);
+
+void markReference(AstNode *ref, int depth) {
+  AstNode *decl = ref->decl;
+  AstNode *index;
+
+  if ((decl != NULL) && ((decl->kind == N_VAR) || (decl->kind == N_PARAM)) && (decl->level != depth))
+    decl->variable = -1;
+  for (index = ref->list; index != NULL; index = index->next)
+    markEscapes(index, depth);
+}
+
+void markArguments(AstNode *call, int depth) {
+  AstNode *arg, *param = call->decl->list;
+
+  for (arg = call->list; arg != NULL; arg = arg->next) {
+    // a variable passed by reference is written through its address
+    if ((param != NULL) && param->isVarParam && (arg->kind == N_VARIABLE) && (arg->decl->kind != N_FUNCTION))
+      arg->decl->variable = -1;
+    markEscapes(arg, depth);
+    if (param != NULL)
+      param = param->next;
+  }
+}
+
+void markEscapes(AstNode *node, int depth) {
+  AstNode **spine;
+  AstNode *st;
+  int count, i;
+
+  if (node == NULL)
+    return;
+  switch (node->kind) {
+  case N_ASSIGN:
+    markReference(node->left, depth);
+    markEscapes(node->right, depth);
+    break;
+  case N_CALL:
+  case N_FUNCALL:
+    markArguments(node, depth);
+    break;
+  case N_GROUP:
+    for (st = node->list; st != NULL; st = st->next)
+      markEscapes(st, depth);
+    break;
+  case N_IF:
+    markEscapes(node->left, depth);
+    markEscapes(node->body, depth);
+    markEscapes(node->right, depth);
+    break;
+  case N_WHILE:
+    markEscapes(node->left, depth);
+    markEscapes(node->body, depth);
+    break;
+  case N_FOR:
+    markReference(node->left, depth);
+    markEscapes(node->right, depth);
+    markEscapes(node->list, depth);
+    markEscapes(node->body, depth);
+    break;
+  case N_VARIABLE:
+    markReference(node, depth);
+    break;
+  case N_UNARY:
+    markEscapes(node->left, depth);
+    break;
+  case N_BINARY:
+    count = binarySpine(node, &spine);
+    for (i = count - 1; i >= 0; i--)
+      markEscapes(spine[i]->right, depth);
+    markEscapes(spine[0]->left, depth);
+    free(spine);
+    break;
+  case N_COMPARE:
+    markEscapes(node->left, depth);
+    markEscapes(node->right, depth);
+    break;
+  default:
+    break;
+  }
+}
+
+// Numbers the bodies as the bytecode does and lays out their frames
+void prepareBody(AstNode *owner, AstNode *block, int depth) {
+  OwnedFunction *owned = (OwnedFunction*)calloc(1, sizeof(OwnedFunction));
+  IrFunction *function = &owned->function;
+  AstNode *decl;
+
+  function->name = owner->name;
+  function->index = irProgram->count;
+  function->depth = depth;
+  function->isFunction = (owner->kind == N_FUNCTION);
+  function->paramCount = (owner->kind != N_PROGRAM) ? listLength(owner->list) : 0;
+  function->frameSize = layoutFrame(owner, block, depth);
+  if (irProgram->count == irProgram->capacity) {
+    irProgram->capacity = irProgram->capacity ? irProgram->capacity * 2 : 16;
+    irProgram->functions = (IrFunction**)realloc(irProgram->functions, irProgram->capacity * sizeof(IrFunction*));
+  }
+  irProgram->functions[irProgram->count++] = function;
+
+  if (owner->kind != N_PROGRAM)
+    for (decl = owner->list; decl != NULL; decl = decl->next)
+      decl->variable = 0;
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if (decl->kind == N_VAR)
+      decl->variable = 0;
+    else if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE)) {
+      decl->level = depth + 1;
+      decl->offset = irProgram->count;
+      prepareBody(decl, decl->body, depth + 1);
+    }
+}
+
+void escapeBody(AstNode *block, int depth) {
+  AstNode *decl;
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      escapeBody(decl->body, depth + 1);
+  markEscapes(block->body, depth);
+}
+
+int isScalar(Type *type) {
+  return (type != NULL) && (type->typeClass != TP_ARRAY);
+}
+
+void buildBody(AstNode *owner, AstNode *block, int index) {
+  AstNode *decl;
+  IrInstr *zero;
+  int i;
+
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      buildBody(decl, decl->body, decl->offset);
+
+  fn = irProgram->functions[index];
+  irOwner = owner;
+  irLineNo = owner->lineNo;
+  irColNo = owner->colNo;
+
+  // variable 0 is the result of a function
+  variableCount = 1;
+  if (owner->kind != N_PROGRAM)
+    for (decl = owner->list; decl != NULL; decl = decl->next)
+      decl->variable = (decl->isVarParam || ((decl->variable == 0) && isScalar(decl->type))) ? variableCount++ : -1;
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if (decl->kind == N_VAR)
+      decl->variable = ((decl->variable == 0) && isScalar(decl->type)) ? variableCount++ : -1;
+
+  current = (IrInstr**)malloc(variableCount * sizeof(IrInstr*));
+  stamps = (int*)calloc(variableCount, sizeof(int));
+  stamp = 0;
+  trailSize = 0;
+
+  // locals start at 0; parameters and the addresses VAR parameters hold are
+  // read from the frame once
+  cur = newBlock(fn);
+  zero = emit0(IR_CONST, 0);
+  for (i = 0; i < variableCount; i++)
+    current[i] = zero;
+  if (owner->kind != N_PROGRAM)
+    for (decl = owner->list; decl != NULL; decl = decl->next)
+      if (decl->variable >= 0)
+        current[decl->variable] = emit1(IR_LOAD, 0, frameCell(decl));
+
+  irStatement(block->body);
+  irLineNo = owner->lineNo;
+  irColNo = owner->colNo;
+  if (owner->kind == N_FUNCTION)
+    emit1(IR_RETURN, 0, current[0]);
+  else emit0(IR_RETURN, 0);
+
+  free(current);
+  free(stamps);
+  free(trail);
+  current = NULL;
+  stamps = NULL;
+  trail = NULL;
+  trailCapacity = 0;
+}
+
+IrProgram* buildIr(AstNode *program) {
+  irProgram = (IrProgram*)calloc(1, sizeof(IrProgram));
+  irProgram->calls = buildCallGraph(program);
+  program->level = 0;
+  program->offset = 0;
+  prepareBody(program, program->body, 0);
+  escapeBody(program->body, 0);
+  buildBody(program, program->body, 0);
+  return irProgram;
+}
+
+void freeIr(IrProgram *program) {
+  OwnedFunction *owned;
+  InstrChunk *instrs;
+  BlockChunk *blocks;
+  int i, j;
+
+  if (program == NULL)
+    return;
+  for (i = 0; i < program->count; i++) {
+    owned = (OwnedFunction*)program->functions[i];
+    while ((instrs = owned->instrs) != NULL) {
+      for (j = 0; j < instrs->used; j++)
+        if (instrs->items[j].args != instrs->items[j].inlineArgs)
+          free(instrs->items[j].args);
+      owned->instrs = instrs->previous;
+      free(instrs);
+    }
+    while ((blocks = owned->blocks) != NULL) {
+      for (j = 0; j < blocks->used; j++)
+        free(blocks->items[j].preds);
+      owned->blocks = blocks->previous;
+      free(blocks);
+    }
+    free(owned->function.order);
+    free(owned);
+  }
+  free(program->functions);
+  freeCallGraph(program->calls);
+  free(program);
+}
+
+/******************************************************************/
+// Dominators, after Cooper, Harvey and Kennedy
+
+IrBlock* intersect(IrBlock *a, IrBlock *b) {
+  while (a != b) {
+    while (a->order > b->order)
+      a = a->idom;
+    while (b->order > a->order)
+      b = b->idom;
+  }
+  return a;
+}
+
+void irDominators(IrFunction *function) {
+  IrBlock **stack, **postorder, *block, *succ, *idom;
+  int *nextSucc;
+  int top = 0, count = 0, changed, i, j;
+
+  for (block = function->entry; block != NULL; block = block->next) {
+    block->order = -1;
+    block->idom = NULL;
+    block->mark = 0;
+  }
+
+  // postorder with an explicit stack, so deep nesting cannot overflow
+  stack = (IrBlock**)malloc(function->blockCount * sizeof(IrBlock*));
+  nextSucc = (int*)calloc(function->blockCount, sizeof(int));
+  postorder = (IrBlock**)malloc(function->blockCount * sizeof(IrBlock*));
+  stack[top++] = function->entry;
+  function->entry->mark = 1;
+  while (top > 0) {
+    block = stack[top - 1];
+    if (nextSucc[block->id] < block->succCount) {
+      succ = block->succs[nextSucc[block->id]++];
+      if (!succ->mark) {
+        succ->mark = 1;
+        stack[top++] = succ;
+      }
+    } else {
+      postorder[count++] = block;
+      top --;
+    }
+  }
+
+  free(function->order);
+  function->order = (IrBlock**)malloc(count * sizeof(IrBlock*));
+  function->orderCount = count;
+  for (i = 0; i < count; i++) {
+    function->order[i] = postorder[count - 1 - i];
+    function->order[i]->order = i;
+  }
+
+  function->entry->idom = function->entry;
+  do {
+    changed = 0;
+    for (i = 1; i < count; i++) {
+      block = function->order[i];
+      idom = NULL;
+      for (j = 0; j < block->predCount; j++)
+        if (block->preds[j]->idom != NULL)
+          idom = (idom == NULL) ? block->preds[j] : intersect(block->preds[j], idom);
+      if (block->idom != idom) {
+        block->idom = idom;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  free(stack);
+  free(nextSucc);
+  free(postorder);
+}
+
+int dominates(IrBlock *a, IrBlock *b) {
+  while (b->order > a->order)
+    b = b->idom;
+  return a == b;
+}
+
+/******************************************************************/
+
+void dumpInstr(IrInstr *instr, FILE *f) {
+  int i;
+
+  if ((instr->op < IR_CHECK) || (instr->op == IR_LOAD) || (instr->op == IR_CALL) ||
+      (instr->op == IR_READC) || (instr->op == IR_READI))
+    fprintf(f, "  v%d = %s", instr->id, irOpNames[instr->op]);
+  else fprintf(f, "  %s", irOpNames[instr->op]);
+
+  switch (instr->op) {
+  case IR_CONST:
+    fprintf(f, " %d", instr->value);
+    break;
+  case IR_FRAME:
+    fprintf(f, " %d, %d", instr->hops, instr->value);
+    break;
+  case IR_PHI:
+    for (i = 0; i < instr->argCount; i++)
+      fprintf(f, "%s[v%d, b%d]", i ? ", " : " ", instr->args[i]->id, instr->block->preds[i]->id);
+    break;
+  case IR_CALL:
+    fprintf(f, " %d (hops %d)", instr->value, instr->hops);
+    for (i = 0; i < instr->argCount; i++)
+      fprintf(f, "%sv%d", i ? ", " : " ", instr->args[i]->id);
+    break;
+  case IR_JUMP:
+    fprintf(f, " b%d", instr->block->succs[0]->id);
+    break;
+  case IR_BRANCH:
+    fprintf(f, " v%d, b%d, b%d", instr->args[0]->id, instr->block->succs[0]->id, instr->block->succs[1]->id);
+    break;
+  case IR_CHECK:
+    fprintf(f, " v%d, %d", instr->args[0]->id, instr->value);
+    break;
+  default:
+    for (i = 0; i < instr->argCount; i++)
+      fprintf(f, "%sv%d", i ? ", " : " ", instr->args[i]->id);
+    break;
+  }
+  fprintf(f, "\n");
+}
+
+void dumpIr(IrProgram *program, FILE *f) {
+  IrFunction *function;
+  IrBlock *block;
+  IrInstr *instr;
+  int i, j;
+
+  for (i = 0; i < program->count; i++) {
+    function = program->functions[i];
+    fprintf(f, "%s %d %s: depth %d, %d parameters, frame %d\n", function->isFunction ? "function" : "procedure",
+            function->index, function->name, function->depth, function->paramCount, function->frameSize);
+    for (block = function->entry; block != NULL; block = block->next) {
+      fprintf(f, "b%d:", block->id);
+      if (block->predCount > 0) {
+        fprintf(f, "  ; from");
+        for (j = 0; j < block->predCount; j++)
+          fprintf(f, " b%d", block->preds[j]->id);
+      }
+      fprintf(f, "\n");
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        dumpInstr(instr, f);
+    }
+    fprintf(f, "\n");
+  }
+}
@@ -0,0 +1,127 @@
+/* SSA intermediate representation
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include <stdio.h>
+#include "ast.h"
+#include "callgraph.h"
+
+// Every body becomes a function: a graph of basic blocks whose instructions
+// are the values they compute. Scalars that never leave their body are SSA
+// values; everything else lives in the frame cells the bytecode uses and is
+// reached through addresses.
+typedef enum {
+  IR_CONST,       // value
+  IR_FRAME,       // address of cell value in the frame hops static links up
+  IR_COPY,        // a
+  IR_PHI,         // one argument per predecessor, in the same order
+  IR_ADD,
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_NEG,
+  IR_EQ,          // comparisons give 1 or 0
+  IR_NE,
+  IR_LT,
+  IR_LE,
+  IR_GT,
+  IR_GE,
+  IR_CHECK,       // a: stop unless 1 <= a <= value
+  IR_LOAD,        // a: address
+  IR_STORE,       // a: address; b: value
+  IR_CALL,        // value: function number; hops; arguments; gives a function's result
+  IR_READC,
+  IR_READI,
+  IR_WRITEC,      // a
+  IR_WRITEI,      // a
+  IR_WRITELN,
+  // terminators
+  IR_JUMP,        // to succs[0]
+  IR_BRANCH,      // a: to succs[0] when it is not 0, else to succs[1]
+  IR_RETURN,      // a: the result of a function
+  IR_OP_COUNT
+} IrOp;
+
+struct IrBlock;
+
+typedef struct IrInstr {
+  IrOp op;
+  int id;
+  int value, hops;
+  struct IrInstr **args;
+  int argCount, argCapacity;
+  struct IrInstr *inlineArgs[2];
+  struct IrBlock *block;
+  struct IrInstr *prev, *next;
+  struct IrInstr *replacement; // once removed, where its uses go
+  int lineNo, colNo;           // of the statement, for run time errors
+  int mark;                    // scratch for the passes
+} IrInstr;
+
+typedef struct IrBlock {
+  int id;
+  IrInstr *first, *last;       // phis first, a terminator last
+  struct IrBlock **preds;
+  int predCount, predCapacity;
+  struct IrBlock *succs[2];
+  int succCount;
+  struct IrBlock *idom;        // set by irDominators()
+  int order;                   // reverse postorder number, -1 if unreachable
+  struct IrBlock *next;        // in the function
+  int mark;
+} IrBlock;
+
+typedef struct IrFunction {
+  char *name;
+  int index;                   // numbered as the bytecode numbers procedures
+  int depth;                   // of the body; the main program is 0
+  int isFunction;
+  int paramCount;
+  int frameSize;               // cells, header included
+  IrBlock *entry, *lastBlock;
+  int blockCount, valueCount;
+  IrBlock **order;             // reachable blocks in reverse postorder
+  int orderCount;
+} IrFunction;
+
+typedef struct {
+  IrFunction **functions;      // 0 is the main program
+  int count, capacity;
+  CallGraph *calls;            // of the source, numbered alike
+} IrProgram;
+
+extern const char *irOpNames[IR_OP_COUNT];
+
+// Builds the IR of a program that passed the semantic analysis
+IrProgram* buildIr(AstNode *program);
+void freeIr(IrProgram *program);
+
+IrInstr* newInstr(IrFunction *fn, IrOp op, int value);
+IrBlock* newBlock(IrFunction *fn);
+void addArg(IrInstr *instr, IrInstr *arg);
+void addEdge(IrBlock *from, IrBlock *to);
+void insertBefore(IrInstr *instr, IrInstr *at);
+void appendInstr(IrBlock *block, IrInstr *instr);
+void removeInstr(IrInstr *instr);
+// Follows the replacements of removed instructions
+IrInstr* resolveInstr(IrInstr *instr);
+// Points every argument at a live instruction
+void resolveArgs(IrFunction *fn);
+int isPure(IrOp op);
+int isTerminator(IrOp op);
+int instructionCount(IrProgram *program);
+// The index checks left
+int checkCount(IrProgram *program);
+
+// Orders the blocks and finds their immediate dominators
+void irDominators(IrFunction *fn);
+int dominates(IrBlock *a, IrBlock *b);
+
+void dumpIr(IrProgram *program, FILE *f);
+
+#endif
@@ -0,0 +1,394 @@
+/* IR interpreter
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "charcode.h"
+#include "error.h"
+#include "code.h"
+#include "vm.h"
+#include "irexec.h"
+
+// A register copy on a control flow edge, where phis are resolved
+#define IR_MOVE IR_OP_COUNT
+
+// Cells of a register window ahead of the registers: the caller's function,
+// its window, where it goes on and the register the result goes to
+#define WINDOW_HEADER 4
+
+extern __thread FILE *outputStream;
+
+// The functions are laid out one after the other; registers are numbered
+// by the ids of the instructions computing them
+typedef struct {
+  int op;
+  int dst, a, b;
+  int value, hops;
+  int target, other;           // where a jump or a branch goes
+  int *args, argCount;
+  int lineNo, colNo;
+} LinearInstr;
+
+typedef struct {
+  int entry;
+  int frameSize;               // memory cells
+  int windowSize;              // registers
+} LinearFunction;
+
+// Jumps to blocks are patched once every block has its place
+typedef struct {
+  int at;
+  int isOther;
+  IrBlock *block;
+} Fixup;
+
+// A branch edge whose phi moves need a block of their own
+typedef struct {
+  int at;
+  int isOther;
+  IrBlock *from, *to;
+} Trampoline;
+
+LinearInstr *linear;
+int linearSize, linearCapacity;
+Fixup *fixups;
+int fixupCount, fixupCapacity;
+int *blockStarts;
+
+int *irCells, *irRegisters;
+
+/******************************************************************/
+
+LinearInstr* emitLinear(int op) {
+  LinearInstr *instr;
+  if (linearSize == linearCapacity) {
+    linearCapacity = linearCapacity ? linearCapacity * 2 : 1024;
+    linear = (LinearInstr*)realloc(linear, linearCapacity * sizeof(LinearInstr));
+  }
+  instr = &linear[linearSize++];
+  memset(instr, 0, sizeof(LinearInstr));
+  instr->op = op;
+  return instr;
+}
+
+void jumpFixup(int at, int isOther, IrBlock *block) {
+  if (fixupCount == fixupCapacity) {
+    fixupCapacity = fixupCapacity ? fixupCapacity * 2 : 256;
+    fixups = (Fixup*)realloc(fixups, fixupCapacity * sizeof(Fixup));
+  }
+  fixups[fixupCount].at = at;
+  fixups[fixupCount].isOther = isOther;
+  fixups[fixupCount].block = block;
+  fixupCount ++;
+}
+
+void emitMove(int dst, int src) {
+  LinearInstr *instr = emitLinear(IR_MOVE);
+  instr->dst = dst;
+  instr->a = src;
+}
+
+// Gives the phis of to their values along the edge from; they all change at
+// once, so when one of them feeds another the values go through scratch
+// registers first. Returns how many moves it made.
+int edgeMoves(IrBlock *from, IrBlock *to, int scratch) {
+  IrInstr *phi, *other;
+  int index, conflict = 0, count = 0, k;
+
+  for (index = 0; to->preds[index] != from; index++)
+    ;
+  for (phi = to->first; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next)
+    for (other = to->first; (other != NULL) && (other->op == IR_PHI); other = other->next)
+      if ((other != phi) && (phi->args[index] == other))
+        conflict = 1;
+
+  for (phi = to->first, k = 0; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next, k++) {
+    if (phi->args[index] == phi)
+      continue;
+    emitMove(conflict ? scratch + k : phi->id, phi->args[index]->id);
+    count ++;
+  }
+  if (conflict)
+    for (phi = to->first, k = 0; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next, k++)
+      if (phi->args[index] != phi)
+        emitMove(phi->id, scratch + k);
+  return count;
+}
+
+int phiCount(IrBlock *block) {
+  IrInstr *phi;
+  int count = 0;
+  for (phi = block->first; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next)
+    count ++;
+  return count;
+}
+
+void linearizeFunction(IrFunction *fn, LinearFunction *out) {
+  IrBlock *block, *succ;
+  IrInstr *instr;
+  LinearInstr *li;
+  Trampoline *trampolines;
+  int scratch = fn->valueCount, maxPhis = 0, trampolineCount = 0, i, j, k;
+
+  irDominators(fn);
+  for (block = fn->entry; block != NULL; block = block->next)
+    if (phiCount(block) > maxPhis)
+      maxPhis = phiCount(block);
+  out->entry = linearSize;
+  out->frameSize = fn->frameSize;
+  out->windowSize = fn->valueCount + maxPhis;
+
+  // branch edges that need moves go through a trampoline after the blocks
+  trampolines = (Trampoline*)malloc(2 * fn->blockCount * sizeof(Trampoline));
+  for (i = 0; i < fn->orderCount; i++) {
+    block = fn->order[i];
+    blockStarts[block->id] = linearSize;
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      if (instr->op == IR_PHI)
+        continue;
+      if (instr->op == IR_JUMP) {
+        succ = block->succs[0];
+        edgeMoves(block, succ, scratch);
+        if ((i + 1 == fn->orderCount) || (fn->order[i + 1] != succ)) {
+          emitLinear(IR_JUMP);
+          jumpFixup(linearSize - 1, 0, succ);
+        }
+        continue;
+      }
+      li = emitLinear(instr->op);
+      li->dst = instr->id;
+      li->value = instr->value;
+      li->hops = instr->hops;
+      li->lineNo = instr->lineNo;
+      li->colNo = instr->colNo;
+      if (instr->argCount > 0)
+        li->a = instr->args[0]->id;
+      if (instr->argCount > 1)
+        li->b = instr->args[1]->id;
+      if (instr->op == IR_CALL) {
+        li->argCount = instr->argCount;
+        li->args = (int*)malloc((instr->argCount + 1) * sizeof(int));
+        for (k = 0; k < instr->argCount; k++)
+          li->args[k] = instr->args[k]->id;
+      } else if (instr->op == IR_BRANCH)
+        for (k = 0; k < 2; k++) {
+          succ = block->succs[k];
+          if (phiCount(succ) > 0) {
+            trampolines[trampolineCount].at = linearSize - 1;
+            trampolines[trampolineCount].isOther = k;
+            trampolines[trampolineCount].from = block;
+            trampolines[trampolineCount].to = succ;
+            trampolineCount ++;
+          } else jumpFixup(linearSize - 1, k, succ);
+        }
+    }
+  }
+
+  for (i = 0; i < trampolineCount; i++) {
+    li = &linear[trampolines[i].at];
+    if (trampolines[i].isOther)
+      li->other = linearSize;
+    else li->target = linearSize;
+    edgeMoves(trampolines[i].from, trampolines[i].to, scratch);
+    emitLinear(IR_JUMP);
+    jumpFixup(linearSize - 1, 0, trampolines[i].to);
+  }
+  free(trampolines);
+
+  for (j = 0; j < fixupCount; j++) {
+    if (fixups[j].isOther)
+      linear[fixups[j].at].other = blockStarts[fixups[j].block->id];
+    else linear[fixups[j].at].target = blockStarts[fixups[j].block->id];
+  }
+  fixupCount = 0;
+}
+
+/******************************************************************/
+
+int irError(ErrorCode err, LinearInstr *instr) {
+  noteError(err, instr->lineNo, instr->colNo);
+  return RUN_ERROR;
+}
+
+int execute(LinearFunction *functions, long long *instructions) {
+  LinearInstr *pc = linear + functions[0].entry;
+  LinearFunction *current = &functions[0];
+  int *s = irCells, *r, *caller;
+  int bp = 0, base, top, i, result = IO_SUCCESS;
+  long long count = 0;
+
+#define WRAP(v) ((int)(unsigned)(v))
+
+  // the main program's frame; its window has no caller
+  memset(s, 0, current->frameSize * sizeof(int));
+  r = irRegisters + WINDOW_HEADER;
+  r[-4] = -1;
+
+  for (;;) {
+    count ++;
+    switch (pc->op) {
+    case IR_CONST:
+      r[pc->dst] = pc->value;
+      break;
+    case IR_FRAME:
+      for (base = bp, i = pc->hops; i > 0; i--)
+        base = s[base + FRAME_STATIC_LINK];
+      r[pc->dst] = base + pc->value;
+      break;
+    case IR_MOVE:
+    case IR_COPY:
+      r[pc->dst] = r[pc->a];
+      break;
+    case IR_ADD:
+      r[pc->dst] = WRAP((unsigned)r[pc->a] + (unsigned)r[pc->b]);
+      break;
+    case IR_SUB:
+      r[pc->dst] = WRAP((unsigned)r[pc->a] - (unsigned)r[pc->b]);
+      break;
+    case IR_MUL:
+      r[pc->dst] = WRAP((unsigned)r[pc->a] * (unsigned)r[pc->b]);
+      break;
+    case IR_DIV:
+      if (r[pc->b] == 0) {
+        result = irError(ERR_DIVISIONBYZERO, pc);
+        goto done;
+      }
+      r[pc->dst] = (r[pc->b] == -1) ? WRAP(0u - (unsigned)r[pc->a]) : r[pc->a] / r[pc->b];
+      break;
+    case IR_NEG:
+      r[pc->dst] = WRAP(0u - (unsigned)r[pc->a]);
+      break;
+    case IR_EQ: r[pc->dst] = r[pc->a] == r[pc->b]; break;
+    case IR_NE: r[pc->dst] = r[pc->a] != r[pc->b]; break;
+    case IR_LT: r[pc->dst] = r[pc->a] < r[pc->b]; break;
+    case IR_LE: r[pc->dst] = r[pc->a] <= r[pc->b]; break;
+    case IR_GT: r[pc->dst] = r[pc->a] > r[pc->b]; break;
+    case IR_GE: r[pc->dst] = r[pc->a] >= r[pc->b]; break;
+    case IR_CHECK:
+      if ((r[pc->a] < 1) || (r[pc->a] > pc->value)) {
+        result = irError(ERR_INDEXOUTOFRANGE, pc);
+        goto done;
+      }
+      break;
+    case IR_LOAD:
+      r[pc->dst] = s[r[pc->a]];
+      break;
+    case IR_STORE:
+      s[r[pc->a]] = r[pc->b];
+      break;
+    case IR_CALL:
+      // the callee's frame and window go right after the caller's
+      for (base = bp, i = pc->hops; i > 0; i--)
+        base = s[base + FRAME_STATIC_LINK];
+      top = bp + current->frameSize;
+      caller = r;
+      r = caller + current->windowSize + WINDOW_HEADER;
+      if (((long long)top + functions[pc->value].frameSize >= STACK_SIZE) ||
+          ((r - irRegisters) + (long long)functions[pc->value].windowSize >= STACK_SIZE)) {
+        result = irError(ERR_STACKOVERFLOW, pc);
+        goto done;
+      }
+      memset(s + top, 0, functions[pc->value].frameSize * sizeof(int));
+      s[top + FRAME_DYNAMIC_LINK] = bp;
+      s[top + FRAME_STATIC_LINK] = base;
+      for (i = 0; i < pc->argCount; i++)
+        s[top + FRAME_HEADER + i] = caller[pc->args[i]];
+      r[-4] = current - functions;
+      r[-3] = (int)(caller - irRegisters);
+      r[-2] = (int)(pc + 1 - linear);
+      r[-1] = pc->dst;
+      bp = top;
+      current = &functions[pc->value];
+      pc = linear + current->entry;
+      continue;
+    case IR_READC:
+      r[pc->dst] = readCodePoint(stdin);
+      break;
+    case IR_READI:
+      r[pc->dst] = 0;
+      if (scanf("%d", &i) == 1)
+        r[pc->dst] = i;
+      break;
+    case IR_WRITEC:
+      writeCodePoint(outputStream, r[pc->a]);
+      break;
+    case IR_WRITEI:
+      fprintf(outputStream, "%d", r[pc->a]);
+      break;
+    case IR_WRITELN:
+      fputc('\n', outputStream);
+      break;
+    case IR_JUMP:
+      pc = linear + pc->target;
+      continue;
+    case IR_BRANCH:
+      pc = linear + (r[pc->a] ? pc->target : pc->other);
+      continue;
+    case IR_RETURN:
+      if (r[-4] < 0)
+        goto done;
+      i = r[pc->a];
+      current = &functions[r[-4]];
+      pc = linear + r[-2];
+      top = r[-1];
+      r = irRegisters + r[-3];
+      r[top] = i;
+      bp = s[bp + FRAME_DYNAMIC_LINK];
+      continue;
+    default:
+      break;
+    }
+    pc ++;
+  }
+
+ done:
+#undef WRAP
+  if (instructions != NULL)
+    *instructions = count;
+  return result;
+}
+
+int runIr(IrProgram *program, long long *instructions) {
+  LinearFunction *functions;
+  int maxBlocks = 0, result, i;
+
+  if (outputStream == NULL)
+    outputStream = stdout;
+  if (irCells == NULL) {
+    irCells = (int*)malloc(STACK_SIZE * sizeof(int));
+    irRegisters = (int*)malloc(STACK_SIZE * sizeof(int));
+    if ((irCells == NULL) || (irRegisters == NULL)) {
+      noteError(ERR_STACKOVERFLOW, 0, 0);
+      return RUN_ERROR;
+    }
+  }
+
+  for (i = 0; i < program->count; i++)
+    if (program->functions[i]->blockCount > maxBlocks)
+      maxBlocks = program->functions[i]->blockCount;
+  blockStarts = (int*)malloc((maxBlocks + 1) * sizeof(int));
+  functions = (LinearFunction*)malloc(program->count * sizeof(LinearFunction));
+  linearSize = 0;
+  for (i = 0; i < program->count; i++)
+    linearizeFunction(program->functions[i], &functions[i]);
+
+  result = execute(functions, instructions);
+  fflush(outputStream);
+
+  for (i = 0; i < linearSize; i++)
+    free(linear[i].args);
+  free(linear);
+  free(fixups);
+  free(blockStarts);
+  free(functions);
+  linear = NULL;
+  fixups = NULL;
+  linearCapacity = fixupCapacity = 0;
+  return result;
+}
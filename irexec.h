@@ -0,0 +1,18 @@
+/* IR interpreter
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IREXEC_H__
+#define __IREXEC_H__
+
+#include "ir.h"
+
+// Runs the IR of a program the way runCode() runs its bytecode: same input,
+// same output, same frames in memory and the same errors, though a stack
+// overflow is reported at the call rather than at the entry. When instructions
+// is not NULL it receives the number of instructions executed.
+int runIr(IrProgram *program, long long *instructions);
+
+#endif
@@ -0,0 +1,1041 @@
+/* SSA optimization passes
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+#include "iropt.h"
+#include "code.h"
+
+#define VALUE_TABLE_SIZE 4096
+
+// A loop found from its back edge; the body blocks carry its mark
+typedef struct {
+  IrBlock *header;
+  IrBlock *latch;
+  IrBlock *preheader;          // NULL when the header has no single outside entry
+  int mark;
+} Loop;
+
+// Values an instruction may take, wider than int while it is computed
+typedef struct {
+  long long lo, hi;
+} Range;
+
+// How far range queries follow arguments and conditions
+#define RANGE_DEPTH 8
+
+// Callees of at most this many instructions are inlined
+#define INLINE_SIZE 40
+
+// Scoped value table of the dominator tree walk
+typedef struct ValueEntry {
+  IrInstr *instr;
+  struct ValueEntry *next;
+} ValueEntry;
+
+IrPass irPasses[] = {
+  { "copy", "copy propagation and trivial phi removal", irCopyPropagation },
+  { "dce", "dead code elimination", irDeadCode },
+  { "gvn", "global value numbering with constant folding", irValueNumbering },
+  { "licm", "loop-invariant code motion", irLoopInvariantMotion },
+  { "sr", "strength reduction of induction variable products", irStrengthReduction },
+  { "bce", "removal of index checks proven in range", irBoundsChecks },
+  { "inline", "inlining of small subroutines, then removal of those never called", NULL, irInline },
+  { NULL, NULL, NULL }
+};
+
+ValueEntry *valueTable[VALUE_TABLE_SIZE];
+int loopMark;
+
+/******************************************************************/
+
+// The next instruction, taken before the current one may be removed
+#define FOR_EACH_INSTR(block, instr, following) \
+  for (instr = (block)->first; (instr != NULL) && ((following = instr->next), 1); instr = following)
+
+void replaceInstr(IrInstr *instr, IrInstr *by) {
+  instr->replacement = by;
+  removeInstr(instr);
+}
+
+void irCopyPropagation(IrFunction *fn) {
+  IrBlock *block;
+  IrInstr *instr, *following, *same, *arg;
+  int changed, trivial, i;
+
+  do {
+    changed = 0;
+    for (block = fn->entry; block != NULL; block = block->next)
+      FOR_EACH_INSTR(block, instr, following) {
+        if (instr->op == IR_COPY) {
+          replaceInstr(instr, resolveInstr(instr->args[0]));
+          changed = 1;
+        } else if (instr->op == IR_PHI) {
+          // a phi of one value, perhaps along with itself, is that value
+          same = NULL;
+          trivial = 1;
+          for (i = 0; i < instr->argCount; i++) {
+            arg = resolveInstr(instr->args[i]);
+            if ((arg == instr) || (arg == same))
+              continue;
+            if (same != NULL) {
+              trivial = 0;
+              break;
+            }
+            same = arg;
+          }
+          if (trivial && (same != NULL)) {
+            replaceInstr(instr, same);
+            changed = 1;
+          }
+        }
+      }
+  } while (changed);
+  resolveArgs(fn);
+}
+
+// Whatever has an effect, may stop the program or ends a block stays
+int isRoot(IrOp op) {
+  return !isPure(op) && (op != IR_PHI) && (op != IR_LOAD);
+}
+
+void irDeadCode(IrFunction *fn) {
+  IrBlock *block;
+  IrInstr *instr, *following, **work;
+  int count = 0, i;
+
+  work = (IrInstr**)malloc(fn->valueCount * sizeof(IrInstr*));
+  for (block = fn->entry; block != NULL; block = block->next)
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      instr->mark = isRoot(instr->op);
+      if (instr->mark)
+        work[count++] = instr;
+    }
+  while (count > 0) {
+    instr = work[--count];
+    for (i = 0; i < instr->argCount; i++)
+      if (!instr->args[i]->mark) {
+        instr->args[i]->mark = 1;
+        work[count++] = instr->args[i];
+      }
+  }
+  for (block = fn->entry; block != NULL; block = block->next)
+    FOR_EACH_INSTR(block, instr, following)
+      if (!instr->mark)
+        removeInstr(instr);
+  free(work);
+}
+
+/******************************************************************/
+// Value numbering
+
+int isCommutative(IrOp op) {
+  return (op == IR_ADD) || (op == IR_MUL) || (op == IR_EQ) || (op == IR_NE);
+}
+
+int isConstant(IrInstr *instr, int value) {
+  return (instr->op == IR_CONST) && (instr->value == value);
+}
+
+void makeConstant(IrInstr *instr, int value) {
+  instr->op = IR_CONST;
+  instr->value = value;
+  instr->argCount = 0;
+}
+
+// Folds constants and applies identities in place; returns the value the
+// instruction is equal to when that is another one, or NULL
+IrInstr* simplify(IrInstr *instr) {
+  IrInstr *a = (instr->argCount > 0) ? instr->args[0] : NULL;
+  IrInstr *b = (instr->argCount > 1) ? instr->args[1] : NULL;
+  unsigned x, y;
+
+  if (instr->op == IR_COPY)
+    return a;
+  if ((a != NULL) && (a->op == IR_CONST) && ((b == NULL) || (b->op == IR_CONST))) {
+    x = (unsigned)a->value;
+    y = (b != NULL) ? (unsigned)b->value : 0;
+    switch (instr->op) {
+    case IR_ADD: makeConstant(instr, (int)(x + y)); return NULL;
+    case IR_SUB: makeConstant(instr, (int)(x - y)); return NULL;
+    case IR_MUL: makeConstant(instr, (int)(x * y)); return NULL;
+    case IR_NEG: makeConstant(instr, (int)(0u - x)); return NULL;
+    case IR_DIV:
+      // a division by zero must still stop the program
+      if (b->value == 0)
+        return NULL;
+      makeConstant(instr, (b->value == -1) ? (int)(0u - x) : a->value / b->value);
+      return NULL;
+    case IR_EQ: makeConstant(instr, a->value == b->value); return NULL;
+    case IR_NE: makeConstant(instr, a->value != b->value); return NULL;
+    case IR_LT: makeConstant(instr, a->value < b->value); return NULL;
+    case IR_LE: makeConstant(instr, a->value <= b->value); return NULL;
+    case IR_GT: makeConstant(instr, a->value > b->value); return NULL;
+    case IR_GE: makeConstant(instr, a->value >= b->value); return NULL;
+    default: return NULL;
+    }
+  }
+
+  switch (instr->op) {
+  case IR_ADD:
+    if (isConstant(b, 0)) return a;
+    if (isConstant(a, 0)) return b;
+    break;
+  case IR_SUB:
+    if (isConstant(b, 0)) return a;
+    if (a == b) makeConstant(instr, 0);
+    break;
+  case IR_MUL:
+    if (isConstant(b, 1)) return a;
+    if (isConstant(a, 1)) return b;
+    if (isConstant(a, 0) || isConstant(b, 0)) makeConstant(instr, 0);
+    break;
+  case IR_DIV:
+    if (isConstant(b, 1)) return a;
+    break;
+  case IR_EQ: case IR_LE: case IR_GE:
+    if (a == b) makeConstant(instr, 1);
+    break;
+  case IR_NE: case IR_LT: case IR_GT:
+    if (a == b) makeConstant(instr, 0);
+    break;
+  default:
+    break;
+  }
+  return NULL;
+}
+
+unsigned valueHash(IrInstr *instr) {
+  unsigned h = instr->op * 31u + (unsigned)instr->value * 17u + (unsigned)instr->hops;
+  int i;
+  for (i = 0; i < instr->argCount; i++)
+    h = h * 31u + (unsigned)instr->args[i]->id;
+  return h % VALUE_TABLE_SIZE;
+}
+
+int sameValue(IrInstr *a, IrInstr *b) {
+  int i;
+  if ((a->op != b->op) || (a->value != b->value) || (a->hops != b->hops) || (a->argCount != b->argCount))
+    return 0;
+  for (i = 0; i < a->argCount; i++)
+    if (a->args[i] != b->args[i])
+      return 0;
+  return 1;
+}
+
+// Numbers the instructions of a block; returns how many entries it added
+int numberBlock(IrBlock *block) {
+  IrInstr *instr, *following, *found, *swap;
+  ValueEntry *entry;
+  unsigned h;
+  int added = 0, i;
+
+  FOR_EACH_INSTR(block, instr, following) {
+    // phi arguments may come along back edges, not numbered yet
+    if (instr->op == IR_PHI)
+      continue;
+    for (i = 0; i < instr->argCount; i++)
+      instr->args[i] = resolveInstr(instr->args[i]);
+    found = simplify(instr);
+    if (found != NULL) {
+      replaceInstr(instr, found);
+      continue;
+    }
+    if (!isPure(instr->op))
+      continue;
+    if (isCommutative(instr->op) && (instr->args[0]->id > instr->args[1]->id)) {
+      swap = instr->args[0];
+      instr->args[0] = instr->args[1];
+      instr->args[1] = swap;
+    }
+    h = valueHash(instr);
+    for (entry = valueTable[h]; entry != NULL; entry = entry->next)
+      if (sameValue(entry->instr, instr))
+        break;
+    if (entry != NULL) {
+      replaceInstr(instr, entry->instr);
+      continue;
+    }
+    entry = (ValueEntry*)malloc(sizeof(ValueEntry));
+    entry->instr = instr;
+    entry->next = valueTable[h];
+    valueTable[h] = entry;
+    added ++;
+  }
+  return added;
+}
+
+// Drops the entries of a block; they were pushed last, so they are first
+void forgetBlock(IrBlock *block, int added) {
+  ValueEntry *entry;
+  IrInstr *instr;
+  unsigned h;
+
+  for (instr = block->last; (instr != NULL) && (added > 0); instr = instr->prev) {
+    if (!isPure(instr->op))
+      continue;
+    h = valueHash(instr);
+    entry = valueTable[h];
+    if ((entry != NULL) && (entry->instr == instr)) {
+      valueTable[h] = entry->next;
+      free(entry);
+      added --;
+    }
+  }
+}
+
+void irValueNumbering(IrFunction *fn) {
+  IrBlock **stack, **children, *block;
+  int *childStart, *childCount, *added, *visited;
+  int top = 0, i, n = fn->blockCount;
+
+  irDominators(fn);
+  // the dominator tree as child lists in reverse postorder
+  childStart = (int*)calloc(n + 1, sizeof(int));
+  childCount = (int*)calloc(n, sizeof(int));
+  children = (IrBlock**)malloc(n * sizeof(IrBlock*));
+  for (i = 1; i < fn->orderCount; i++)
+    childStart[fn->order[i]->idom->id + 1] ++;
+  for (i = 0; i < n; i++)
+    childStart[i + 1] += childStart[i];
+  for (i = 1; i < fn->orderCount; i++) {
+    block = fn->order[i];
+    children[childStart[block->idom->id] + childCount[block->idom->id]++] = block;
+  }
+
+  // preorder walk; a block's entries stay in the table while its subtree runs
+  stack = (IrBlock**)malloc(n * sizeof(IrBlock*));
+  added = (int*)calloc(n, sizeof(int));
+  visited = (int*)calloc(n, sizeof(int));
+  stack[top++] = fn->entry;
+  while (top > 0) {
+    block = stack[top - 1];
+    if (!visited[block->id]) {
+      visited[block->id] = 1;
+      added[block->id] = numberBlock(block);
+      for (i = childCount[block->id] - 1; i >= 0; i--)
+        stack[top++] = children[childStart[block->id] + i];
+    } else {
+      forgetBlock(block, added[block->id]);
+      top --;
+    }
+  }
+  resolveArgs(fn);
+
+  free(stack);
+  free(added);
+  free(visited);
+  free(children);
+  free(childStart);
+  free(childCount);
+}
+
+/******************************************************************/
+// Loops
+
+// Marks are reused by the next loop, so membership is checked right away
+int inLoop(IrBlock *block, Loop *loop) {
+  return (block != NULL) && (block->mark == loop->mark);
+}
+
+// Marks the blocks reaching the latch without passing the header
+void markLoop(IrFunction *fn, Loop *loop) {
+  IrBlock **work = (IrBlock**)malloc(fn->blockCount * sizeof(IrBlock*));
+  IrBlock *block;
+  int top = 0, k;
+
+  loop->mark = ++loopMark;
+  loop->header->mark = loopMark;
+  if (loop->latch->mark != loopMark) {
+    loop->latch->mark = loopMark;
+    work[top++] = loop->latch;
+  }
+  while (top > 0) {
+    block = work[--top];
+    for (k = 0; k < block->predCount; k++)
+      if ((block->preds[k]->mark != loopMark) && (block->preds[k]->order >= 0)) {
+        block->preds[k]->mark = loopMark;
+        work[top++] = block->preds[k];
+      }
+  }
+  free(work);
+}
+
+// Finds the loops of fn, innermost first
+Loop* findLoops(IrFunction *fn, int *count) {
+  Loop *loops = NULL;
+  IrBlock *block, *header;
+  int capacity = 0, i, j, k, outside;
+
+  irDominators(fn);
+  *count = 0;
+  for (block = fn->entry; block != NULL; block = block->next)
+    block->mark = 0;
+  // walking the blocks backwards puts inner headers before outer ones
+  for (i = fn->orderCount - 1; i >= 0; i--) {
+    header = fn->order[i];
+    for (j = 0; j < header->predCount; j++) {
+      block = header->preds[j];
+      if ((block->order < 0) || !dominates(header, block))
+        continue;
+      if (*count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        loops = (Loop*)realloc(loops, capacity * sizeof(Loop));
+      }
+      loops[*count].header = header;
+      loops[*count].latch = block;
+      loops[*count].preheader = NULL;
+      loops[*count].mark = 0;
+      (*count) ++;
+    }
+  }
+
+  for (i = 0; i < *count; i++) {
+    markLoop(fn, &loops[i]);
+    header = loops[i].header;
+    outside = 0;
+    for (k = 0; k < header->predCount; k++)
+      if (header->preds[k]->mark != loops[i].mark) {
+        outside ++;
+        loops[i].preheader = header->preds[k];
+      }
+    if ((outside != 1) || (loops[i].preheader->succCount != 1))
+      loops[i].preheader = NULL;
+  }
+  return loops;
+}
+
+int isInvariant(IrInstr *instr, Loop *loop) {
+  int i;
+  for (i = 0; i < instr->argCount; i++)
+    if (inLoop(instr->args[i]->block, loop))
+      return 0;
+  return 1;
+}
+
+void irLoopInvariantMotion(IrFunction *fn) {
+  Loop *loops;
+  IrBlock *block;
+  IrInstr *instr, *following;
+  int count, i, j;
+
+  loops = findLoops(fn, &count);
+  for (i = 0; i < count; i++) {
+    if (loops[i].preheader == NULL)
+      continue;
+    markLoop(fn, &loops[i]);
+    // in reverse postorder a value is hoisted before the ones using it
+    for (j = 0; j < fn->orderCount; j++) {
+      block = fn->order[j];
+      if (!inLoop(block, &loops[i]))
+        continue;
+      FOR_EACH_INSTR(block, instr, following)
+        if (isPure(instr->op) && isInvariant(instr, &loops[i])) {
+          removeInstr(instr);
+          insertBefore(instr, loops[i].preheader->last);
+        }
+    }
+  }
+  free(loops);
+}
+
+/******************************************************************/
+// Strength reduction
+
+IrInstr* newInLoop(IrFunction *fn, IrOp op, IrInstr *a, IrInstr *b, IrInstr *like) {
+  IrInstr *instr = newInstr(fn, op, 0);
+  addArg(instr, a);
+  if (b != NULL)
+    addArg(instr, b);
+  instr->lineNo = like->lineNo;
+  instr->colNo = like->colNo;
+  return instr;
+}
+
+void insertAfter(IrInstr *instr, IrInstr *at) {
+  if (at->next != NULL)
+    insertBefore(instr, at->next);
+  else appendInstr(at->block, instr);
+}
+
+// Turns product = iv * factor, with iv = phi(init, iv +- step) in the header
+// and factor invariant, into a phi of its own stepped by step * factor
+void reduceProduct(IrFunction *fn, Loop *loop, IrInstr *product, IrInstr *iv, IrInstr *factor,
+                   int entryArg, int latchArg) {
+  IrInstr *next = iv->args[latchArg];
+  IrInstr *start, *step, *phi, *stepped, *terminator = loop->preheader->last;
+
+  start = newInLoop(fn, IR_MUL, iv->args[entryArg], factor, product);
+  insertBefore(start, terminator);
+  step = newInLoop(fn, IR_MUL, (next->args[0] == iv) ? next->args[1] : next->args[0], factor, product);
+  insertBefore(step, terminator);
+
+  phi = newInstr(fn, IR_PHI, 0);
+  addArg(phi, NULL);
+  addArg(phi, NULL);
+  phi->args[entryArg] = start;
+  stepped = newInLoop(fn, next->op, phi, step, product);
+  phi->args[latchArg] = stepped;
+  insertBefore(phi, loop->header->first);
+  insertAfter(stepped, next);
+  replaceInstr(product, phi);
+}
+
+// Returns the header phi iv when instr is iv + step, step + iv or iv - step
+IrInstr* inductionOf(IrInstr *instr, Loop *loop, int latchArg) {
+  IrInstr *iv;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    iv = instr->args[i];
+    if ((iv->op != IR_PHI) || (iv->block != loop->header) || (iv->args[latchArg] != instr))
+      continue;
+    if ((instr->op == IR_SUB) && (i == 1))
+      continue;
+    if (!inLoop(instr->args[1 - i]->block, loop))
+      return iv;
+  }
+  return NULL;
+}
+
+void irStrengthReduction(IrFunction *fn) {
+  Loop *loops;
+  IrBlock *block;
+  IrInstr *instr, *following, *iv, *next;
+  int count, entryArg, latchArg, i, j, k;
+
+  loops = findLoops(fn, &count);
+  for (i = 0; i < count; i++) {
+    if ((loops[i].preheader == NULL) || (loops[i].header->predCount != 2))
+      continue;
+    markLoop(fn, &loops[i]);
+    entryArg = (loops[i].header->preds[0] == loops[i].preheader) ? 0 : 1;
+    latchArg = 1 - entryArg;
+    for (j = 0; j < fn->orderCount; j++) {
+      block = fn->order[j];
+      if (!inLoop(block, &loops[i]))
+        continue;
+      FOR_EACH_INSTR(block, instr, following) {
+        if (instr->op != IR_MUL)
+          continue;
+        for (k = 0; k < 2; k++) {
+          iv = instr->args[k];
+          if ((iv->op != IR_PHI) || (iv->block != loops[i].header) || inLoop(instr->args[1 - k]->block, &loops[i]))
+            continue;
+          next = iv->args[latchArg];
+          if (((next->op == IR_ADD) || (next->op == IR_SUB)) && (inductionOf(next, &loops[i], latchArg) == iv)) {
+            reduceProduct(fn, &loops[i], instr, iv, instr->args[1 - k], entryArg, latchArg);
+            break;
+          }
+        }
+      }
+    }
+  }
+  resolveArgs(fn);
+  free(loops);
+}
+
+/******************************************************************/
+// Bounds check elimination
+
+Range rangeAt(IrInstr *value, IrBlock *block, int depth);
+
+Range makeRange(long long lo, long long hi) {
+  Range r;
+  // out of int the arithmetic wraps, and anything goes
+  if ((lo < INT_MIN) || (hi > INT_MAX) || (lo > hi)) {
+    lo = INT_MIN;
+    hi = INT_MAX;
+  }
+  r.lo = lo;
+  r.hi = hi;
+  return r;
+}
+
+IrOp swappedCompare(IrOp op) {
+  switch (op) {
+  case IR_LT: return IR_GT;
+  case IR_LE: return IR_GE;
+  case IR_GT: return IR_LT;
+  case IR_GE: return IR_LE;
+  default: return op;
+  }
+}
+
+IrOp negatedCompare(IrOp op) {
+  switch (op) {
+  case IR_EQ: return IR_NE;
+  case IR_NE: return IR_EQ;
+  case IR_LT: return IR_GE;
+  case IR_LE: return IR_GT;
+  case IR_GT: return IR_LE;
+  default: return IR_LT;
+  }
+}
+
+// Narrows r, the range of value, where condition is known to be taken or not
+void narrowRange(Range *r, IrInstr *value, IrInstr *condition, int taken, IrBlock *at, int depth) {
+  IrOp op = condition->op;
+  IrInstr *other;
+  Range o;
+
+  if ((op < IR_EQ) || (op > IR_GE))
+    return;
+  if (condition->args[0] == value)
+    other = condition->args[1];
+  else if (condition->args[1] == value) {
+    other = condition->args[0];
+    op = swappedCompare(op);
+  } else return;
+  if (!taken)
+    op = negatedCompare(op);
+  o = rangeAt(other, at, depth + 1);
+  switch (op) {
+  case IR_EQ:
+    if (o.lo > r->lo) r->lo = o.lo;
+    if (o.hi < r->hi) r->hi = o.hi;
+    break;
+  case IR_LT:
+    if (o.hi - 1 < r->hi) r->hi = o.hi - 1;
+    break;
+  case IR_LE:
+    if (o.hi < r->hi) r->hi = o.hi;
+    break;
+  case IR_GT:
+    if (o.lo + 1 > r->lo) r->lo = o.lo + 1;
+    break;
+  case IR_GE:
+    if (o.lo > r->lo) r->lo = o.lo;
+    break;
+  default:
+    break;
+  }
+}
+
+// Step of a phi updated as phi + k or phi - k on a back edge, 0 otherwise
+long long stepOf(IrInstr *phi, IrInstr *next) {
+  if ((next->op == IR_ADD) && (next->args[0] == phi) && (next->args[1]->op == IR_CONST))
+    return next->args[1]->value;
+  if ((next->op == IR_ADD) && (next->args[1] == phi) && (next->args[0]->op == IR_CONST))
+    return next->args[0]->value;
+  if ((next->op == IR_SUB) && (next->args[0] == phi) && (next->args[1]->op == IR_CONST))
+    return -(long long)next->args[1]->value;
+  return 0;
+}
+
+// The union of what reaches a phi. An induction variable only moves one way
+// from its entry values as long as its step cannot wrap around, which the
+// conditions guarding the step tell.
+Range phiRange(IrInstr *phi, int depth) {
+  IrBlock *pred;
+  IrInstr *next;
+  Range r, a;
+  long long lo = LLONG_MAX, hi = LLONG_MIN, step;
+  int up = 0, down = 0, i;
+
+  // a phi reached again through its own loop
+  if (phi->mark)
+    return makeRange(INT_MIN, INT_MAX);
+  phi->mark = 1;
+  for (i = 0; i < phi->argCount; i++) {
+    pred = phi->block->preds[i];
+    next = phi->args[i];
+    if (next == phi)
+      continue;
+    step = (pred->order >= 0) && dominates(phi->block, pred) ? stepOf(phi, next) : 0;
+    if (step != 0) {
+      a = rangeAt(phi, next->block, depth + 1);
+      if ((step > 0) && (a.hi + step <= INT_MAX))
+        up = 1;
+      else if ((step < 0) && (a.lo + step >= INT_MIN))
+        down = 1;
+      else lo = INT_MIN, hi = INT_MAX;
+      continue;
+    }
+    a = rangeAt(next, pred, depth + 1);
+    if (a.lo < lo) lo = a.lo;
+    if (a.hi > hi) hi = a.hi;
+  }
+  phi->mark = 0;
+  if (up && down)
+    return makeRange(INT_MIN, INT_MAX);
+  r = makeRange(lo, hi);
+  if (up)
+    r.hi = INT_MAX;
+  if (down)
+    r.lo = INT_MIN;
+  return r;
+}
+
+// What value computes, from the ranges of its arguments
+Range ownRange(IrInstr *value, IrBlock *block, int depth) {
+  Range a, b;
+  long long p[4], lo, hi;
+  int i;
+
+  switch (value->op) {
+  case IR_CONST:
+    return makeRange(value->value, value->value);
+  case IR_COPY:
+    return rangeAt(value->args[0], block, depth + 1);
+  case IR_PHI:
+    return phiRange(value, depth);
+  case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    return makeRange(0, 1);
+  case IR_NEG:
+    a = rangeAt(value->args[0], block, depth + 1);
+    return makeRange(-a.hi, -a.lo);
+  case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+    break;
+  default:
+    return makeRange(INT_MIN, INT_MAX);
+  }
+
+  a = rangeAt(value->args[0], block, depth + 1);
+  b = rangeAt(value->args[1], block, depth + 1);
+  switch (value->op) {
+  case IR_ADD:
+    return makeRange(a.lo + b.lo, a.hi + b.hi);
+  case IR_SUB:
+    return makeRange(a.lo - b.hi, a.hi - b.lo);
+  case IR_MUL:
+    p[0] = a.lo * b.lo;
+    p[1] = a.lo * b.hi;
+    p[2] = a.hi * b.lo;
+    p[3] = a.hi * b.hi;
+    lo = hi = p[0];
+    for (i = 1; i < 4; i++) {
+      if (p[i] < lo) lo = p[i];
+      if (p[i] > hi) hi = p[i];
+    }
+    return makeRange(lo, hi);
+  default:
+    // truncating division by a positive constant keeps the order
+    if ((b.lo == b.hi) && (b.lo > 0))
+      return makeRange(a.lo / b.lo, a.hi / b.lo);
+    return makeRange(INT_MIN, INT_MAX);
+  }
+}
+
+// The range of value wherever block runs: what it computes, narrowed by the
+// branches that must have been taken to get there
+Range rangeAt(IrInstr *value, IrBlock *block, int depth) {
+  IrBlock *b, *pred;
+  Range r;
+
+  if (depth > RANGE_DEPTH)
+    return makeRange(INT_MIN, INT_MAX);
+  r = ownRange(value, block, depth);
+  for (b = block; (b != b->idom) && (b->idom != NULL); b = b->idom) {
+    if (b->predCount != 1)
+      continue;
+    pred = b->preds[0];
+    if ((pred->last->op != IR_BRANCH) || (pred->succs[0] == pred->succs[1]))
+      continue;
+    narrowRange(&r, value, pred->last->args[0], b == pred->succs[0], pred, depth);
+  }
+  return r;
+}
+
+// Whether check runs only after earlier, which stops outside a range as wide
+int isCoveredBy(IrInstr *check, IrInstr *earlier) {
+  IrInstr *instr;
+
+  if ((earlier == check) || (earlier->args[0] != check->args[0]) || (earlier->value > check->value))
+    return 0;
+  if (earlier->block != check->block)
+    return dominates(earlier->block, check->block);
+  for (instr = earlier->next; instr != NULL; instr = instr->next)
+    if (instr == check)
+      return 1;
+  return 0;
+}
+
+void irBoundsChecks(IrFunction *fn) {
+  IrInstr *instr, **checks = NULL;
+  Range r;
+  int count = 0, capacity = 0, i, j;
+
+  irDominators(fn);
+  for (i = 0; i < fn->orderCount; i++)
+    for (instr = fn->order[i]->first; instr != NULL; instr = instr->next) {
+      instr->mark = 0;
+      if (instr->op != IR_CHECK)
+        continue;
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        checks = (IrInstr**)realloc(checks, capacity * sizeof(IrInstr*));
+      }
+      checks[count++] = instr;
+    }
+
+  for (i = 0; i < count; i++) {
+    r = rangeAt(checks[i]->args[0], checks[i]->block, 0);
+    if ((r.lo >= 1) && (r.hi <= checks[i]->value)) {
+      removeInstr(checks[i]);
+      checks[i] = NULL;
+      continue;
+    }
+    // or a check of the same index as strict ran before it
+    for (j = 0; j < count; j++)
+      if ((checks[j] != NULL) && (j != i) && isCoveredBy(checks[i], checks[j])) {
+        removeInstr(checks[i]);
+        checks[i] = NULL;
+        break;
+      }
+  }
+  free(checks);
+}
+
+/******************************************************************/
+// Inlining
+
+int functionSize(IrFunction *fn) {
+  IrBlock *block;
+  IrInstr *instr;
+  int count = 0;
+
+  for (block = fn->entry; block != NULL; block = block->next)
+    for (instr = block->first; instr != NULL; instr = instr->next)
+      count ++;
+  return count;
+}
+
+// The load of an argument from the callee's own frame, done once on entry
+int isArgumentLoad(IrInstr *instr) {
+  return (instr->op == IR_LOAD) && (instr->args[0]->op == IR_FRAME) && (instr->args[0]->hops == 0);
+}
+
+// A call to callee can become a copy of its body when the callee is small,
+// not recursive, calls none of the subroutines nested in it and uses its
+// own frame only to read its arguments: locals that live in memory would
+// have to start at 0 on every call
+int isInlinable(IrProgram *program, IrFunction *callee) {
+  IrBlock *block;
+  IrInstr *instr;
+  int i;
+
+  if (program->calls->nodes[callee->index].isRecursive || (callee->entry->predCount > 0) ||
+      (functionSize(callee) > INLINE_SIZE))
+    return 0;
+  for (block = callee->entry; block != NULL; block = block->next)
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      if (((instr->op == IR_CALL) || (instr->op == IR_FRAME)) && (instr->hops == 0) &&
+          ((instr->op == IR_CALL) || (instr->value < FRAME_HEADER) ||
+           (instr->value >= FRAME_HEADER + callee->paramCount)))
+        return 0;
+      for (i = 0; i < instr->argCount; i++)
+        if ((instr->args[i]->op == IR_FRAME) && (instr->args[i]->hops == 0) && !isArgumentLoad(instr))
+          return 0;
+    }
+  return 1;
+}
+
+// Replaces call, an instruction of fn, with a copy of the body of callee.
+// The instructions after the call move to a block the returns jump to.
+// Frame addresses and static links are counted from the caller's depth.
+void inlineCall(IrFunction *fn, IrInstr *call, IrFunction *callee) {
+  IrBlock *before = call->block, *after, **blocks, *block, *copy;
+  IrInstr **values, **results, *instr, *clone, *following, *result = NULL;
+  int delta = fn->depth - callee->depth, i, j;
+
+  after = newBlock(fn);
+  for (instr = call->next; instr != NULL; instr = following) {
+    following = instr->next;
+    removeInstr(instr);
+    appendInstr(after, instr);
+  }
+  for (i = 0; i < before->succCount; i++) {
+    after->succs[i] = before->succs[i];
+    for (j = 0; j < after->succs[i]->predCount; j++)
+      if (after->succs[i]->preds[j] == before)
+        after->succs[i]->preds[j] = after;
+  }
+  after->succCount = before->succCount;
+  before->succCount = 0;
+
+  blocks = (IrBlock**)malloc(callee->blockCount * sizeof(IrBlock*));
+  values = (IrInstr**)calloc(callee->valueCount, sizeof(IrInstr*));
+  results = (IrInstr**)malloc(callee->blockCount * sizeof(IrInstr*));
+  for (block = callee->entry; block != NULL; block = block->next)
+    blocks[block->id] = newBlock(fn);
+  for (block = callee->entry; block != NULL; block = block->next)
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      if ((instr->op == IR_FRAME) && (instr->hops == 0))
+        continue;
+      if (isArgumentLoad(instr)) {
+        values[instr->id] = call->args[instr->args[0]->value - FRAME_HEADER];
+        continue;
+      }
+      clone = newInstr(fn, (instr->op == IR_RETURN) ? IR_JUMP : instr->op, instr->value);
+      clone->hops = ((instr->op == IR_FRAME) || (instr->op == IR_CALL)) ? instr->hops + delta : instr->hops;
+      clone->lineNo = instr->lineNo;
+      clone->colNo = instr->colNo;
+      appendInstr(blocks[block->id], clone);
+      values[instr->id] = clone;
+    }
+
+  for (block = callee->entry; block != NULL; block = block->next) {
+    copy = blocks[block->id];
+    for (i = 0; i < block->succCount; i++)
+      copy->succs[i] = blocks[block->succs[i]->id];
+    copy->succCount = block->succCount;
+    copy->preds = (IrBlock**)malloc((block->predCount + 1) * sizeof(IrBlock*));
+    copy->predCapacity = block->predCount + 1;
+    for (i = 0; i < block->predCount; i++)
+      copy->preds[i] = blocks[block->preds[i]->id];
+    copy->predCount = block->predCount;
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      if (((instr->op == IR_FRAME) && (instr->hops == 0)) || isArgumentLoad(instr))
+        continue;
+      if (instr->op == IR_RETURN) {
+        if (instr->argCount > 0)
+          results[after->predCount] = values[instr->args[0]->id];
+        addEdge(copy, after);
+        continue;
+      }
+      for (i = 0; i < instr->argCount; i++)
+        addArg(values[instr->id], values[instr->args[i]->id]);
+    }
+  }
+
+  // a function that returns from several blocks gives a phi of their results
+  if (callee->isFunction && (after->predCount == 1))
+    result = results[0];
+  else if (callee->isFunction && (after->predCount > 1)) {
+    result = newInstr(fn, IR_PHI, 0);
+    for (i = 0; i < after->predCount; i++)
+      addArg(result, results[i]);
+    insertBefore(result, after->first);
+  }
+
+  removeInstr(call);
+  call->replacement = result;
+  instr = newInstr(fn, IR_JUMP, 0);
+  appendInstr(before, instr);
+  addEdge(before, blocks[callee->entry->id]);
+  free(blocks);
+  free(values);
+  free(results);
+}
+
+// Empties the functions no call reaches from the main program any more
+void removeDeadFunctions(IrProgram *program) {
+  IrFunction *fn;
+  IrBlock *block;
+  IrInstr *instr;
+  int *work = (int*)malloc(program->count * sizeof(int));
+  int *live = (int*)calloc(program->count, sizeof(int));
+  int count = 0, i;
+
+  live[0] = 1;
+  work[count++] = 0;
+  while (count > 0) {
+    fn = program->functions[work[--count]];
+    for (block = fn->entry; block != NULL; block = block->next)
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        if ((instr->op == IR_CALL) && !live[instr->value]) {
+          live[instr->value] = 1;
+          work[count++] = instr->value;
+        }
+  }
+  for (i = 1; i < program->count; i++)
+    if (!live[i]) {
+      fn = program->functions[i];
+      block = newBlock(fn);
+      fn->entry = block;
+      instr = newInstr(fn, IR_RETURN, 0);
+      if (fn->isFunction) {
+        appendInstr(block, newInstr(fn, IR_CONST, 0));
+        addArg(instr, block->first);
+      }
+      appendInstr(block, instr);
+    }
+  free(work);
+  free(live);
+}
+
+// Goes through the bodies callees first, so that what a callee inlined
+// comes along when it is inlined in turn. A frame removed this way is no
+// longer counted against the stack.
+void irInline(IrProgram *program) {
+  CallGraph *calls = program->calls;
+  IrFunction *fn;
+  IrBlock *block;
+  IrInstr *instr, **sites = NULL;
+  int *inlinable = (int*)calloc(program->count, sizeof(int));
+  int siteCount, siteCapacity = 0, i, k;
+
+  for (k = 0; k < calls->count; k++) {
+    fn = program->functions[calls->order[k]];
+    siteCount = 0;
+    for (block = fn->entry; block != NULL; block = block->next)
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        if ((instr->op == IR_CALL) && inlinable[instr->value]) {
+          if (siteCount == siteCapacity) {
+            siteCapacity = siteCapacity ? siteCapacity * 2 : 16;
+            sites = (IrInstr**)realloc(sites, siteCapacity * sizeof(IrInstr*));
+          }
+          sites[siteCount++] = instr;
+        }
+    for (i = 0; i < siteCount; i++)
+      inlineCall(fn, sites[i], program->functions[sites[i]->value]);
+    resolveArgs(fn);
+    inlinable[fn->index] = (fn->index != 0) && isInlinable(program, fn);
+  }
+  removeDeadFunctions(program);
+  free(sites);
+  free(inlinable);
+}
+
+/******************************************************************/
+
+double passClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int runPasses(IrProgram *program, char *passes, FILE *timing) {
+  char name[32];
+  double start;
+  int length, i, p;
+
+  if (passes == NULL)
+    passes = DEFAULT_PASSES;
+  if (timing != NULL)
+    fprintf(timing, "%-6s %10s %12s %8s\n", "pass", "seconds", "instructions", "checks");
+  if (timing != NULL)
+    fprintf(timing, "%-6s %10s %12d %8d\n", "build", "", instructionCount(program), checkCount(program));
+
+  while (*passes != '\0') {
+    length = strcspn(passes, ",");
+    snprintf(name, sizeof(name), "%.*s", length, passes);
+    passes += length;
+    if (*passes == ',')
+      passes ++;
+    if (length == 0)
+      continue;
+
+    for (p = 0; irPasses[p].name != NULL; p++)
+      if (strcmp(irPasses[p].name, name) == 0)
+        break;
+    if (irPasses[p].name == NULL)
+      return -1;
+    start = passClock();
+    if (irPasses[p].runProgram != NULL)
+      irPasses[p].runProgram(program);
+    else for (i = 0; i < program->count; i++)
+      irPasses[p].run(program->functions[i]);
+    if (timing != NULL)
+      fprintf(timing, "%-6s %10.6f %12d %8d\n", name, passClock() - start, instructionCount(program),
+              checkCount(program));
+  }
+  return 0;
+}
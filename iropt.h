@@ -0,0 +1,39 @@
+/* SSA optimization passes
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IROPT_H__
+#define __IROPT_H__
+
+#include <stdio.h>
+#include "ir.h"
+
+// What runPasses() does when no list is given
+#define DEFAULT_PASSES "inline,copy,gvn,licm,bce,sr,gvn,copy,dce"
+
+// A pass runs over each function in turn, or over the whole program
+typedef struct {
+  char *name;
+  char *description;
+  void (*run)(IrFunction *fn);
+  void (*runProgram)(IrProgram *program);
+} IrPass;
+
+extern IrPass irPasses[];
+
+void irCopyPropagation(IrFunction *fn);
+void irDeadCode(IrFunction *fn);
+void irValueNumbering(IrFunction *fn);
+void irLoopInvariantMotion(IrFunction *fn);
+void irStrengthReduction(IrFunction *fn);
+void irBoundsChecks(IrFunction *fn);
+void irInline(IrProgram *program);
+
+// Runs the comma separated passes over every function. When timing is not
+// NULL, each pass writes its time and the instructions and index checks
+// left there. Returns 0, or -1 for an unknown pass.
+int runPasses(IrProgram *program, char *passes, FILE *timing);
+
+#endif
@@ -0,0 +1,281 @@
+/* Minimal JSON reader and writer
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+char *jsonText;
+long jsonLength, jsonPos;
+
+JsonValue* parseJsonValue(void);
+
+/******************************************************************/
+
+void skipJsonBlank(void) {
+  while ((jsonPos < jsonLength) &&
+         (jsonText[jsonPos] == ' ' || jsonText[jsonPos] == '\t' ||
+          jsonText[jsonPos] == '\n' || jsonText[jsonPos] == '\r'))
+    jsonPos ++;
+}
+
+JsonValue* makeJsonValue(JsonType type) {
+  JsonValue *value = (JsonValue*)calloc(1, sizeof(JsonValue));
+  value->type = type;
+  return value;
+}
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+int putUtf8(char *out, unsigned int cp) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = (char)(0xC0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3F));
+    return 2;
+  } else if (cp < 0x10000) {
+    out[0] = (char)(0xE0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (cp & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (cp >> 18));
+  out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (cp & 0x3F));
+  return 4;
+}
+
+unsigned int readHex4(void) {
+  unsigned int cp = 0;
+  int i, d;
+  for (i = 0; i < 4 && jsonPos < jsonLength; i++) {
+    d = hexDigit(jsonText[jsonPos++]);
+    if (d < 0) return 0xFFFD;
+    cp = cp * 16 + d;
+  }
+  return cp;
+}
+
+// Reads a string literal starting at the opening quote. The decoded text is
+// never longer than the literal, so it fits in a buffer of the same size.
+char* parseJsonString(long *length) {
+  long start = ++jsonPos, n = 0;
+  char *out, c;
+  unsigned int cp, low;
+
+  while ((jsonPos < jsonLength) && (jsonText[jsonPos] != '"')) {
+    if (jsonText[jsonPos] == '\\') jsonPos ++;
+    jsonPos ++;
+  }
+  if (jsonPos >= jsonLength) return NULL;
+
+  out = (char*)malloc(jsonPos - start + 1);
+  jsonPos = start;
+  while (jsonText[jsonPos] != '"') {
+    c = jsonText[jsonPos++];
+    if (c != '\\') {
+      out[n++] = c;
+      continue;
+    }
+    c = jsonText[jsonPos++];
+    switch (c) {
+    case 'n': out[n++] = '\n'; break;
+    case 't': out[n++] = '\t'; break;
+    case 'r': out[n++] = '\r'; break;
+    case 'b': out[n++] = '\b'; break;
+    case 'f': out[n++] = '\f'; break;
+    case 'u':
+      cp = readHex4();
+      if ((cp >= 0xD800) && (cp < 0xDC00) && (jsonPos + 6 <= jsonLength) &&
+          (jsonText[jsonPos] == '\\') && (jsonText[jsonPos + 1] == 'u')) {
+        jsonPos += 2;
+        low = readHex4();
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      }
+      n += putUtf8(out + n, cp);
+      break;
+    default: out[n++] = c; break;
+    }
+  }
+  jsonPos ++;
+  out[n] = '\0';
+  *length = n;
+  return out;
+}
+
+JsonValue* parseJsonList(JsonType type, char close) {
+  JsonValue *list = makeJsonValue(type), *item, **tail = &list->child;
+  char *key = NULL;
+  long keyLength;
+
+  jsonPos ++;
+  skipJsonBlank();
+  if ((jsonPos < jsonLength) && (jsonText[jsonPos] == close)) {
+    jsonPos ++;
+    return list;
+  }
+  while (jsonPos < jsonLength) {
+    if (type == JSON_OBJECT) {
+      skipJsonBlank();
+      if ((jsonPos >= jsonLength) || (jsonText[jsonPos] != '"')) break;
+      key = parseJsonString(&keyLength);
+      skipJsonBlank();
+      if ((key == NULL) || (jsonPos >= jsonLength) || (jsonText[jsonPos] != ':')) {
+        free(key);
+        break;
+      }
+      jsonPos ++;
+    }
+    item = parseJsonValue();
+    if (item == NULL) {
+      free(key);
+      break;
+    }
+    item->key = key;
+    key = NULL;
+    *tail = item;
+    tail = &item->next;
+    skipJsonBlank();
+    if (jsonPos >= jsonLength) break;
+    if (jsonText[jsonPos] == ',') {
+      jsonPos ++;
+      continue;
+    }
+    if (jsonText[jsonPos] == close) {
+      jsonPos ++;
+      return list;
+    }
+    break;
+  }
+  freeJson(list);
+  return NULL;
+}
+
+JsonValue* parseJsonValue(void) {
+  JsonValue *value;
+  char *end;
+
+  skipJsonBlank();
+  if (jsonPos >= jsonLength) return NULL;
+
+  switch (jsonText[jsonPos]) {
+  case '{': return parseJsonList(JSON_OBJECT, '}');
+  case '[': return parseJsonList(JSON_ARRAY, ']');
+  case '"':
+    value = makeJsonValue(JSON_STRING);
+    value->string = parseJsonString(&value->length);
+    if (value->string == NULL) {
+      free(value);
+      return NULL;
+    }
+    return value;
+  case 't':
+    jsonPos += 4;
+    return makeJsonValue(JSON_TRUE);
+  case 'f':
+    jsonPos += 5;
+    return makeJsonValue(JSON_FALSE);
+  case 'n':
+    jsonPos += 4;
+    return makeJsonValue(JSON_NULL);
+  default:
+    value = makeJsonValue(JSON_NUMBER);
+    value->number = strtod(jsonText + jsonPos, &end);
+    if (end == jsonText + jsonPos) {
+      free(value);
+      return NULL;
+    }
+    jsonPos = end - jsonText;
+    return value;
+  }
+}
+
+/******************************************************************/
+
+// text must be NUL terminated after length bytes
+JsonValue* parseJson(char *text, long length) {
+  jsonText = text;
+  jsonLength = length;
+  jsonPos = 0;
+  return parseJsonValue();
+}
+
+void freeJson(JsonValue *value) {
+  JsonValue *next;
+  while (value != NULL) {
+    next = value->next;
+    freeJson(value->child);
+    free(value->key);
+    free(value->string);
+    free(value);
+    value = next;
+  }
+}
+
+JsonValue* jsonMember(JsonValue *object, char *key) {
+  JsonValue *member;
+  if ((object == NULL) || (object->type != JSON_OBJECT))
+    return NULL;
+  for (member = object->child; member != NULL; member = member->next)
+    if (strcmp(member->key, key) == 0)
+      return member;
+  return NULL;
+}
+
+// Follows a dotted path of member names such as "params.textDocument.uri"
+JsonValue* jsonPath(JsonValue *value, char *path) {
+  char key[64];
+  char *dot;
+  long n;
+
+  while ((value != NULL) && (*path != '\0')) {
+    dot = strchr(path, '.');
+    n = (dot == NULL) ? (long)strlen(path) : dot - path;
+    if (n >= (long)sizeof(key)) return NULL;
+    memcpy(key, path, n);
+    key[n] = '\0';
+    value = jsonMember(value, key);
+    path += n + (dot != NULL);
+  }
+  return value;
+}
+
+long jsonInt(JsonValue *value, long otherwise) {
+  if ((value == NULL) || (value->type != JSON_NUMBER))
+    return otherwise;
+  return (long)value->number;
+}
+
+void writeJsonString(FILE *f, char *s, long length) {
+  long i;
+  unsigned char c;
+
+  fputc('"', f);
+  for (i = 0; i < length; i++) {
+    c = (unsigned char)s[i];
+    switch (c) {
+    case '"': fputs("\\\"", f); break;
+    case '\\': fputs("\\\\", f); break;
+    case '\n': fputs("\\n", f); break;
+    case '\r': fputs("\\r", f); break;
+    case '\t': fputs("\\t", f); break;
+    default:
+      if (c < 0x20) fprintf(f, "\\u%04x", c);
+      else fputc(c, f);
+    }
+  }
+  fputc('"', f);
+}
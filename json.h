@@ -0,0 +1,41 @@
+/* Minimal JSON reader and writer
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stdio.h>
+
+typedef enum {
+  JSON_NULL,
+  JSON_FALSE,
+  JSON_TRUE,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT
+} JsonType;
+
+typedef struct JsonValue {
+  JsonType type;
+  double number;
+  char *key;                // member name inside an object
+  char *string;
+  long length;              // string length in bytes
+  struct JsonValue *child;  // first element or member
+  struct JsonValue *next;   // next sibling
+} JsonValue;
+
+JsonValue* parseJson(char *text, long length);
+void freeJson(JsonValue *value);
+
+JsonValue* jsonMember(JsonValue *object, char *key);
+JsonValue* jsonPath(JsonValue *value, char *path);
+long jsonInt(JsonValue *value, long otherwise);
+
+void writeJsonString(FILE *f, char *s, long length);
+
+#endif
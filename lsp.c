@@ -0,0 +1,440 @@
+/* Language server: publishes parse diagnostics over JSON-RPC on stdio
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "incremental.h"
+#include "json.h"
+
+#define MAX_OPEN_FILES 256
+
+// Latency histogram with 8 sub-buckets per power of two microseconds
+#define HISTOGRAM_OCTAVES 32
+#define HISTOGRAM_SUBBUCKETS 8
+
+typedef struct {
+  char *uri;
+  long version;
+  char *text;
+  long length, capacity;
+  Document *doc;
+  int dirty;
+  int opened;           // the pending change is the didOpen itself
+  double changedAt;     // arrival time of the newest unpublished change
+} OpenFile;
+
+typedef struct {
+  char *name;
+  long count;
+  double total, max;
+  long buckets[HISTOGRAM_OCTAVES * HISTOGRAM_SUBBUCKETS];
+} Histogram;
+
+OpenFile openFiles[MAX_OPEN_FILES];
+int openFileCount;
+
+Histogram openLatency = { "didOpen" };
+Histogram changeLatency = { "didChange" };
+long supersededChanges;
+
+char *inputBuffer;
+long inputLength, inputCapacity;
+int debounceMs = 0;
+int shuttingDown = 0;
+
+/******************************************************************/
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int histogramBucket(double micros) {
+  unsigned long v = (micros < 1) ? 1 : (unsigned long)micros;
+  int octave = 63 - __builtin_clzl(v);
+  int sub = (octave >= 3) ? (int)((v >> (octave - 3)) & 7) : (int)((v << (3 - octave)) & 7);
+  if (octave >= HISTOGRAM_OCTAVES) return HISTOGRAM_OCTAVES * HISTOGRAM_SUBBUCKETS - 1;
+  return octave * HISTOGRAM_SUBBUCKETS + sub;
+}
+
+double bucketUpperBound(int bucket) {
+  int octave = bucket / HISTOGRAM_SUBBUCKETS, sub = bucket % HISTOGRAM_SUBBUCKETS;
+  return (double)(1UL << octave) * (1.0 + (sub + 1) / 8.0);
+}
+
+void recordLatency(Histogram *h, double seconds) {
+  double micros = seconds * 1e6;
+  h->count ++;
+  h->total += micros;
+  if (micros > h->max) h->max = micros;
+  h->buckets[histogramBucket(micros)] ++;
+}
+
+double histogramPercentile(Histogram *h, double p) {
+  long seen = 0, target = (long)(p * h->count + 0.999999);
+  int i;
+  if (h->count == 0) return 0;
+  for (i = 0; i < HISTOGRAM_OCTAVES * HISTOGRAM_SUBBUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= target) {
+      double bound = bucketUpperBound(i);
+      return (bound < h->max) ? bound : h->max;
+    }
+  }
+  return h->max;
+}
+
+void writeHistogram(FILE *f, Histogram *h) {
+  fprintf(f, "\"%s\":{\"count\":%ld,\"meanUs\":%.1f,\"p50Us\":%.1f,\"p99Us\":%.1f,\"maxUs\":%.1f}",
+          h->name, h->count, h->count ? h->total / h->count : 0.0,
+          histogramPercentile(h, 0.50), histogramPercentile(h, 0.99), h->max);
+}
+
+/******************************************************************/
+
+// Returns the body of the next message, NULL when none arrived within
+// timeoutMs (-1 waits forever) and sets *eof at the end of the input.
+char* readMessage(int timeoutMs, int *eof) {
+  struct pollfd pfd;
+  char *header, *body, *p;
+  long bodyLength, headerLength, n;
+
+  *eof = 0;
+  while (1) {
+    header = memmem(inputBuffer, inputLength, "\r\n\r\n", 4);
+    if (header != NULL) {
+      headerLength = header - inputBuffer + 4;
+      p = strcasestr(inputBuffer, "Content-Length:");
+      bodyLength = (p != NULL && p < header) ? atol(p + 15) : 0;
+      if (inputLength >= headerLength + bodyLength) {
+        body = (char*)malloc(bodyLength + 1);
+        memcpy(body, inputBuffer + headerLength, bodyLength);
+        body[bodyLength] = '\0';
+        inputLength -= headerLength + bodyLength;
+        memmove(inputBuffer, inputBuffer + headerLength + bodyLength, inputLength);
+        inputBuffer[inputLength] = '\0';
+        return body;
+      }
+    }
+
+    pfd.fd = 0;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) == 0)
+      return NULL;
+
+    if (inputCapacity - inputLength < 65536) {
+      inputCapacity = inputCapacity * 2 + 65536;
+      inputBuffer = (char*)realloc(inputBuffer, inputCapacity + 1);
+    }
+    n = read(0, inputBuffer + inputLength, inputCapacity - inputLength);
+    if (n <= 0) {
+      *eof = 1;
+      return NULL;
+    }
+    inputLength += n;
+    inputBuffer[inputLength] = '\0';
+  }
+}
+
+void sendMessage(char *body, size_t length) {
+  printf("Content-Length: %lu\r\n\r\n", (unsigned long)length);
+  fwrite(body, 1, length, stdout);
+  fflush(stdout);
+}
+
+void sendResult(JsonValue *id, char *result) {
+  char *body = NULL;
+  size_t length = 0;
+  FILE *f = open_memstream(&body, &length);
+
+  fprintf(f, "{\"jsonrpc\":\"2.0\",\"id\":");
+  if (id->type == JSON_STRING) writeJsonString(f, id->string, id->length);
+  else fprintf(f, "%ld", jsonInt(id, 0));
+  fprintf(f, ",\"result\":%s}", result);
+  fclose(f);
+  sendMessage(body, length);
+  free(body);
+}
+
+void sendError(JsonValue *id, int code, char *message) {
+  char *body = NULL;
+  size_t length = 0;
+  FILE *f = open_memstream(&body, &length);
+
+  fprintf(f, "{\"jsonrpc\":\"2.0\",\"id\":");
+  if (id->type == JSON_STRING) writeJsonString(f, id->string, id->length);
+  else fprintf(f, "%ld", jsonInt(id, 0));
+  fprintf(f, ",\"error\":{\"code\":%d,\"message\":", code);
+  writeJsonString(f, message, strlen(message));
+  fprintf(f, "}}");
+  fclose(f);
+  sendMessage(body, length);
+  free(body);
+}
+
+/******************************************************************/
+
+// Byte offset of an LSP position, whose character counts UTF-16 code units
+long offsetAt(OpenFile *file, long line, long character) {
+  long offset = 0, units = 0;
+  unsigned char c;
+  char *p;
+
+  while (line > 0) {
+    p = (char*)memchr(file->text + offset, '\n', file->length - offset);
+    if (p == NULL) return file->length;
+    offset = p - file->text + 1;
+    line --;
+  }
+  while ((offset < file->length) && (units < character) && (file->text[offset] != '\n')) {
+    c = (unsigned char)file->text[offset];
+    if (c >= 0xF0) { units += 2; offset += 4; }
+    else if (c >= 0xE0) { units ++; offset += 3; }
+    else if (c >= 0xC0) { units ++; offset += 2; }
+    else { units ++; offset ++; }
+  }
+  return (offset < file->length) ? offset : file->length;
+}
+
+// UTF-16 column of the character column colNo (1-based) on line lineNo (1-based)
+long characterAt(OpenFile *file, int lineNo, int colNo) {
+  long offset = offsetAt(file, lineNo - 1, 0), units = 0;
+  unsigned char c;
+
+  for (; (colNo > 1) && (offset < file->length); colNo--) {
+    c = (unsigned char)file->text[offset++];
+    units += (c >= 0xF0) ? 2 : 1;
+    while ((offset < file->length) && ((file->text[offset] & 0xC0) == 0x80)) offset ++;
+  }
+  return units;
+}
+
+void replaceText(OpenFile *file, long start, long end, char *text, long length) {
+  long newLength = file->length - (end - start) + length;
+  if (newLength + 1 > file->capacity) {
+    file->capacity = newLength * 2 + 1;
+    file->text = (char*)realloc(file->text, file->capacity);
+  }
+  memmove(file->text + start + length, file->text + end, file->length - end);
+  memcpy(file->text + start, text, length);
+  file->length = newLength;
+  file->text[newLength] = '\0';
+}
+
+OpenFile* findFile(JsonValue *uri) {
+  int i;
+  if ((uri == NULL) || (uri->type != JSON_STRING)) return NULL;
+  for (i = 0; i < openFileCount; i++)
+    if (strcmp(openFiles[i].uri, uri->string) == 0)
+      return &openFiles[i];
+  return NULL;
+}
+
+void publishDiagnostics(OpenFile *file) {
+  char *body = NULL, *message;
+  size_t length = 0;
+  int lineNo, colNo;
+  long character;
+  FILE *f = open_memstream(&body, &length);
+
+  fprintf(f, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+  writeJsonString(f, file->uri, strlen(file->uri));
+  fprintf(f, ",\"version\":%ld,\"diagnostics\":[", file->version);
+  if ((file->doc != NULL) && documentError(file->doc, &lineNo, &colNo, &message)) {
+    character = characterAt(file, lineNo, colNo);
+    fprintf(f, "{\"range\":{\"start\":{\"line\":%d,\"character\":%ld},\"end\":{\"line\":%d,\"character\":%ld}},"
+            "\"severity\":1,\"source\":\"kpl\",\"message\":",
+            lineNo - 1, character, lineNo - 1, character + 1);
+    writeJsonString(f, message, strlen(message));
+    fprintf(f, "}");
+  }
+  fprintf(f, "]}}");
+  fclose(f);
+  sendMessage(body, length);
+  free(body);
+}
+
+// Parses the newest text of every changed file. Changes that arrived while
+// an earlier one was still waiting were never parsed on their own.
+void flushChanges(void) {
+  OpenFile *file;
+  int i;
+
+  for (i = 0; i < openFileCount; i++) {
+    file = &openFiles[i];
+    if (!file->dirty) continue;
+    if (file->doc == NULL)
+      file->doc = openDocument(file->text, file->length);
+    else replaceDocument(file->doc, file->text, file->length);
+    publishDiagnostics(file);
+    recordLatency(file->opened ? &openLatency : &changeLatency, now() - file->changedAt);
+    file->dirty = 0;
+    file->opened = 0;
+  }
+}
+
+/******************************************************************/
+
+void didOpen(JsonValue *params, double arrived) {
+  JsonValue *uri = jsonPath(params, "textDocument.uri");
+  JsonValue *text = jsonPath(params, "textDocument.text");
+  OpenFile *file = findFile(uri);
+
+  if ((uri == NULL) || (text == NULL) || (text->type != JSON_STRING)) return;
+  if (file == NULL) {
+    if (openFileCount == MAX_OPEN_FILES) return;
+    file = &openFiles[openFileCount++];
+    memset(file, 0, sizeof(OpenFile));
+    file->uri = strdup(uri->string);
+  } else if (file->doc != NULL) {
+    closeDocument(file->doc);
+    file->doc = NULL;
+  }
+  file->length = 0;
+  replaceText(file, 0, 0, text->string, text->length);
+  file->version = jsonInt(jsonPath(params, "textDocument.version"), 0);
+  file->dirty = 1;
+  file->opened = 1;
+  file->changedAt = arrived;
+}
+
+void didChange(JsonValue *params, double arrived) {
+  OpenFile *file = findFile(jsonPath(params, "textDocument.uri"));
+  JsonValue *change, *range, *text;
+  long start, end;
+
+  if (file == NULL) return;
+  for (change = jsonMember(params, "contentChanges") ? jsonMember(params, "contentChanges")->child : NULL;
+       change != NULL; change = change->next) {
+    text = jsonMember(change, "text");
+    if ((text == NULL) || (text->type != JSON_STRING)) continue;
+    range = jsonMember(change, "range");
+    if (range == NULL) {
+      start = 0;
+      end = file->length;
+    } else {
+      start = offsetAt(file, jsonInt(jsonPath(range, "start.line"), 0),
+                       jsonInt(jsonPath(range, "start.character"), 0));
+      end = offsetAt(file, jsonInt(jsonPath(range, "end.line"), 0),
+                     jsonInt(jsonPath(range, "end.character"), 0));
+      if (end < start) end = start;
+    }
+    replaceText(file, start, end, text->string, text->length);
+  }
+  if (file->dirty) supersededChanges ++;
+  file->version = jsonInt(jsonPath(params, "textDocument.version"), file->version + 1);
+  file->dirty = 1;
+  file->changedAt = arrived;
+}
+
+void didClose(JsonValue *params) {
+  OpenFile *file = findFile(jsonPath(params, "textDocument.uri"));
+  if (file == NULL) return;
+  if (file->doc != NULL) closeDocument(file->doc);
+  file->doc = NULL;
+  file->length = 0;
+  file->dirty = 0;
+  publishDiagnostics(file);
+  free(file->uri);
+  free(file->text);
+  *file = openFiles[--openFileCount];
+}
+
+void sendLatencyStats(JsonValue *id) {
+  char *result = NULL;
+  size_t length = 0;
+  FILE *f = open_memstream(&result, &length);
+
+  fprintf(f, "{");
+  writeHistogram(f, &openLatency);
+  fprintf(f, ",");
+  writeHistogram(f, &changeLatency);
+  fprintf(f, ",\"superseded\":%ld}", supersededChanges);
+  fclose(f);
+  sendResult(id, result);
+  free(result);
+}
+
+// Returns 0 once the client has sent exit
+int handleMessage(char *body, double arrived) {
+  JsonValue *message = parseJson(body, strlen(body));
+  JsonValue *method = jsonMember(message, "method");
+  JsonValue *id = jsonMember(message, "id");
+  JsonValue *params = jsonMember(message, "params");
+  char *name = (method != NULL && method->type == JSON_STRING) ? method->string : "";
+  int running = 1;
+
+  if (strcmp(name, "initialize") == 0)
+    sendResult(id, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2}},"
+               "\"serverInfo\":{\"name\":\"kpl-lsp\",\"version\":\"" PARSER_VERSION "\"}}");
+  else if (strcmp(name, "textDocument/didOpen") == 0)
+    didOpen(params, arrived);
+  else if (strcmp(name, "textDocument/didChange") == 0)
+    didChange(params, arrived);
+  else if (strcmp(name, "textDocument/didClose") == 0)
+    didClose(params);
+  else if (strcmp(name, "kpl/latencyStats") == 0 && id != NULL)
+    sendLatencyStats(id);
+  else if (strcmp(name, "shutdown") == 0 && id != NULL) {
+    shuttingDown = 1;
+    sendResult(id, "null");
+  } else if (strcmp(name, "exit") == 0)
+    running = 0;
+  else if (id != NULL)
+    sendError(id, -32601, "Method not found");
+
+  freeJson(message);
+  return running;
+}
+
+int main(int argc, char *argv[]) {
+  char *body;
+  int i, eof, pending;
+  double arrived;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc)
+      debounceMs = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: kpl-lsp [--debounce MS]\n");
+      return -1;
+    }
+  }
+
+  while (1) {
+    pending = 0;
+    for (i = 0; i < openFileCount; i++)
+      pending |= openFiles[i].dirty;
+
+    body = readMessage(pending ? debounceMs : -1, &eof);
+    if (eof) break;
+    if (body == NULL) {
+      flushChanges();
+      continue;
+    }
+    arrived = now();
+    if (!handleMessage(body, arrived)) {
+      free(body);
+      break;
+    }
+    free(body);
+  }
+
+  fprintf(stderr, "kpl-lsp: didOpen %ld (p50 %.0f us, p99 %.0f us), didChange %ld (p50 %.0f us, p99 %.0f us), %ld superseded\n",
+          openLatency.count, histogramPercentile(&openLatency, 0.5), histogramPercentile(&openLatency, 0.99),
+          changeLatency.count, histogramPercentile(&changeLatency, 0.5), histogramPercentile(&changeLatency, 0.99),
+          supersededChanges);
+  return shuttingDown ? 0 : 1;
+}
@@ -4,24 +4,331 @@
  * @version 1.0
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "reader.h"
 #include "parser.h"
+#include "cache.h"
+#include "stats.h"
+#include "codegen.h"
+#include "vm.h"
+#include "image.h"
+#include "ir.h"
+#include "iropt.h"
+#include "irexec.h"
+#include "native.h"
+#include "transpile.h"
+#include "callgraph.h"
+#include "parallel.h"
+#include "push.h"
+
+extern int traceEnabled;
+extern int checkSymbols;
+extern int checkSemantics;
+extern int semanticThreads;
+extern int pipelinedScan;
+extern int (*programHook)(AstNode *program);
+extern __thread FILE *outputStream;
+
+// The passes --ir and --ir-run run, and whether they report their times
+char *irPassList = DEFAULT_PASSES;
+int irTiming = 0;
+// Where --elf writes the object, --c the C source and --callgraph the graph
+char *objectName = NULL;
+char *cSourceName = NULL;
+char *callGraphName = NULL;
+// Feeds the source to a push parse this many bytes at a time with --push
+int pushChunk = 0;
 
 /******************************************************************/
 
+int runProgram(AstNode *program) {
+  CodeBlock *block = generateCode(program);
+  int result = runCode(block, NULL);
+  freeCodeBlock(block);
+  return result;
+}
+
+// Runs the code of fileName from its .kplc, compiling that first if needed
+int runPrecompiled(char *fileName) {
+  CodeBlock *block;
+  int result;
+
+  block = loadProgram(fileName, &result);
+  if (block != NULL) {
+    result = runCode(block, NULL);
+    freeCodeBlock(block);
+  }
+  return result;
+}
+
+int dumpProgram(AstNode *program) {
+  CodeBlock *block = generateCode(program);
+  dumpCode(block, outputStream);
+  freeCodeBlock(block);
+  return IO_SUCCESS;
+}
+
+// Builds the IR and runs the passes over it; NULL for an unknown pass
+IrProgram* optimizedIr(AstNode *program) {
+  IrProgram *ir = buildIr(program);
+  if (runPasses(ir, irPassList, irTiming ? stderr : NULL) < 0) {
+    fprintf(stderr, "parser: unknown pass in %s\n", irPassList);
+    freeIr(ir);
+    return NULL;
+  }
+  return ir;
+}
+
+int dumpIrProgram(AstNode *program) {
+  IrProgram *ir = optimizedIr(program);
+  if (ir == NULL)
+    return IO_SUCCESS;
+  dumpIr(ir, outputStream);
+  freeIr(ir);
+  return IO_SUCCESS;
+}
+
+int runIrProgram(AstNode *program) {
+  IrProgram *ir = optimizedIr(program);
+  int result;
+  if (ir == NULL)
+    return IO_SUCCESS;
+  result = runIr(ir, NULL);
+  freeIr(ir);
+  return result;
+}
+
+int runNativeProgram(AstNode *program) {
+  IrProgram *ir = optimizedIr(program);
+  NativeCode *code;
+  int result;
+  if (ir == NULL)
+    return IO_SUCCESS;
+  code = generateNative(ir);
+  freeIr(ir);
+  result = runNative(code);
+  freeNativeCode(code);
+  return result;
+}
+
+int writeNativeProgram(AstNode *program) {
+  IrProgram *ir = optimizedIr(program);
+  NativeCode *code;
+  if (ir == NULL)
+    return IO_SUCCESS;
+  code = generateNative(ir);
+  freeIr(ir);
+  if (writeNativeObject(code, objectName) != IO_SUCCESS)
+    fprintf(stderr, "parser: can\'t write %s\n", objectName);
+  freeNativeCode(code);
+  return IO_SUCCESS;
+}
+
+int writeCSource(AstNode *program) {
+  FILE *f = fopen(cSourceName, "w");
+  if ((f == NULL) || (writeCProgram(program, f) != IO_SUCCESS))
+    fprintf(stderr, "parser: can\'t write %s\n", cSourceName);
+  if (f != NULL)
+    fclose(f);
+  return IO_SUCCESS;
+}
+
+// In DOT, or in JSON for a name ending in .json
+int writeCallGraph(AstNode *program) {
+  FILE *f = fopen(callGraphName, "w");
+  CallGraph *graph;
+  int length = strlen(callGraphName);
+
+  if (f == NULL) {
+    fprintf(stderr, "parser: can\'t write %s\n", callGraphName);
+    return IO_SUCCESS;
+  }
+  graph = buildCallGraph(program);
+  if ((length > 5) && (strcmp(callGraphName + length - 5, ".json") == 0))
+    writeCallGraphJson(graph, f);
+  else writeCallGraphDot(graph, f);
+  freeCallGraph(graph);
+  fclose(f);
+  return IO_SUCCESS;
+}
+
+// Parses the files as they are read, one chunk after the other. Several
+// files are fed a chunk each in turn, so that their parsers are open at
+// once; what each one prints comes out when all are done, in order.
+int compilePushed(char **fileNames, int count) {
+  FILE *savedOutput = (outputStream != NULL) ? outputStream : stdout;
+  FILE **files = (FILE**)calloc(count, sizeof(FILE*));
+  FILE **outputs = (FILE**)calloc(count, sizeof(FILE*));
+  PushParser **parsers = (PushParser**)calloc(count, sizeof(PushParser*));
+  char **texts = (char**)calloc(count, sizeof(char*));
+  size_t *textLengths = (size_t*)calloc(count, sizeof(size_t));
+  int *results = (int*)calloc(count, sizeof(int));
+  char *chunk = (char*)malloc(pushChunk);
+  long length;
+  int result = IO_SUCCESS, fed, i;
+
+  for (i = 0; i < count; i++) {
+    files[i] = fopen(fileNames[i], "rb");
+    if (files[i] == NULL) {
+      result = IO_ERROR;
+      break;
+    }
+    if (count > 1)
+      outputStream = outputs[i] = open_memstream(&texts[i], &textLengths[i]);
+    parsers[i] = openPushParser();
+    outputStream = savedOutput;
+    if (parsers[i] == NULL) {
+      result = IO_ERROR;
+      break;
+    }
+    results[i] = PARSE_MORE;
+  }
+
+  if (result == IO_SUCCESS)
+    do {
+      fed = 0;
+      for (i = 0; i < count; i++)
+        if ((results[i] == PARSE_MORE) && ((length = fread(chunk, 1, pushChunk, files[i])) > 0)) {
+          results[i] = feedParser(parsers[i], chunk, length);
+          fed = 1;
+        }
+    } while (fed);
+
+  for (i = 0; i < count; i++) {
+    if (parsers[i] != NULL) {
+      results[i] = finishParser(parsers[i]);
+      closePushParser(parsers[i]);
+    }
+    if (outputs[i] != NULL) {
+      fclose(outputs[i]);
+      if (result == IO_SUCCESS)
+        fwrite(texts[i], 1, textLengths[i], savedOutput);
+      free(texts[i]);
+    }
+    if (files[i] != NULL)
+      fclose(files[i]);
+  }
+  free(files);
+  free(outputs);
+  free(parsers);
+  free(texts);
+  free(textLengths);
+  free(results);
+  free(chunk);
+  return result;
+}
+
+void usage(void) {
+  printf("usage: parser [--quiet] [--check] [--semantic] [--threads N] [--pipeline] [--parallel] [--push BYTES] [--run] [--kplc] [--dump] [--ir] [--ir-run] [--passes LIST] [--ir-timing] [--native] [--elf FILE] [--c FILE] [--callgraph FILE] [--stats] [--cache DIR] [--cache-limit BYTES] file...\n");
+}
+
 int main(int argc, char *argv[]) {
-  if (argc <= 1) {
+  char *fileName = NULL;
+  // the files given; all but the last are read with --push only
+  char **fileNames = (char**)malloc(argc * sizeof(char*));
+  int fileCount = 0;
+  char *cacheDir = NULL;
+  long cacheLimit = CACHE_DEFAULT_LIMIT;
+  int showStats = 0;
+  int precompiled = 0;
+  int result, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+      cacheDir = argv[++i];
+    else if (strcmp(argv[i], "--quiet") == 0)
+      traceEnabled = 0;
+    else if (strcmp(argv[i], "--check") == 0)
+      checkSymbols = 1;
+    else if (strcmp(argv[i], "--semantic") == 0)
+      checkSymbols = checkSemantics = 1;
+    else if (strcmp(argv[i], "--run") == 0)
+      programHook = runProgram;
+    else if (strcmp(argv[i], "--kplc") == 0) {
+      programHook = runProgram;
+      precompiled = 1;
+    } else if (strcmp(argv[i], "--dump") == 0)
+      programHook = dumpProgram;
+    else if (strcmp(argv[i], "--ir") == 0)
+      programHook = dumpIrProgram;
+    else if (strcmp(argv[i], "--ir-run") == 0)
+      programHook = runIrProgram;
+    else if (strcmp(argv[i], "--native") == 0)
+      programHook = runNativeProgram;
+    else if (strcmp(argv[i], "--elf") == 0 && i + 1 < argc) {
+      programHook = writeNativeProgram;
+      objectName = argv[++i];
+    } else if (strcmp(argv[i], "--c") == 0 && i + 1 < argc) {
+      programHook = writeCSource;
+      cSourceName = argv[++i];
+    } else if (strcmp(argv[i], "--callgraph") == 0 && i + 1 < argc) {
+      programHook = writeCallGraph;
+      callGraphName = argv[++i];
+    } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc)
+      irPassList = argv[++i];
+    else if (strcmp(argv[i], "--ir-timing") == 0)
+      irTiming = 1;
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+      semanticThreads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--pipeline") == 0)
+      pipelinedScan = 1;
+    else if (strcmp(argv[i], "--parallel") == 0)
+      parallelParse = 1;
+    else if (strcmp(argv[i], "--push") == 0 && i + 1 < argc)
+      pushChunk = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--stats") == 0)
+      showStats = 1;
+    else if (strcmp(argv[i], "--cache-limit") == 0 && i + 1 < argc)
+      cacheLimit = atol(argv[++i]);
+    else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      usage();
+      return -1;
+    } else fileName = fileNames[fileCount++] = argv[i];
+  }
+
+#ifndef KPL_STATS
+  if (showStats) {
+    printf("parser: built without statistics, rebuild with make STATS=1\n");
+    return -1;
+  }
+#endif
+
+  if (fileName == NULL) {
     printf("parser: no input file.\n");
     return -1;
   }
 
-  if (compile(argv[1]) == IO_ERROR) {
+  // the program's own output replaces the trace
+  if (programHook != NULL) {
+    checkSymbols = checkSemantics = 1;
+    traceEnabled = 0;
+  }
+
+  // a run depends on its input, so it is never cached
+  if (precompiled)
+    result = runPrecompiled(fileName);
+  else if ((cacheDir != NULL) && (programHook == NULL))
+    result = compileCached(fileName, cacheDir, cacheLimit);
+  else if (parallelParse && !checkSymbols)
+    result = compileParallel(fileName);
+  else if (pushChunk > 0)
+    result = compilePushed(fileNames, fileCount);
+  else result = compile(fileName);
+
+  if (result == IO_ERROR) {
     printf("Can\'t read input file!\n");
     return -1;
   }
+
+#ifdef KPL_STATS
+  // on stderr, so it never mixes with the trace
+  if (showStats)
+    writeStats(stderr);
+#endif
     
   return 0;
 }
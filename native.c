@@ -0,0 +1,1161 @@
+/* x86-64 code generator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <elf.h>
+#include <sys/mman.h>
+
+#include "reader.h"
+#include "charcode.h"
+#include "error.h"
+#include "code.h"
+#include "vm.h"
+#include "native.h"
+
+// The machine stack the code runs on; a call fails once less than
+// NATIVE_STACK_MARGIN of it is left
+#define NATIVE_STACK_SIZE (256L << 20)
+#define NATIVE_STACK_MARGIN (1L << 20)
+
+// Frames at most this big are cleared by stores, bigger ones by rep stosd
+#define UNROLLED_CLEAR 16
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Values live in these; rax, rcx and rdx are scratch, r13 holds the frame
+// pointer as a cell index, r14 the cells and r15 the runtime. A function
+// saves the ones it uses, so they survive calls between functions; around
+// the runtime's C functions the caller-saved ones are saved.
+int allocatable[] = { RBX, R12, RSI, RDI, R8, R9, R10, R11 };
+int callerSaved[] = { RSI, RDI, R8, R9, R10, R11 };
+#define REGISTER_COUNT 8
+#define CALLER_SAVED_COUNT 6
+
+// Condition codes, the low nibble of jcc and setcc
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G 0xF
+
+typedef enum { LOC_NONE, LOC_REG, LOC_STACK, LOC_CONST } LocKind;
+
+typedef struct {
+  LocKind kind;
+  int reg;                     // or stack slot, or constant
+} Loc;
+
+// A rel32 to patch once its target is placed
+typedef struct {
+  int at;
+  int target;                  // block id, function number or -1
+} NativeFixup;
+
+// An out of line call to the error exit
+typedef struct {
+  int at;
+  ErrorCode err;
+  int lineNo, colNo;
+} ErrorSite;
+
+// A branch edge whose phi moves need code of their own
+typedef struct {
+  int at;
+  IrBlock *from, *to;
+} EdgeStub;
+
+NativeCode *native;
+int errorExit;
+
+// Per function
+IrFunction *nativeFn;
+IrProgram *nativeProgram;
+Loc *locs;
+int *positions, *useCounts, *fused;
+int slotCount, scratchSlot;
+int usedRegisters[REGISTER_COUNT];
+int *blockOffsets;
+NativeFixup *blockFixups, *callFixups;
+int blockFixupCount, blockFixupCapacity, callFixupCount, callFixupCapacity;
+ErrorSite *errorSites;
+int errorSiteCount, errorSiteCapacity;
+
+/******************************************************************/
+// Encoding
+
+void xByte(int b) {
+  if (native->size == native->capacity) {
+    native->capacity = native->capacity ? native->capacity * 2 : 4096;
+    native->code = (unsigned char*)realloc(native->code, native->capacity);
+  }
+  native->code[native->size++] = (unsigned char)b;
+}
+
+void xInt(int v) {
+  xByte(v);
+  xByte(v >> 8);
+  xByte(v >> 16);
+  xByte(v >> 24);
+}
+
+void xPatch(int at, int target) {
+  int rel = target - (at + 4);
+  memcpy(native->code + at, &rel, 4);
+}
+
+void xRex(int w, int reg, int index, int base) {
+  int rex = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((base >> 3) & 1);
+  if (rex != 0x40)
+    xByte(rex);
+}
+
+// An opcode of one byte, or 0x0F and one
+void xOpcode(int op) {
+  if (op > 0xFF)
+    xByte(op >> 8);
+  xByte(op & 0xFF);
+}
+
+// op reg, rm between registers
+void xRR(int op, int w, int reg, int rm) {
+  xRex(w, reg, 0, rm);
+  xOpcode(op);
+  xByte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [base + disp]
+void xRM(int op, int w, int reg, int base, int disp) {
+  xRex(w, reg, 0, base);
+  xOpcode(op);
+  xByte(0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP)
+    xByte(0x24);
+  xInt(disp);
+}
+
+// op reg, [base + index * 4 + disp]
+void xRMI(int op, int reg, int base, int index, int disp) {
+  xRex(0, reg, index, base);
+  xOpcode(op);
+  xByte(0x80 | ((reg & 7) << 3) | 4);
+  xByte(0x80 | ((index & 7) << 3) | (base & 7));
+  xInt(disp);
+}
+
+void xMovImm(int reg, int value) {
+  xRex(0, 0, 0, reg);
+  xByte(0xB8 + (reg & 7));
+  xInt(value);
+}
+
+// add, or, adc, sbb, and, sub, xor or cmp (ext 0 to 7) with an immediate
+void xAluImm(int ext, int w, int reg, int value) {
+  xRex(w, 0, 0, reg);
+  xByte(0x81);
+  xByte(0xC0 | (ext << 3) | (reg & 7));
+  xInt(value);
+}
+
+void xPush(int reg) {
+  xRex(0, 0, 0, reg);
+  xByte(0x50 + (reg & 7));
+}
+
+void xPop(int reg) {
+  xRex(0, 0, 0, reg);
+  xByte(0x58 + (reg & 7));
+}
+
+// A jump whose rel32 is patched later; returns where it goes
+int xJump(int cc) {
+  if (cc < 0)
+    xByte(0xE9);
+  else {
+    xByte(0x0F);
+    xByte(0x80 | cc);
+  }
+  xInt(0);
+  return native->size - 4;
+}
+
+int xCall(void) {
+  xByte(0xE8);
+  xInt(0);
+  return native->size - 4;
+}
+
+// call [r15 + offset]
+void xCallRuntime(int offset) {
+  xRM(0xFF, 0, 2, R15, offset);
+}
+
+/******************************************************************/
+// Operands
+
+#define ALU_ADD 0x03
+#define ALU_SUB 0x2B
+#define ALU_CMP 0x3B
+#define ALU_IMUL 0x0FAF
+
+int slotOffset(int slot) {
+  return slot * 8;
+}
+
+Loc locOf(IrInstr *instr) {
+  Loc loc;
+  if (instr->op == IR_CONST) {
+    loc.kind = LOC_CONST;
+    loc.reg = instr->value;
+    return loc;
+  }
+  return locs[instr->id];
+}
+
+int sameLoc(Loc a, Loc b) {
+  return (a.kind == b.kind) && (a.kind != LOC_NONE) && (a.reg == b.reg);
+}
+
+void loadLoc(int reg, Loc loc) {
+  switch (loc.kind) {
+  case LOC_REG:
+    if (loc.reg != reg)
+      xRR(0x89, 0, loc.reg, reg);
+    break;
+  case LOC_STACK:
+    xRM(0x8B, 0, reg, RSP, slotOffset(loc.reg));
+    break;
+  case LOC_CONST:
+    xMovImm(reg, loc.reg);
+    break;
+  default:
+    break;
+  }
+}
+
+void storeLoc(Loc loc, int reg) {
+  if (loc.kind == LOC_REG) {
+    if (loc.reg != reg)
+      xRR(0x89, 0, reg, loc.reg);
+  } else if (loc.kind == LOC_STACK)
+    xRM(0x89, 0, reg, RSP, slotOffset(loc.reg));
+}
+
+// reg = reg op loc
+void aluLoc(int op, int reg, Loc loc) {
+  switch (loc.kind) {
+  case LOC_REG:
+    xRR(op, 0, reg, loc.reg);
+    break;
+  case LOC_STACK:
+    xRM(op, 0, reg, RSP, slotOffset(loc.reg));
+    break;
+  case LOC_CONST:
+    if (op == ALU_IMUL) {
+      xRR(0x69, 0, reg, reg);
+      xInt(loc.reg);
+    } else xAluImm((op == ALU_ADD) ? 0 : (op == ALU_SUB) ? 5 : 7, 0, reg, loc.reg);
+    break;
+  default:
+    break;
+  }
+}
+
+void moveLoc(Loc dst, Loc src) {
+  if (sameLoc(dst, src) || (dst.kind == LOC_NONE))
+    return;
+  if (dst.kind == LOC_REG)
+    loadLoc(dst.reg, src);
+  else if (src.kind == LOC_REG)
+    storeLoc(dst, src.reg);
+  else {
+    loadLoc(RAX, src);
+    storeLoc(dst, RAX);
+  }
+}
+
+/******************************************************************/
+// Liveness and linear scan allocation
+
+typedef unsigned long long Bits;
+#define BITS_WORD 64
+
+int bitsWords;
+
+int testBit(Bits *set, int i) {
+  return (set[i / BITS_WORD] >> (i % BITS_WORD)) & 1;
+}
+
+void setBit(Bits *set, int i) {
+  set[i / BITS_WORD] |= 1ULL << (i % BITS_WORD);
+}
+
+int predIndex(IrBlock *block, IrBlock *pred) {
+  int i;
+  for (i = 0; block->preds[i] != pred; i++)
+    ;
+  return i;
+}
+
+// A value needs a location unless it is a constant or a compare the next
+// branch consumes
+int needsLoc(IrInstr *instr) {
+  return (instr->op != IR_CONST) && !fused[instr->id] && !isTerminator(instr->op) &&
+         (instr->op != IR_CHECK) && (instr->op != IR_STORE) && (instr->op != IR_WRITEC) &&
+         (instr->op != IR_WRITEI) && (instr->op != IR_WRITELN);
+}
+
+void extend(int *start, int *end, int id, int position) {
+  if (position < start[id])
+    start[id] = position;
+  if (position > end[id])
+    end[id] = position;
+}
+
+// qsort() has no context, so the interval starts go through here
+int *intervalStart;
+
+int compareStarts(const void *a, const void *b) {
+  return intervalStart[*(int*)a] - intervalStart[*(int*)b];
+}
+
+void allocateRegisters(IrFunction *fn) {
+  IrBlock *block, *succ;
+  IrInstr *instr;
+  Bits *liveIn, *liveOut, *gen, *kill, *in, *out, live;
+  int *start, *end, *blockStart, *blockEnd, *sorted, *active, *activeReg;
+  int n = fn->valueCount, position = 0, count = 0, activeCount = 0, changed;
+  int freeRegs[REGISTER_COUNT];
+  int b, i, j, k, v, w, spill;
+
+  bitsWords = (n + BITS_WORD - 1) / BITS_WORD;
+  liveIn = (Bits*)calloc(fn->blockCount * bitsWords, sizeof(Bits));
+  liveOut = (Bits*)calloc(fn->blockCount * bitsWords, sizeof(Bits));
+  gen = (Bits*)calloc(fn->blockCount * bitsWords, sizeof(Bits));
+  kill = (Bits*)calloc(fn->blockCount * bitsWords, sizeof(Bits));
+  blockStart = (int*)malloc(fn->blockCount * sizeof(int));
+  blockEnd = (int*)malloc(fn->blockCount * sizeof(int));
+
+  // positions in reverse postorder; the phis of a block share its start
+  for (b = 0; b < fn->orderCount; b++) {
+    block = fn->order[b];
+    blockStart[block->id] = position;
+    position += 2;
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      if (instr->op == IR_PHI) {
+        positions[instr->id] = blockStart[block->id];
+        setBit(kill + block->id * bitsWords, instr->id);
+        continue;
+      }
+      for (i = 0; i < instr->argCount; i++)
+        if ((instr->args[i]->op != IR_CONST) && !testBit(kill + block->id * bitsWords, instr->args[i]->id))
+          setBit(gen + block->id * bitsWords, instr->args[i]->id);
+      setBit(kill + block->id * bitsWords, instr->id);
+      positions[instr->id] = position;
+      position += 2;
+    }
+    blockEnd[block->id] = position - 1;
+  }
+
+  // live out: what the successors need, with the phi arguments along the edge
+  do {
+    changed = 0;
+    for (b = fn->orderCount - 1; b >= 0; b--) {
+      block = fn->order[b];
+      in = liveIn + block->id * bitsWords;
+      out = liveOut + block->id * bitsWords;
+      for (k = 0; k < block->succCount; k++) {
+        succ = block->succs[k];
+        for (w = 0; w < bitsWords; w++)
+          if ((out[w] | liveIn[succ->id * bitsWords + w]) != out[w]) {
+            out[w] |= liveIn[succ->id * bitsWords + w];
+            changed = 1;
+          }
+        j = predIndex(succ, block);
+        for (instr = succ->first; (instr != NULL) && (instr->op == IR_PHI); instr = instr->next)
+          if ((instr->args[j]->op != IR_CONST) && !testBit(out, instr->args[j]->id)) {
+            setBit(out, instr->args[j]->id);
+            changed = 1;
+          }
+      }
+      for (w = 0; w < bitsWords; w++) {
+        live = gen[block->id * bitsWords + w] | (out[w] & ~kill[block->id * bitsWords + w]);
+        if (live != in[w]) {
+          in[w] = live;
+          changed = 1;
+        }
+      }
+    }
+  } while (changed);
+
+  // one interval per value, from its first to its last live point
+  start = (int*)malloc(n * sizeof(int));
+  end = (int*)malloc(n * sizeof(int));
+  for (v = 0; v < n; v++) {
+    start[v] = INT_MAX;
+    end[v] = -1;
+  }
+  for (b = 0; b < fn->orderCount; b++) {
+    block = fn->order[b];
+    for (w = 0; w < bitsWords; w++) {
+      live = liveIn[block->id * bitsWords + w];
+      for (; live != 0; live &= live - 1)
+        extend(start, end, w * BITS_WORD + __builtin_ctzll(live), blockStart[block->id]);
+      live = liveOut[block->id * bitsWords + w];
+      for (; live != 0; live &= live - 1)
+        extend(start, end, w * BITS_WORD + __builtin_ctzll(live), blockEnd[block->id]);
+    }
+    for (instr = block->first; instr != NULL; instr = instr->next) {
+      extend(start, end, instr->id, positions[instr->id]);
+      if (instr->op != IR_PHI)
+        for (i = 0; i < instr->argCount; i++)
+          extend(start, end, instr->args[i]->id, positions[instr->id]);
+    }
+  }
+
+  sorted = (int*)malloc(n * sizeof(int));
+  for (b = 0; b < fn->orderCount; b++)
+    for (instr = fn->order[b]->first; instr != NULL; instr = instr->next)
+      if (needsLoc(instr))
+        sorted[count++] = instr->id;
+  intervalStart = start;
+  qsort(sorted, count, sizeof(int), compareStarts);
+
+  active = (int*)malloc((REGISTER_COUNT + 1) * sizeof(int));
+  activeReg = (int*)malloc((REGISTER_COUNT + 1) * sizeof(int));
+  for (k = 0; k < REGISTER_COUNT; k++) {
+    freeRegs[k] = 1;
+    usedRegisters[k] = 0;
+  }
+  slotCount = 0;
+  for (i = 0; i < count; i++) {
+    v = sorted[i];
+    for (j = 0; j < activeCount; j++)
+      if (end[active[j]] < start[v]) {
+        freeRegs[activeReg[j]] = 1;
+        active[j] = active[activeCount - 1];
+        activeReg[j] = activeReg[activeCount - 1];
+        activeCount --;
+        j --;
+      }
+    for (k = 0; (k < REGISTER_COUNT) && !freeRegs[k]; k++)
+      ;
+    if (k < REGISTER_COUNT) {
+      freeRegs[k] = 0;
+      usedRegisters[k] = 1;
+      locs[v].kind = LOC_REG;
+      locs[v].reg = allocatable[k];
+      active[activeCount] = v;
+      activeReg[activeCount++] = k;
+      continue;
+    }
+    // no register left: the interval ending last goes to the stack
+    spill = 0;
+    for (j = 1; j < activeCount; j++)
+      if (end[active[j]] > end[active[spill]])
+        spill = j;
+    if (end[active[spill]] > end[v]) {
+      locs[v] = locs[active[spill]];
+      locs[active[spill]].kind = LOC_STACK;
+      locs[active[spill]].reg = slotCount++;
+      active[spill] = v;
+    } else {
+      locs[v].kind = LOC_STACK;
+      locs[v].reg = slotCount++;
+    }
+  }
+
+  free(liveIn);
+  free(liveOut);
+  free(gen);
+  free(kill);
+  free(blockStart);
+  free(blockEnd);
+  free(start);
+  free(end);
+  free(sorted);
+  free(active);
+  free(activeReg);
+}
+
+/******************************************************************/
+// Instructions
+
+void blockFixup(int at, IrBlock *target) {
+  if (blockFixupCount == blockFixupCapacity) {
+    blockFixupCapacity = blockFixupCapacity ? blockFixupCapacity * 2 : 256;
+    blockFixups = (NativeFixup*)realloc(blockFixups, blockFixupCapacity * sizeof(NativeFixup));
+  }
+  blockFixups[blockFixupCount].at = at;
+  blockFixups[blockFixupCount].target = target->id;
+  blockFixupCount ++;
+}
+
+void callFixup(int at, int function) {
+  if (callFixupCount == callFixupCapacity) {
+    callFixupCapacity = callFixupCapacity ? callFixupCapacity * 2 : 256;
+    callFixups = (NativeFixup*)realloc(callFixups, callFixupCapacity * sizeof(NativeFixup));
+  }
+  callFixups[callFixupCount].at = at;
+  callFixups[callFixupCount].target = function;
+  callFixupCount ++;
+}
+
+// A conditional jump to the error exit, reporting err at instr
+void errorJump(int cc, ErrorCode err, IrInstr *instr) {
+  if (errorSiteCount == errorSiteCapacity) {
+    errorSiteCapacity = errorSiteCapacity ? errorSiteCapacity * 2 : 64;
+    errorSites = (ErrorSite*)realloc(errorSites, errorSiteCapacity * sizeof(ErrorSite));
+  }
+  errorSites[errorSiteCount].at = xJump(cc);
+  errorSites[errorSiteCount].err = err;
+  errorSites[errorSiteCount].lineNo = instr->lineNo;
+  errorSites[errorSiteCount].colNo = instr->colNo;
+  errorSiteCount ++;
+}
+
+int conditionOf(IrOp op) {
+  switch (op) {
+  case IR_EQ: return CC_E;
+  case IR_NE: return CC_NE;
+  case IR_LT: return CC_L;
+  case IR_LE: return CC_LE;
+  case IR_GT: return CC_G;
+  default: return CC_GE;
+  }
+}
+
+// Calls a C function of the runtime with eax as its argument, keeping the
+// values in caller-saved registers and aligning the stack for it
+void runtimeCall(int offset, IrInstr *arg) {
+  int i;
+  if (arg != NULL)
+    loadLoc(RAX, locOf(arg));
+  for (i = 0; i < CALLER_SAVED_COUNT; i++)
+    xPush(callerSaved[i]);
+  xRR(0x89, 0, RAX, RDI);
+  xPush(RBP);
+  xRR(0x89, 1, RSP, RBP);
+  xRex(1, 0, 0, RSP);
+  xByte(0x83);
+  xByte(0xE4);
+  xByte(0xF0);
+  xCallRuntime(offset);
+  xRR(0x89, 1, RBP, RSP);
+  xPop(RBP);
+  for (i = CALLER_SAVED_COUNT - 1; i >= 0; i--)
+    xPop(callerSaved[i]);
+}
+
+// Gives the phis of to their values along the edge from, all at once
+void nativeEdgeMoves(IrBlock *from, IrBlock *to) {
+  IrInstr *phi, *other;
+  int index = predIndex(to, from), conflict = 0, k;
+
+  for (phi = to->first; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next)
+    for (other = to->first; (other != NULL) && (other->op == IR_PHI); other = other->next)
+      if ((other != phi) && sameLoc(locOf(phi), locOf(other->args[index])))
+        conflict = 1;
+
+  if (!conflict) {
+    for (phi = to->first; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next)
+      moveLoc(locOf(phi), locOf(phi->args[index]));
+    return;
+  }
+  // through the scratch slots when one phi feeds another
+  for (phi = to->first, k = 0; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next, k++) {
+    loadLoc(RAX, locOf(phi->args[index]));
+    xRM(0x89, 0, RAX, RSP, slotOffset(scratchSlot + k));
+  }
+  for (phi = to->first, k = 0; (phi != NULL) && (phi->op == IR_PHI); phi = phi->next, k++) {
+    xRM(0x8B, 0, RAX, RSP, slotOffset(scratchSlot + k));
+    storeLoc(locOf(phi), RAX);
+  }
+}
+
+int hasPhis(IrBlock *block) {
+  return (block->first != NULL) && (block->first->op == IR_PHI);
+}
+
+void epilogue(void) {
+  int k;
+  if (slotCount > 0)
+    xAluImm(0, 1, RSP, slotCount * 8);
+  for (k = REGISTER_COUNT - 1; k >= 0; k--)
+    if (usedRegisters[k])
+      xPop(allocatable[k]);
+  xByte(0xC3);
+}
+
+void nativeCall(IrInstr *instr) {
+  int callerFrame = nativeFn->frameSize;
+  int calleeFrame = nativeProgram->functions[instr->value]->frameSize;
+  int i;
+
+  // both stacks must have room for the callee
+  xRM(0x3B, 1, RSP, R15, offsetof(NativeRuntime, stackLimit));
+  errorJump(0x2, ERR_STACKOVERFLOW, instr);
+  xRR(0x89, 0, R13, RAX);
+  xAluImm(0, 0, RAX, callerFrame + calleeFrame);
+  xAluImm(7, 0, RAX, STACK_SIZE);
+  errorJump(0x3, ERR_STACKOVERFLOW, instr);
+
+  if (calleeFrame <= UNROLLED_CLEAR)
+    for (i = 0; i < calleeFrame; i++) {
+      xRMI(0xC7, 0, R14, R13, (callerFrame + i) * 4);
+      xInt(0);
+    }
+  else {
+    xPush(RDI);
+    xRex(1, RDI, R13, R14);
+    xByte(0x8D);
+    xByte(0x84 | ((RDI & 7) << 3));
+    xByte(0x80 | ((R13 & 7) << 3) | (R14 & 7));
+    xInt(callerFrame * 4);
+    xMovImm(RCX, calleeFrame);
+    xRR(0x31, 0, RAX, RAX);
+    xByte(0xF3);
+    xByte(0xAB);
+    xPop(RDI);
+  }
+
+  xRR(0x89, 0, R13, RCX);
+  for (i = 0; i < instr->hops; i++)
+    xRMI(0x8B, RCX, R14, RCX, FRAME_STATIC_LINK * 4);
+  xRMI(0x89, R13, R14, R13, (callerFrame + FRAME_DYNAMIC_LINK) * 4);
+  xRMI(0x89, RCX, R14, R13, (callerFrame + FRAME_STATIC_LINK) * 4);
+  for (i = 0; i < instr->argCount; i++) {
+    loadLoc(RAX, locOf(instr->args[i]));
+    xRMI(0x89, RAX, R14, R13, (callerFrame + FRAME_HEADER + i) * 4);
+  }
+  xAluImm(0, 0, R13, callerFrame);
+  callFixup(xCall(), instr->value);
+  xAluImm(5, 0, R13, callerFrame);
+  storeLoc(locs[instr->id], RAX);
+}
+
+// Jumps along the edge to target, unless it comes next
+void nativeJumpTo(IrBlock *target, IrBlock *next) {
+  if (target != next)
+    blockFixup(xJump(-1), target);
+}
+
+void nativeBranch(IrInstr *instr, IrBlock *next, EdgeStub *stubs, int *stubCount) {
+  IrBlock *block = instr->block, *onTrue = block->succs[0], *onFalse = block->succs[1];
+  IrInstr *condition = instr->args[0];
+  int cc, at;
+
+  if (fused[condition->id]) {
+    loadLoc(RAX, locOf(condition->args[0]));
+    aluLoc(ALU_CMP, RAX, locOf(condition->args[1]));
+    cc = conditionOf(condition->op);
+  } else {
+    loadLoc(RAX, locOf(condition));
+    xRR(0x85, 0, RAX, RAX);
+    cc = CC_NE;
+  }
+
+  // falls through to the next block when it is one of the two
+  if ((onTrue == next) && !hasPhis(onTrue)) {
+    onTrue = onFalse;
+    onFalse = next;
+    cc ^= 1;
+  }
+  at = xJump(cc);
+  if (hasPhis(onTrue)) {
+    stubs[*stubCount].at = at;
+    stubs[*stubCount].from = block;
+    stubs[*stubCount].to = onTrue;
+    (*stubCount) ++;
+  } else blockFixup(at, onTrue);
+  if (hasPhis(onFalse))
+    nativeEdgeMoves(block, onFalse);
+  nativeJumpTo(onFalse, next);
+}
+
+void nativeInstr(IrInstr *instr, IrBlock *next, EdgeStub *stubs, int *stubCount) {
+  Loc dst = locs[instr->id];
+  int i;
+
+  switch (instr->op) {
+  case IR_CONST:
+  case IR_PHI:
+    break;
+  case IR_FRAME:
+    xRR(0x89, 0, R13, RAX);
+    for (i = 0; i < instr->hops; i++)
+      xRMI(0x8B, RAX, R14, RAX, FRAME_STATIC_LINK * 4);
+    if (instr->value != 0)
+      xAluImm(0, 0, RAX, instr->value);
+    storeLoc(dst, RAX);
+    break;
+  case IR_COPY:
+    moveLoc(dst, locOf(instr->args[0]));
+    break;
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+    loadLoc(RAX, locOf(instr->args[0]));
+    aluLoc((instr->op == IR_ADD) ? ALU_ADD : (instr->op == IR_SUB) ? ALU_SUB : ALU_IMUL, RAX, locOf(instr->args[1]));
+    storeLoc(dst, RAX);
+    break;
+  case IR_DIV:
+    // x / -1 wraps like the interpreters instead of trapping
+    loadLoc(RCX, locOf(instr->args[1]));
+    xRR(0x85, 0, RCX, RCX);
+    errorJump(CC_E, ERR_DIVISIONBYZERO, instr);
+    loadLoc(RAX, locOf(instr->args[0]));
+    xAluImm(7, 0, RCX, -1);
+    xByte(0x75);
+    xByte(4);
+    xRR(0xF7, 0, 3, RAX);
+    xByte(0xEB);
+    xByte(3);
+    xByte(0x99);
+    xRR(0xF7, 0, 7, RCX);
+    storeLoc(dst, RAX);
+    break;
+  case IR_NEG:
+    loadLoc(RAX, locOf(instr->args[0]));
+    xRR(0xF7, 0, 3, RAX);
+    storeLoc(dst, RAX);
+    break;
+  case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    if (fused[instr->id])
+      break;
+    loadLoc(RAX, locOf(instr->args[0]));
+    aluLoc(ALU_CMP, RAX, locOf(instr->args[1]));
+    xByte(0x0F);
+    xByte(0x90 | conditionOf(instr->op));
+    xByte(0xC0);
+    xRR(0x0FB6, 0, RAX, RAX);
+    storeLoc(dst, RAX);
+    break;
+  case IR_CHECK:
+    loadLoc(RAX, locOf(instr->args[0]));
+    xAluImm(7, 0, RAX, 1);
+    errorJump(CC_L, ERR_INDEXOUTOFRANGE, instr);
+    xAluImm(7, 0, RAX, instr->value);
+    errorJump(CC_G, ERR_INDEXOUTOFRANGE, instr);
+    break;
+  case IR_LOAD:
+    loadLoc(RCX, locOf(instr->args[0]));
+    xRMI(0x8B, RAX, R14, RCX, 0);
+    storeLoc(dst, RAX);
+    break;
+  case IR_STORE:
+    loadLoc(RCX, locOf(instr->args[0]));
+    loadLoc(RAX, locOf(instr->args[1]));
+    xRMI(0x89, RAX, R14, RCX, 0);
+    break;
+  case IR_CALL:
+    nativeCall(instr);
+    break;
+  case IR_READC:
+    runtimeCall(offsetof(NativeRuntime, readChar), NULL);
+    storeLoc(dst, RAX);
+    break;
+  case IR_READI:
+    runtimeCall(offsetof(NativeRuntime, readInteger), NULL);
+    storeLoc(dst, RAX);
+    break;
+  case IR_WRITEC:
+    runtimeCall(offsetof(NativeRuntime, writeChar), instr->args[0]);
+    break;
+  case IR_WRITEI:
+    runtimeCall(offsetof(NativeRuntime, writeInteger), instr->args[0]);
+    break;
+  case IR_WRITELN:
+    runtimeCall(offsetof(NativeRuntime, writeLine), NULL);
+    break;
+  case IR_JUMP:
+    if (hasPhis(instr->block->succs[0]))
+      nativeEdgeMoves(instr->block, instr->block->succs[0]);
+    nativeJumpTo(instr->block->succs[0], next);
+    break;
+  case IR_BRANCH:
+    nativeBranch(instr, next, stubs, stubCount);
+    break;
+  case IR_RETURN:
+    if (instr->argCount > 0)
+      loadLoc(RAX, locOf(instr->args[0]));
+    epilogue();
+    break;
+  default:
+    break;
+  }
+}
+
+// A compare feeding only the branch right after it becomes a cmp and a jcc
+void findFusedCompares(IrFunction *fn) {
+  IrInstr *instr;
+  int b, i;
+
+  for (b = 0; b < fn->orderCount; b++)
+    for (instr = fn->order[b]->first; instr != NULL; instr = instr->next)
+      for (i = 0; i < instr->argCount; i++)
+        useCounts[instr->args[i]->id] ++;
+  for (b = 0; b < fn->orderCount; b++) {
+    instr = fn->order[b]->last;
+    if ((instr != NULL) && (instr->op == IR_BRANCH) && (instr->prev == instr->args[0]) &&
+        (instr->args[0]->op >= IR_EQ) && (instr->args[0]->op <= IR_GE) && (useCounts[instr->args[0]->id] == 1))
+      fused[instr->args[0]->id] = 1;
+  }
+}
+
+void nativeFunction(IrFunction *fn, int index) {
+  IrBlock *block, *next;
+  IrInstr *instr;
+  EdgeStub *stubs;
+  int stubCount = 0, maxPhis = 0, phis, b, i, k;
+
+  nativeFn = fn;
+  irDominators(fn);
+  locs = (Loc*)calloc(fn->valueCount, sizeof(Loc));
+  positions = (int*)calloc(fn->valueCount, sizeof(int));
+  useCounts = (int*)calloc(fn->valueCount, sizeof(int));
+  fused = (int*)calloc(fn->valueCount, sizeof(int));
+  blockOffsets = (int*)malloc(fn->blockCount * sizeof(int));
+  stubs = (EdgeStub*)malloc(2 * fn->blockCount * sizeof(EdgeStub));
+
+  findFusedCompares(fn);
+  allocateRegisters(fn);
+  for (b = 0; b < fn->orderCount; b++) {
+    phis = 0;
+    for (instr = fn->order[b]->first; (instr != NULL) && (instr->op == IR_PHI); instr = instr->next)
+      phis ++;
+    if (phis > maxPhis)
+      maxPhis = phis;
+  }
+  scratchSlot = slotCount;
+  slotCount += maxPhis;
+
+  native->entries[index] = native->size;
+  for (k = 0; k < REGISTER_COUNT; k++)
+    if (usedRegisters[k])
+      xPush(allocatable[k]);
+  if (slotCount > 0)
+    xAluImm(5, 1, RSP, slotCount * 8);
+
+  for (b = 0; b < fn->orderCount; b++) {
+    block = fn->order[b];
+    next = (b + 1 < fn->orderCount) ? fn->order[b + 1] : NULL;
+    blockOffsets[block->id] = native->size;
+    for (instr = block->first; instr != NULL; instr = instr->next)
+      nativeInstr(instr, next, stubs, &stubCount);
+  }
+  for (i = 0; i < stubCount; i++) {
+    xPatch(stubs[i].at, native->size);
+    nativeEdgeMoves(stubs[i].from, stubs[i].to);
+    blockFixup(xJump(-1), stubs[i].to);
+  }
+  for (i = 0; i < errorSiteCount; i++) {
+    xPatch(errorSites[i].at, native->size);
+    xMovImm(RDI, errorSites[i].err);
+    xMovImm(RSI, errorSites[i].lineNo);
+    xMovImm(RDX, errorSites[i].colNo);
+    xPatch(xJump(-1), errorExit);
+  }
+  for (i = 0; i < blockFixupCount; i++)
+    xPatch(blockFixups[i].at, blockOffsets[blockFixups[i].target]);
+  blockFixupCount = 0;
+  errorSiteCount = 0;
+
+  free(locs);
+  free(positions);
+  free(useCounts);
+  free(fused);
+  free(blockOffsets);
+  free(stubs);
+}
+
+// int kpl_main(NativeRuntime *rt): saves what C needs kept, moves to the
+// machine stack of the runtime, clears the main frame and calls the main
+// program. The error exit comes back here from any depth.
+void nativeEntry(IrProgram *program) {
+  int exitLabel, done;
+
+  native->mainEntry = native->size;
+  xPush(RBX);
+  xPush(RBP);
+  xPush(R12);
+  xPush(R13);
+  xPush(R14);
+  xPush(R15);
+  xAluImm(5, 1, RSP, 8);
+  xRR(0x89, 1, RDI, R15);
+  xRM(0x89, 1, RSP, R15, offsetof(NativeRuntime, savedStack));
+  xRM(0x8B, 1, RSP, R15, offsetof(NativeRuntime, stackTop));
+  xRM(0x8B, 1, R14, R15, offsetof(NativeRuntime, cells));
+  xRR(0x31, 0, R13, R13);
+  xRR(0x89, 1, R14, RDI);
+  xMovImm(RCX, program->functions[0]->frameSize);
+  xRR(0x31, 0, RAX, RAX);
+  xByte(0xF3);
+  xByte(0xAB);
+  callFixup(xCall(), 0);
+  xMovImm(RAX, IO_SUCCESS);
+  done = xJump(-1);
+
+  errorExit = native->size;
+  xRM(0x8B, 1, RSP, R15, offsetof(NativeRuntime, savedStack));
+  xCallRuntime(offsetof(NativeRuntime, error));
+  xMovImm(RAX, RUN_ERROR);
+
+  exitLabel = native->size;
+  xPatch(done, exitLabel);
+  xRM(0x8B, 1, RSP, R15, offsetof(NativeRuntime, savedStack));
+  xAluImm(0, 1, RSP, 8);
+  xPop(R15);
+  xPop(R14);
+  xPop(R13);
+  xPop(R12);
+  xPop(RBP);
+  xPop(RBX);
+  xByte(0xC3);
+}
+
+NativeCode* generateNative(IrProgram *program) {
+  int i;
+
+  native = (NativeCode*)calloc(1, sizeof(NativeCode));
+  native->functionCount = program->count;
+  native->entries = (int*)malloc(program->count * sizeof(int));
+  native->names = (char**)malloc(program->count * sizeof(char*));
+  nativeProgram = program;
+
+  nativeEntry(program);
+  for (i = 0; i < program->count; i++) {
+    native->names[i] = strdup(program->functions[i]->name);
+    nativeFunction(program->functions[i], i);
+  }
+  for (i = 0; i < callFixupCount; i++)
+    xPatch(callFixups[i].at, native->entries[callFixups[i].target]);
+  callFixupCount = 0;
+  return native;
+}
+
+void freeNativeCode(NativeCode *code) {
+  int i;
+  if (code == NULL)
+    return;
+  for (i = 0; i < code->functionCount; i++)
+    free(code->names[i]);
+  free(code->names);
+  free(code->entries);
+  free(code->code);
+  free(code);
+}
+
+/******************************************************************/
+// Running
+
+extern __thread FILE *outputStream;
+
+// Allocated by the first run and kept for the next ones
+int *nativeCells;
+char *nativeStack;
+
+void nativeWriteInteger(int value) {
+  fprintf(outputStream, "%d", value);
+}
+
+void nativeWriteChar(int value) {
+  writeCodePoint(outputStream, value);
+}
+
+void nativeWriteLine(void) {
+  fputc('\n', outputStream);
+}
+
+int nativeReadInteger(void) {
+  int value;
+  return (scanf("%d", &value) == 1) ? value : 0;
+}
+
+int nativeReadChar(void) {
+  return readCodePoint(stdin);
+}
+
+void nativeError(int err, int lineNo, int colNo) {
+  noteError((ErrorCode)err, lineNo, colNo);
+}
+
+int initNativeRuntime(NativeRuntime *rt) {
+  if (outputStream == NULL)
+    outputStream = stdout;
+  if (nativeCells == NULL)
+    nativeCells = (int*)malloc(STACK_SIZE * sizeof(int));
+  if (nativeStack == NULL) {
+    nativeStack = (char*)mmap(NULL, NATIVE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (nativeStack == MAP_FAILED)
+      nativeStack = NULL;
+  }
+  if ((nativeCells == NULL) || (nativeStack == NULL))
+    return IO_ERROR;
+  memset(rt, 0, sizeof(NativeRuntime));
+  rt->cells = nativeCells;
+  rt->stackTop = nativeStack + NATIVE_STACK_SIZE;
+  rt->stackLimit = nativeStack + NATIVE_STACK_MARGIN;
+  rt->writeInteger = nativeWriteInteger;
+  rt->writeChar = nativeWriteChar;
+  rt->writeLine = nativeWriteLine;
+  rt->readInteger = nativeReadInteger;
+  rt->readChar = nativeReadChar;
+  rt->error = nativeError;
+  return IO_SUCCESS;
+}
+
+void freeNativeRuntime(NativeRuntime *rt) {
+  // the stacks are kept for the next run
+  rt->cells = NULL;
+}
+
+int runNative(NativeCode *code) {
+  NativeRuntime rt;
+  unsigned char *mapping;
+  int (*entry)(NativeRuntime*);
+  int result;
+
+  if (initNativeRuntime(&rt) != IO_SUCCESS) {
+    noteError(ERR_STACKOVERFLOW, 0, 0);
+    return RUN_ERROR;
+  }
+  // written while writable, then executable and no longer writable
+  mapping = (unsigned char*)mmap(NULL, code->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED)
+    return RUN_ERROR;
+  memcpy(mapping, code->code, code->size);
+  if (mprotect(mapping, code->size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mapping, code->size);
+    return RUN_ERROR;
+  }
+  entry = (int (*)(NativeRuntime*))(mapping + code->mainEntry);
+  result = entry(&rt);
+  fflush(outputStream);
+  munmap(mapping, code->size);
+  freeNativeRuntime(&rt);
+  return result;
+}
+
+/******************************************************************/
+// ELF objects
+
+// Sections: null, .text, .symtab, .strtab, .shstrtab, .note.GNU-stack
+#define SECTION_COUNT 6
+
+int addString(char **table, int *size, char *s) {
+  int at = *size;
+  *table = (char*)realloc(*table, *size + strlen(s) + 1);
+  strcpy(*table + at, s);
+  *size += strlen(s) + 1;
+  return at;
+}
+
+int writeNativeObject(NativeCode *code, char *fileName) {
+  static char sectionNames[] = "\0.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+  Elf64_Ehdr header;
+  Elf64_Shdr sections[SECTION_COUNT];
+  Elf64_Sym *symbols;
+  char *strings = NULL, name[64];
+  int stringSize = 0, symbolCount, i;
+  long offset;
+  FILE *f;
+
+  // the functions are local, kpl_main the one global symbol
+  symbolCount = code->functionCount + 2;
+  symbols = (Elf64_Sym*)calloc(symbolCount, sizeof(Elf64_Sym));
+  addString(&strings, &stringSize, "");
+  for (i = 0; i < code->functionCount; i++) {
+    snprintf(name, sizeof(name), "kpl_%d_%s", i, code->names[i]);
+    symbols[i + 1].st_name = addString(&strings, &stringSize, name);
+    symbols[i + 1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_FUNC);
+    symbols[i + 1].st_shndx = 1;
+    symbols[i + 1].st_value = code->entries[i];
+  }
+  symbols[symbolCount - 1].st_name = addString(&strings, &stringSize, NATIVE_ENTRY);
+  symbols[symbolCount - 1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+  symbols[symbolCount - 1].st_shndx = 1;
+  symbols[symbolCount - 1].st_value = code->mainEntry;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_REL;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_shentsize = sizeof(Elf64_Shdr);
+  header.e_shnum = SECTION_COUNT;
+  header.e_shstrndx = 4;
+
+  memset(sections, 0, sizeof(sections));
+  offset = sizeof(Elf64_Ehdr);
+  sections[1].sh_name = 1;
+  sections[1].sh_type = SHT_PROGBITS;
+  sections[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+  sections[1].sh_offset = offset;
+  sections[1].sh_size = code->size;
+  sections[1].sh_addralign = 16;
+  offset += code->size;
+  offset = (offset + 7) & ~7L;
+  sections[2].sh_name = 7;
+  sections[2].sh_type = SHT_SYMTAB;
+  sections[2].sh_offset = offset;
+  sections[2].sh_size = symbolCount * sizeof(Elf64_Sym);
+  sections[2].sh_link = 3;
+  sections[2].sh_info = symbolCount - 1;
+  sections[2].sh_addralign = 8;
+  sections[2].sh_entsize = sizeof(Elf64_Sym);
+  offset += sections[2].sh_size;
+  sections[3].sh_name = 15;
+  sections[3].sh_type = SHT_STRTAB;
+  sections[3].sh_offset = offset;
+  sections[3].sh_size = stringSize;
+  sections[3].sh_addralign = 1;
+  offset += stringSize;
+  sections[4].sh_name = 23;
+  sections[4].sh_type = SHT_STRTAB;
+  sections[4].sh_offset = offset;
+  sections[4].sh_size = sizeof(sectionNames);
+  sections[4].sh_addralign = 1;
+  offset += sizeof(sectionNames);
+  sections[5].sh_name = 33;
+  sections[5].sh_type = SHT_PROGBITS;
+  sections[5].sh_offset = offset;
+  sections[5].sh_addralign = 1;
+  offset = (offset + 7) & ~7L;
+  header.e_shoff = offset;
+
+  f = fopen(fileName, "wb");
+  if (f == NULL) {
+    free(symbols);
+    free(strings);
+    return IO_ERROR;
+  }
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(code->code, 1, code->size, f);
+  while (ftell(f) < (long)sections[2].sh_offset)
+    fputc(0, f);
+  fwrite(symbols, sizeof(Elf64_Sym), symbolCount, f);
+  fwrite(strings, 1, stringSize, f);
+  fwrite(sectionNames, 1, sizeof(sectionNames), f);
+  while (ftell(f) < offset)
+    fputc(0, f);
+  fwrite(sections, sizeof(Elf64_Shdr), SECTION_COUNT, f);
+  fclose(f);
+  free(symbols);
+  free(strings);
+  return IO_SUCCESS;
+}
@@ -0,0 +1,53 @@
+/* x86-64 code generator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __NATIVE_H__
+#define __NATIVE_H__
+
+#include "ir.h"
+
+#define NATIVE_ENTRY "kpl_main"
+
+// What the generated code needs from its host; r15 points at it all along,
+// so the code itself has no relocations. An object written by
+// writeNativeObject() exports int kpl_main(NativeRuntime *rt).
+typedef struct {
+  int *cells;                  // the frames, STACK_SIZE cells
+  char *stackTop;              // the machine stack the code runs on
+  char *stackLimit;
+  char *savedStack;            // the caller's, while the code runs
+  void (*writeInteger)(int value);
+  void (*writeChar)(int value);
+  void (*writeLine)(void);
+  int (*readInteger)(void);
+  int (*readChar)(void);
+  void (*error)(int err, int lineNo, int colNo);
+} NativeRuntime;
+
+typedef struct {
+  unsigned char *code;
+  int size, capacity;
+  int *entries;                // of every function, numbered as in the IR
+  char **names;
+  int functionCount;
+  int mainEntry;               // of kpl_main
+} NativeCode;
+
+// Translates the IR of a program; its passes should have run already
+NativeCode* generateNative(IrProgram *program);
+void freeNativeCode(NativeCode *code);
+
+// Maps the code executable and runs it, with its output on outputStream;
+// returns IO_SUCCESS or RUN_ERROR
+int runNative(NativeCode *code);
+// Writes the code as an x86-64 ELF relocatable object
+int writeNativeObject(NativeCode *code, char *fileName);
+
+// The runtime runNative() uses, for hosts linking a written object
+int initNativeRuntime(NativeRuntime *rt);
+void freeNativeRuntime(NativeRuntime *rt);
+
+#endif
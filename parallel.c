@@ -0,0 +1,353 @@
+/* Parallel parsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "reader.h"
+#include "charcode.h"
+#include "parser.h"
+#include "cache.h"
+#include "sema.h"
+#include "stats.h"
+#include "parallel.h"
+
+#define WORKER_STACK_SIZE (64 << 20)
+
+// A top-level subroutine, from its FUNCTION or PROCEDURE to the first token
+// after it, and what parsing it alone printed
+typedef struct {
+  long start;
+  int lineNo, colNo;
+  char *output;
+  size_t outputLength;
+  int status;
+  int stopLineNo, stopColNo;   // lookAhead once it was parsed, 0 if it was not
+  int ranOut;                  // it failed at the end of its part, so may need what follows
+} SubTask;
+
+int parallelParse;
+
+char *source;
+long sourceLength;
+SubTask *subTasks;
+int subTaskCount, subTaskCapacity;
+int nextSubTask;
+pthread_mutex_t subTaskLock = PTHREAD_MUTEX_INITIALIZER;
+// The BEGIN of the main block
+long mainStart;
+int mainLineNo, mainColNo;
+
+// What the main thread parses itself: the program less its subroutines.
+// The output of the subroutines goes in at skippedOutput.
+int skipped;
+size_t skeletonLength, skippedOutput;
+
+__thread int stopLineNo, stopColNo;
+// The subroutine this thread is parsing
+__thread SubTask *runningTask;
+
+extern __thread FILE *outputStream;
+extern __thread int currentChar;
+extern __thread Token *lookAhead;
+extern __thread int blockLevel;
+extern __thread int nestingDepth;
+extern void (*subDeclHook)(void);
+extern CharCode charCodes[];
+
+/******************************************************************/
+
+void addSubTask(long start, int lineNo, int colNo) {
+  if (subTaskCount == subTaskCapacity) {
+    subTaskCapacity = subTaskCapacity ? subTaskCapacity * 2 : 64;
+    subTasks = (SubTask*)realloc(subTasks, subTaskCapacity * sizeof(SubTask));
+  }
+  subTasks[subTaskCount].start = start;
+  subTasks[subTaskCount].lineNo = lineNo;
+  subTasks[subTaskCount].colNo = colNo;
+  subTasks[subTaskCount].output = NULL;
+  subTasks[subTaskCount].outputLength = 0;
+  subTaskCount ++;
+}
+
+// Whether the word of length characters at start spells keyword
+int isKeyword(long start, int length, char *keyword) {
+  int i;
+  for (i = 0; i < length; i++)
+    if ((keyword[i] == '\0') || (toupper((unsigned char)source[start + i]) != keyword[i]))
+      return 0;
+  return keyword[length] == '\0';
+}
+
+// Finds the top-level subroutines from their keywords alone, positions
+// counted as the reader counts them. A FUNCTION or PROCEDURE met outside any
+// subroutine starts one; every header is closed by the END that closes its
+// body, and the first BEGIN outside subroutines opens the main block. The
+// parse checks each guess, so a program this gets wrong is only slower.
+void findSubroutines(void) {
+  long i = 0, start;
+  int lineNo = 1, colNo = 1, length;
+  int headers = 0, depth = 0;
+
+  subTaskCount = 0;
+  mainStart = -1;
+  while (i < sourceLength) {
+    switch (charCodes[(unsigned char)source[i]]) {
+    case CHAR_LETTER:
+      start = i;
+      while ((i < sourceLength) && ((charCodes[(unsigned char)source[i]] == CHAR_LETTER) ||
+                                    (charCodes[(unsigned char)source[i]] == CHAR_DIGIT)))
+        i ++;
+      length = (int)(i - start);
+      if (isKeyword(start, length, "FUNCTION") || isKeyword(start, length, "PROCEDURE")) {
+        if (headers == 0)
+          addSubTask(start, lineNo, colNo);
+        headers ++;
+      } else if (isKeyword(start, length, "BEGIN")) {
+        if (headers == 0) {
+          mainStart = start;
+          mainLineNo = lineNo;
+          mainColNo = colNo;
+          return;
+        }
+        depth ++;
+      } else if (isKeyword(start, length, "END") && (depth > 0)) {
+        depth --;
+        if (depth == 0)
+          headers --;
+      }
+      colNo += length;
+      break;
+    case CHAR_LPAR:
+      i ++;
+      colNo ++;
+      if ((i >= sourceLength) || (source[i] != '*'))
+        break;
+      // a comment, up to the first *) after its (*
+      i ++;
+      colNo ++;
+      while ((i < sourceLength) && !((source[i] == '*') && (i + 1 < sourceLength) && (source[i + 1] == ')'))) {
+        if (source[i] == '\n') {
+          lineNo ++;
+          colNo = 0;
+        }
+        if ((source[i] & 0xC0) != 0x80)
+          colNo ++;
+        i ++;
+      }
+      i += 2;
+      colNo += 2;
+      break;
+    case CHAR_SINGLEQUOTE:
+      // the quoted character may be anything, a newline or a quote included
+      if ((i + 1 < sourceLength) && (source[i + 1] == '\n')) {
+        lineNo ++;
+        colNo = -1;
+      }
+      i += 2;
+      colNo += 2;
+      while ((i < sourceLength) && ((source[i] & 0xC0) == 0x80))
+        i ++;
+      if ((i < sourceLength) && (source[i] == '\'')) {
+        i ++;
+        colNo ++;
+      }
+      break;
+    default:
+      if (source[i] == '\n') {
+        lineNo ++;
+        colNo = 0;
+      }
+      // columns count characters, not the bytes that go on a UTF-8 one
+      if ((source[i] & 0xC0) != 0x80)
+        colNo ++;
+      i ++;
+      break;
+    }
+  }
+}
+
+/******************************************************************/
+
+// Where a part of the program stops, its lookAhead and the bytes read past
+// where that token starts, at position, belong to the next part, which
+// counts them itself
+void uncountLookAhead(long position) {
+  STAT_ADD(tokens[lookAhead->tokenType], -1);
+  STAT_ADD(bytesRead, position - inputPosition());
+}
+
+void compileSubroutine(void) {
+  blockLevel = 1;
+  nestingDepth = 1;
+  if (lookAhead->tokenType == KW_FUNCTION)
+    compileFuncDecl();
+  else if (lookAhead->tokenType == KW_PROCEDURE)
+    compileProcDecl();
+  else return;
+  stopLineNo = lookAhead->lineNo;
+  stopColNo = lookAhead->colNo;
+  if (runningTask + 1 < subTasks + subTaskCount) {
+    if ((stopLineNo == runningTask[1].lineNo) && (stopColNo == runningTask[1].colNo))
+      uncountLookAhead(runningTask[1].start - runningTask->start);
+  } else if ((stopLineNo == mainLineNo) && (stopColNo == mainColNo))
+    uncountLookAhead(mainStart - runningTask->start);
+}
+
+// The bytes a subroutine is parsed from: up to the keyword that starts the
+// part after it, that keyword included so that the parse stops there as it
+// would in the whole source
+long partLength(SubTask *task) {
+  long end = (task + 1 < subTasks + subTaskCount) ? task[1].start : mainStart;
+
+  while ((end < sourceLength) && (charCodes[(unsigned char)source[end]] == CHAR_LETTER))
+    end ++;
+  return end - task->start;
+}
+
+void runSubTask(SubTask *task) {
+  FILE *savedOutput = outputStream;
+
+  outputStream = open_memstream(&task->output, &task->outputLength);
+  openInputBuffer(source + task->start, partLength(task), task->lineNo, task->colNo);
+  runningTask = task;
+  stopLineNo = stopColNo = 0;
+  task->status = compileWith(compileSubroutine);
+  task->stopLineNo = stopLineNo;
+  task->stopColNo = stopColNo;
+  task->ranOut = (task->status != IO_SUCCESS) && (currentChar == EOF);
+  closeInputStream();
+  fclose(outputStream);
+  outputStream = savedOutput;
+}
+
+void* parseWorker(void *unused) {
+  int i;
+  while (1) {
+    pthread_mutex_lock(&subTaskLock);
+    i = nextSubTask ++;
+    pthread_mutex_unlock(&subTaskLock);
+    if (i >= subTaskCount) {
+      STAT_MERGE();
+      return NULL;
+    }
+    runSubTask(&subTasks[i]);
+  }
+}
+
+// Called where the main thread reaches the top-level subroutines: when they
+// are where they were expected, it goes on from the main block
+void skipSubroutines(void) {
+  if (skipped || (lookAhead->lineNo != subTasks[0].lineNo) || (lookAhead->colNo != subTasks[0].colNo))
+    return;
+  fflush(outputStream);
+  skippedOutput = skeletonLength;
+  skipped = 1;
+  uncountLookAhead(subTasks[0].start);
+  closeInputStream();
+  openInputBuffer(source + mainStart, sourceLength - mainStart, mainLineNo, mainColNo);
+  rescan();
+}
+
+// Parses on from a subroutine the workers could not be trusted with, to the
+// end of the source
+int compileRest(SubTask *task) {
+  int result;
+
+  openInputBuffer(source + task->start, sourceLength - task->start, task->lineNo, task->colNo);
+  result = compileWith(compileProgramRest);
+  closeInputStream();
+  return result;
+}
+
+int compileParallel(char *fileName) {
+  FILE *savedOutput = outputStream;
+  char *skeleton = NULL;
+  pthread_t *workers;
+  pthread_attr_t attr;
+  int threads = semanticThreads;
+  int result, i, lineNo, colNo;
+
+  if (savedOutput == NULL)
+    savedOutput = stdout;
+  source = readWholeFile(fileName, &sourceLength);
+  if (source == NULL)
+    return IO_ERROR;
+  findSubroutines();
+  if ((subTaskCount < 2) || (mainStart < 0)) {
+    openInputBuffer(source, sourceLength, 1, 1);
+    result = compileSource();
+    closeInputStream();
+    free(source);
+    return result;
+  }
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > subTaskCount)
+    threads = subTaskCount;
+  if (threads < 1)
+    threads = 1;
+  nextSubTask = 0;
+  workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+  for (i = 1; i < threads; i++)
+    if (pthread_create(&workers[i], &attr, parseWorker, NULL) != 0)
+      break;
+  threads = i;
+
+  // meanwhile this thread parses the rest, then helps the workers
+  skipped = 0;
+  outputStream = open_memstream(&skeleton, &skeletonLength);
+  subDeclHook = skipSubroutines;
+  openInputBuffer(source, sourceLength, 1, 1);
+  result = compileWith(compileProgram);
+  closeInputStream();
+  subDeclHook = NULL;
+  fclose(outputStream);
+  outputStream = savedOutput;
+  parseWorker(NULL);
+  for (i = 1; i < threads; i++)
+    pthread_join(workers[i], NULL);
+  pthread_attr_destroy(&attr);
+  free(workers);
+
+  // the output of the program parsed in one piece, in source order: it ends
+  // at the first error
+  if (!skipped) {
+    // the main thread met the subroutines elsewhere, so it did parse them
+    fwrite(skeleton, 1, skeletonLength, outputStream);
+  } else {
+    fwrite(skeleton, 1, skippedOutput, outputStream);
+    for (i = 0; i < subTaskCount; i++) {
+      lineNo = (i + 1 < subTaskCount) ? subTasks[i + 1].lineNo : mainLineNo;
+      colNo = (i + 1 < subTaskCount) ? subTasks[i + 1].colNo : mainColNo;
+      if (subTasks[i].ranOut || ((subTasks[i].status == IO_SUCCESS) &&
+          ((subTasks[i].stopLineNo != lineNo) || (subTasks[i].stopColNo != colNo)))) {
+        result = compileRest(&subTasks[i]);
+        break;
+      }
+      fwrite(subTasks[i].output, 1, subTasks[i].outputLength, outputStream);
+      if (subTasks[i].status != IO_SUCCESS) {
+        result = subTasks[i].status;
+        break;
+      }
+    }
+    if (i == subTaskCount)
+      fwrite(skeleton + skippedOutput, 1, skeletonLength - skippedOutput, outputStream);
+  }
+
+  for (i = 0; i < subTaskCount; i++)
+    free(subTasks[i].output);
+  free(skeleton);
+  free(source);
+  return result;
+}
@@ -0,0 +1,18 @@
+/* Parallel parsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+// When set, the parser parses the top-level subroutines of a program on
+// semanticThreads workers, every core when it is 0. Only plain parses run
+// this way; checking symbols needs the declarations in order.
+extern int parallelParse;
+
+// Parses fileName as compile() does, with the same output and result
+int compileParallel(char *fileName);
+
+#endif
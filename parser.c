@@ -4,122 +4,448 @@
  * @version 1.0
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
 
 #include "reader.h"
 #include "scanner.h"
 #include "parser.h"
 #include "error.h"
+#include "stats.h"
+#include "probes.h"
+#include "symtab.h"
+#include "ast.h"
+#include "sema.h"
+#include "pipeline.h"
 
-Token *currentToken;
-Token *lookAhead;
+// The state of a parse belongs to the thread running it
+__thread Token *currentToken;
+__thread Token *lookAhead;
+// The tokens scanned so far, up to TOKEN_RING of them: ringPosition counts
+// the tokens eaten and ringEnd those scanned
+__thread Token tokenRing[TOKEN_RING];
+__thread unsigned int ringPosition, ringEnd;
+
+// Nesting level of compileBlock(); the program block is level 1
+__thread int blockLevel;
+// Called before each top-level subroutine and before the main block
+void (*subDeclHook)(void);
+// Blocks, statements and expressions currently open
+__thread int nestingDepth;
+// When set, declarations go into the symbol table and every identifier used
+// must be declared. Only whole programs are checked, not resumed parses.
+int checkSymbols;
+// When set, the productions build the tree of what they parse and leave
+// identifier errors to the semantic analysis; otherwise they return NULL
+int buildAst;
+// Runs the semantic analysis after a successful parse; implies the two above
+int checkSemantics;
+// The tree of the last program parsed with buildAst
+__thread AstNode *programTree;
+// Called with the tree of a program that passed the semantic analysis,
+// before it is freed; returns IO_SUCCESS or an error status
+int (*programHook)(AstNode *program);
+// Block whose declarations are being parsed, and where the next one goes
+__thread AstNode *currentBlock;
+__thread AstNode **declTail;
+// Value and type of the constant compileConstant() just parsed. Constants are
+// folded only when symbols are checked; the type is NULL when it is unknown.
+__thread int constValue;
+__thread Type *constType;
+// Where the parser takes its tokens from, scanning each into a ring slot
+void (*tokenSource)(Token *token) = scanValidToken;
+// Called with each identifier declared or used, right after it is eaten
+void (*referenceHook)(ReferenceKind kind, Token *name);
+
+extern __thread FILE *outputStream;
+extern __thread jmp_buf *errorTrap;
+extern int traceEnabled;
+
+// The k-th token ahead, 1 being lookAhead; k must be below TOKEN_RING
+Token* peek(int k) {
+  while (ringPosition + k > ringEnd) {
+    tokenSource(&tokenRing[ringEnd % TOKEN_RING]);
+    ringEnd ++;
+  }
+  return &tokenRing[(ringPosition + k - 1) % TOKEN_RING];
+}
 
 void scan(void) {
-  Token* tmp = currentToken;
   currentToken = lookAhead;
-  lookAhead = getValidToken();
-  free(tmp);
+  ringPosition ++;
+  lookAhead = peek(1);
+}
+
+// Forgets the tokens scanned ahead, once the input has moved elsewhere
+void rescan(void) {
+  ringEnd = ringPosition;
+  lookAhead = peek(1);
 }
 
 void eat(TokenType tokenType) {
   if (lookAhead->tokenType == tokenType) {
-    printToken(lookAhead);
+    if (traceEnabled)
+      printToken(lookAhead);
     scan();
   } else missingToken(tokenType, lookAhead->lineNo, lookAhead->colNo);
 }
 
+// Each level of nesting costs a few stack frames; refuse to go deeper than
+// MAX_NESTING_DEPTH rather than overflow the stack.
+void enterNesting(void) {
+  nestingDepth ++;
+  STAT_MAX(peakNestingDepth, nestingDepth);
+  if (nestingDepth > MAX_NESTING_DEPTH)
+    error(ERR_NESTINGTOODEEP, lookAhead->lineNo, lookAhead->colNo);
+}
+
+void leaveNesting(void) {
+  nestingDepth --;
+}
+
+// Identifier and folding errors stop the parse unless the analysis will
+// report them
+void semanticError(ErrorCode err, int lineNo, int colNo) {
+  if (buildAst)
+    addDiagnostic(&resolveErrors, err, lineNo, colNo);
+  else error(err, lineNo, colNo);
+}
+
+// A node at the token just eaten, or NULL when no tree is being built
+AstNode* makeNode(NodeKind kind) {
+  AstNode *node;
+  if (!buildAst)
+    return NULL;
+  node = newNode(kind, currentToken->lineNo, currentToken->colNo);
+  strcpy(node->name, currentToken->string);
+  return node;
+}
+
+// Adds a declaration of the current block
+void addDecl(AstNode *node) {
+  if (node != NULL) {
+    *declTail = node;
+    declTail = &node->next;
+  }
+}
+
+void noteReference(ReferenceKind kind) {
+  if (referenceHook != NULL)
+    referenceHook(kind, currentToken);
+}
+
+// The identifier just eaten names a new symbol in the current scope, declared
+// by node. Returns it, or NULL when symbols are not being checked.
+Symbol* declareIdent(SymbolKind kind, AstNode *node) {
+  Symbol *symbol;
+  if (!checkSymbols)
+    return NULL;
+  symbol = declareSymbol(currentToken->string, kind, currentToken->lineNo, currentToken->colNo);
+  if (symbol == NULL)
+    semanticError(ERR_DUPLICATEIDENT, currentToken->lineNo, currentToken->colNo);
+  else symbol->node = node;
+  return symbol;
+}
+
+void setSymbolType(Symbol *symbol, Type *type) {
+  if (symbol != NULL)
+    symbol->type = type;
+}
+
+// The identifier just eaten must already be declared. Returns a node of the
+// given kind that refers to its declaration.
+AstNode* makeReference(NodeKind kind) {
+  Symbol *symbol = NULL;
+  AstNode *node;
+
+  if (checkSymbols) {
+    symbol = lookupSymbol(currentToken->string);
+    if (symbol == NULL)
+      semanticError(ERR_UNDECLAREDIDENT, currentToken->lineNo, currentToken->colNo);
+  }
+  node = makeNode(kind);
+  if ((node != NULL) && (symbol != NULL))
+    node->decl = symbol->node;
+  return node;
+}
+
+// The standard I/O subroutines every program can call
+void declareBuiltins(void) {
+  Builtin builtin;
+  AstNode *node;
+  Symbol *symbol;
+
+  for (builtin = BUILTIN_READC; builtin <= BUILTIN_COUNT; builtin ++) {
+    node = builtinNode(builtin);
+    symbol = declareSymbol(node->name, node->kind == N_FUNCTION ? SYM_FUNCTION : SYM_PROCEDURE, 0, 0);
+    symbol->type = node->type;
+    symbol->node = node;
+  }
+}
+
+// The number just eaten. Literals beyond INTEGER are reported when symbols
+// are checked.
+int numberValue(void) {
+  if (checkSymbols && (strlen(currentToken->string) > 10 || atoll(currentToken->string) > INT_MAX))
+    semanticError(ERR_INTEGEROVERFLOW, currentToken->lineNo, currentToken->colNo);
+  return currentToken->value;
+}
+
+// Turns a reference to a constant into its value
+AstNode* foldReference(AstNode *node) {
+  if ((node != NULL) && (node->kind == N_VARIABLE) && (node->list == NULL) && (node->decl != NULL) &&
+      (node->decl->kind == N_CONST) && (node->decl->type != NULL)) {
+    node->kind = (node->decl->type == charType) ? N_CHARCONST : N_NUMBER;
+    node->value = node->decl->value;
+  }
+  return node;
+}
+
+// A sign or operator whose operands are integer literals becomes a literal.
+// Division by zero and results beyond INTEGER are left unfolded and reported.
+AstNode* foldOperation(AstNode *node) {
+  long long result;
+
+  if ((node == NULL) || (node->left == NULL) || (node->right == NULL && node->kind == N_BINARY))
+    return node;
+  if ((node->kind == N_BINARY) && (node->op == SB_SLASH) &&
+      (node->right->kind == N_NUMBER) && (node->right->value == 0)) {
+    semanticError(ERR_DIVISIONBYZERO, node->lineNo, node->colNo);
+    return node;
+  }
+  if (node->left->kind != N_NUMBER)
+    return node;
+  if (node->kind == N_UNARY)
+    result = (node->op == SB_MINUS) ? -(long long)node->left->value : node->left->value;
+  else {
+    if (node->right->kind != N_NUMBER)
+      return node;
+    switch (node->op) {
+    case SB_PLUS: result = (long long)node->left->value + node->right->value; break;
+    case SB_MINUS: result = (long long)node->left->value - node->right->value; break;
+    case SB_TIMES: result = (long long)node->left->value * node->right->value; break;
+    default: result = (long long)node->left->value / node->right->value; break;
+    }
+  }
+  if ((result < INT_MIN) || (result > INT_MAX)) {
+    semanticError(ERR_INTEGEROVERFLOW, node->lineNo, node->colNo);
+    return node;
+  }
+  node->left->value = (int)result;
+  return node->left;
+}
+
+// Links node in front of list, skipping empty statements
+AstNode* prepend(AstNode *node, AstNode *list) {
+  if (node == NULL)
+    return list;
+  node->next = list;
+  return node;
+}
+
+void openScope(void) {
+  if (checkSymbols) enterScope();
+}
+
+void closeScope(void) {
+  if (checkSymbols) exitScope();
+}
+
 void compileProgram(void) {
+  AstNode *program;
+
+  STAT_PRODUCTION();
   assert("Parsing a Program ....");
   eat(KW_PROGRAM);
+  if (checkSymbols) {
+    initSymTab();
+    enterScope();
+    declareBuiltins();
+  }
   eat(TK_IDENT);
+  noteReference(REF_PROGRAM);
+  program = makeNode(N_PROGRAM);
+  declareIdent(SYM_PROGRAM, program);
   eat(SB_SEMICOLON);
-  compileBlock();
+  openScope();
+  if (program != NULL)
+    program->body = compileBlock();
+  else compileBlock();
+  closeScope();
   eat(SB_PERIOD);
+  programTree = program;
   assert("Program parsed!");
 }
 
-void compileBlock(void) {
+AstNode* compileBlock(void) {
+  AstNode *block = makeNode(N_BLOCK);
+  AstNode *outerBlock = currentBlock;
+  AstNode **outerTail = declTail;
+  AstNode *body;
+
+  STAT_PRODUCTION();
   assert("Parsing a Block ....");
+  enterNesting();
+  PROBE1(block_entry, nestingDepth);
+  blockLevel ++;
+  currentBlock = block;
+  declTail = (block != NULL) ? &block->list : NULL;
   if (lookAhead->tokenType == KW_CONST) {
     eat(KW_CONST);
     compileConstDecl();
     compileConstDecls();
-    compileBlock2();
+    body = compileBlock2();
   } 
-  else compileBlock2();
+  else body = compileBlock2();
+  if (block != NULL)
+    block->body = body;
+  currentBlock = outerBlock;
+  declTail = outerTail;
+  blockLevel --;
+  PROBE1(block_exit, nestingDepth);
+  leaveNesting();
   assert("Block parsed!");
+  return block;
 }
 
-void compileBlock2(void) {
+AstNode* compileBlock2(void) {
+  STAT_PRODUCTION();
   if (lookAhead->tokenType == KW_TYPE) {
     eat(KW_TYPE);
     compileTypeDecl();
     compileTypeDecls();
-    compileBlock3();
+    return compileBlock3();
   } 
-  else compileBlock3();
+  else return compileBlock3();
 }
 
-void compileBlock3(void) {
+AstNode* compileBlock3(void) {
+  STAT_PRODUCTION();
   if (lookAhead->tokenType == KW_VAR) {
     eat(KW_VAR);
     compileVarDecl();
     compileVarDecls();
-    compileBlock4();
+    return compileBlock4();
   } 
-  else compileBlock4();
+  else return compileBlock4();
 }
 
-void compileBlock4(void) {
+AstNode* compileBlock4(void) {
+  STAT_PRODUCTION();
   compileSubDecls();
-  compileBlock5();
+  return compileBlock5();
 }
 
-void compileBlock5(void) {
+AstNode* compileBlock5(void) {
+  AstNode *body;
+
+  STAT_PRODUCTION();
   eat(KW_BEGIN);
-  compileStatements();
+  body = makeNode(N_GROUP);
+  if (body != NULL)
+    body->list = compileStatements();
+  else compileStatements();
   eat(KW_END);
+  return body;
 }
 
 void compileConstDecls(void) {
+  STAT_PRODUCTION();
   while (lookAhead->tokenType == TK_IDENT)
       compileConstDecl();
 }
 
 void compileConstDecl(void) {
+  AstNode *node;
+  Symbol *symbol;
+
+  STAT_PRODUCTION();
   eat(TK_IDENT);
+  noteReference(REF_CONST);
+  node = makeNode(N_CONST);
+  symbol = declareIdent(SYM_CONSTANT, node);
   eat(SB_EQ);
   compileConstant();
+  if (symbol != NULL) {
+    symbol->type = constType;
+    symbol->value = constValue;
+  }
+  if (node != NULL) {
+    node->type = constType;
+    node->value = constValue;
+    addDecl(node);
+  }
   eat(SB_SEMICOLON);
 }
 
 void compileTypeDecls(void) {
+  STAT_PRODUCTION();
   while (lookAhead->tokenType == TK_IDENT)
       compileTypeDecl();
 }
 
 void compileTypeDecl(void) {
+  AstNode *node;
+  Symbol *symbol;
+  Type *type;
+
+  STAT_PRODUCTION();
   eat(TK_IDENT);
+  noteReference(REF_TYPE);
+  node = makeNode(N_TYPE);
+  symbol = declareIdent(SYM_TYPE, node);
   eat(SB_EQ);
-  compileType();
+  // an alias stands for the canonical type it names
+  type = compileType();
+  setSymbolType(symbol, type);
+  if (node != NULL) {
+    node->type = type;
+    addDecl(node);
+  }
   eat(SB_SEMICOLON);
 }
 
 void compileVarDecls(void) {
+  STAT_PRODUCTION();
   while(lookAhead->tokenType == TK_IDENT)
       compileVarDecl();
 }
 
 void compileVarDecl(void) {
+  AstNode *node;
+  Symbol *symbol;
+  Type *type;
+
+  STAT_PRODUCTION();
   eat(TK_IDENT);
+  noteReference(REF_VAR);
+  node = makeNode(N_VAR);
+  symbol = declareIdent(SYM_VARIABLE, node);
   eat(SB_COLON);
-  compileType();
+  type = compileType();
+  setSymbolType(symbol, type);
+  if (node != NULL) {
+    node->type = type;
+    addDecl(node);
+  }
   eat(SB_SEMICOLON);
 }
 
 void compileSubDecls(void) {
+  STAT_PRODUCTION();
   assert("Parsing subtoutines ....");
+  compileSubDecls2();
+  assert("Subtoutines parsed ....");
+}
+
+void compileSubDecls2(void) {
+  STAT_PRODUCTION();
   while(1){
+    if ((blockLevel == 1) && (subDeclHook != NULL))
+      subDeclHook();
     if (lookAhead->tokenType == KW_FUNCTION) {
       compileFuncDecl();   
     } else if (lookAhead->tokenType == KW_PROCEDURE) {
@@ -127,62 +453,116 @@ void compileSubDecls(void) {
     }
     else break;
   }
-  assert("Subtoutines parsed ....");
 }
 
 void compileFuncDecl(void) {
+  AstNode *node;
+  AstNode *params;
+  Symbol *symbol;
+  Type *type;
+
+  STAT_PRODUCTION();
   assert("Parsing a function ....");
   eat(KW_FUNCTION);
   eat(TK_IDENT);
-  compileFuncParams();
+  noteReference(REF_FUNCTION);
+  node = makeNode(N_FUNCTION);
+  symbol = declareIdent(SYM_FUNCTION, node);
+  addDecl(node);
+  openScope();
+  params = compileFuncParams();
   eat(SB_COLON);
-  compileBasicType();
+  type = compileBasicType();
+  setSymbolType(symbol, type);
   eat(SB_SEMICOLON);
-  compileBlock();
+  if (node != NULL) {
+    node->list = params;
+    node->type = type;
+    node->body = compileBlock();
+  } else compileBlock();
+  closeScope();
   eat(SB_SEMICOLON);
   assert("Function parsed ....");
 }
 
 void compileProcDecl(void) {
+  AstNode *node;
+  AstNode *params;
+
+  STAT_PRODUCTION();
   assert("Parsing a procedure ....");
   eat(KW_PROCEDURE);
   eat(TK_IDENT);
-  compileProcParams();
+  noteReference(REF_PROCEDURE);
+  node = makeNode(N_PROCEDURE);
+  declareIdent(SYM_PROCEDURE, node);
+  addDecl(node);
+  openScope();
+  params = compileProcParams();
   eat(SB_SEMICOLON);
-  compileBlock();
+  if (node != NULL) {
+    node->list = params;
+    node->body = compileBlock();
+  } else compileBlock();
+  closeScope();
   eat(SB_SEMICOLON);
   assert("Procedure parsed ....");
 }
 
-void compileUnsignedConstant(void) {
+AstNode* compileUnsignedConstant(void) {
+  AstNode *node = NULL;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case TK_NUMBER:
       eat(TK_NUMBER);
+      node = makeNode(N_NUMBER);
+      if (node != NULL)
+        node->value = numberValue();
       break;
   case TK_IDENT:
       eat(TK_IDENT);
+      noteReference(REF_READ);
+      node = foldReference(makeReference(N_VARIABLE));
       break;
   case TK_CHAR:
       eat(TK_CHAR);
+      node = makeNode(N_CHARCONST);
+      if (node != NULL)
+        node->value = currentToken->value;
       break;
   default:
       error(ERR_INVALIDCONSTANT, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return node;
 }
 
 void compileConstant(void) {
+  TokenType sign;
+  int lineNo, colNo;
+
+  STAT_PRODUCTION();
   switch(lookAhead->tokenType) {
   case SB_PLUS:
-      eat(SB_PLUS);
-      compileConstant2();
-      break;
   case SB_MINUS:
-      eat(SB_MINUS);
+      eat(lookAhead->tokenType);
+      sign = currentToken->tokenType;
+      lineNo = currentToken->lineNo;
+      colNo = currentToken->colNo;
       compileConstant2();
+      if (constType == charType)
+        semanticError(ERR_INTEGEREXPECTED, lineNo, colNo);
+      else if (constType != NULL && sign == SB_MINUS) {
+        if (constValue == INT_MIN)
+          semanticError(ERR_INTEGEROVERFLOW, lineNo, colNo);
+        else constValue = -constValue;
+      }
       break;
   case TK_CHAR:
       eat(TK_CHAR);
+      constValue = currentToken->value;
+      constType = charType;
       break;
   default:
       compileConstant2();
@@ -190,13 +570,33 @@ void compileConstant(void) {
   }
 }
 
+// An unsigned number or the name of a constant
 void compileConstant2(void) {
+  Symbol *symbol;
+
+  STAT_PRODUCTION();
+  constValue = 0;
+  constType = NULL;
   switch (lookAhead->tokenType) {
   case TK_IDENT:
       eat(TK_IDENT);
+      noteReference(REF_READ);
+      if (!checkSymbols)
+        break;
+      symbol = lookupSymbol(currentToken->string);
+      if (symbol == NULL)
+        semanticError(ERR_UNDECLAREDIDENT, currentToken->lineNo, currentToken->colNo);
+      else if (symbol->kind != SYM_CONSTANT)
+        semanticError(ERR_NOTACONSTANT, currentToken->lineNo, currentToken->colNo);
+      else {
+        constValue = symbol->value;
+        constType = symbol->type;
+      }
       break;
   case TK_NUMBER:
       eat(TK_NUMBER);
+      constValue = numberValue();
+      constType = intType;
       break;
   default:
       error(ERR_INVALIDCONSTANT, lookAhead->lineNo, lookAhead->colNo);
@@ -204,51 +604,87 @@ void compileConstant2(void) {
   }
 }
 
-void compileType(void) {
+// Returns the canonical type, or NULL when it depends on a name and symbols
+// are not being checked
+Type* compileType(void) {
+  Type *type = NULL;
+  Type *sizeType;
+  Symbol *symbol;
+  int arraySize;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case KW_INTEGER:
       eat(KW_INTEGER);
+      type = intType;
       break;
   case KW_CHAR:
       eat(KW_CHAR);
+      type = charType;
       break;
   case TK_IDENT:
       eat(TK_IDENT);
+      noteReference(REF_READ);
+      if (checkSymbols) {
+        symbol = lookupSymbol(currentToken->string);
+        if (symbol == NULL)
+          semanticError(ERR_UNDECLAREDIDENT, currentToken->lineNo, currentToken->colNo);
+        else if (symbol->kind != SYM_TYPE)
+          semanticError(ERR_INVALIDTYPE, currentToken->lineNo, currentToken->colNo);
+        else type = symbol->type;
+      }
       break;
   case KW_ARRAY:
+      enterNesting();
       eat(KW_ARRAY);
       eat(SB_LSEL);
-      eat(TK_NUMBER);
+      // the size may name a constant
+      compileConstant2();
+      arraySize = constValue;
+      sizeType = constType;
+      if (sizeType == charType)
+        semanticError(ERR_INTEGEREXPECTED, currentToken->lineNo, currentToken->colNo);
+      else if ((sizeType == intType) && (arraySize < 1) && checkSymbols)
+        semanticError(ERR_INVALIDARRAYSIZE, currentToken->lineNo, currentToken->colNo);
       eat(SB_RSEL);
       eat(KW_OF);
-      compileType();
+      type = compileType();
+      if ((type != NULL) && (sizeType == intType))
+        type = makeArrayType(arraySize, type);
+      else type = NULL;
+      leaveNesting();
       break;
   default:
       error(ERR_INVALIDTYPE, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return type;
 }
 
-void compileBasicType(void) {
+Type* compileBasicType(void) {
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case KW_INTEGER:
       eat(KW_INTEGER);
-      break;
+      return intType;
   case KW_CHAR:
       eat(KW_CHAR);
-      break;
+      return charType;
   default:
       error(ERR_INVALIDBASICTYPE, lookAhead->lineNo, lookAhead->colNo);
-      break;
+      return NULL;
   }
 }
 
-void compileParams(void) {
+AstNode* compileParams(void) {
+  AstNode *params = NULL;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case SB_LPAR:
       eat(SB_LPAR);
-      compileParam();
-      compileParams2();
+      params = compileParam();
+      params = prepend(params, compileParams2());
       eat(SB_RPAR);
       break;
   case SB_COLON:
@@ -258,10 +694,14 @@ void compileParams(void) {
       error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return params;
 }
 
-void compileFuncParams(void) {
-  compileParams();
+AstNode* compileFuncParams(void) {
+  AstNode *params;
+
+  STAT_PRODUCTION();
+  params = compileParams();
   switch (lookAhead->tokenType) {
     // Follow
   case SB_COLON:
@@ -270,10 +710,14 @@ void compileFuncParams(void) {
       error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return params;
 }
 
-void compileProcParams(void) {
-  compileParams();
+AstNode* compileProcParams(void) {
+  AstNode *params;
+
+  STAT_PRODUCTION();
+  params = compileParams();
   switch (lookAhead->tokenType) {
   // Follow
   case SB_SEMICOLON:
@@ -282,54 +726,82 @@ void compileProcParams(void) {
       error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return params;
 }
 
-void compileParams2(void) {
-  switch (lookAhead->tokenType) {
-  case SB_SEMICOLON:
+AstNode* compileParams2(void) {
+  AstNode *params = NULL;
+  AstNode **tail = &params;
+
+  STAT_PRODUCTION();
+  while (lookAhead->tokenType == SB_SEMICOLON) {
       eat(SB_SEMICOLON);
-      compileParam();
-      compileParams2();
-      break;
+      if ((*tail = compileParam()) != NULL)
+        tail = &(*tail)->next;
+  }
+  switch (lookAhead->tokenType) {
   case SB_RPAR:
       break;
   default:
       error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return params;
 }
 
-void compileParam(void) {
+AstNode* compileParam(void) {
+  AstNode *node = NULL;
+  Symbol *symbol;
+  Type *type;
+  int isVarParam = 0;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case TK_IDENT:
-      eat(TK_IDENT);
-      eat(SB_COLON);
-      compileBasicType();
       break;
   case KW_VAR:
       eat(KW_VAR);
-      eat(TK_IDENT);
-      eat(SB_COLON);
-      compileBasicType();
+      isVarParam = 1;
       break;
   default:
       error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  eat(TK_IDENT);
+  noteReference(REF_PARAM);
+  node = makeNode(N_PARAM);
+  symbol = declareIdent(SYM_PARAMETER, node);
+  eat(SB_COLON);
+  type = compileBasicType();
+  setSymbolType(symbol, type);
+  if (node != NULL) {
+    node->type = type;
+    node->isVarParam = isVarParam;
+  }
+  return node;
 }
 
-void compileStatements(void) {
-  compileStatement();
-  compileStatements2();
+AstNode* compileStatements(void) {
+  AstNode *first;
+
+  STAT_PRODUCTION();
+  first = compileStatement();
+  return prepend(first, compileStatements2());
 }
 
-void compileStatements2(void) {
-  switch (lookAhead->tokenType) {
-  case SB_SEMICOLON:
+// The tail-recursive productions below loop instead, so the length of a
+// list does not decide how deep the stack grows.
+AstNode* compileStatements2(void) {
+  AstNode *statements = NULL;
+  AstNode **tail = &statements;
+
+  STAT_PRODUCTION();
+  while (lookAhead->tokenType == SB_SEMICOLON) {
       eat(SB_SEMICOLON);
-      compileStatement();
-      compileStatements2();
-      break;
+      if ((*tail = compileStatement()) != NULL)
+        tail = &(*tail)->next;
+  }
+  switch (lookAhead->tokenType) {
   // Follow
   case KW_END:
       break;
@@ -338,27 +810,34 @@ void compileStatements2(void) {
       error(ERR_INVALIDSTATEMENT, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return statements;
 }
 
-void compileStatement(void) {
+// Returns NULL for the empty statement
+AstNode* compileStatement(void) {
+  AstNode *statement = NULL;
+
+  STAT_PRODUCTION();
+  enterNesting();
+  PROBE1(statement_entry, nestingDepth);
   switch (lookAhead->tokenType) {
   case TK_IDENT:
-    compileAssignSt();
+    statement = compileAssignSt();
     break;
   case KW_CALL:
-    compileCallSt();
+    statement = compileCallSt();
     break;
   case KW_BEGIN:
-    compileGroupSt();
+    statement = compileGroupSt();
     break;
   case KW_IF:
-    compileIfSt();
+    statement = compileIfSt();
     break;
   case KW_WHILE:
-    compileWhileSt();
+    statement = compileWhileSt();
     break;
   case KW_FOR:
-    compileForSt();
+    statement = compileForSt();
     break;
     // EmptySt needs to check FOLLOW tokens
   case SB_SEMICOLON:
@@ -370,79 +849,153 @@ void compileStatement(void) {
     error(ERR_INVALIDSTATEMENT, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  PROBE1(statement_exit, nestingDepth);
+  leaveNesting();
+  return statement;
 }
 
-void compileAssignSt(void) {
+AstNode* compileAssignSt(void) {
+  AstNode *node, *target;
+  AstNode *indexes = NULL;
+  AstNode *value;
+
+  STAT_PRODUCTION();
   assert("Parsing an assign statement ....");
   eat(TK_IDENT);
+  noteReference(REF_ASSIGN);
+  target = makeReference(N_VARIABLE);
+  node = makeNode(N_ASSIGN);
   if (lookAhead->tokenType == SB_LSEL) {
-      compileIndexes();
+      indexes = compileIndexes();
   }
   eat(SB_ASSIGN);
-  compileExpression();
+  value = compileExpression();
+  if (node != NULL) {
+    target->list = indexes;
+    node->left = target;
+    node->right = value;
+  }
   assert("Assign statement parsed ....");
+  return node;
 }
 
-void compileCallSt(void) {
+AstNode* compileCallSt(void) {
+  AstNode *node;
+  AstNode *args;
+
+  STAT_PRODUCTION();
   assert("Parsing a call statement ....");
   eat(KW_CALL);
   eat(TK_IDENT);
-  compileArguments();
+  noteReference(REF_CALL);
+  node = makeReference(N_CALL);
+  args = compileArguments();
+  if (node != NULL)
+    node->list = args;
   assert("Call statement parsed ....");
+  return node;
 }
 
-void compileGroupSt(void) {
+AstNode* compileGroupSt(void) {
+  AstNode *node;
+  AstNode *statements;
+
+  STAT_PRODUCTION();
   assert("Parsing a group statement ....");
   eat(KW_BEGIN);
-  compileStatements();
+  node = makeNode(N_GROUP);
+  statements = compileStatements();
+  if (node != NULL)
+    node->list = statements;
   eat(KW_END);
   assert("Group statement parsed ....");
+  return node;
 }
 
-void compileIfSt(void) {
+AstNode* compileIfSt(void) {
+  AstNode *node;
+  AstNode *condition, *thenPart, *elsePart = NULL;
+
+  STAT_PRODUCTION();
   assert("Parsing an if statement ....");
   eat(KW_IF);
-  compileCondition();
+  node = makeNode(N_IF);
+  condition = compileCondition();
   eat(KW_THEN);
-  compileStatement();
+  thenPart = compileStatement();
   if (lookAhead->tokenType == KW_ELSE) 
-    compileElseSt();
+    elsePart = compileElseSt();
+  if (node != NULL) {
+    node->left = condition;
+    node->body = thenPart;
+    node->right = elsePart;
+  }
   assert("If statement parsed ....");
+  return node;
 }
 
-void compileElseSt(void) {
+AstNode* compileElseSt(void) {
+  STAT_PRODUCTION();
   eat(KW_ELSE);
-  compileStatement();
+  return compileStatement();
 }
 
-void compileWhileSt(void) {
+AstNode* compileWhileSt(void) {
+  AstNode *node;
+  AstNode *condition, *body;
+
+  STAT_PRODUCTION();
   assert("Parsing a while statement ....");
   eat(KW_WHILE);
-  compileCondition();
+  node = makeNode(N_WHILE);
+  condition = compileCondition();
   eat(KW_DO);
-  compileStatement();
+  body = compileStatement();
+  if (node != NULL) {
+    node->left = condition;
+    node->body = body;
+  }
   assert("While statement parsed ....");
+  return node;
 }
 
-void compileForSt(void) {
+AstNode* compileForSt(void) {
+  AstNode *node, *var;
+  AstNode *from, *to, *body;
+
+  STAT_PRODUCTION();
   assert("Parsing a for statement ....");
   eat(KW_FOR);
+  node = makeNode(N_FOR);
   eat(TK_IDENT);
+  // the control variable is assigned each time round
+  noteReference(REF_ASSIGN);
+  var = makeReference(N_VARIABLE);
   eat(SB_ASSIGN);
-  compileExpression();
+  from = compileExpression();
   eat(KW_TO);
-  compileExpression();
+  to = compileExpression();
   eat(KW_DO);
-  compileStatement();
+  body = compileStatement();
+  if (node != NULL) {
+    node->left = var;
+    node->right = from;
+    node->list = to;
+    node->body = body;
+  }
   assert("For statement parsed ....");
+  return node;
 }
 
-void compileArguments(void) {
+AstNode* compileArguments(void) {
+  AstNode *args = NULL;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case SB_LPAR:
       eat(SB_LPAR);
-      compileExpression();
-      compileArguments2();
+      args = compileExpression();
+      args = prepend(args, compileArguments2());
       eat(SB_RPAR);
       break;
   // Follow - same as call statement as statement:
@@ -477,15 +1030,20 @@ void compileArguments(void) {
       error(ERR_INVALIDARGUMENTS, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return args;
 }
 
-void compileArguments2(void) {
-  switch (lookAhead->tokenType) {
-  case SB_COMMA:
+AstNode* compileArguments2(void) {
+  AstNode *args = NULL;
+  AstNode **tail = &args;
+
+  STAT_PRODUCTION();
+  while (lookAhead->tokenType == SB_COMMA) {
       eat(SB_COMMA);
-      compileExpression();
-      compileArguments2();
-      break;
+      if ((*tail = compileExpression()) != NULL)
+        tail = &(*tail)->next;
+  }
+  switch (lookAhead->tokenType) {
   // Follow
   case SB_RPAR:
       break;
@@ -494,211 +1052,267 @@ void compileArguments2(void) {
       error(ERR_INVALIDARGUMENTS, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return args;
 }
 
-void compileCondition(void) {
-  compileExpression();
-  compileCondition2();
-}
+// How tightly each binary operator holds its operands, 0 for any other token.
+// Expressions climb from BP_SUM; a condition compares two of them.
+#define BP_COMPARE 1
+#define BP_SUM 2
+#define BP_PRODUCT 3
 
-void compileCondition2(void) {
-  switch (lookAhead->tokenType) {
-  case SB_EQ:
-      eat(SB_EQ);
-      compileExpression();
-      break;
-  case SB_NEQ:
-      eat(SB_NEQ);
-      compileExpression();
-      break;
-  case SB_LE:
-      eat(SB_LE);
-      compileExpression();
-      break;
-  case SB_LT:
-      eat(SB_LT);
-      compileExpression();
-      break;
-  case SB_GE:
-      eat(SB_GE);
-      compileExpression();
-      break;
-  case SB_GT:
-      eat(SB_GT);
-      compileExpression();
-      break;
-  default:
-      error(ERR_INVALIDCOMPARATOR, lookAhead->lineNo, lookAhead->colNo);
-      break;
-  }
-}
-
-void compileExpression(void) {
-  assert("Parsing an expression");
-  switch (lookAhead->tokenType) {
-  case SB_PLUS:
-      eat(SB_PLUS);
-      compileExpression2();
-      break;
-  case SB_MINUS:
-      eat(SB_MINUS);
-      compileExpression2();
-      break;
-  default:
-      compileExpression2();
-      break;
-  }
-  assert("Expression parsed");
-}
-
-void compileExpression2(void) {
-  compileTerm();
-  compileExpression3();
-}
+unsigned char bindingPower[SB_RSEL + 1] = {
+  [SB_EQ] = BP_COMPARE, [SB_NEQ] = BP_COMPARE,
+  [SB_LT] = BP_COMPARE, [SB_LE] = BP_COMPARE,
+  [SB_GT] = BP_COMPARE, [SB_GE] = BP_COMPARE,
+  [SB_PLUS] = BP_SUM, [SB_MINUS] = BP_SUM,
+  [SB_TIMES] = BP_PRODUCT, [SB_SLASH] = BP_PRODUCT
+};
 
-
-void compileExpression3(void) {
-  switch(lookAhead->tokenType) {
-  case SB_PLUS:
-      eat(SB_PLUS);
-      compileTerm();
-      compileExpression3();
-      break;
-  case SB_MINUS:
-      eat(SB_MINUS);
-      compileTerm();
-      compileExpression3();
-      break;
+// The tokens that may follow an expression
+unsigned char endsExpression[SB_RSEL + 1] = {
   // Follow (statement)
-  case SB_SEMICOLON:
-  case KW_END:
-  case KW_ELSE:
+  [SB_SEMICOLON] = 1, [KW_END] = 1, [KW_ELSE] = 1,
   // Follow (For statement)
-  case KW_TO:
-  case KW_DO:
+  [KW_TO] = 1, [KW_DO] = 1,
   // Follow (arguments2)
-  case SB_COMMA:
-  // Follow (condition2)
-  case SB_EQ:
-  case SB_NEQ:
-  case SB_LE:
-  case SB_LT:
-  case SB_GE:
-  case SB_GT:
+  [SB_COMMA] = 1,
+  // Follow (condition)
+  [SB_EQ] = 1, [SB_NEQ] = 1, [SB_LE] = 1, [SB_LT] = 1, [SB_GE] = 1, [SB_GT] = 1,
   // Follow (factor)
-  case SB_RPAR:
+  [SB_RPAR] = 1,
   // Follow (indexes)
-  case SB_RSEL:
+  [SB_RSEL] = 1,
   // Follow (if statement)
-  case KW_THEN:
-      break;
-  // Error
-  default:
-      error(ERR_INVALIDEXPRESSION, lookAhead->lineNo, lookAhead->colNo);
-      break;
+  [KW_THEN] = 1
+};
+
+AstNode* compileCondition(void) {
+  AstNode *node;
+  AstNode *left;
+  AstNode *right;
+
+  STAT_PRODUCTION();
+  left = compileExpression();
+  if (bindingPower[lookAhead->tokenType] == BP_COMPARE)
+    eat(lookAhead->tokenType);
+  else error(ERR_INVALIDCOMPARATOR, lookAhead->lineNo, lookAhead->colNo);
+  node = makeNode(N_COMPARE);
+  if (node != NULL)
+    node->op = currentToken->tokenType;
+  right = compileExpression();
+  if (node != NULL) {
+    node->left = left;
+    node->right = right;
   }
+  return node;
 }
 
-void compileTerm(void) {
-  compileFactor();
-  compileTerm2();
-}
+AstNode* compileExpression(void) {
+  AstNode *node = NULL;
+  AstNode *operand;
 
-void compileTerm2(void) {
+  STAT_PRODUCTION();
+  assert("Parsing an expression");
+  enterNesting();
+  PROBE1(expression_entry, nestingDepth);
   switch (lookAhead->tokenType) {
-  case SB_TIMES:
-      eat(SB_TIMES);
-      compileFactor();
-      compileTerm2();
-      break;
-  case SB_SLASH:
-      eat(SB_SLASH);
-      compileFactor();
-      compileTerm2();
-      break;
-  // Follow - same as expression3
   case SB_PLUS:
   case SB_MINUS:
-  // Follow (statement)
-  case SB_SEMICOLON:
-  case KW_END:
-  case KW_ELSE:
-  // Follow (For statement)
-  case KW_TO:
-  case KW_DO:
-  // Follow (arguments2)
-  case SB_COMMA:
-  // Follow (condition2)
-  case SB_EQ:
-  case SB_NEQ:
-  case SB_LE:
-  case SB_LT:
-  case SB_GE:
-  case SB_GT:
-  // Follow (factor)
-  case SB_RPAR:
-  // Follow (indexes)
-  case SB_RSEL:
-  // Follow (if statement)
-  case KW_THEN:
+      // the sign applies to all the terms after it
+      eat(lookAhead->tokenType);
+      node = makeNode(N_UNARY);
+      if (node != NULL)
+        node->op = currentToken->tokenType;
+      operand = compileOperators(compileFactor(), BP_SUM);
+      if (node != NULL) {
+        node->left = operand;
+        node = foldOperation(node);
+      }
       break;
   default:
-      error(ERR_INVALIDTERM, lookAhead->lineNo, lookAhead->colNo);
+      node = compileOperators(compileFactor(), BP_SUM);
       break;
   }
+  // A term ends before anything an expression may not end with, so that is
+  // where the error is
+  if (!endsExpression[lookAhead->tokenType])
+    error(ERR_INVALIDTERM, lookAhead->lineNo, lookAhead->colNo);
+  PROBE1(expression_exit, nestingDepth);
+  leaveNesting();
+  assert("Expression parsed");
+  return node;
 }
 
-void compileFactor(void) {
+// Folds onto left, in a left-leaning tree, the operators that follow it while
+// they bind at least power tight. The operand right of one goes first to the
+// operators binding tighter than it, which recurses once per level, not once
+// per operand.
+AstNode* compileOperators(AstNode *left, int power) {
+  AstNode *node;
+  AstNode *right;
+  int operatorPower;
+
+  STAT_PRODUCTION();
+  while ((operatorPower = bindingPower[lookAhead->tokenType]) >= power) {
+      eat(lookAhead->tokenType);
+      node = makeNode(N_BINARY);
+      if (node != NULL)
+        node->op = currentToken->tokenType;
+      right = compileFactor();
+      if (bindingPower[lookAhead->tokenType] > operatorPower)
+        right = compileOperators(right, operatorPower + 1);
+      if (node != NULL) {
+        node->left = left;
+        node->right = right;
+        left = foldOperation(node);
+      }
+  }
+  return left;
+}
+
+AstNode* compileFactor(void) {
+  AstNode *node = NULL;
+  AstNode *list = NULL;
+
+  STAT_PRODUCTION();
   switch (lookAhead->tokenType) {
   case TK_NUMBER:
   case TK_CHAR:
-      compileUnsignedConstant();
+      node = compileUnsignedConstant();
       break;
   case SB_LPAR:
       eat(SB_LPAR);
-      compileExpression();
+      node = compileExpression();
       eat(SB_RPAR);
       break;
   case TK_IDENT:
       eat(TK_IDENT);
+      // a function called without arguments looks like a read
+      noteReference((lookAhead->tokenType == SB_LPAR) ? REF_CALL : REF_READ);
+      node = makeReference(N_VARIABLE);
       switch(lookAhead->tokenType) {
       case SB_LSEL:
-          compileIndexes();
+          list = compileIndexes();
           break;
       case SB_LPAR:
-          compileArguments();
+          list = compileArguments();
+          if (node != NULL)
+            node->kind = N_FUNCALL;
           break;
       default:
           break;
       }
+      if (node != NULL) {
+        node->list = list;
+        // a function without arguments is still a call
+        if ((node->decl != NULL) && (node->decl->kind == N_FUNCTION))
+          node->kind = N_FUNCALL;
+        node = foldReference(node);
+      }
       break;
   default:
       error(ERR_INVALIDFACTOR, lookAhead->lineNo, lookAhead->colNo);
       break;
   }
+  return node;
 }
 
-void compileIndexes(void) {
-  if (lookAhead->tokenType == SB_LSEL) {
+AstNode* compileIndexes(void) {
+  AstNode *indexes = NULL;
+  AstNode **tail = &indexes;
+
+  STAT_PRODUCTION();
+  while (lookAhead->tokenType == SB_LSEL) {
       eat(SB_LSEL);
-      compileExpression();
+      if ((*tail = compileExpression()) != NULL)
+        tail = &(*tail)->next;
       eat(SB_RSEL);
-      compileIndexes();
   }
+  return indexes;
 }
 
-int compile(char *fileName) {
-  if (openInputStream(fileName) == IO_ERROR)
-    return IO_ERROR;
+// Picks a program up again at a top-level subroutine boundary: the remaining
+// subroutines, then what compileSubDecls(), compileBlock() and
+// compileProgram() still have to parse after them.
+void compileProgramRest(void) {
+  STAT_PRODUCTION();
+  blockLevel = 1;
+  nestingDepth = 1;
+  compileSubDecls2();
+  assert("Subtoutines parsed ....");
+  compileBlock5();
+  blockLevel --;
+  assert("Block parsed!");
+  eat(SB_PERIOD);
+  assert("Program parsed!");
+}
+
+// Runs production over the already opened input, stopping at the first error.
+int compileWith(void (*production)(void)) {
+  jmp_buf trap;
+  // set again once an error has unwound to the trap
+  volatile int result = IO_SUCCESS;
+  STAT_TIMER(start);
+
+  if (outputStream == NULL)
+    outputStream = stdout;
 
   currentToken = NULL;
-  lookAhead = getValidToken();
+  lookAhead = NULL;
+  blockLevel = 0;
+  nestingDepth = 0;
+  programTree = NULL;
+  errorTrap = &trap;
 
-  compileProgram();
+  ringPosition = ringEnd = 0;
+  if (setjmp(trap) == 0) {
+    lookAhead = peek(1);
+    production();
+  } else result = COMPILE_ERROR;
 
-  free(currentToken);
-  free(lookAhead);
-  closeInputStream();
-  return IO_SUCCESS;
+  errorTrap = NULL;
+  if (checkSymbols)
+    cleanSymTab();
+  currentToken = NULL;
+  lookAhead = NULL;
+  STAT_ELAPSED(compileNanos, start);
+  return result;
+}
+
+// Parses the opened program and, with checkSemantics, analyzes it. A
+// program with syntax errors is not analyzed.
+int compileSource(void) {
+  int result;
 
+  if (!checkSemantics)
+    return compileWith(compileProgram);
+
+  checkSymbols = 1;
+  buildAst = 1;
+  result = compileWith(compileProgram);
+  if ((result == IO_SUCCESS) && (analyzeProgram(programTree) > 0))
+    result = COMPILE_ERROR;
+  if ((result == IO_SUCCESS) && (programHook != NULL))
+    result = programHook(programTree);
+  buildAst = 0;
+  clearDiagnostics(&resolveErrors);
+  freeAst();
+  programTree = NULL;
+  return result;
+}
+
+int compile(char *fileName) {
+  int result;
+
+  if (openInputStream(fileName) == IO_ERROR)
+    return IO_ERROR;
+
+  if (pipelinedScan)
+    startPipeline();
+  result = compileSource();
+  if (pipelinedScan)
+    stopPipeline();
+  closeInputStream();
+  return result;
 }
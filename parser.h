@@ -6,16 +6,50 @@
 #ifndef __PARSER_H__
 #define __PARSER_H__
 #include "token.h"
+#include "types.h"
+#include "ast.h"
 
+#define PARSER_VERSION "1.0"
+
+// compile() returns IO_ERROR, IO_SUCCESS or this when parsing stopped at an error
+#define COMPILE_ERROR 2
+
+// Deepest nesting of blocks, statements and expressions accepted
+#define MAX_NESTING_DEPTH 10000
+
+// Token slots the parser cycles through: the current token and up to
+// TOKEN_RING - 1 tokens ahead. A power of two.
+#define TOKEN_RING 8
+
+// What an identifier is doing where referenceHook is told about it: being
+// declared, called, assigned or read
+typedef enum {
+  REF_PROGRAM,
+  REF_CONST,
+  REF_TYPE,
+  REF_VAR,
+  REF_PARAM,
+  REF_FUNCTION,
+  REF_PROCEDURE,
+  REF_CALL,
+  REF_ASSIGN,
+  REF_READ
+} ReferenceKind;
+
+void enterNesting(void);
+void leaveNesting(void);
+Token* peek(int k);
 void scan(void);
+void rescan(void);
 void eat(TokenType tokenType);
+void noteReference(ReferenceKind kind);
 
 void compileProgram(void);
-void compileBlock(void);
-void compileBlock2(void);
-void compileBlock3(void);
-void compileBlock4(void);
-void compileBlock5(void);
+AstNode* compileBlock(void);
+AstNode* compileBlock2(void);
+AstNode* compileBlock3(void);
+AstNode* compileBlock4(void);
+AstNode* compileBlock5(void);
 void compileConstDecls(void);
 void compileConstDecl(void);
 void compileTypeDecls(void);
@@ -23,41 +57,42 @@ void compileTypeDecl(void);
 void compileVarDecls(void);
 void compileVarDecl(void);
 void compileSubDecls(void);
+void compileSubDecls2(void);
 void compileFuncDecl(void);
 void compileProcDecl(void);
-void compileUnsignedConstant(void);
+AstNode* compileUnsignedConstant(void);
 void compileConstant(void);
 void compileConstant2(void);
-void compileType(void);
-void compileBasicType(void);
-void compileParams(void);
-void compileParams2(void);
-void compileParam(void);
-void compileStatements(void);
-void compileStatements2(void);
-void compileStatement(void);
-void compileAssignSt(void);
-void compileCallSt(void);
-void compileGroupSt(void);
-void compileIfSt(void);
-void compileElseSt(void);
-void compileWhileSt(void);
-void compileForSt(void);
-void compileArguments(void);
-void compileArguments2(void);
-void compileCondition(void);
-void compileCondition2(void);
-void compileExpression(void);
-void compileExpression2(void);
-void compileExpression3(void);
-void compileTerm(void);
-void compileTerm2(void);
-void compileFactor(void);
-void compileIndexes(void);
-
-void compileFuncParams(void);
-void compileProcParams(void);
+Type* compileType(void);
+Type* compileBasicType(void);
+AstNode* compileParams(void);
+AstNode* compileParams2(void);
+AstNode* compileParam(void);
+AstNode* compileStatements(void);
+AstNode* compileStatements2(void);
+AstNode* compileStatement(void);
+AstNode* compileAssignSt(void);
+AstNode* compileCallSt(void);
+AstNode* compileGroupSt(void);
+AstNode* compileIfSt(void);
+AstNode* compileElseSt(void);
+AstNode* compileWhileSt(void);
+AstNode* compileForSt(void);
+AstNode* compileArguments(void);
+AstNode* compileArguments2(void);
+AstNode* compileCondition(void);
+AstNode* compileExpression(void);
+AstNode* compileOperators(AstNode *left, int power);
+AstNode* compileFactor(void);
+AstNode* compileIndexes(void);
+
+AstNode* compileFuncParams(void);
+AstNode* compileProcParams(void);
+
+void compileProgramRest(void);
 
+int compileWith(void (*production)(void));
+int compileSource(void);
 int compile(char *fileName);
 
 #endif
@@ -0,0 +1,187 @@
+/* Pipelined scanner
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "error.h"
+#include "stats.h"
+#include "pipeline.h"
+
+#define CACHE_LINE 64
+// Tokens go from the lexer to the parser a batch at a time, so that the two
+// threads meet once every BATCH_TOKENS tokens rather than at every token
+#define BATCH_TOKENS (8 * CACHE_LINE / sizeof(Token))
+// Batches the lexer may run ahead of the parser; a power of two
+#define RING_BATCHES 64
+
+typedef struct {
+  Token tokens[BATCH_TOKENS];
+  int count;
+} __attribute__((aligned(CACHE_LINE))) TokenBatch;
+
+// A count written by one thread and read by the other, alone on its line
+typedef struct {
+  atomic_ulong count;
+} __attribute__((aligned(CACHE_LINE))) Counter;
+
+int pipelinedScan;
+
+TokenBatch ring[RING_BATCHES];
+// Batches the lexer has filled and those the parser is done with
+Counter produced, consumed;
+// Set when the parser stops reading
+atomic_int stopRequested;
+
+pthread_t lexer;
+int lexerRunning;
+
+// Lexer side: the batch being filled, NULL until a slot is free
+TokenBatch *writeBatch;
+unsigned long producedCount;
+
+// Parser side: the batch being read, and what the parser has seen of the end
+TokenBatch *readBatch;
+int readPosition;
+unsigned long consumedCount;
+int atEnd;
+Token endToken;
+
+extern void (*tokenSource)(Token *token);
+extern __thread InputStream inputStream;
+extern __thread int lineNo, colNo, currentChar, currentCodePoint;
+
+// The reader state, handed over to the lexer thread with the input
+InputStream lexerInput;
+int lexerLineNo, lexerColNo, lexerChar, lexerCodePoint;
+
+/******************************************************************/
+
+// Waits until the parser has freed a slot, unless it is gone. A full ring
+// holds the lexer back, so a slow parse never buffers the whole input.
+int openBatch(void) {
+  while (producedCount - atomic_load_explicit(&consumed.count, memory_order_acquire) >= RING_BATCHES) {
+    if (atomic_load_explicit(&stopRequested, memory_order_relaxed))
+      return 0;
+    sched_yield();
+  }
+  writeBatch = &ring[producedCount % RING_BATCHES];
+  writeBatch->count = 0;
+  return 1;
+}
+
+void publishBatch(void) {
+  producedCount ++;
+  atomic_store_explicit(&produced.count, producedCount, memory_order_release);
+  writeBatch = NULL;
+}
+
+int putToken(Token *token) {
+  if ((writeBatch == NULL) && !openBatch())
+    return 0;
+  writeBatch->tokens[writeBatch->count++] = *token;
+  if (writeBatch->count == BATCH_TOKENS)
+    publishBatch();
+  return 1;
+}
+
+// Scans up to the end of the input or the first error. The error goes into
+// the ring as a TK_NONE token whose value is its code.
+void* runLexer(void *unused) {
+  jmp_buf trap;
+  Token token;
+  Token failure;
+  TokenType type;
+
+  inputStream = lexerInput;
+  lineNo = lexerLineNo;
+  colNo = lexerColNo;
+  currentChar = lexerChar;
+  currentCodePoint = lexerCodePoint;
+  scanTrap = &trap;
+  if (setjmp(trap) == 0) {
+    do {
+      scanValidToken(&token);
+      type = token.tokenType;
+      if (!putToken(&token))
+        type = TK_EOF;
+    } while (type != TK_EOF);
+  } else {
+    failure.string[0] = '\0';
+    failure.tokenType = TK_NONE;
+    failure.lineNo = scanErrorLineNo;
+    failure.colNo = scanErrorColNo;
+    failure.value = scanErrorCode;
+    putToken(&failure);
+  }
+  if (writeBatch != NULL)
+    publishBatch();
+  scanTrap = NULL;
+  STAT_MERGE();
+  return NULL;
+}
+
+/******************************************************************/
+
+void pipelinedToken(Token *token) {
+  // past the end, the parser sees the end again, as it would from the scanner
+  if (atEnd) {
+    *token = endToken;
+    return;
+  }
+  if (readBatch == NULL) {
+    while (atomic_load_explicit(&produced.count, memory_order_acquire) == consumedCount)
+      sched_yield();
+    readBatch = &ring[consumedCount % RING_BATCHES];
+    readPosition = 0;
+  }
+  *token = readBatch->tokens[readPosition++];
+  if (readPosition == readBatch->count) {
+    readBatch = NULL;
+    consumedCount ++;
+    atomic_store_explicit(&consumed.count, consumedCount, memory_order_release);
+  }
+  if (token->tokenType == TK_EOF) {
+    atEnd = 1;
+    endToken = *token;
+  } else if (token->tokenType == TK_NONE)
+    error((ErrorCode)token->value, token->lineNo, token->colNo);
+}
+
+void startPipeline(void) {
+  atomic_store(&produced.count, 0);
+  atomic_store(&consumed.count, 0);
+  atomic_store(&stopRequested, 0);
+  writeBatch = NULL;
+  producedCount = 0;
+  readBatch = NULL;
+  consumedCount = 0;
+  atEnd = 0;
+  lexerInput = inputStream;
+  lexerLineNo = lineNo;
+  lexerColNo = colNo;
+  lexerChar = currentChar;
+  lexerCodePoint = currentCodePoint;
+  if (pthread_create(&lexer, NULL, runLexer, NULL) != 0)
+    return;
+  lexerRunning = 1;
+  tokenSource = pipelinedToken;
+}
+
+void stopPipeline(void) {
+  if (!lexerRunning)
+    return;
+  atomic_store(&stopRequested, 1);
+  pthread_join(lexer, NULL);
+  lexerRunning = 0;
+  tokenSource = scanValidToken;
+}
@@ -0,0 +1,26 @@
+/* Pipelined scanner
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "token.h"
+
+// When set, compile() scans on a thread of its own, ahead of the parser
+extern int pipelinedScan;
+
+// Starts scanning the open input on a lexer thread and makes the parser take
+// its tokens from it. Errors the lexer finds are reported when the parser
+// reaches them, as if it had scanned the input itself. Without a thread the
+// parser keeps scanning.
+void startPipeline(void);
+// Stops the lexer, wherever it is, and gives the parser back the scanner
+void stopPipeline(void);
+
+// Copies the next token of the lexer thread into token
+void pipelinedToken(Token *token);
+
+#endif
@@ -0,0 +1,36 @@
+/* Static tracepoints
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+// USDT probes under the provider "kpl", listed by
+//   perf buildid-cache --add ./parser; perf list sdt_kpl:*
+// Each one is a single nop until a tracer attaches. Without <sys/sdt.h>
+// (systemtap-sdt-dev), or with make PROBES=0, they compile to nothing.
+//
+//   token(tokenType, lineNo, colNo)       every token scanToken() scans
+//   block_entry(depth), block_exit(depth)
+//   statement_entry(depth), statement_exit(depth)
+//   expression_entry(depth), expression_exit(depth)
+//   error(lineNo, colNo, message)          every error() and missingToken()
+
+#if !defined(KPL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define KPL_PROBES
+#endif
+#endif
+
+#ifdef KPL_PROBES
+#define PROBE1(name, a) DTRACE_PROBE1(kpl, name, a)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(kpl, name, a, b, c)
+#else
+#define PROBE1(name, a)
+#define PROBE3(name, a, b, c)
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+/* Push parsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "push.h"
+
+// Room for MAX_NESTING_DEPTH; pages are only touched as deep as a parse goes
+#define PUSH_STACK_SIZE (64 << 20)
+
+extern __thread InputStream inputStream;
+extern __thread int lineNo, colNo, currentChar, currentCodePoint;
+extern __thread FILE *outputStream;
+extern __thread jmp_buf *errorTrap;
+extern __thread Token *currentToken;
+extern __thread Token *lookAhead;
+extern __thread Token tokenRing[];
+extern __thread unsigned int ringPosition, ringEnd;
+extern __thread int blockLevel;
+extern __thread int nestingDepth;
+extern int buildAst;
+extern __thread AstNode *programTree;
+extern __thread AstNode *currentBlock;
+extern __thread AstNode **declTail;
+extern __thread int constValue;
+extern __thread Type *constType;
+extern struct SymbolEntry *entries;
+extern unsigned int entryCapacity, entryCount;
+extern Symbol **scopes;
+extern int scopeCapacity, currentLevel;
+extern struct NodeChunk *nodeChunk;
+extern int nodeChunkUsed;
+
+// The parser whose stack is being entered for the first time
+__thread PushParser *startingParser;
+
+/******************************************************************/
+
+void saveState(ParseState *state) {
+  state->inputStream = inputStream;
+  state->lineNo = lineNo;
+  state->colNo = colNo;
+  state->currentChar = currentChar;
+  state->currentCodePoint = currentCodePoint;
+  state->outputStream = outputStream;
+  state->errorTrap = errorTrap;
+  state->currentToken = currentToken;
+  state->lookAhead = lookAhead;
+  memcpy(state->tokenRing, tokenRing, sizeof(state->tokenRing));
+  state->ringPosition = ringPosition;
+  state->ringEnd = ringEnd;
+  state->blockLevel = blockLevel;
+  state->nestingDepth = nestingDepth;
+  state->buildAst = buildAst;
+  state->programTree = programTree;
+  state->currentBlock = currentBlock;
+  state->declTail = declTail;
+  state->constValue = constValue;
+  state->constType = constType;
+  state->entries = entries;
+  state->entryCapacity = entryCapacity;
+  state->entryCount = entryCount;
+  state->scopes = scopes;
+  state->scopeCapacity = scopeCapacity;
+  state->currentLevel = currentLevel;
+  state->nodeChunk = nodeChunk;
+  state->nodeChunkUsed = nodeChunkUsed;
+  state->resolveErrors = resolveErrors;
+}
+
+void loadState(ParseState *state) {
+  inputStream = state->inputStream;
+  lineNo = state->lineNo;
+  colNo = state->colNo;
+  currentChar = state->currentChar;
+  currentCodePoint = state->currentCodePoint;
+  outputStream = state->outputStream;
+  errorTrap = state->errorTrap;
+  currentToken = state->currentToken;
+  lookAhead = state->lookAhead;
+  memcpy(tokenRing, state->tokenRing, sizeof(state->tokenRing));
+  ringPosition = state->ringPosition;
+  ringEnd = state->ringEnd;
+  blockLevel = state->blockLevel;
+  nestingDepth = state->nestingDepth;
+  buildAst = state->buildAst;
+  programTree = state->programTree;
+  currentBlock = state->currentBlock;
+  declTail = state->declTail;
+  constValue = state->constValue;
+  constType = state->constType;
+  entries = state->entries;
+  entryCapacity = state->entryCapacity;
+  entryCount = state->entryCount;
+  scopes = state->scopes;
+  scopeCapacity = state->scopeCapacity;
+  currentLevel = state->currentLevel;
+  nodeChunk = state->nodeChunk;
+  nodeChunkUsed = state->nodeChunkUsed;
+  resolveErrors = state->resolveErrors;
+}
+
+// What the reader reads: the bytes fed so far, read where they are, and when
+// there are none left, it suspends the parse until more come
+long takePushed(void *source, char **bytes) {
+  PushParser *parser = (PushParser*)source;
+  long length;
+
+  while ((parser->available == 0) && !parser->finished)
+    swapcontext(&parser->parse, &parser->caller);
+  *bytes = parser->bytes;
+  length = parser->available;
+  parser->bytes += length;
+  parser->available = 0;
+  return length;
+}
+
+void runParse(void) {
+  PushParser *parser = startingParser;
+
+  openInputSource(takePushed, parser);
+  parser->result = compileSource();
+  closeInputStream();
+  parser->done = 1;
+}
+
+// Runs the parse until it has read all it was given or is done. Several
+// parsers may be open at once, checking or not, so each one's state is
+// swapped in and out, that of whoever called it included.
+void resumeParser(PushParser *parser) {
+  saveState(&parser->callerState);
+  loadState(&parser->state);
+  startingParser = parser;
+  swapcontext(&parser->caller, &parser->parse);
+  saveState(&parser->state);
+  loadState(&parser->callerState);
+}
+
+/******************************************************************/
+
+PushParser* openPushParser(void) {
+  // live across getcontext(), which may return more than once
+  PushParser *volatile parser = (PushParser*)calloc(1, sizeof(PushParser));
+
+  parser->stack = (char*)mmap(NULL, PUSH_STACK_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (parser->stack == MAP_FAILED) {
+    free(parser);
+    return NULL;
+  }
+  parser->state.outputStream = (outputStream != NULL) ? outputStream : stdout;
+  // no symbols yet, and no chunk of nodes
+  parser->state.currentLevel = -1;
+  getcontext(&parser->parse);
+  parser->parse.uc_stack.ss_sp = parser->stack;
+  parser->parse.uc_stack.ss_size = PUSH_STACK_SIZE;
+  parser->parse.uc_link = &parser->caller;
+  makecontext(&parser->parse, runParse, 0);
+  return parser;
+}
+
+int feedParser(PushParser *parser, char *bytes, long length) {
+  if (!parser->done && (length > 0)) {
+    parser->bytes = bytes;
+    parser->available = length;
+    resumeParser(parser);
+    // a parse that stopped early leaves the rest unread, and one that goes
+    // on has read them all
+    parser->bytes = NULL;
+    parser->available = 0;
+  }
+  return parser->done ? parser->result : PARSE_MORE;
+}
+
+int finishParser(PushParser *parser) {
+  parser->finished = 1;
+  if (!parser->done)
+    resumeParser(parser);
+  return parser->result;
+}
+
+// A parse still running is finished first, its source ending where it is
+void closePushParser(PushParser *parser) {
+  finishParser(parser);
+  munmap(parser->stack, PUSH_STACK_SIZE);
+  free(parser);
+}
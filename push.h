@@ -0,0 +1,72 @@
+/* Push parsing
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PUSH_H__
+#define __PUSH_H__
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include "reader.h"
+#include "token.h"
+#include "ast.h"
+#include "symtab.h"
+#include "sema.h"
+#include "parser.h"
+
+// feedParser() returns this while the parse waits for more of the source
+#define PARSE_MORE 3
+
+// Everything a parse keeps between two tokens, saved while it is suspended:
+// the reader, the scanner and the parser, and with checking on, the symbol
+// table, the tree and its nodes, and the identifier errors
+typedef struct {
+  InputStream inputStream;
+  int lineNo, colNo, currentChar, currentCodePoint;
+  FILE *outputStream;
+  jmp_buf *errorTrap;
+  Token *currentToken, *lookAhead;
+  Token tokenRing[TOKEN_RING];
+  unsigned int ringPosition, ringEnd;
+  int blockLevel, nestingDepth;
+  int buildAst;
+  AstNode *programTree, *currentBlock, **declTail;
+  int constValue;
+  Type *constType;
+  struct SymbolEntry *entries;
+  unsigned int entryCapacity, entryCount;
+  Symbol **scopes;
+  int scopeCapacity, currentLevel;
+  struct NodeChunk *nodeChunk;
+  int nodeChunkUsed;
+  Diagnostics resolveErrors;
+} ParseState;
+
+// A parse of a source that arrives in pieces. It runs on a stack of its own
+// and gives control back whenever it has read every byte it was given.
+typedef struct {
+  ucontext_t parse, caller;
+  char *stack;
+  ParseState state, callerState;
+  char *bytes;            // what the last feedParser() passed, not yet read
+  long available;
+  int finished;           // no more bytes will come
+  int done;
+  int result;             // that of compileSource() once done
+} PushParser;
+
+// Starts a parse of a whole program, as compileSource() would do it, printing
+// to the current output
+PushParser* openPushParser(void);
+// Parses as far as the next length bytes of the source allow. They may end
+// anywhere, even inside a token, and the parser keeps none of them: it
+// returns PARSE_MORE once it needs the ones after, or the result when done.
+int feedParser(PushParser *parser, char *bytes, long length);
+// The source ends here; returns the result of the parse
+int finishParser(PushParser *parser);
+void closePushParser(PushParser *parser);
+
+#endif
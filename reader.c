@@ -1,37 +1,210 @@
-/* 
+/*
  * @copyright (c) 2008, Hedspi, Hanoi University of Technology
  * @author Huu-Duc Nguyen
  * @version 1.0
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "reader.h"
+#include "stats.h"
 
-FILE *inputStream;
-int lineNo, colNo;
-int currentChar;
+// Bytes read from a file at a time
+#define READ_CHUNK (64 << 10)
+// Bytes checked for ASCII at a time
+#define ASCII_BLOCK 32
+// Bytes looked ahead for ASCII at most, so that opening a large buffer costs
+// no more than what is read of it
+#define ASCII_WINDOW 4096
+
+// Each thread reads an input of its own
+__thread InputStream inputStream;
+__thread int lineNo, colNo;
+__thread int currentChar;
+__thread int currentCodePoint;
+
+/******************************************************************/
+
+// How many of the length bytes at bytes are ASCII, up to the first that is
+// not. Blocks of ASCII_BLOCK bytes are checked at once.
+long asciiPrefix(unsigned char *bytes, long length) {
+  long i = 0;
+#ifdef __SSE2__
+  __m128i block;
+
+  while (i + ASCII_BLOCK <= length) {
+    block = _mm_or_si128(_mm_loadu_si128((__m128i*)(bytes + i)),
+                         _mm_loadu_si128((__m128i*)(bytes + i + 16)));
+    if (_mm_movemask_epi8(block) != 0)
+      break;
+    i += ASCII_BLOCK;
+  }
+#endif
+  while ((i < length) && (bytes[i] < 0x80))
+    i ++;
+  return i;
+}
+
+// Finds where the ASCII run from next ends, within the window
+void scanAscii(void) {
+  long length = inputStream.end - inputStream.next;
+
+  if (length > ASCII_WINDOW)
+    length = ASCII_WINDOW;
+  inputStream.asciiEnd = inputStream.next + asciiPrefix(inputStream.next, length);
+}
+
+// Makes the next chunk of the input current; 0 at its end
+int refillInput(void) {
+  char *bytes = NULL;
+  long length = 0;
+
+  inputStream.consumed += inputStream.end - inputStream.chunk;
+  if (inputStream.file != NULL) {
+    bytes = inputStream.buffer;
+    length = (long)fread(bytes, 1, READ_CHUNK, inputStream.file);
+  } else if (inputStream.refill != NULL)
+    length = inputStream.refill(inputStream.source, &bytes);
+  if (length <= 0) {
+    inputStream.chunk = inputStream.next = inputStream.end = NULL;
+    return 0;
+  }
+  inputStream.chunk = inputStream.next = (unsigned char*)bytes;
+  inputStream.end = inputStream.next + length;
+  return 1;
+}
+
+int peekByte(void) {
+  if ((inputStream.next == inputStream.end) && !refillInput())
+    return EOF;
+  return *inputStream.next;
+}
+
+// Reads what readChar() leaves: the end of a chunk or of the ASCII window,
+// and what is not ASCII. A byte sequence that is not UTF-8 reads as
+// INVALID_CHAR, up to where a character may start again.
+int decodeChar(void) {
+  int c = peekByte(), b, length, minimum, i;
 
-int readChar(void) {
-  currentChar = getc(inputStream);
   colNo ++;
-  if (currentChar == '\n') {
-    lineNo ++;
-    colNo = 0;
+  if (c == EOF) {
+    currentChar = EOF;
+    return currentChar;
+  }
+  inputStream.next ++;
+  STAT_ADD(bytesRead, 1);
+  if (c < 0x80) {
+    currentChar = c;
+    if (currentChar == '\n') {
+      lineNo ++;
+      colNo = 0;
+    }
+  } else {
+    if ((c >= 0xC2) && (c <= 0xDF)) {
+      length = 2;
+      minimum = 0x80;
+      currentCodePoint = c & 0x1F;
+    } else if ((c >= 0xE0) && (c <= 0xEF)) {
+      length = 3;
+      minimum = 0x800;
+      currentCodePoint = c & 0x0F;
+    } else if ((c >= 0xF0) && (c <= 0xF4)) {
+      length = 4;
+      minimum = 0x10000;
+      currentCodePoint = c & 0x07;
+    } else {
+      length = 0;
+      minimum = 0;
+    }
+    for (i = 1; i < length; i++) {
+      b = peekByte();
+      if ((b == EOF) || ((b & 0xC0) != 0x80))
+        break;
+      currentCodePoint = (currentCodePoint << 6) | (b & 0x3F);
+      inputStream.next ++;
+      STAT_ADD(bytesRead, 1);
+    }
+    // overlong forms and surrogates are not UTF-8 either
+    if ((length == 0) || (i < length) || (currentCodePoint < minimum) || (currentCodePoint > 0x10FFFF) ||
+        ((currentCodePoint >= 0xD800) && (currentCodePoint <= 0xDFFF)))
+      currentChar = INVALID_CHAR;
+    else currentChar = MULTIBYTE_CHAR;
   }
+  scanAscii();
   return currentChar;
 }
 
+int readChar(void) {
+  if (inputStream.next < inputStream.asciiEnd) {
+    currentChar = *inputStream.next ++;
+    STAT_ADD(bytesRead, 1);
+    colNo ++;
+    if (currentChar == '\n') {
+      lineNo ++;
+      colNo = 0;
+    }
+    return currentChar;
+  }
+  return decodeChar();
+}
+
+long inputPosition(void) {
+  return inputStream.consumed + (inputStream.next - inputStream.chunk);
+}
+
+/******************************************************************/
+
+// Starts reading what inputStream was set to, its first character taken to
+// be at startLine/startCol
+void startInput(int startLine, int startCol) {
+  if (inputStream.next != NULL)
+    scanAscii();
+  lineNo = startLine;
+  colNo = startCol - 1;
+  readChar();
+}
+
 int openInputStream(char *fileName) {
-  inputStream = fopen(fileName, "rt");
-  if (inputStream == NULL)
+  FILE *file = fopen(fileName, "rt");
+  if (file == NULL)
     return IO_ERROR;
-  lineNo = 1;
-  colNo = 0;
-  readChar();
+  memset(&inputStream, 0, sizeof(InputStream));
+  inputStream.file = file;
+  inputStream.buffer = (char*)malloc(READ_CHUNK);
+  startInput(1, 1);
+  return IO_SUCCESS;
+}
+
+// Reads from memory instead of a file. The first character is taken to be at
+// startLine/startCol, so a fragment of a larger source reports its real position.
+int openInputBuffer(char *buffer, long length, int startLine, int startCol) {
+  memset(&inputStream, 0, sizeof(InputStream));
+  if (length > 0) {
+    inputStream.chunk = inputStream.next = (unsigned char*)buffer;
+    inputStream.end = inputStream.next + length;
+  }
+  startInput(startLine, startCol);
+  return IO_SUCCESS;
+}
+
+// Reads the chunks refill hands out, such as those fed to a push parse
+int openInputSource(long (*refill)(void *source, char **bytes), void *source) {
+  memset(&inputStream, 0, sizeof(InputStream));
+  inputStream.refill = refill;
+  inputStream.source = source;
+  startInput(1, 1);
   return IO_SUCCESS;
 }
 
 void closeInputStream() {
-  fclose(inputStream);
+  if (inputStream.file != NULL)
+    fclose(inputStream.file);
+  free(inputStream.buffer);
+  memset(&inputStream, 0, sizeof(InputStream));
 }
 
@@ -1,4 +1,4 @@
-/* 
+/*
  * @copyright (c) 2008, Hedspi, Hanoi University of Technology
  * @author Huu-Duc Nguyen
  * @version 1.0
@@ -7,11 +7,38 @@
 #ifndef __READER_H__
 #define __READER_H__
 
+#include <stdio.h>
+
 #define IO_ERROR 0
 #define IO_SUCCESS 1
 
+// The source is UTF-8. A character beyond ASCII is read as MULTIBYTE_CHAR,
+// its code point in currentCodePoint, and bytes that are not UTF-8 as
+// INVALID_CHAR. Neither is a character of the language.
+#define MULTIBYTE_CHAR 0x80
+#define INVALID_CHAR 0xFF
+
+// Where the reader takes its bytes from, a chunk at a time: a file, a buffer
+// in memory, or whatever refill hands out
+typedef struct {
+  unsigned char *chunk, *next, *end;
+  // The bytes from next up to here are ASCII, found a window at a time
+  unsigned char *asciiEnd;
+  // Bytes in the chunks before this one
+  long consumed;
+  FILE *file;
+  char *buffer;
+  // Sets bytes to the next chunk and returns its length, 0 at the end
+  long (*refill)(void *source, char **bytes);
+  void *source;
+} InputStream;
+
 int readChar(void);
 int openInputStream(char *fileName);
+int openInputBuffer(char *buffer, long length, int startLine, int startCol);
+int openInputSource(long (*refill)(void *source, char **bytes), void *source);
 void closeInputStream(void);
+// Bytes read so far, those of currentChar included
+long inputPosition(void);
 
 #endif
@@ -6,22 +6,41 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
 
 #include "reader.h"
 #include "charcode.h"
 #include "token.h"
 #include "error.h"
 #include "scanner.h"
+#include "stats.h"
+#include "probes.h"
 
 
-extern int lineNo;
-extern int colNo;
-extern int currentChar;
+extern __thread int lineNo;
+extern __thread int colNo;
+extern __thread int currentChar;
+extern __thread int currentCodePoint;
+extern __thread FILE *outputStream;
 
 extern CharCode charCodes[];
 
+__thread jmp_buf *scanTrap;
+__thread ErrorCode scanErrorCode;
+__thread int scanErrorLineNo, scanErrorColNo;
+
 /***************************************************************/
 
+void scanError(ErrorCode err, int lineNo, int colNo) {
+  if (scanTrap != NULL) {
+    scanErrorCode = err;
+    scanErrorLineNo = lineNo;
+    scanErrorColNo = colNo;
+    longjmp(*scanTrap, 1);
+  }
+  error(err, lineNo, colNo);
+}
+
 void skipBlank() {
   while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_SPACE))
     readChar();
@@ -39,16 +58,26 @@ void skipComment() {
       else state = 0;
       break;
     default:
+      if (currentChar == INVALID_CHAR)
+        scanError(ERR_INVALIDENCODING, lineNo, colNo);
       state = 0;
     }
     readChar();
   }
   if (state != 2) 
-    error(ERR_ENDOFCOMMENT, lineNo, colNo);
+    scanError(ERR_ENDOFCOMMENT, lineNo, colNo);
 }
 
-Token* readIdentKeyword(void) {
-  Token *token = makeToken(TK_NONE, lineNo, colNo);
+// Fills in the kind and position of the token being read
+Token* setToken(Token *token, TokenType tokenType, int ln, int cn) {
+  token->tokenType = tokenType;
+  token->lineNo = ln;
+  token->colNo = cn;
+  return token;
+}
+
+Token* readIdentKeyword(Token *token) {
+  setToken(token, TK_NONE, lineNo, colNo);
   int count = 1;
 
   token->string[0] = (char)currentChar;
@@ -56,15 +85,15 @@ Token* readIdentKeyword(void) {
 
   while ((currentChar != EOF) && 
 	 ((charCodes[currentChar] == CHAR_LETTER) || (charCodes[currentChar] == CHAR_DIGIT))) {
-    if (count <= MAX_IDENT_LEN) token->string[count++] = (char)currentChar;
+    // no need to read the rest of an identifier that is already too long
+    if (count == MAX_IDENT_LEN) {
+      scanError(ERR_IDENTTOOLONG, token->lineNo, token->colNo);
+      return token;
+    }
+    token->string[count++] = (char)currentChar;
     readChar();
   }
 
-  if (count > MAX_IDENT_LEN) {
-    error(ERR_IDENTTOOLONG, token->lineNo, token->colNo);
-    return token;
-  }
-
   token->string[count] = '\0';
   token->tokenType = checkKeyword(token->string);
 
@@ -74,11 +103,15 @@ Token* readIdentKeyword(void) {
   return token;
 }
 
-Token* readNumber(void) {
-  Token *token = makeToken(TK_NUMBER, lineNo, colNo);
+Token* readNumber(Token *token) {
+  setToken(token, TK_NUMBER, lineNo, colNo);
   int count = 0;
 
   while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_DIGIT)) {
+    if (count == MAX_IDENT_LEN) {
+      scanError(ERR_NUMBERTOOLONG, token->lineNo, token->colNo);
+      return token;
+    }
     token->string[count++] = (char)currentChar;
     readChar();
   }
@@ -88,23 +121,28 @@ Token* readNumber(void) {
   return token;
 }
 
-Token* readConstChar(void) {
-  Token *token = makeToken(TK_CHAR, lineNo, colNo);
+Token* readConstChar(Token *token) {
+  setToken(token, TK_CHAR, lineNo, colNo);
 
   readChar();
   if (currentChar == EOF) {
     token->tokenType = TK_NONE;
-    error(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
+    scanError(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
     return token;
   }
     
-  token->string[0] = currentChar;
-  token->string[1] = '\0';
+  if (currentChar == INVALID_CHAR) {
+    token->tokenType = TK_NONE;
+    scanError(ERR_INVALIDENCODING, lineNo, colNo);
+    return token;
+  }
+  token->value = (currentChar == MULTIBYTE_CHAR) ? currentCodePoint : currentChar;
+  token->string[encodeChar(token->value, token->string)] = '\0';
 
   readChar();
   if (currentChar == EOF) {
     token->tokenType = TK_NONE;
-    error(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
+    scanError(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
     return token;
   }
 
@@ -113,36 +151,36 @@ Token* readConstChar(void) {
     return token;
   } else {
     token->tokenType = TK_NONE;
-    error(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
+    scanError(ERR_INVALIDCHARCONSTANT, token->lineNo, token->colNo);
     return token;
   }
 }
 
-Token* getToken(void) {
-  Token *token;
+// Reads the next token, or returns NULL after skipping blanks or a comment
+Token* readToken(Token *token) {
   int ln, cn;
 
   if (currentChar == EOF) 
-    return makeToken(TK_EOF, lineNo, colNo);
+    return setToken(token, TK_EOF, lineNo, colNo);
 
   switch (charCodes[currentChar]) {
-  case CHAR_SPACE: skipBlank(); return getToken();
-  case CHAR_LETTER: return readIdentKeyword();
-  case CHAR_DIGIT: return readNumber();
+  case CHAR_SPACE: skipBlank(); return NULL;
+  case CHAR_LETTER: return readIdentKeyword(token);
+  case CHAR_DIGIT: return readNumber(token);
   case CHAR_PLUS: 
-    token = makeToken(SB_PLUS, lineNo, colNo);
+    setToken(token, SB_PLUS, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_MINUS:
-    token = makeToken(SB_MINUS, lineNo, colNo);
+    setToken(token, SB_MINUS, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_TIMES:
-    token = makeToken(SB_TIMES, lineNo, colNo);
+    setToken(token, SB_TIMES, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_SLASH:
-    token = makeToken(SB_SLASH, lineNo, colNo);
+    setToken(token, SB_SLASH, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_LT:
@@ -151,18 +189,18 @@ Token* getToken(void) {
     readChar();
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
       readChar();
-      return makeToken(SB_LE, ln, cn);
-    } else return makeToken(SB_LT, ln, cn);
+      return setToken(token, SB_LE, ln, cn);
+    } else return setToken(token, SB_LT, ln, cn);
   case CHAR_GT:
     ln = lineNo;
     cn = colNo;
     readChar();
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
       readChar();
-      return makeToken(SB_GE, ln, cn);
-    } else return makeToken(SB_GT, ln, cn);
+      return setToken(token, SB_GE, ln, cn);
+    } else return setToken(token, SB_GT, ln, cn);
   case CHAR_EQ: 
-    token = makeToken(SB_EQ, lineNo, colNo);
+    setToken(token, SB_EQ, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_EXCLAIMATION:
@@ -171,14 +209,14 @@ Token* getToken(void) {
     readChar();
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
       readChar();
-      return makeToken(SB_NEQ, ln, cn);
+      return setToken(token, SB_NEQ, ln, cn);
     } else {
-      token = makeToken(TK_NONE, ln, cn);
-      error(ERR_INVALIDSYMBOL, ln, cn);
+      setToken(token, TK_NONE, ln, cn);
+      scanError(ERR_INVALIDSYMBOL, ln, cn);
       return token;
     }
   case CHAR_COMMA:
-    token = makeToken(SB_COMMA, lineNo, colNo);
+    setToken(token, SB_COMMA, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_PERIOD:
@@ -187,10 +225,10 @@ Token* getToken(void) {
     readChar();
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_RPAR)) {
       readChar();
-      return makeToken(SB_RSEL, ln, cn);
-    } else return makeToken(SB_PERIOD, ln, cn);
+      return setToken(token, SB_RSEL, ln, cn);
+    } else return setToken(token, SB_PERIOD, ln, cn);
   case CHAR_SEMICOLON:
-    token = makeToken(SB_SEMICOLON, lineNo, colNo);
+    setToken(token, SB_SEMICOLON, lineNo, colNo);
     readChar(); 
     return token;
   case CHAR_COLON:
@@ -199,47 +237,55 @@ Token* getToken(void) {
     readChar();
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_EQ)) {
       readChar();
-      return makeToken(SB_ASSIGN, ln, cn);
-    } else return makeToken(SB_COLON, ln, cn);
-  case CHAR_SINGLEQUOTE: return readConstChar();
+      return setToken(token, SB_ASSIGN, ln, cn);
+    } else return setToken(token, SB_COLON, ln, cn);
+  case CHAR_SINGLEQUOTE: return readConstChar(token);
   case CHAR_LPAR:
     ln = lineNo;
     cn = colNo;
     readChar();
 
     if (currentChar == EOF) 
-      return makeToken(SB_LPAR, ln, cn);
+      return setToken(token, SB_LPAR, ln, cn);
 
     switch (charCodes[currentChar]) {
     case CHAR_PERIOD:
       readChar();
-      return makeToken(SB_LSEL, ln, cn);
+      return setToken(token, SB_LSEL, ln, cn);
     case CHAR_TIMES:
       readChar();
       skipComment();
-      return getToken();
+      return NULL;
     default:
-      return makeToken(SB_LPAR, ln, cn);
+      return setToken(token, SB_LPAR, ln, cn);
     }
   case CHAR_RPAR:
-    token = makeToken(SB_RPAR, lineNo, colNo);
+    setToken(token, SB_RPAR, lineNo, colNo);
     readChar(); 
     return token;
   default:
-    token = makeToken(TK_NONE, lineNo, colNo);
-    error(ERR_INVALIDSYMBOL, lineNo, colNo);
+    setToken(token, TK_NONE, lineNo, colNo);
+    scanError((currentChar == INVALID_CHAR) ? ERR_INVALIDENCODING : ERR_INVALIDSYMBOL, lineNo, colNo);
     readChar(); 
     return token;
   }
 }
 
-Token* getValidToken(void) {
-  Token *token = getToken();
-  while (token->tokenType == TK_NONE) {
-    free(token);
-    token = getToken();
-  }
-  return token;
+// Scans the next token into token. Loops rather than recursing over blanks
+// and comments, so a long run of them cannot exhaust the stack.
+void scanToken(Token *token) {
+  while (readToken(token) == NULL);
+  STAT_TOKEN(token->tokenType);
+  PROBE3(token, token->tokenType, token->lineNo, token->colNo);
+}
+
+// The same, past the invalid tokens that were reported
+void scanValidToken(Token *token) {
+  STAT_TIMER(start);
+  scanToken(token);
+  while (token->tokenType == TK_NONE)
+    scanToken(token);
+  STAT_ELAPSED(scannerNanos, start);
 }
 
 
@@ -247,55 +293,55 @@ Token* getValidToken(void) {
 
 void printToken(Token *token) {
 
-  printf("%d-%d:", token->lineNo, token->colNo);
+  fprintf(outputStream, "%d-%d:", token->lineNo, token->colNo);
 
   switch (token->tokenType) {
-  case TK_NONE: printf("TK_NONE\n"); break;
-  case TK_IDENT: printf("TK_IDENT(%s)\n", token->string); break;
-  case TK_NUMBER: printf("TK_NUMBER(%s)\n", token->string); break;
-  case TK_CHAR: printf("TK_CHAR(\'%s\')\n", token->string); break;
-  case TK_EOF: printf("TK_EOF\n"); break;
-
-  case KW_PROGRAM: printf("KW_PROGRAM\n"); break;
-  case KW_CONST: printf("KW_CONST\n"); break;
-  case KW_TYPE: printf("KW_TYPE\n"); break;
-  case KW_VAR: printf("KW_VAR\n"); break;
-  case KW_INTEGER: printf("KW_INTEGER\n"); break;
-  case KW_CHAR: printf("KW_CHAR\n"); break;
-  case KW_ARRAY: printf("KW_ARRAY\n"); break;
-  case KW_OF: printf("KW_OF\n"); break;
-  case KW_FUNCTION: printf("KW_FUNCTION\n"); break;
-  case KW_PROCEDURE: printf("KW_PROCEDURE\n"); break;
-  case KW_BEGIN: printf("KW_BEGIN\n"); break;
-  case KW_END: printf("KW_END\n"); break;
-  case KW_CALL: printf("KW_CALL\n"); break;
-  case KW_IF: printf("KW_IF\n"); break;
-  case KW_THEN: printf("KW_THEN\n"); break;
-  case KW_ELSE: printf("KW_ELSE\n"); break;
-  case KW_WHILE: printf("KW_WHILE\n"); break;
-  case KW_DO: printf("KW_DO\n"); break;
-  case KW_FOR: printf("KW_FOR\n"); break;
-  case KW_TO: printf("KW_TO\n"); break;
-
-  case SB_SEMICOLON: printf("SB_SEMICOLON\n"); break;
-  case SB_COLON: printf("SB_COLON\n"); break;
-  case SB_PERIOD: printf("SB_PERIOD\n"); break;
-  case SB_COMMA: printf("SB_COMMA\n"); break;
-  case SB_ASSIGN: printf("SB_ASSIGN\n"); break;
-  case SB_EQ: printf("SB_EQ\n"); break;
-  case SB_NEQ: printf("SB_NEQ\n"); break;
-  case SB_LT: printf("SB_LT\n"); break;
-  case SB_LE: printf("SB_LE\n"); break;
-  case SB_GT: printf("SB_GT\n"); break;
-  case SB_GE: printf("SB_GE\n"); break;
-  case SB_PLUS: printf("SB_PLUS\n"); break;
-  case SB_MINUS: printf("SB_MINUS\n"); break;
-  case SB_TIMES: printf("SB_TIMES\n"); break;
-  case SB_SLASH: printf("SB_SLASH\n"); break;
-  case SB_LPAR: printf("SB_LPAR\n"); break;
-  case SB_RPAR: printf("SB_RPAR\n"); break;
-  case SB_LSEL: printf("SB_LSEL\n"); break;
-  case SB_RSEL: printf("SB_RSEL\n"); break;
+  case TK_NONE: fprintf(outputStream, "TK_NONE\n"); break;
+  case TK_IDENT: fprintf(outputStream, "TK_IDENT(%s)\n", token->string); break;
+  case TK_NUMBER: fprintf(outputStream, "TK_NUMBER(%s)\n", token->string); break;
+  case TK_CHAR: fprintf(outputStream, "TK_CHAR(\'%s\')\n", token->string); break;
+  case TK_EOF: fprintf(outputStream, "TK_EOF\n"); break;
+
+  case KW_PROGRAM: fprintf(outputStream, "KW_PROGRAM\n"); break;
+  case KW_CONST: fprintf(outputStream, "KW_CONST\n"); break;
+  case KW_TYPE: fprintf(outputStream, "KW_TYPE\n"); break;
+  case KW_VAR: fprintf(outputStream, "KW_VAR\n"); break;
+  case KW_INTEGER: fprintf(outputStream, "KW_INTEGER\n"); break;
+  case KW_CHAR: fprintf(outputStream, "KW_CHAR\n"); break;
+  case KW_ARRAY: fprintf(outputStream, "KW_ARRAY\n"); break;
+  case KW_OF: fprintf(outputStream, "KW_OF\n"); break;
+  case KW_FUNCTION: fprintf(outputStream, "KW_FUNCTION\n"); break;
+  case KW_PROCEDURE: fprintf(outputStream, "KW_PROCEDURE\n"); break;
+  case KW_BEGIN: fprintf(outputStream, "KW_BEGIN\n"); break;
+  case KW_END: fprintf(outputStream, "KW_END\n"); break;
+  case KW_CALL: fprintf(outputStream, "KW_CALL\n"); break;
+  case KW_IF: fprintf(outputStream, "KW_IF\n"); break;
+  case KW_THEN: fprintf(outputStream, "KW_THEN\n"); break;
+  case KW_ELSE: fprintf(outputStream, "KW_ELSE\n"); break;
+  case KW_WHILE: fprintf(outputStream, "KW_WHILE\n"); break;
+  case KW_DO: fprintf(outputStream, "KW_DO\n"); break;
+  case KW_FOR: fprintf(outputStream, "KW_FOR\n"); break;
+  case KW_TO: fprintf(outputStream, "KW_TO\n"); break;
+
+  case SB_SEMICOLON: fprintf(outputStream, "SB_SEMICOLON\n"); break;
+  case SB_COLON: fprintf(outputStream, "SB_COLON\n"); break;
+  case SB_PERIOD: fprintf(outputStream, "SB_PERIOD\n"); break;
+  case SB_COMMA: fprintf(outputStream, "SB_COMMA\n"); break;
+  case SB_ASSIGN: fprintf(outputStream, "SB_ASSIGN\n"); break;
+  case SB_EQ: fprintf(outputStream, "SB_EQ\n"); break;
+  case SB_NEQ: fprintf(outputStream, "SB_NEQ\n"); break;
+  case SB_LT: fprintf(outputStream, "SB_LT\n"); break;
+  case SB_LE: fprintf(outputStream, "SB_LE\n"); break;
+  case SB_GT: fprintf(outputStream, "SB_GT\n"); break;
+  case SB_GE: fprintf(outputStream, "SB_GE\n"); break;
+  case SB_PLUS: fprintf(outputStream, "SB_PLUS\n"); break;
+  case SB_MINUS: fprintf(outputStream, "SB_MINUS\n"); break;
+  case SB_TIMES: fprintf(outputStream, "SB_TIMES\n"); break;
+  case SB_SLASH: fprintf(outputStream, "SB_SLASH\n"); break;
+  case SB_LPAR: fprintf(outputStream, "SB_LPAR\n"); break;
+  case SB_RPAR: fprintf(outputStream, "SB_RPAR\n"); break;
+  case SB_LSEL: fprintf(outputStream, "SB_LSEL\n"); break;
+  case SB_RSEL: fprintf(outputStream, "SB_RSEL\n"); break;
   }
 }
 
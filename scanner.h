@@ -7,10 +7,19 @@
 #ifndef __SCANNER_H__
 #define __SCANNER_H__
 
+#include <setjmp.h>
 #include "token.h"
+#include "error.h"
 
-Token* getToken(void);
-Token* getValidToken(void);
+// While set, an error the scanner finds is not reported: it is left in
+// scanErrorCode and its position, and the scanner unwinds to the trap
+extern __thread jmp_buf *scanTrap;
+extern __thread ErrorCode scanErrorCode;
+extern __thread int scanErrorLineNo, scanErrorColNo;
+
+void scanToken(Token *token);
+void scanValidToken(Token *token);
 void printToken(Token *token);
+void scanError(ErrorCode err, int lineNo, int colNo);
 
 #endif
@@ -0,0 +1,371 @@
+/* Semantic analysis
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "sema.h"
+
+// Statements and expressions may nest MAX_NESTING_DEPTH deep
+#define WORKER_STACK_SIZE (64 << 20)
+
+// One body to check: the main program or a subroutine at any depth. Tasks
+// share the tree read-only and each keeps its own errors.
+typedef struct {
+  AstNode *owner;
+  AstNode *block;
+  Diagnostics diagnostics;
+} Task;
+
+Diagnostics resolveErrors;
+int semanticThreads;
+
+Task *tasks;
+int taskCount;
+int taskCapacity;
+int nextTask;
+pthread_mutex_t taskLock = PTHREAD_MUTEX_INITIALIZER;
+
+Type* typeOf(Task *task, AstNode *expr);
+void checkStatement(Task *task, AstNode *statement);
+
+/******************************************************************/
+
+void addDiagnostic(Diagnostics *diagnostics, ErrorCode code, int lineNo, int colNo) {
+  Diagnostic *d;
+  if (diagnostics->count == diagnostics->capacity) {
+    diagnostics->capacity = diagnostics->capacity ? diagnostics->capacity * 2 : 16;
+    diagnostics->items = (Diagnostic*)realloc(diagnostics->items, diagnostics->capacity * sizeof(Diagnostic));
+  }
+  d = &diagnostics->items[diagnostics->count];
+  d->lineNo = lineNo;
+  d->colNo = colNo;
+  d->code = code;
+  d->sequence = diagnostics->count ++;
+}
+
+void clearDiagnostics(Diagnostics *diagnostics) {
+  free(diagnostics->items);
+  diagnostics->items = NULL;
+  diagnostics->count = 0;
+  diagnostics->capacity = 0;
+}
+
+void taskError(Task *task, ErrorCode code, AstNode *node) {
+  addDiagnostic(&task->diagnostics, code, node->lineNo, node->colNo);
+}
+
+int isBasicType(Type *type) {
+  return (type == intType) || (type == charType);
+}
+
+// Undeclared identifiers were reported already, so they pass as variables
+int isVariable(AstNode *expr) {
+  if (expr->kind != N_VARIABLE)
+    return 0;
+  return (expr->decl == NULL) || (expr->decl->kind == N_VAR) || (expr->decl->kind == N_PARAM);
+}
+
+void expectInteger(Task *task, AstNode *expr) {
+  Type *type = typeOf(task, expr);
+  if ((type != NULL) && (type != intType))
+    taskError(task, ERR_INTEGEREXPECTED, expr);
+}
+
+// Applies the indexes of ref to type, which is NULL when unknown
+Type* checkIndexes(Task *task, AstNode *ref, Type *type) {
+  AstNode *index;
+  for (index = ref->list; index != NULL; index = index->next) {
+    expectInteger(task, index);
+    if (type == NULL)
+      continue;
+    if (type->typeClass != TP_ARRAY) {
+      taskError(task, ERR_INDEXCOUNT, ref);
+      type = NULL;
+    } else type = type->elementType;
+  }
+  return type;
+}
+
+// Checks the arguments of call against decl, the subroutine it names or NULL
+void checkArguments(Task *task, AstNode *call, AstNode *decl) {
+  AstNode *arg, *param = (decl != NULL) ? decl->list : NULL;
+  Type *type;
+
+  if ((decl != NULL) && (listLength(call->list) != listLength(param)))
+    taskError(task, ERR_ARGUMENTCOUNT, call);
+  for (arg = call->list; arg != NULL; arg = arg->next) {
+    type = typeOf(task, arg);
+    if (param == NULL)
+      continue;
+    if (param->isVarParam && !isVariable(arg))
+      taskError(task, ERR_NOTAVARIABLE, arg);
+    else if ((type != NULL) && (param->type != NULL) && (type != param->type))
+      taskError(task, ERR_TYPEINCONSISTENCY, arg);
+    param = param->next;
+  }
+}
+
+// call must name a subroutine of the given kind; returns it or NULL
+AstNode* checkCall(Task *task, AstNode *call, NodeKind kind, ErrorCode code) {
+  AstNode *decl = call->decl;
+  if ((decl != NULL) && (decl->kind != kind)) {
+    taskError(task, code, call);
+    decl = NULL;
+  }
+  checkArguments(task, call, decl);
+  return decl;
+}
+
+Type* typeOf(Task *task, AstNode *expr) {
+  AstNode **spine;
+  AstNode *decl;
+  int count, i;
+
+  switch (expr->kind) {
+  case N_NUMBER:
+    return intType;
+  case N_CHARCONST:
+    return charType;
+  case N_VARIABLE:
+    if (expr->decl == NULL)
+      return checkIndexes(task, expr, NULL);
+    switch (expr->decl->kind) {
+    case N_CONST:
+    case N_VAR:
+    case N_PARAM:
+      return checkIndexes(task, expr, expr->decl->type);
+    default:
+      taskError(task, ERR_INVALIDFACTOR, expr);
+      return checkIndexes(task, expr, NULL);
+    }
+  case N_FUNCALL:
+    decl = checkCall(task, expr, N_FUNCTION, ERR_NOTAFUNCTION);
+    return (decl != NULL) ? decl->type : NULL;
+  case N_UNARY:
+    expectInteger(task, expr->left);
+    return intType;
+  case N_BINARY:
+    count = binarySpine(expr, &spine);
+    for (i = count - 1; i >= 0; i--)
+      expectInteger(task, spine[i]->right);
+    expectInteger(task, spine[0]->left);
+    free(spine);
+    return intType;
+  default:
+    return NULL;
+  }
+}
+
+void checkCondition(Task *task, AstNode *condition) {
+  Type *left = typeOf(task, condition->left);
+  Type *right = typeOf(task, condition->right);
+  if ((left != NULL) && (right != NULL) && ((left != right) || !isBasicType(left)))
+    taskError(task, ERR_TYPEINCONSISTENCY, condition);
+}
+
+void checkAssignment(Task *task, AstNode *statement) {
+  AstNode *target = statement->left;
+  Type *type = NULL, *value;
+
+  if (target->decl == NULL)
+    checkIndexes(task, target, NULL);
+  else switch (target->decl->kind) {
+  case N_VAR:
+  case N_PARAM:
+    type = checkIndexes(task, target, target->decl->type);
+    if ((type != NULL) && !isBasicType(type)) {
+      taskError(task, ERR_INDEXCOUNT, target);
+      type = NULL;
+    }
+    break;
+  case N_FUNCTION:
+    // a function sets its result inside its own body only
+    if (target->decl == task->owner) {
+      type = checkIndexes(task, target, target->decl->type);
+      break;
+    }
+  default:
+    taskError(task, ERR_NOTAVARIABLE, target);
+    break;
+  }
+
+  value = typeOf(task, statement->right);
+  if ((type != NULL) && (value != NULL) && (type != value))
+    taskError(task, ERR_TYPEINCONSISTENCY, statement->right);
+}
+
+void checkFor(Task *task, AstNode *statement) {
+  AstNode *var = statement->left;
+  Type *type;
+
+  if (!isVariable(var))
+    taskError(task, ERR_NOTAVARIABLE, var);
+  else if (var->decl != NULL) {
+    type = var->decl->type;
+    if ((type != NULL) && (type != intType))
+      taskError(task, ERR_INTEGEREXPECTED, var);
+  }
+  expectInteger(task, statement->right);
+  expectInteger(task, statement->list);
+  checkStatement(task, statement->body);
+}
+
+void checkStatement(Task *task, AstNode *statement) {
+  AstNode *st;
+
+  if (statement == NULL)
+    return;
+  switch (statement->kind) {
+  case N_ASSIGN:
+    checkAssignment(task, statement);
+    break;
+  case N_CALL:
+    checkCall(task, statement, N_PROCEDURE, ERR_NOTAPROCEDURE);
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      checkStatement(task, st);
+    break;
+  case N_IF:
+    checkCondition(task, statement->left);
+    checkStatement(task, statement->body);
+    checkStatement(task, statement->right);
+    break;
+  case N_WHILE:
+    checkCondition(task, statement->left);
+    checkStatement(task, statement->body);
+    break;
+  case N_FOR:
+    checkFor(task, statement);
+    break;
+  default:
+    break;
+  }
+}
+
+void runTask(Task *task) {
+  checkStatement(task, task->block->body);
+}
+
+void collectTasks(AstNode *owner, AstNode *block) {
+  AstNode *decl;
+
+  if (taskCount == taskCapacity) {
+    taskCapacity = taskCapacity ? taskCapacity * 2 : 64;
+    tasks = (Task*)realloc(tasks, taskCapacity * sizeof(Task));
+  }
+  tasks[taskCount].owner = owner;
+  tasks[taskCount].block = block;
+  tasks[taskCount].diagnostics.items = NULL;
+  tasks[taskCount].diagnostics.count = 0;
+  tasks[taskCount].diagnostics.capacity = 0;
+  taskCount ++;
+
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      collectTasks(decl, decl->body);
+}
+
+void* semanticWorker(void *unused) {
+  int i;
+  while (1) {
+    pthread_mutex_lock(&taskLock);
+    i = nextTask ++;
+    pthread_mutex_unlock(&taskLock);
+    if (i >= taskCount) {
+      STAT_MERGE();
+      return NULL;
+    }
+    runTask(&tasks[i]);
+  }
+}
+
+void runTasks(void) {
+  pthread_t *workers;
+  pthread_attr_t attr;
+  int threads = semanticThreads;
+  int i;
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > taskCount)
+    threads = taskCount;
+  if (threads < 1)
+    threads = 1;
+
+  nextTask = 0;
+  workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+  // this thread is a worker too
+  for (i = 1; i < threads; i++)
+    if (pthread_create(&workers[i], &attr, semanticWorker, NULL) != 0)
+      break;
+  threads = i;
+  semanticWorker(NULL);
+  for (i = 1; i < threads; i++)
+    pthread_join(workers[i], NULL);
+  pthread_attr_destroy(&attr);
+  free(workers);
+}
+
+int compareDiagnostics(const void *a, const void *b) {
+  const Diagnostic *x = (const Diagnostic*)a;
+  const Diagnostic *y = (const Diagnostic*)b;
+  if (x->lineNo != y->lineNo) return x->lineNo - y->lineNo;
+  if (x->colNo != y->colNo) return x->colNo - y->colNo;
+  return x->sequence - y->sequence;
+}
+
+// Gathers the errors of every task in task order and sorts them by position,
+// so the report does not depend on which worker finished first
+void reportDiagnostics(void) {
+  Diagnostics all = { NULL, 0, 0 };
+  Diagnostic *d;
+  int i, j;
+
+  for (j = 0; j < resolveErrors.count; j++) {
+    d = &resolveErrors.items[j];
+    addDiagnostic(&all, d->code, d->lineNo, d->colNo);
+  }
+  for (i = 0; i < taskCount; i++)
+    for (j = 0; j < tasks[i].diagnostics.count; j++) {
+      d = &tasks[i].diagnostics.items[j];
+      addDiagnostic(&all, d->code, d->lineNo, d->colNo);
+    }
+  qsort(all.items, all.count, sizeof(Diagnostic), compareDiagnostics);
+  for (j = 0; j < all.count; j++)
+    noteError(all.items[j].code, all.items[j].lineNo, all.items[j].colNo);
+  clearDiagnostics(&all);
+}
+
+int analyzeProgram(AstNode *program) {
+  int count, i;
+
+  if (program == NULL)
+    return 0;
+
+  taskCount = 0;
+  collectTasks(program, program->body);
+  runTasks();
+  reportDiagnostics();
+
+  count = resolveErrors.count;
+  clearDiagnostics(&resolveErrors);
+  for (i = 0; i < taskCount; i++) {
+    count += tasks[i].diagnostics.count;
+    clearDiagnostics(&tasks[i].diagnostics);
+  }
+  free(tasks);
+  tasks = NULL;
+  taskCount = 0;
+  taskCapacity = 0;
+  return count;
+}
@@ -0,0 +1,37 @@
+/* Semantic analysis
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __SEMA_H__
+#define __SEMA_H__
+
+#include "ast.h"
+#include "error.h"
+
+typedef struct {
+  int lineNo, colNo;
+  ErrorCode code;
+  int sequence;                // keeps reports at the same position in order
+} Diagnostic;
+
+typedef struct {
+  Diagnostic *items;
+  int count, capacity;
+} Diagnostics;
+
+// Identifier errors the parser leaves for the analysis to report
+extern Diagnostics resolveErrors;
+// Workers checking subroutine bodies; 0 uses one per online processor
+extern int semanticThreads;
+
+void addDiagnostic(Diagnostics *diagnostics, ErrorCode code, int lineNo, int colNo);
+void clearDiagnostics(Diagnostics *diagnostics);
+
+// Checks the main body and every subroutine body of a resolved program, each
+// as its own task, then reports all errors sorted by position. Returns how
+// many there were.
+int analyzeProgram(AstNode *program);
+
+#endif
@@ -0,0 +1,115 @@
+/* Hot-path counters
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+#ifdef KPL_STATS
+
+__thread KplStats kplStats;
+// What the threads merged so far
+KplStats statsTotal;
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Production slots are shared by all threads
+const char *productionNames[MAX_PRODUCTIONS];
+int productionCount;
+
+char *tokenNames[TOKEN_TYPE_COUNT] = {
+  "TK_NONE", "TK_IDENT", "TK_NUMBER", "TK_CHAR", "TK_EOF",
+  "KW_PROGRAM", "KW_CONST", "KW_TYPE", "KW_VAR",
+  "KW_INTEGER", "KW_CHAR", "KW_ARRAY", "KW_OF",
+  "KW_FUNCTION", "KW_PROCEDURE",
+  "KW_BEGIN", "KW_END", "KW_CALL",
+  "KW_IF", "KW_THEN", "KW_ELSE",
+  "KW_WHILE", "KW_DO", "KW_FOR", "KW_TO",
+  "SB_SEMICOLON", "SB_COLON", "SB_PERIOD", "SB_COMMA",
+  "SB_ASSIGN", "SB_EQ", "SB_NEQ", "SB_LT", "SB_LE", "SB_GT", "SB_GE",
+  "SB_PLUS", "SB_MINUS", "SB_TIMES", "SB_SLASH",
+  "SB_LPAR", "SB_RPAR", "SB_LSEL", "SB_RSEL"
+};
+
+/******************************************************************/
+
+int registerProduction(atomic_int *slot, const char *name) {
+  int result;
+
+  pthread_mutex_lock(&statsLock);
+  result = atomic_load_explicit(slot, memory_order_relaxed);
+  if (result < 0) {
+    if (productionCount == MAX_PRODUCTIONS)
+      result = MAX_PRODUCTIONS - 1;
+    else {
+      productionNames[productionCount] = name;
+      result = productionCount ++;
+    }
+    atomic_store_explicit(slot, result, memory_order_release);
+  }
+  pthread_mutex_unlock(&statsLock);
+  return result;
+}
+
+// Adds the counts of this thread to the totals and starts it over
+void mergeStats(void) {
+  int i;
+
+  pthread_mutex_lock(&statsLock);
+  statsTotal.bytesRead += kplStats.bytesRead;
+  for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+    statsTotal.tokens[i] += kplStats.tokens[i];
+  if (kplStats.peakNestingDepth > statsTotal.peakNestingDepth)
+    statsTotal.peakNestingDepth = kplStats.peakNestingDepth;
+  statsTotal.typeRequests += kplStats.typeRequests;
+  statsTotal.typesInterned += kplStats.typesInterned;
+  for (i = 0; i < MAX_PRODUCTIONS; i++)
+    statsTotal.productionCalls[i] += kplStats.productionCalls[i];
+  statsTotal.compileNanos += kplStats.compileNanos;
+  statsTotal.scannerNanos += kplStats.scannerNanos;
+  pthread_mutex_unlock(&statsLock);
+  memset(&kplStats, 0, sizeof(KplStats));
+}
+
+long long statsClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The totals of every thread merged, this one included. Times are summed
+// over the threads, so with several they may exceed the time taken.
+void writeStats(FILE *f) {
+  long total = 0;
+  int i, first;
+
+  mergeStats();
+  for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+    total += statsTotal.tokens[i];
+
+  fprintf(f, "{\n  \"bytesRead\": %ld,\n", statsTotal.bytesRead);
+  fprintf(f, "  \"tokens\": {\"total\": %ld, \"byType\": {", total);
+  for (i = 0, first = 1; i < TOKEN_TYPE_COUNT; i++) {
+    if (statsTotal.tokens[i] == 0) continue;
+    fprintf(f, "%s\n    \"%s\": %ld", first ? "" : ",", tokenNames[i], statsTotal.tokens[i]);
+    first = 0;
+  }
+  fprintf(f, "}},\n");
+  fprintf(f, "  \"productions\": {");
+  for (i = 0; i < productionCount; i++)
+    fprintf(f, "%s\n    \"%s\": %ld", i ? "," : "", productionNames[i], statsTotal.productionCalls[i]);
+  fprintf(f, "},\n");
+  fprintf(f, "  \"peakNestingDepth\": %d,\n", statsTotal.peakNestingDepth);
+  fprintf(f, "  \"arrayTypes\": {\"requests\": %ld, \"interned\": %ld},\n",
+          statsTotal.typeRequests, statsTotal.typesInterned);
+  fprintf(f, "  \"seconds\": {\"total\": %.6f, \"scanner\": %.6f, \"parser\": %.6f}\n}\n",
+          statsTotal.compileNanos * 1e-9, statsTotal.scannerNanos * 1e-9,
+          (statsTotal.compileNanos - statsTotal.scannerNanos) * 1e-9);
+}
+
+#endif
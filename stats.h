@@ -0,0 +1,70 @@
+/* Hot-path counters
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include "token.h"
+#ifdef KPL_STATS
+#include <stdatomic.h>
+#endif
+
+// The counters exist only in builds made with -DKPL_STATS (make STATS=1);
+// otherwise every STAT_* macro expands to nothing.
+#ifdef KPL_STATS
+
+#define TOKEN_TYPE_COUNT (SB_RSEL + 1)
+#define MAX_PRODUCTIONS 64
+
+typedef struct {
+  long bytesRead;
+  long tokens[TOKEN_TYPE_COUNT];
+  int peakNestingDepth;
+  long typeRequests;
+  long typesInterned;
+  long productionCalls[MAX_PRODUCTIONS];
+  long long compileNanos;
+  long long scannerNanos;
+} KplStats;
+
+// Each thread counts into its own kplStats and adds them to the totals with
+// STAT_MERGE() before it ends; writeStats() prints the totals
+extern __thread KplStats kplStats;
+
+// Gives the production name a slot, unless another thread has given it one
+int registerProduction(atomic_int *slot, const char *name);
+void mergeStats(void);
+long long statsClock(void);
+void writeStats(FILE *f);
+
+#define STAT_ADD(counter, n) (kplStats.counter += (n))
+#define STAT_MAX(counter, n) do { if ((n) > kplStats.counter) kplStats.counter = (n); } while (0)
+#define STAT_TOKEN(tokenType) (kplStats.tokens[tokenType] ++)
+// Counts calls of the enclosing compile* function; its slot is looked up once
+#define STAT_PRODUCTION() do {                          \
+    static atomic_int statSlot = -1;                    \
+    int slot = atomic_load_explicit(&statSlot, memory_order_acquire); \
+    if (slot < 0) slot = registerProduction(&statSlot, __func__); \
+    kplStats.productionCalls[slot] ++;                  \
+  } while (0)
+#define STAT_TIMER(name) long long name = statsClock()
+#define STAT_ELAPSED(counter, name) (kplStats.counter += statsClock() - (name))
+#define STAT_MERGE() mergeStats()
+
+#else
+
+#define STAT_ADD(counter, n)
+#define STAT_MAX(counter, n)
+#define STAT_TOKEN(tokenType)
+#define STAT_PRODUCTION()
+#define STAT_TIMER(name)
+#define STAT_ELAPSED(counter, name)
+#define STAT_MERGE()
+
+#endif
+
+#endif
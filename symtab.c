@@ -0,0 +1,162 @@
+/* Symbol table
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "symtab.h"
+
+typedef struct SymbolEntry {
+  char key[MAX_IDENT_LEN + 1];
+  unsigned int hash;
+  Symbol *binding;
+} SymbolEntry;
+
+SymbolEntry *entries;
+unsigned int entryCapacity, entryCount;
+
+Symbol **scopes;
+int scopeCapacity;
+int currentLevel = -1;
+
+/******************************************************************/
+
+// Upper-cases name into key and returns its FNV-1a hash
+unsigned int makeKey(char *name, char *key) {
+  unsigned int h = 2166136261u;
+  int i;
+  for (i = 0; i < MAX_IDENT_LEN && name[i] != '\0'; i++) {
+    key[i] = (char)toupper((unsigned char)name[i]);
+    h = (h ^ (unsigned char)key[i]) * 16777619u;
+  }
+  key[i] = '\0';
+  return h;
+}
+
+// Linear probing; the table is kept at most half full, so an empty slot is
+// always reached.
+unsigned int findSlot(char *key, unsigned int hash) {
+  unsigned int mask = entryCapacity - 1, i = hash & mask;
+  while (entries[i].key[0] != '\0' &&
+         (entries[i].hash != hash || strcmp(entries[i].key, key) != 0))
+    i = (i + 1) & mask;
+  return i;
+}
+
+void growEntries(void) {
+  SymbolEntry *old = entries;
+  unsigned int oldCapacity = entryCapacity, i, slot;
+  Symbol *s;
+
+  entryCapacity = oldCapacity ? oldCapacity * 2 : 256;
+  entries = (SymbolEntry*)calloc(entryCapacity, sizeof(SymbolEntry));
+  for (i = 0; i < oldCapacity; i++) {
+    if (old[i].key[0] == '\0') continue;
+    slot = findSlot(old[i].key, old[i].hash);
+    entries[slot] = old[i];
+    for (s = old[i].binding; s != NULL; s = s->shadowed)
+      s->slot = slot;
+  }
+  free(old);
+}
+
+void freeScope(Symbol *s) {
+  Symbol *next;
+  while (s != NULL) {
+    next = s->nextInScope;
+    free(s);
+    s = next;
+  }
+}
+
+/******************************************************************/
+
+void initSymTab(void) {
+  cleanSymTab();
+  entryCapacity = 0;
+  growEntries();
+  currentLevel = -1;
+}
+
+void cleanSymTab(void) {
+  while (currentLevel >= 0)
+    freeScope(scopes[currentLevel--]);
+  free(entries);
+  free(scopes);
+  entries = NULL;
+  scopes = NULL;
+  entryCapacity = entryCount = 0;
+  scopeCapacity = 0;
+  currentLevel = -1;
+}
+
+void enterScope(void) {
+  currentLevel ++;
+  if (currentLevel == scopeCapacity) {
+    scopeCapacity = scopeCapacity ? scopeCapacity * 2 : 16;
+    scopes = (Symbol**)realloc(scopes, scopeCapacity * sizeof(Symbol*));
+  }
+  scopes[currentLevel] = NULL;
+}
+
+// Each name declared here gets back the declaration it was hiding. Entries
+// are never removed, so the probe sequences of other names stay intact.
+void exitScope(void) {
+  Symbol *s, *next;
+
+  for (s = scopes[currentLevel]; s != NULL; s = next) {
+    next = s->nextInScope;
+    entries[s->slot].binding = s->shadowed;
+    free(s);
+  }
+  currentLevel --;
+}
+
+int scopeLevel(void) {
+  return currentLevel;
+}
+
+Symbol* declareSymbol(char *name, SymbolKind kind, int lineNo, int colNo) {
+  char key[MAX_IDENT_LEN + 1];
+  unsigned int hash = makeKey(name, key), slot;
+  Symbol *s;
+
+  slot = findSlot(key, hash);
+  if (entries[slot].key[0] == '\0') {
+    if (2 * (entryCount + 1) > entryCapacity) {
+      growEntries();
+      slot = findSlot(key, hash);
+    }
+    strcpy(entries[slot].key, key);
+    entries[slot].hash = hash;
+    entries[slot].binding = NULL;
+    entryCount ++;
+  } else if (entries[slot].binding != NULL && entries[slot].binding->level == currentLevel)
+    return NULL;
+
+  s = (Symbol*)malloc(sizeof(Symbol));
+  strcpy(s->name, name);
+  s->kind = kind;
+  s->lineNo = lineNo;
+  s->colNo = colNo;
+  s->type = NULL;
+  s->value = 0;
+  s->node = NULL;
+  s->level = currentLevel;
+  s->slot = slot;
+  s->shadowed = entries[slot].binding;
+  s->nextInScope = scopes[currentLevel];
+  scopes[currentLevel] = s;
+  entries[slot].binding = s;
+  return s;
+}
+
+Symbol* lookupSymbol(char *name) {
+  char key[MAX_IDENT_LEN + 1];
+  unsigned int hash = makeKey(name, key);
+  return entries[findSlot(key, hash)].binding;
+}
@@ -0,0 +1,53 @@
+/* Symbol table
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __SYMTAB_H__
+#define __SYMTAB_H__
+
+#include "token.h"
+#include "types.h"
+
+struct AstNode;
+
+typedef enum {
+  SYM_PROGRAM,
+  SYM_CONSTANT,
+  SYM_TYPE,
+  SYM_VARIABLE,
+  SYM_PARAMETER,
+  SYM_FUNCTION,
+  SYM_PROCEDURE
+} SymbolKind;
+
+typedef struct Symbol {
+  char name[MAX_IDENT_LEN + 1];
+  SymbolKind kind;
+  int lineNo, colNo;
+  Type *type;                  // NULL for programs and procedures
+  int value;                   // of a constant
+  int level;                   // scope depth; 0 holds the builtins and the program name
+  int slot;                    // entry for this name in the hash table
+  struct Symbol *shadowed;     // same name in an enclosing scope
+  struct Symbol *nextInScope;
+  struct AstNode *node;        // the declaration, when the parser builds a tree
+} Symbol;
+
+// Every name ever declared has one open-addressing entry, keyed by its
+// upper-cased spelling since KPL identifiers ignore case. The entry points
+// at the innermost visible declaration, which links to the ones it hides.
+// Lookup is one probe sequence; leaving a scope only restores the entries of
+// the names it declared.
+void initSymTab(void);
+void cleanSymTab(void);
+void enterScope(void);
+void exitScope(void);
+int scopeLevel(void);
+
+// Returns NULL when the name is already declared in the current scope
+Symbol* declareSymbol(char *name, SymbolKind kind, int lineNo, int colNo);
+Symbol* lookupSymbol(char *name);
+
+#endif
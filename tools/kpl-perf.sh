@@ -0,0 +1,53 @@
+#!/bin/sh
+# Attaches perf to the parser's USDT probes on a generated corpus and writes
+#   OUT/latency.txt     per-production latency (block, statement, expression)
+#   OUT/stacks.folded   sampled call stacks, one line per stack, ready for
+#                       flamegraph.pl or speedscope
+#
+#   tools/kpl-perf.sh [--size 4M] [--out perf-out] [--tokens]
+#
+# Needs perf, root or kernel.perf_event_paranoid <= 1 for uprobes, and a
+# parser built with <sys/sdt.h> installed (check with: perf list sdt_kpl:*).
+# --tokens also records the token probe, which fires once per token.
+
+set -e
+SIZE=4M
+OUT=perf-out
+TOKENS=0
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --size) SIZE="$2"; shift 2 ;;
+    --out) OUT="$2"; shift 2 ;;
+    --tokens) TOKENS=1; shift ;;
+    *) echo "usage: $0 [--size N[K|M|G]] [--out DIR] [--tokens]" >&2; exit 1 ;;
+  esac
+done
+
+cd "$(dirname "$0")/.."
+make -s parser kplgen
+mkdir -p "$OUT"
+./kplgen --size "$SIZE" --seed 1 -o "$OUT/corpus.kpl"
+
+PROBES="block_entry block_exit statement_entry statement_exit expression_entry expression_exit error"
+[ "$TOKENS" = 1 ] && PROBES="$PROBES token"
+
+perf buildid-cache --add ./parser
+EVENTS=""
+for p in $PROBES; do
+  perf probe -q -d "sdt_kpl:$p" 2>/dev/null || true
+  if ! perf probe -q "sdt_kpl:$p"; then
+    echo "$0: no sdt_kpl:$p probe; was the parser built with <sys/sdt.h>?" >&2
+    exit 1
+  fi
+  EVENTS="$EVENTS -e sdt_kpl:$p"
+done
+trap 'for p in $PROBES; do perf probe -q -d "sdt_kpl:$p" 2>/dev/null || true; done' EXIT
+
+perf record -q $EVENTS -o "$OUT/probes.data" ./parser --quiet "$OUT/corpus.kpl"
+perf script -i "$OUT/probes.data" -F time,event,trace | python3 tools/perf_probes.py latency > "$OUT/latency.txt"
+
+perf record -q -F 4999 -g -o "$OUT/cpu.data" ./parser --quiet "$OUT/corpus.kpl"
+perf script -i "$OUT/cpu.data" | python3 tools/perf_probes.py fold > "$OUT/stacks.folded"
+
+cat "$OUT/latency.txt"
+echo "stacks: $OUT/stacks.folded"
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Replays an edit session against kpl-lsp and reports keystroke-to-diagnostic latency.
+
+    tools/lsp_replay.py test/example4.kpl
+    tools/lsp_replay.py --keystrokes 2000 --interval-ms 0 big.kpl
+    tools/lsp_replay.py --session edits.jsonl big.kpl
+
+A session file holds one edit per line:
+    {"line": 12, "character": 4, "delete": 0, "insert": "X"}
+Without one, the client types and then erases a short expression, one
+keystroke per change, at random assignments in the file.
+"""
+
+import argparse
+import json
+import random
+import subprocess
+import sys
+import threading
+import time
+import queue
+
+
+class Server:
+    def __init__(self, command):
+        self.proc = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.messages = queue.Queue()
+        self.next_id = 1
+        threading.Thread(target=self._read, daemon=True).start()
+
+    def _read(self):
+        out = self.proc.stdout
+        while True:
+            length = None
+            while True:
+                line = out.readline()
+                if not line:
+                    self.messages.put(None)
+                    return
+                line = line.strip()
+                if not line:
+                    break
+                if line.lower().startswith(b"content-length:"):
+                    length = int(line.split(b":")[1])
+            self.messages.put((time.perf_counter(), json.loads(out.read(length))))
+
+    def send(self, message):
+        body = json.dumps(message).encode()
+        self.proc.stdin.write(b"Content-Length: %d\r\n\r\n" % len(body) + body)
+        self.proc.stdin.flush()
+
+    def notify(self, method, params):
+        self.send({"jsonrpc": "2.0", "method": method, "params": params})
+
+    def request(self, method, params=None):
+        rid = self.next_id
+        self.next_id += 1
+        self.send({"jsonrpc": "2.0", "id": rid, "method": method, "params": params or {}})
+        while True:
+            item = self.messages.get()
+            if item is None:
+                sys.exit("server exited")
+            if item[1].get("id") == rid:
+                return item[1].get("result")
+
+    def wait_diagnostics(self, version):
+        while True:
+            item = self.messages.get()
+            if item is None:
+                sys.exit("server exited")
+            at, message = item
+            if message.get("method") == "textDocument/publishDiagnostics" and \
+               message["params"].get("version", -1) >= version:
+                return at, message["params"]
+
+
+def synthetic_session(text, keystrokes, rng):
+    lines = text.split("\n")
+    targets = [i for i, l in enumerate(lines) if ":=" in l] or [0]
+    edits = []
+    while len(edits) < keystrokes:
+        line = rng.choice(targets)
+        character = len(lines[line].rstrip().rstrip(";"))
+        typed = " + X1"
+        for i, ch in enumerate(typed):
+            edits.append({"line": line, "character": character + i, "delete": 0, "insert": ch})
+        for i in reversed(range(len(typed))):
+            edits.append({"line": line, "character": character + i, "delete": 1, "insert": ""})
+    return edits[:keystrokes]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("file")
+    ap.add_argument("--server", default="./kpl-lsp")
+    ap.add_argument("--debounce", type=int, default=0, help="server debounce window in ms")
+    ap.add_argument("--session", help="JSON lines file of edits to replay")
+    ap.add_argument("--keystrokes", type=int, default=500)
+    ap.add_argument("--interval-ms", type=float, default=None,
+                    help="send keystrokes at this pace instead of waiting for each diagnostic")
+    ap.add_argument("--seed", type=int, default=1)
+    args = ap.parse_args()
+
+    text = open(args.file, encoding="utf-8", errors="replace").read()
+    if args.session:
+        edits = [json.loads(l) for l in open(args.session) if l.strip()]
+    else:
+        edits = synthetic_session(text, args.keystrokes, random.Random(args.seed))
+
+    server = Server([args.server, "--debounce", str(args.debounce)])
+    server.request("initialize", {"processId": None, "rootUri": None, "capabilities": {}})
+    server.notify("initialized", {})
+
+    uri = "file://" + args.file
+    sent = time.perf_counter()
+    server.notify("textDocument/didOpen",
+                  {"textDocument": {"uri": uri, "languageId": "kpl", "version": 0, "text": text}})
+    at, _ = server.wait_diagnostics(0)
+    open_ms = (at - sent) * 1e3
+
+    latencies = []
+    sent_at = {}
+    for version, edit in enumerate(edits, 1):
+        start = {"line": edit["line"], "character": edit["character"]}
+        end = {"line": edit["line"], "character": edit["character"] + edit.get("delete", 0)}
+        sent_at[version] = time.perf_counter()
+        server.notify("textDocument/didChange",
+                      {"textDocument": {"uri": uri, "version": version},
+                       "contentChanges": [{"range": {"start": start, "end": end}, "text": edit["insert"]}]})
+        if args.interval_ms is None:
+            at, params = server.wait_diagnostics(version)
+            latencies.append((at - sent_at[version]) * 1e3)
+        elif args.interval_ms > 0:
+            time.sleep(args.interval_ms / 1e3)
+
+    if args.interval_ms is not None and edits:
+        # superseded versions are never published; time each one that is
+        version = 0
+        while version < len(edits):
+            at, params = server.wait_diagnostics(version + 1)
+            version = params["version"]
+            latencies.append((at - sent_at[version]) * 1e3)
+
+    stats = server.request("kpl/latencyStats")
+    server.request("shutdown")
+    server.notify("exit", None)
+    server.proc.wait()
+
+    print("file: %s (%d bytes, %d lines)" % (args.file, len(text), text.count("\n") + 1))
+    print("didOpen: %.3f ms" % open_ms)
+    if latencies:
+        print("keystrokes: %d sent, %d diagnostics" % (len(edits), len(latencies)))
+        print("client latency: p50 %.3f ms  p99 %.3f ms  max %.3f ms" %
+              (percentile(latencies, 0.5), percentile(latencies, 0.99), max(latencies)))
+    print("server latency: %s" % json.dumps(stats))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Turns perf script output for the parser into reports.
+
+    perf script -F time,event,trace | tools/perf_probes.py latency
+    perf script | tools/perf_probes.py fold > stacks.folded
+
+latency pairs the sdt_kpl:*_entry and *_exit probes and prints, for each
+production, how often it ran and its inclusive and self time. Self time
+excludes nested productions. An error probe ends the parse, so entries still
+open at that point are dropped. fold turns sampled call stacks into the
+folded format read by flamegraph.pl and speedscope.
+"""
+
+import re
+import sys
+from collections import defaultdict
+
+PROBE = re.compile(r"^\s*(?:\S.*?\s)?(\d+\.\d+):\s+sdt_kpl:(\w+):")
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def latency(lines):
+    inclusive = defaultdict(list)
+    self_time = defaultdict(float)
+    counts = defaultdict(int)
+    stack = []  # [kind, start, time spent in nested productions]
+    tokens = errors = 0
+
+    for line in lines:
+        m = PROBE.match(line)
+        if not m:
+            continue
+        t, event = float(m.group(1)), m.group(2)
+        if event == "token":
+            tokens += 1
+        elif event == "error":
+            errors += 1
+            stack.clear()
+        elif event.endswith("_entry"):
+            stack.append([event[:-6], t, 0.0])
+        elif event.endswith("_exit"):
+            kind = event[:-5]
+            while stack and stack[-1][0] != kind:
+                stack.pop()
+            if not stack:
+                continue
+            _, start, nested = stack.pop()
+            spent = t - start
+            inclusive[kind].append(spent)
+            self_time[kind] += spent - nested
+            counts[kind] += 1
+            if stack:
+                stack[-1][2] += spent
+
+    print("%-12s %10s %12s %12s %10s %10s %10s" %
+          ("production", "calls", "total ms", "self ms", "p50 us", "p99 us", "max us"))
+    for kind in sorted(inclusive, key=lambda k: -self_time[k]):
+        spans = sorted(inclusive[kind])
+        print("%-12s %10d %12.3f %12.3f %10.2f %10.2f %10.2f" %
+              (kind, counts[kind], sum(spans) * 1e3, self_time[kind] * 1e3,
+               percentile(spans, 50) * 1e6, percentile(spans, 99) * 1e6, spans[-1] * 1e6))
+    if tokens:
+        print("tokens: %d" % tokens)
+    print("errors: %d" % errors)
+
+
+def fold(lines):
+    stacks = defaultdict(int)
+    comm, frames = None, []
+    for line in lines + [""]:
+        if not line.strip():
+            if comm is not None and frames:
+                stacks[";".join([comm] + frames[::-1])] += 1
+            comm, frames = None, []
+        elif not line[0].isspace():
+            comm = line.split()[0]
+        else:
+            parts = line.split()
+            if len(parts) >= 2:
+                frames.append(re.sub(r"\+0x[0-9a-f]+$", "", parts[1]))
+    for stack, count in sorted(stacks.items()):
+        print("%s %d" % (stack, count))
+
+
+def main():
+    if len(sys.argv) != 2 or sys.argv[1] not in ("latency", "fold"):
+        sys.exit(__doc__)
+    lines = sys.stdin.read().splitlines()
+    if sys.argv[1] == "latency":
+        latency(lines)
+    else:
+        fold(lines)
+
+
+if __name__ == "__main__":
+    main()
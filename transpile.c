@@ -0,0 +1,910 @@
+/* KPL to C translator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "reader.h"
+#include "error.h"
+#include "codegen.h"
+#include "vm.h"
+#include "bounds.h"
+#include "transpile.h"
+
+// The file being written, and the statements of the subroutine being
+// written, kept aside until its temporaries are known
+FILE *cOut;
+FILE *cBody;
+// Depth of that subroutine, its temporaries so far and the indentation
+int cDepth;
+int cTemps, cPointers;
+int cIndent;
+// The statement being written, where its runtime errors are reported
+int cLineNo, cColNo;
+
+// By the number each subroutine has in its offset; 0 is the program.
+// A subroutine has a frame struct when the ones nested in it reach through
+// it to a variable of its own or of an outer subroutine.
+char **cNames;
+int *cFrameSizes;
+int *cParents;
+int *cHasFrame;
+int cRoutineCount, cRoutineCapacity;
+
+// Variables and parameters some nested subroutine uses
+AstNode **cCaptured;
+int cCapturedCount, cCapturedCapacity;
+
+void cExpression(AstNode *expr);
+void cStatement(AstNode *statement);
+
+/******************************************************************/
+
+int isCaptured(AstNode *decl) {
+  int i;
+  for (i = 0; i < cCapturedCount; i++)
+    if (cCaptured[i] == decl)
+      return 1;
+  return 0;
+}
+
+void captureRef(AstNode *ref, int depth) {
+  AstNode *decl = ref->decl;
+
+  if ((decl == NULL) || ((decl->kind != N_VAR) && (decl->kind != N_PARAM)))
+    return;
+  if ((decl->level == 0) || (decl->level >= depth) || isCaptured(decl))
+    return;
+  if (cCapturedCount == cCapturedCapacity) {
+    cCapturedCapacity = cCapturedCapacity ? cCapturedCapacity * 2 : 16;
+    cCaptured = (AstNode**)realloc(cCaptured, cCapturedCapacity * sizeof(AstNode*));
+  }
+  cCaptured[cCapturedCount++] = decl;
+}
+
+// Indexes and arguments are in list, operands in left and right
+void captureExpression(AstNode *expr, int depth) {
+  AstNode **spine;
+  AstNode *node;
+  int count, i;
+
+  if (expr == NULL)
+    return;
+  if (expr->kind == N_BINARY) {
+    count = binarySpine(expr, &spine);
+    captureExpression(spine[0]->left, depth);
+    for (i = 0; i < count; i++)
+      captureExpression(spine[i]->right, depth);
+    free(spine);
+    return;
+  }
+  if (expr->kind == N_VARIABLE)
+    captureRef(expr, depth);
+  for (node = expr->list; node != NULL; node = node->next)
+    captureExpression(node, depth);
+  captureExpression(expr->left, depth);
+  captureExpression(expr->right, depth);
+}
+
+void captureStatement(AstNode *statement, int depth) {
+  AstNode *st;
+
+  if (statement == NULL)
+    return;
+  switch (statement->kind) {
+  case N_ASSIGN:
+  case N_CALL:
+    captureExpression(statement, depth);
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      captureStatement(st, depth);
+    break;
+  case N_IF:
+    captureExpression(statement->left, depth);
+    captureStatement(statement->body, depth);
+    captureStatement(statement->right, depth);
+    break;
+  case N_WHILE:
+    captureExpression(statement->left, depth);
+    captureStatement(statement->body, depth);
+    break;
+  case N_FOR:
+    captureExpression(statement->left, depth);
+    captureExpression(statement->right, depth);
+    captureExpression(statement->list, depth);
+    captureStatement(statement->body, depth);
+    break;
+  default:
+    break;
+  }
+}
+
+int addRoutine(AstNode *owner, int parent) {
+  char name[MAX_IDENT_LEN + 16];
+  int number = cRoutineCount++, i;
+
+  if (cRoutineCount > cRoutineCapacity) {
+    cRoutineCapacity = cRoutineCapacity ? cRoutineCapacity * 2 : 16;
+    cNames = (char**)realloc(cNames, cRoutineCapacity * sizeof(char*));
+    cFrameSizes = (int*)realloc(cFrameSizes, cRoutineCapacity * sizeof(int));
+    cParents = (int*)realloc(cParents, cRoutineCapacity * sizeof(int));
+    cHasFrame = (int*)realloc(cHasFrame, cRoutineCapacity * sizeof(int));
+  }
+  // subroutines of different bodies may share a name
+  snprintf(name, sizeof(name), "f_%s", owner->name);
+  for (i = 1; i < number; i++)
+    if (strcmp(cNames[i], name) == 0) {
+      snprintf(name, sizeof(name), "f_%s_%d", owner->name, number);
+      break;
+    }
+  cNames[number] = strdup(number ? name : "program");
+  cParents[number] = parent;
+  cHasFrame[number] = 0;
+  return number;
+}
+
+// Lays out the frames as the bytecode would, numbers the subroutines and
+// finds the variables reached from nested bodies
+void cLayout(AstNode *owner, AstNode *block, int depth, int number) {
+  AstNode *decl;
+  int nested = 0, own = 0;
+
+  cFrameSizes[number] = layoutFrame(owner, block, depth);
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE)) {
+      decl->level = depth + 1;
+      decl->offset = addRoutine(decl, number);
+      cLayout(decl, decl->body, depth + 1, decl->offset);
+      nested = 1;
+    }
+  captureStatement(block->body, depth);
+
+  if ((number == 0) || !nested)
+    return;
+  for (decl = owner->list; decl != NULL; decl = decl->next)
+    own |= isCaptured(decl);
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    own |= (decl->kind == N_VAR) && isCaptured(decl);
+  // settled outer to inner once every body is seen
+  cHasFrame[number] = own ? 1 : -1;
+}
+
+/******************************************************************/
+
+void cLine(void) {
+  fprintf(cBody, "%*s", 2 * cIndent, "");
+}
+
+void cDeclare(FILE *f, Type *type, char *prefix, char *name) {
+  fprintf(f, "int %s%s", prefix, name);
+  for (; (type != NULL) && (type->typeClass == TP_ARRAY); type = type->elementType)
+    fprintf(f, "[%d]", type->arraySize);
+}
+
+int isArray(AstNode *decl) {
+  return (decl->type != NULL) && (decl->type->typeClass == TP_ARRAY);
+}
+
+int isLiteral(AstNode *expr) {
+  return (expr->kind == N_NUMBER) || (expr->kind == N_CHARCONST) ||
+         ((expr->kind == N_VARIABLE) && (expr->decl->kind == N_CONST));
+}
+
+int constantValue(AstNode *expr) {
+  return (expr->kind == N_VARIABLE) ? expr->decl->value : expr->value;
+}
+
+#define RISK_INDEX 1
+#define RISK_DIVIDE 2
+#define RISK_CALL 4
+
+// What evaluating expr may do by itself, its operands aside
+int ownRisk(AstNode *expr) {
+  AstNode *node;
+  Type *type;
+  int risk = 0;
+
+  if ((expr->kind == N_VARIABLE) && (expr->list != NULL))
+    for (node = expr->list, type = expr->decl->type; node != NULL; node = node->next, type = type->elementType)
+      if (!isIndexInRange(node, type))
+        risk |= RISK_INDEX;
+  if ((expr->kind == N_BINARY) && (expr->op == SB_SLASH) &&
+      !(isLiteral(expr->right) && (constantValue(expr->right) != 0)))
+    risk |= RISK_DIVIDE;
+  return risk;
+}
+
+// How evaluating expr may stop the program or do more than compute a value,
+// found once per node
+int riskOf(AstNode *expr) {
+  AstNode **spine;
+  AstNode *node;
+  int risk = 0, count, i;
+
+  if (expr == NULL)
+    return 0;
+  if (expr->risk != 0)
+    return expr->risk - 1;
+  if (expr->kind == N_FUNCALL)
+    risk = RISK_CALL;
+  else if (expr->kind == N_BINARY) {
+    count = binarySpine(expr, &spine);
+    for (i = 0; i < count; i++)
+      if (spine[i]->risk == 0)
+        spine[i]->risk = (riskOf(spine[i]->left) | riskOf(spine[i]->right) | ownRisk(spine[i])) + 1;
+    free(spine);
+    return expr->risk - 1;
+  } else {
+    risk = ownRisk(expr);
+    for (node = expr->list; node != NULL; node = node->next)
+      risk |= riskOf(node);
+    risk |= riskOf(expr->left) | riskOf(expr->right);
+  }
+  expr->risk = risk + 1;
+  return risk;
+}
+
+// C leaves the order of operands open, the bytecode evaluates them left to
+// right: first goes into a temporary when later could tell the difference,
+// by changing what first reads or by failing with another error
+int mustPrecede(int first, int later) {
+  if (later & RISK_CALL)
+    return 1;
+  if (!first || !later)
+    return 0;
+  return (first & RISK_CALL) || (first != later) || (first == (RISK_INDEX | RISK_DIVIDE));
+}
+
+int mustHoist(AstNode *first, AstNode *later) {
+  int risk;
+
+  if (isLiteral(first))
+    return 0;
+  risk = riskOf(first);
+  // a call may store into what later reads
+  if ((risk & RISK_CALL) && !isLiteral(later))
+    return 1;
+  return mustPrecede(risk, riskOf(later));
+}
+
+int mustHoistBefore(AstNode *first, AstNode *rest) {
+  for (; rest != NULL; rest = rest->next)
+    if (mustHoist(first, rest))
+      return 1;
+  return 0;
+}
+
+void cNumber(int value) {
+  if (value == INT_MIN)
+    fprintf(cBody, "(%d - 1)", INT_MIN + 1);
+  else fprintf(cBody, "%d", value);
+}
+
+// Where the variable or parameter decl is kept, seen from the current body
+void cStorage(AstNode *decl) {
+  int depth;
+
+  if (decl->level == 0)
+    fprintf(cBody, "v_%s", decl->name);
+  else if (decl->level == cDepth)
+    fprintf(cBody, isCaptured(decl) ? "frame.v_%s" : "v_%s", decl->name);
+  else {
+    fprintf(cBody, "up->");
+    for (depth = cDepth - 1; depth > decl->level; depth--)
+      fprintf(cBody, "up->");
+    fprintf(cBody, "v_%s", decl->name);
+  }
+}
+
+void cIndex(AstNode *index, Type *type) {
+  if (needsIndexCheck(index, type)) {
+    fprintf(cBody, "kplIndex(");
+    cExpression(index);
+    fprintf(cBody, ", %d, %d, %d)", type->arraySize, cLineNo, cColNo);
+  } else if (isLiteral(index))
+    fprintf(cBody, "%d", constantValue(index) - 1);
+  else if (index->kind == N_VARIABLE) {
+    cExpression(index);
+    fprintf(cBody, " - 1");
+  } else {
+    fprintf(cBody, "(");
+    cExpression(index);
+    fprintf(cBody, ") - 1");
+  }
+}
+
+// A variable, parameter or array element, as an lvalue
+void cVariable(AstNode *ref) {
+  AstNode *decl = ref->decl;
+  AstNode *index;
+  Type *type = decl->type;
+  int *temps, hoisted = 0, i;
+
+  if (decl->isVarParam) {
+    fprintf(cBody, "(*");
+    cStorage(decl);
+    fprintf(cBody, ")");
+    return;
+  }
+  for (index = ref->list; index != NULL; index = index->next)
+    hoisted |= mustHoistBefore(index, index->next);
+  if (!hoisted) {
+    cStorage(decl);
+    for (index = ref->list; index != NULL; index = index->next, type = type->elementType) {
+      fprintf(cBody, "[");
+      cIndex(index, type);
+      fprintf(cBody, "]");
+    }
+    return;
+  }
+
+  // every index but the last checked in turn before the element is reached
+  temps = (int*)malloc(listLength(ref->list) * sizeof(int));
+  fprintf(cBody, "(*(");
+  for (index = ref->list, i = 0; index->next != NULL; index = index->next, type = type->elementType, i++) {
+    temps[i] = ++cTemps;
+    fprintf(cBody, "t%d = ", temps[i]);
+    cIndex(index, type);
+    fprintf(cBody, ", ");
+  }
+  fprintf(cBody, "&");
+  cStorage(decl);
+  for (index = ref->list, i = 0; index->next != NULL; index = index->next, i++)
+    fprintf(cBody, "[t%d]", temps[i]);
+  fprintf(cBody, "[");
+  cIndex(index, type);
+  fprintf(cBody, "]))");
+  free(temps);
+}
+
+void cPair(AstNode *first, AstNode *later, char *open, char *middle, char *close) {
+  int temp;
+
+  if (mustHoist(first, later)) {
+    temp = ++cTemps;
+    fprintf(cBody, "(t%d = ", temp);
+    cExpression(first);
+    fprintf(cBody, ", %st%d%s", open, temp, middle);
+    cExpression(later);
+    fprintf(cBody, "%s)", close);
+  } else {
+    fprintf(cBody, "%s", open);
+    cExpression(first);
+    fprintf(cBody, "%s", middle);
+    cExpression(later);
+    fprintf(cBody, "%s", close);
+  }
+}
+
+// The address a VAR parameter is given
+void cAddress(AstNode *arg) {
+  if (arg->decl->isVarParam)
+    cStorage(arg->decl);
+  else {
+    fprintf(cBody, "&");
+    cVariable(arg);
+  }
+}
+
+void cArgument(AstNode *arg, AstNode *param) {
+  if (param->isVarParam)
+    cAddress(arg);
+  else cExpression(arg);
+}
+
+// Calls a builtin or a subroutine
+void cCall(AstNode *call) {
+  AstNode *decl = call->decl;
+  AstNode *arg, *param;
+  int *temps, count = listLength(call->list), hoisted = 0, depth, i;
+
+  switch (decl->builtin) {
+  case BUILTIN_READC:
+    fprintf(cBody, "kplReadChar()");
+    return;
+  case BUILTIN_READI:
+    fprintf(cBody, "kplReadInteger()");
+    return;
+  case BUILTIN_WRITEI:
+    fprintf(cBody, "printf(\"%%d\", ");
+    cExpression(call->list);
+    fprintf(cBody, ")");
+    return;
+  case BUILTIN_WRITEC:
+    fprintf(cBody, "kplWriteChar(");
+    cExpression(call->list);
+    fprintf(cBody, ")");
+    return;
+  case BUILTIN_WRITELN:
+    fprintf(cBody, "putchar('\\n')");
+    return;
+  default:
+    break;
+  }
+
+  // arguments are evaluated left to right too
+  temps = (int*)calloc(count + 1, sizeof(int));
+  for (arg = call->list, i = 0; arg != NULL; arg = arg->next, i++)
+    if (mustHoistBefore(arg, arg->next)) {
+      fprintf(cBody, hoisted ? ", " : "(");
+      param = decl->list;
+      for (depth = 0; depth < i; depth++)
+        param = param->next;
+      if (param->isVarParam) {
+        temps[i] = -(++cPointers);
+        fprintf(cBody, "p%d = ", -temps[i]);
+      } else {
+        temps[i] = ++cTemps;
+        fprintf(cBody, "t%d = ", temps[i]);
+      }
+      cArgument(arg, param);
+      hoisted = 1;
+    }
+  if (hoisted)
+    fprintf(cBody, ", ");
+
+  fprintf(cBody, "%s(", cNames[decl->offset]);
+  // the frame of the body declaring the callee
+  depth = decl->level - 1;
+  if (cHasFrame[cParents[decl->offset]]) {
+    if (depth == cDepth)
+      fprintf(cBody, "&frame");
+    else {
+      fprintf(cBody, "up");
+      for (; depth < cDepth - 1; depth++)
+        fprintf(cBody, "->up");
+    }
+    if (call->list != NULL)
+      fprintf(cBody, ", ");
+  }
+  for (arg = call->list, param = decl->list, i = 0; arg != NULL; arg = arg->next, param = param->next, i++) {
+    if (i > 0)
+      fprintf(cBody, ", ");
+    if (temps[i] > 0)
+      fprintf(cBody, "t%d", temps[i]);
+    else if (temps[i] < 0)
+      fprintf(cBody, "p%d", -temps[i]);
+    else cArgument(arg, param);
+  }
+  fprintf(cBody, hoisted ? "))" : ")");
+  free(temps);
+}
+
+char* cOperator(TokenType op) {
+  switch (op) {
+  case SB_PLUS: return "ADD(";
+  case SB_MINUS: return "SUB(";
+  case SB_TIMES: return "MUL(";
+  default: return "kplDivide(";
+  }
+}
+
+// The operations of a left spine are opened outermost first, each around a
+// temporary when its left operand must be computed before its right one
+void cBinary(AstNode *expr) {
+  AstNode **spine;
+  int *temps;
+  int count, i;
+
+  count = binarySpine(expr, &spine);
+  temps = (int*)calloc(count, sizeof(int));
+  for (i = count - 1; i >= 0; i--)
+    if (mustHoist(spine[i]->left, spine[i]->right)) {
+      temps[i] = ++cTemps;
+      fprintf(cBody, "(t%d = ", temps[i]);
+    } else fprintf(cBody, "%s", cOperator(spine[i]->op));
+  cExpression(spine[0]->left);
+  for (i = 0; i < count; i++) {
+    if (temps[i])
+      fprintf(cBody, ", %st%d", cOperator(spine[i]->op), temps[i]);
+    fprintf(cBody, ", ");
+    cExpression(spine[i]->right);
+    if (spine[i]->op == SB_SLASH)
+      fprintf(cBody, ", %d, %d", cLineNo, cColNo);
+    fprintf(cBody, temps[i] ? "))" : ")");
+  }
+  free(temps);
+  free(spine);
+}
+
+void cExpression(AstNode *expr) {
+  switch (expr->kind) {
+  case N_NUMBER:
+    cNumber(expr->value);
+    break;
+  case N_CHARCONST:
+    if ((expr->value < 0x80) && isgraph(expr->value) && (expr->value != '\'') && (expr->value != '\\'))
+      fprintf(cBody, "'%c'", expr->value);
+    else fprintf(cBody, "%d", expr->value);
+    break;
+  case N_VARIABLE:
+    if (expr->decl->kind == N_CONST)
+      cNumber(expr->decl->value);
+    else cVariable(expr);
+    break;
+  case N_FUNCALL:
+    cCall(expr);
+    break;
+  case N_UNARY:
+    if (expr->op == SB_MINUS) {
+      fprintf(cBody, "NEG(");
+      cExpression(expr->left);
+      fprintf(cBody, ")");
+    } else cExpression(expr->left);
+    break;
+  case N_BINARY:
+    cBinary(expr);
+    break;
+  default:
+    break;
+  }
+}
+
+void cCondition(AstNode *condition) {
+  char *op;
+
+  switch (condition->op) {
+  case SB_EQ: op = " == "; break;
+  case SB_NEQ: op = " != "; break;
+  case SB_GT: op = " > "; break;
+  case SB_LT: op = " < "; break;
+  case SB_GE: op = " >= "; break;
+  default: op = " <= "; break;
+  }
+  cPair(condition->left, condition->right, "", op, "");
+}
+
+void cAssign(AstNode *target, AstNode *value) {
+  int temp;
+
+  cLine();
+  if (target->decl->kind == N_FUNCTION) {
+    fprintf(cBody, "result = ");
+    cExpression(value);
+  } else if (riskOf(target) && mustHoist(target, value)) {
+    // the element is found before the value is computed
+    temp = ++cPointers;
+    fprintf(cBody, "p%d = &", temp);
+    cVariable(target);
+    fprintf(cBody, ";\n");
+    cLine();
+    fprintf(cBody, "*p%d = ", temp);
+    cExpression(value);
+  } else {
+    cVariable(target);
+    fprintf(cBody, " = ");
+    cExpression(value);
+  }
+  fprintf(cBody, ";\n");
+}
+
+// A statement in braces, a group without a second pair
+void cBlock(AstNode *statement) {
+  AstNode *st;
+
+  fprintf(cBody, "{\n");
+  cIndent ++;
+  if ((statement != NULL) && (statement->kind == N_GROUP))
+    for (st = statement->list; st != NULL; st = st->next)
+      cStatement(st);
+  else cStatement(statement);
+  cIndent --;
+  cLine();
+  fprintf(cBody, "}");
+}
+
+void cFor(AstNode *statement) {
+  AstNode *var = statement->left;
+  int temp = 0;
+
+  // the final value is computed once, after the first assignment
+  cLine();
+  fprintf(cBody, "for (");
+  cVariable(var);
+  fprintf(cBody, " = ");
+  cExpression(statement->right);
+  if (!isLiteral(statement->list)) {
+    temp = ++cTemps;
+    fprintf(cBody, ", t%d = ", temp);
+    cExpression(statement->list);
+  }
+  fprintf(cBody, "; ");
+  cVariable(var);
+  fprintf(cBody, " <= ");
+  if (temp)
+    fprintf(cBody, "t%d", temp);
+  else cExpression(statement->list);
+  fprintf(cBody, "; ");
+  cVariable(var);
+  fprintf(cBody, " = ADD(");
+  cVariable(var);
+  fprintf(cBody, ", 1)) ");
+  enterLoop(statement, cDepth);
+  cBlock(statement->body);
+  leaveLoop();
+  fprintf(cBody, "\n");
+}
+
+void cStatement(AstNode *statement) {
+  AstNode *st;
+
+  if (statement == NULL)
+    return;
+  if (statement->kind != N_GROUP) {
+    cLineNo = statement->lineNo;
+    cColNo = statement->colNo;
+  }
+
+  switch (statement->kind) {
+  case N_ASSIGN:
+    cAssign(statement->left, statement->right);
+    break;
+  case N_CALL:
+    cLine();
+    cCall(statement);
+    fprintf(cBody, ";\n");
+    break;
+  case N_GROUP:
+    for (st = statement->list; st != NULL; st = st->next)
+      cStatement(st);
+    break;
+  case N_IF:
+    cLine();
+    fprintf(cBody, "if (");
+    cCondition(statement->left);
+    fprintf(cBody, ") ");
+    cBlock(statement->body);
+    if (statement->right != NULL) {
+      fprintf(cBody, " else ");
+      cBlock(statement->right);
+    }
+    fprintf(cBody, "\n");
+    break;
+  case N_WHILE:
+    cLine();
+    fprintf(cBody, "while (");
+    cCondition(statement->left);
+    fprintf(cBody, ") ");
+    cBlock(statement->body);
+    fprintf(cBody, "\n");
+    break;
+  case N_FOR:
+    cFor(statement);
+    break;
+  default:
+    break;
+  }
+}
+
+/******************************************************************/
+
+// The frame struct of a subroutine, before those nested in it
+void cFrame(AstNode *owner, AstNode *block) {
+  AstNode *decl;
+  int number = owner->offset;
+
+  if ((number != 0) && cHasFrame[number]) {
+    fprintf(cOut, "struct %s_frame {\n", cNames[number]);
+    if (cHasFrame[cParents[number]])
+      fprintf(cOut, "  struct %s_frame *up;\n", cNames[cParents[number]]);
+    for (decl = owner->list; decl != NULL; decl = decl->next)
+      if (isCaptured(decl))
+        fprintf(cOut, "  int %sv_%s;\n", decl->isVarParam ? "*" : "", decl->name);
+    for (decl = block->list; decl != NULL; decl = decl->next)
+      if ((decl->kind == N_VAR) && isCaptured(decl)) {
+        fprintf(cOut, "  ");
+        cDeclare(cOut, decl->type, "v_", decl->name);
+        fprintf(cOut, ";\n");
+      }
+    fprintf(cOut, "};\n\n");
+  }
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      cFrame(decl, decl->body);
+}
+
+void cHeader(AstNode *owner) {
+  AstNode *param;
+  int number = owner->offset, parent = cParents[number];
+
+  fprintf(cOut, "static %s %s(", owner->kind == N_FUNCTION ? "int" : "void", cNames[number]);
+  if (cHasFrame[parent])
+    fprintf(cOut, "struct %s_frame *up%s", cNames[parent], owner->list != NULL ? ", " : "");
+  else if (owner->list == NULL)
+    fprintf(cOut, "void");
+  for (param = owner->list; param != NULL; param = param->next)
+    fprintf(cOut, "int %sv_%s%s", param->isVarParam ? "*" : "", param->name, param->next != NULL ? ", " : "");
+  fprintf(cOut, ")");
+}
+
+void cPrototypes(AstNode *block) {
+  AstNode *decl;
+
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE)) {
+      cHeader(decl);
+      fprintf(cOut, ";\n");
+      cPrototypes(decl->body);
+    }
+}
+
+void cTemporaries(void) {
+  int i;
+
+  for (i = 1; i <= cTemps; i++)
+    fprintf(cOut, "%st%d%s", i == 1 ? "  int " : "", i, i == cTemps ? ";\n" : ", ");
+  for (i = 1; i <= cPointers; i++)
+    fprintf(cOut, "%sp%d%s", i == 1 ? "  int *" : "", i, i == cPointers ? ";\n" : ", *");
+}
+
+// The body of a subroutine and then those nested in it
+void cSubroutine(AstNode *owner) {
+  AstNode *block = owner->body, *decl;
+  int number = owner->offset;
+  char *text;
+  size_t length;
+
+  cBody = open_memstream(&text, &length);
+  cDepth = owner->level;
+  cTemps = cPointers = 0;
+  cIndent = 1;
+  cStatement(block->body);
+  fclose(cBody);
+
+  fprintf(cOut, "\n");
+  cHeader(owner);
+  fprintf(cOut, " {\n");
+  if (cHasFrame[number])
+    fprintf(cOut, "  struct %s_frame frame;\n", cNames[number]);
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_VAR) && !isCaptured(decl)) {
+      fprintf(cOut, "  ");
+      cDeclare(cOut, decl->type, "v_", decl->name);
+      fprintf(cOut, isArray(decl) ? ";\n" : " = 0;\n");
+    }
+  if (owner->kind == N_FUNCTION)
+    fprintf(cOut, "  int result = 0;\n");
+  cTemporaries();
+
+  fprintf(cOut, "\n  kplEnter(%d, %d, %d);\n", cFrameSizes[number], owner->lineNo, owner->colNo);
+  if (cHasFrame[number]) {
+    fprintf(cOut, "  memset(&frame, 0, sizeof(frame));\n");
+    if (cHasFrame[cParents[number]])
+      fprintf(cOut, "  frame.up = up;\n");
+    for (decl = owner->list; decl != NULL; decl = decl->next)
+      if (isCaptured(decl))
+        fprintf(cOut, "  frame.v_%s = v_%s;\n", decl->name, decl->name);
+  }
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_VAR) && !isCaptured(decl) && isArray(decl))
+      fprintf(cOut, "  memset(v_%s, 0, sizeof(v_%s));\n", decl->name, decl->name);
+  fwrite(text, 1, length, cOut);
+  free(text);
+  fprintf(cOut, "  kplCells -= %d;\n", cFrameSizes[number]);
+  if (owner->kind == N_FUNCTION)
+    fprintf(cOut, "  return result;\n");
+  fprintf(cOut, "}\n");
+
+  for (decl = block->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      cSubroutine(decl);
+}
+
+void cRuntime(void) {
+  fprintf(cOut, "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <pthread.h>\n\n");
+  fprintf(cOut, "// Arithmetic wraps around as on the interpreter\n");
+  fprintf(cOut, "#define ADD(a, b) ((int)((unsigned)(a) + (unsigned)(b)))\n");
+  fprintf(cOut, "#define SUB(a, b) ((int)((unsigned)(a) - (unsigned)(b)))\n");
+  fprintf(cOut, "#define MUL(a, b) ((int)((unsigned)(a) * (unsigned)(b)))\n");
+  fprintf(cOut, "#define NEG(a) ((int)(0u - (unsigned)(a)))\n\n");
+  fprintf(cOut, "// Cells the frames would take on its stack, and how many it has\n");
+  fprintf(cOut, "#define STACK_SIZE %d\n", STACK_SIZE);
+  fprintf(cOut, "static long kplCells;\n\n");
+  fprintf(cOut, "static inline void kplFail(int lineNo, int colNo, const char *message) {\n");
+  fprintf(cOut, "  printf(\"%%d-%%d:%%s\\n\", lineNo, colNo, message);\n");
+  fprintf(cOut, "  exit(1);\n}\n\n");
+  fprintf(cOut, "static inline void kplEnter(int frameSize, int lineNo, int colNo) {\n");
+  fprintf(cOut, "  if (kplCells + frameSize >= STACK_SIZE)\n");
+  fprintf(cOut, "    kplFail(lineNo, colNo, \"%s\");\n", errorMessage(ERR_STACKOVERFLOW));
+  fprintf(cOut, "  kplCells += frameSize;\n}\n\n");
+  fprintf(cOut, "static inline int kplIndex(int index, int size, int lineNo, int colNo) {\n");
+  fprintf(cOut, "  if ((index < 1) || (index > size))\n");
+  fprintf(cOut, "    kplFail(lineNo, colNo, \"%s\");\n", errorMessage(ERR_INDEXOUTOFRANGE));
+  fprintf(cOut, "  return index - 1;\n}\n\n");
+  fprintf(cOut, "static inline int kplDivide(int a, int b, int lineNo, int colNo) {\n");
+  fprintf(cOut, "  if (b == 0)\n");
+  fprintf(cOut, "    kplFail(lineNo, colNo, \"%s\");\n", errorMessage(ERR_DIVISIONBYZERO));
+  fprintf(cOut, "  return (b == -1) ? NEG(a) : a / b;\n}\n\n");
+  fprintf(cOut, "static inline int kplReadInteger(void) {\n  int value;\n");
+  fprintf(cOut, "  return (scanf(\"%%d\", &value) == 1) ? value : 0;\n}\n\n");
+  // characters are code points, read and written as UTF-8 as the interpreters do
+  fprintf(cOut, "static inline int kplReadChar(void) {\n  char c;\n  int value, length, b;\n");
+  fprintf(cOut, "  if (scanf(\" %%c\", &c) != 1)\n    return 0;\n");
+  fprintf(cOut, "  value = (unsigned char)c;\n");
+  fprintf(cOut, "  if ((value >= 0xC2) && (value <= 0xDF)) length = 1;\n");
+  fprintf(cOut, "  else if ((value >= 0xE0) && (value <= 0xEF)) length = 2;\n");
+  fprintf(cOut, "  else if ((value >= 0xF0) && (value <= 0xF4)) length = 3;\n");
+  fprintf(cOut, "  else return value;\n");
+  fprintf(cOut, "  value &= 0x3F >> length;\n");
+  fprintf(cOut, "  while (length-- > 0) {\n    b = getchar();\n");
+  fprintf(cOut, "    if ((b == EOF) || ((b & 0xC0) != 0x80)) {\n      ungetc(b, stdin);\n      return (unsigned char)c;\n    }\n");
+  fprintf(cOut, "    value = (value << 6) | (b & 0x3F);\n  }\n  return value;\n}\n\n");
+  fprintf(cOut, "static inline void kplWriteChar(int c) {\n");
+  fprintf(cOut, "  if ((c < 0x80) || (c > 0x10FFFF) || ((c >= 0xD800) && (c <= 0xDFFF)))\n    putchar(c);\n");
+  fprintf(cOut, "  else if (c < 0x800) {\n    putchar(0xC0 | (c >> 6));\n    putchar(0x80 | (c & 0x3F));\n");
+  fprintf(cOut, "  } else if (c < 0x10000) {\n    putchar(0xE0 | (c >> 12));\n");
+  fprintf(cOut, "    putchar(0x80 | ((c >> 6) & 0x3F));\n    putchar(0x80 | (c & 0x3F));\n");
+  fprintf(cOut, "  } else {\n    putchar(0xF0 | (c >> 18));\n    putchar(0x80 | ((c >> 12) & 0x3F));\n");
+  fprintf(cOut, "    putchar(0x80 | ((c >> 6) & 0x3F));\n    putchar(0x80 | (c & 0x3F));\n  }\n}\n\n");
+}
+
+void cMain(AstNode *program) {
+  char *text;
+  size_t length;
+
+  cBody = open_memstream(&text, &length);
+  cDepth = 0;
+  cTemps = cPointers = 0;
+  cIndent = 1;
+  cStatement(program->body->body);
+  fclose(cBody);
+
+  fprintf(cOut, "\nstatic void program(void) {\n");
+  cTemporaries();
+  fprintf(cOut, "  kplEnter(%d, %d, %d);\n", cFrameSizes[0], program->lineNo, program->colNo);
+  fwrite(text, 1, length, cOut);
+  free(text);
+  fprintf(cOut, "}\n\n");
+
+  fprintf(cOut, "static void *run(void *unused) {\n  program();\n  return NULL;\n}\n\n");
+  fprintf(cOut, "int main(void) {\n  pthread_attr_t attr;\n  pthread_t thread;\n\n");
+  fprintf(cOut, "  // deep recursion needs more than the default stack\n");
+  fprintf(cOut, "  pthread_attr_init(&attr);\n");
+  fprintf(cOut, "  pthread_attr_setstacksize(&attr, (size_t)1 << 30);\n");
+  fprintf(cOut, "  if (pthread_create(&thread, &attr, run, NULL) != 0)\n    program();\n");
+  fprintf(cOut, "  else pthread_join(thread, NULL);\n  return 0;\n}\n");
+}
+
+int writeCProgram(AstNode *program, FILE *f) {
+  AstNode *decl;
+  int i;
+
+  cOut = f;
+  cRoutineCount = 0;
+  cCapturedCount = 0;
+  resetIndexChecks();
+  program->level = 0;
+  program->offset = addRoutine(program, 0);
+  cLayout(program, program->body, 0, 0);
+  for (i = 1; i < cRoutineCount; i++)
+    if (cHasFrame[i] < 0)
+      cHasFrame[i] = cHasFrame[cParents[i]];
+
+  fprintf(cOut, "/* PROGRAM %s, translated from KPL; build with cc -O2 -pthread */\n\n", program->name);
+  cRuntime();
+  cFrame(program, program->body);
+  for (decl = program->body->list; decl != NULL; decl = decl->next)
+    if (decl->kind == N_VAR) {
+      fprintf(cOut, "static ");
+      cDeclare(cOut, decl->type, "v_", decl->name);
+      fprintf(cOut, ";\n");
+    }
+  fprintf(cOut, "\n");
+  cPrototypes(program->body);
+  for (decl = program->body->list; decl != NULL; decl = decl->next)
+    if ((decl->kind == N_FUNCTION) || (decl->kind == N_PROCEDURE))
+      cSubroutine(decl);
+  cMain(program);
+  fprintf(cOut, "\n/* index checks: %d of %d removed */\n", indexChecksRemoved, indexChecks);
+
+  for (i = 0; i < cRoutineCount; i++)
+    free(cNames[i]);
+  return ferror(cOut) ? IO_ERROR : IO_SUCCESS;
+}
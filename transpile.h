@@ -0,0 +1,19 @@
+/* KPL to C translator
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __TRANSPILE_H__
+#define __TRANSPILE_H__
+
+#include <stdio.h>
+#include "ast.h"
+
+// Writes a program that passed the semantic analysis as one self-contained
+// C file, built with cc -O2 -pthread. It prints what runCode() prints, the
+// runtime errors included; a stack overflow is counted in frame cells as the
+// bytecode lays them out, without the temporaries of the callers.
+int writeCProgram(AstNode *program, FILE *f);
+
+#endif
@@ -0,0 +1,98 @@
+/* Canonical types
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "stats.h"
+
+#define TYPE_CHUNK 256
+
+Type intTypeNode = { TP_INT, 0, 0, NULL };
+Type charTypeNode = { TP_CHAR, 1, 0, NULL };
+Type *intType = &intTypeNode;
+Type *charType = &charTypeNode;
+
+// Array types by (arraySize, elementType), open addressing, at most half full
+Type **arrayTypes;
+unsigned int arrayTypeCapacity, arrayTypeCount;
+
+// Nodes are carved out of chunks, so interning does not malloc per type
+Type *typeChunk;
+int typeChunkUsed = TYPE_CHUNK;
+// Subroutines parsed in parallel intern their array types here too
+pthread_mutex_t typeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************/
+
+unsigned int arrayTypeHash(int arraySize, Type *elementType) {
+  unsigned int h = (unsigned int)arraySize * 0x9E3779B1u;
+  h ^= (unsigned int)elementType->id + 0x7F4A7C15u + (h << 6) + (h >> 2);
+  return h;
+}
+
+unsigned int findArrayType(int arraySize, Type *elementType) {
+  unsigned int mask = arrayTypeCapacity - 1;
+  unsigned int i = arrayTypeHash(arraySize, elementType) & mask;
+  while (arrayTypes[i] != NULL &&
+         (arrayTypes[i]->arraySize != arraySize || arrayTypes[i]->elementType != elementType))
+    i = (i + 1) & mask;
+  return i;
+}
+
+void growArrayTypes(void) {
+  Type **old = arrayTypes;
+  unsigned int oldCapacity = arrayTypeCapacity, i;
+
+  arrayTypeCapacity = oldCapacity ? oldCapacity * 2 : 64;
+  arrayTypes = (Type**)calloc(arrayTypeCapacity, sizeof(Type*));
+  for (i = 0; i < oldCapacity; i++)
+    if (old[i] != NULL)
+      arrayTypes[findArrayType(old[i]->arraySize, old[i]->elementType)] = old[i];
+  free(old);
+}
+
+Type* newType(void) {
+  if (typeChunkUsed == TYPE_CHUNK) {
+    typeChunk = (Type*)malloc(TYPE_CHUNK * sizeof(Type));
+    typeChunkUsed = 0;
+  }
+  return &typeChunk[typeChunkUsed++];
+}
+
+/******************************************************************/
+
+Type* makeArrayType(int arraySize, Type *elementType) {
+  unsigned int slot;
+  Type *type;
+
+  pthread_mutex_lock(&typeLock);
+  if (2 * (arrayTypeCount + 1) > arrayTypeCapacity)
+    growArrayTypes();
+  slot = findArrayType(arraySize, elementType);
+  STAT_ADD(typeRequests, 1);
+  if (arrayTypes[slot] != NULL) {
+    type = arrayTypes[slot];
+    pthread_mutex_unlock(&typeLock);
+    return type;
+  }
+
+  type = newType();
+  type->typeClass = TP_ARRAY;
+  type->id = 2 + arrayTypeCount;
+  type->arraySize = arraySize;
+  type->elementType = elementType;
+  arrayTypes[slot] = type;
+  arrayTypeCount ++;
+  STAT_ADD(typesInterned, 1);
+  pthread_mutex_unlock(&typeLock);
+  return type;
+}
+
+int typeCount(void) {
+  return 2 + arrayTypeCount;
+}
@@ -0,0 +1,32 @@
+/* Canonical types
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __TYPES_H__
+#define __TYPES_H__
+
+typedef enum {
+  TP_INT,
+  TP_CHAR,
+  TP_ARRAY
+} TypeClass;
+
+typedef struct TypeTag {
+  TypeClass typeClass;
+  int id;                        // small and unique per canonical type
+  int arraySize;
+  struct TypeTag *elementType;
+} Type;
+
+// Types are hash-consed: structurally equal types are the same node, so two
+// types are equal exactly when their pointers are. Nodes live as long as the
+// process and are never freed.
+extern Type *intType;
+extern Type *charType;
+
+Type* makeArrayType(int arraySize, Type *elementType);
+int typeCount(void);
+
+#endif
@@ -0,0 +1,322 @@
+/* Bytecode interpreter
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "reader.h"
+#include "charcode.h"
+#include "error.h"
+#include "vm.h"
+
+extern __thread FILE *outputStream;
+
+// Allocated by the first run and kept for the next ones
+int *stack;
+
+/******************************************************************/
+
+// Reports err at the statement holding address
+int runError(CodeBlock *block, ErrorCode err, int address) {
+  LineEntry *line = findLine(block, address);
+  if (line != NULL)
+    noteError(err, line->lineNo, line->colNo);
+  else noteError(err, 0, 0);
+  return RUN_ERROR;
+}
+
+// The code is direct-threaded before it runs: every opcode word becomes the
+// address of its handler and every jump target a pointer into the threaded
+// code, so dispatching an instruction is a single indirect jump. Addresses
+// on the stack are cell indexes; return addresses are code addresses.
+int runCode(CodeBlock *block, long long *instructions) {
+  static void *handlers[OP_COUNT] = {
+    &&op_LA, &&op_LV, &&op_LC, &&op_LI, &&op_ST, &&op_INT, &&op_DCT, &&op_CV, &&op_J, &&op_FJ,
+    &&op_CALL, &&op_ENTER, &&op_EP, &&op_EF, &&op_HL, &&op_RC, &&op_RI, &&op_WRC, &&op_WRI, &&op_WLN,
+    &&op_AD, &&op_SB, &&op_ML, &&op_DV, &&op_NEG, &&op_EQ, &&op_NE, &&op_GT, &&op_LT, &&op_GE, &&op_LE,
+    &&op_IDX, &&op_LAL, &&op_LVL, &&op_STL, &&op_LAG, &&op_LVG, &&op_STG,
+    &&op_ADC, &&op_INCL, &&op_INCG, &&op_FJEQ, &&op_FJNE, &&op_FJGT, &&op_FJLT, &&op_FJGE, &&op_FJLE,
+    &&op_IXU
+  };
+  void **threaded, **entries, **pc;
+  int *paramCounts;
+  int *s;
+  int sp, bp, base, a, b, i, op, address, result = IO_SUCCESS;
+  long long count = 0;
+
+  if (outputStream == NULL)
+    outputStream = stdout;
+  if (stack == NULL) {
+    stack = (int*)malloc(STACK_SIZE * sizeof(int));
+    if (stack == NULL)
+      return runError(block, ERR_STACKOVERFLOW, 0);
+  }
+  s = stack;
+
+  threaded = (void**)malloc((block->size + 1) * sizeof(void*));
+  for (address = 0; address < block->size; address += opLengths[op]) {
+    op = block->code[address];
+    threaded[address] = handlers[op];
+    for (i = 1; i < opLengths[op]; i++)
+      threaded[address + i] = (void*)(intptr_t)block->code[address + i];
+    if (isJump(op))
+      threaded[address + 1] = threaded + block->code[address + 1];
+  }
+  entries = (void**)malloc(block->procedureCount * sizeof(void*));
+  paramCounts = (int*)malloc(block->procedureCount * sizeof(int));
+  for (i = 0; i < block->procedureCount; i++) {
+    entries[i] = threaded + block->procedures[i].entry;
+    paramCounts[i] = block->procedures[i].paramCount;
+  }
+
+#define OPERAND(n) ((int)(intptr_t)pc[n])
+#define NEXT do { count ++; goto *pc[0]; } while (0)
+#define FAIL(err) do { result = runError(block, err, pc - threaded); goto done; } while (0)
+#define WRAP(x) ((int)(unsigned)(x))
+#define BRANCH(cond) do { b = s[sp--]; a = s[sp--]; \
+    if (cond) pc += 2; else pc = (void**)pc[1]; NEXT; } while (0)
+
+  // the main program's frame; its variables are the globals at cell offsets
+  bp = 0;
+  sp = FRAME_HEADER - 1;
+  memset(s, 0, FRAME_HEADER * sizeof(int));
+  pc = threaded;
+  NEXT;
+
+ op_LA:
+  for (base = bp, i = OPERAND(1); i > 0; i--)
+    base = s[base + FRAME_STATIC_LINK];
+  s[++sp] = base + OPERAND(2);
+  pc += 3;
+  NEXT;
+ op_LV:
+  for (base = bp, i = OPERAND(1); i > 0; i--)
+    base = s[base + FRAME_STATIC_LINK];
+  s[++sp] = s[base + OPERAND(2)];
+  pc += 3;
+  NEXT;
+ op_LC:
+  s[++sp] = OPERAND(1);
+  pc += 2;
+  NEXT;
+ op_LI:
+  s[sp] = s[s[sp]];
+  pc += 1;
+  NEXT;
+ op_ST:
+  s[s[sp - 1]] = s[sp];
+  sp -= 2;
+  pc += 1;
+  NEXT;
+ op_INT:
+  memset(s + sp + 1, 0, OPERAND(1) * sizeof(int));
+  sp += OPERAND(1);
+  pc += 2;
+  NEXT;
+ op_DCT:
+  sp -= OPERAND(1);
+  pc += 2;
+  NEXT;
+ op_CV:
+  s[sp + 1] = s[sp];
+  sp ++;
+  pc += 1;
+  NEXT;
+ op_J:
+  pc = (void**)pc[1];
+  NEXT;
+ op_FJ:
+  if (s[sp--]) pc += 2;
+  else pc = (void**)pc[1];
+  NEXT;
+ op_CALL:
+  for (base = bp, i = OPERAND(1); i > 0; i--)
+    base = s[base + FRAME_STATIC_LINK];
+  i = OPERAND(2);
+  a = sp - paramCounts[i] - (FRAME_HEADER - 1);
+  s[a + FRAME_DYNAMIC_LINK] = bp;
+  s[a + FRAME_RETURN_ADDRESS] = (int)(pc + 3 - threaded);
+  s[a + FRAME_STATIC_LINK] = base;
+  bp = a;
+  pc = (void**)entries[i];
+  NEXT;
+ op_ENTER:
+  // the callee's frame, its locals and its temporaries must all fit
+  if ((long long)sp + OPERAND(1) + OPERAND(2) >= STACK_SIZE)
+    FAIL(ERR_STACKOVERFLOW);
+  memset(s + sp + 1, 0, OPERAND(1) * sizeof(int));
+  sp += OPERAND(1);
+  pc += 3;
+  NEXT;
+ op_EP:
+  pc = threaded + s[bp + FRAME_RETURN_ADDRESS];
+  sp = bp - 1;
+  bp = s[bp + FRAME_DYNAMIC_LINK];
+  NEXT;
+ op_EF:
+  pc = threaded + s[bp + FRAME_RETURN_ADDRESS];
+  sp = bp;
+  bp = s[bp + FRAME_DYNAMIC_LINK];
+  NEXT;
+ op_HL:
+  goto done;
+ op_RC:
+  s[++sp] = readCodePoint(stdin);
+  pc += 1;
+  NEXT;
+ op_RI:
+  s[++sp] = 0;
+  if (scanf("%d", &a) == 1)
+    s[sp] = a;
+  pc += 1;
+  NEXT;
+ op_WRC:
+  writeCodePoint(outputStream, s[sp--]);
+  pc += 1;
+  NEXT;
+ op_WRI:
+  fprintf(outputStream, "%d", s[sp--]);
+  pc += 1;
+  NEXT;
+ op_WLN:
+  fputc('\n', outputStream);
+  pc += 1;
+  NEXT;
+ op_AD:
+  sp --;
+  s[sp] = WRAP((unsigned)s[sp] + (unsigned)s[sp + 1]);
+  pc += 1;
+  NEXT;
+ op_SB:
+  sp --;
+  s[sp] = WRAP((unsigned)s[sp] - (unsigned)s[sp + 1]);
+  pc += 1;
+  NEXT;
+ op_ML:
+  sp --;
+  s[sp] = WRAP((unsigned)s[sp] * (unsigned)s[sp + 1]);
+  pc += 1;
+  NEXT;
+ op_DV:
+  b = s[sp--];
+  if (b == 0)
+    FAIL(ERR_DIVISIONBYZERO);
+  s[sp] = (b == -1) ? WRAP(0u - (unsigned)s[sp]) : s[sp] / b;
+  pc += 1;
+  NEXT;
+ op_NEG:
+  s[sp] = WRAP(0u - (unsigned)s[sp]);
+  pc += 1;
+  NEXT;
+ op_EQ:
+  sp --;
+  s[sp] = s[sp] == s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_NE:
+  sp --;
+  s[sp] = s[sp] != s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_GT:
+  sp --;
+  s[sp] = s[sp] > s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_LT:
+  sp --;
+  s[sp] = s[sp] < s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_GE:
+  sp --;
+  s[sp] = s[sp] >= s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_LE:
+  sp --;
+  s[sp] = s[sp] <= s[sp + 1];
+  pc += 1;
+  NEXT;
+ op_IDX:
+  a = s[sp--];
+  if ((a < 1) || (a > OPERAND(1)))
+    FAIL(ERR_INDEXOUTOFRANGE);
+  s[sp] += (a - 1) * OPERAND(2);
+  pc += 3;
+  NEXT;
+ op_LAL:
+  s[++sp] = bp + OPERAND(1);
+  pc += 2;
+  NEXT;
+ op_LVL:
+  s[sp + 1] = s[bp + OPERAND(1)];
+  sp ++;
+  pc += 2;
+  NEXT;
+ op_STL:
+  s[bp + OPERAND(1)] = s[sp--];
+  pc += 2;
+  NEXT;
+ op_LAG:
+  s[++sp] = OPERAND(1);
+  pc += 2;
+  NEXT;
+ op_LVG:
+  s[sp + 1] = s[OPERAND(1)];
+  sp ++;
+  pc += 2;
+  NEXT;
+ op_STG:
+  s[OPERAND(1)] = s[sp--];
+  pc += 2;
+  NEXT;
+ op_ADC:
+  s[sp] = WRAP((unsigned)s[sp] + (unsigned)OPERAND(1));
+  pc += 2;
+  NEXT;
+ op_INCL:
+  s[bp + OPERAND(1)] = WRAP((unsigned)s[bp + OPERAND(1)] + (unsigned)OPERAND(2));
+  pc += 3;
+  NEXT;
+ op_INCG:
+  s[OPERAND(1)] = WRAP((unsigned)s[OPERAND(1)] + (unsigned)OPERAND(2));
+  pc += 3;
+  NEXT;
+ op_FJEQ:
+  BRANCH(a == b);
+ op_FJNE:
+  BRANCH(a != b);
+ op_FJGT:
+  BRANCH(a > b);
+ op_FJLT:
+  BRANCH(a < b);
+ op_FJGE:
+  BRANCH(a >= b);
+ op_FJLE:
+  BRANCH(a <= b);
+ op_IXU:
+  a = s[sp--];
+  s[sp] += (a - 1) * OPERAND(2);
+  pc += 3;
+  NEXT;
+
+ done:
+#undef OPERAND
+#undef NEXT
+#undef FAIL
+#undef WRAP
+#undef BRANCH
+  fflush(outputStream);
+  free(threaded);
+  free(entries);
+  free(paramCounts);
+  if (instructions != NULL)
+    *instructions = count;
+  return result;
+}
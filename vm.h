@@ -0,0 +1,22 @@
+/* Bytecode interpreter
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __VM_H__
+#define __VM_H__
+
+#include "code.h"
+
+// runCode() returns IO_SUCCESS or this when the program stopped at an error
+#define RUN_ERROR 3
+
+// Cells of the stack every run shares
+#define STACK_SIZE (4 << 20)
+
+// Runs a program read from stdin and written to outputStream. When
+// instructions is not NULL it receives the number of instructions executed.
+int runCode(CodeBlock *block, long long *instructions);
+
+#endif
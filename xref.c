@@ -0,0 +1,662 @@
+/* Cross-reference index
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "cache.h"
+#include "xref.h"
+
+#define MAX_PATH_LEN 4096
+#define BYTE_ORDER_MARK 0x01020304
+
+extern __thread FILE *outputStream;
+extern __thread int blockLevel;
+extern __thread int lastErrorLineNo, lastErrorColNo;
+extern __thread char lastErrorMessage[];
+extern int traceEnabled;
+extern void (*referenceHook)(ReferenceKind kind, Token *name);
+
+// A ref of a file just parsed; name and scope are ids of parsedNames
+typedef struct {
+  int name;
+  int file;
+  int lineNo, colNo;
+  int kind;
+  int scope;
+} ParsedRef;
+
+// The names the parsed files use, interned in a hash table of ids
+char (*parsedNames)[MAX_IDENT_LEN + 1];
+int parsedNameCount, parsedNameCapacity;
+int *nameSlots;
+int nameSlotCount;
+
+ParsedRef *parsedRefs;
+int parsedRefCount, parsedRefCapacity;
+
+// The file being parsed, and the subroutine or program whose block is open
+// at each level
+int parsedFile;
+int openScopes[MAX_NESTING_DEPTH + 2];
+
+/******************************************************************/
+
+char* referenceKindName(int kind) {
+  switch (kind) {
+  case REF_PROGRAM: return "program";
+  case REF_CONST: return "constant";
+  case REF_TYPE: return "type";
+  case REF_VAR: return "variable";
+  case REF_PARAM: return "parameter";
+  case REF_FUNCTION: return "function";
+  case REF_PROCEDURE: return "procedure";
+  case REF_CALL: return "call";
+  case REF_ASSIGN: return "assign";
+  case REF_READ: return "read";
+  }
+  return "?";
+}
+
+// Identifiers are case-insensitive: the index keeps and looks up their
+// upper-case spelling
+void upperName(char *name, char *key) {
+  int i;
+  for (i = 0; (i < MAX_IDENT_LEN) && (name[i] != '\0'); i++)
+    key[i] = (char)toupper((unsigned char)name[i]);
+  key[i] = '\0';
+}
+
+int internName(char *spelling) {
+  char name[MAX_IDENT_LEN + 1];
+  unsigned long long h;
+  int i, slot;
+
+  upperName(spelling, name);
+  h = hashBytes(name, strlen(name));
+
+  if (2 * (parsedNameCount + 1) > nameSlotCount) {
+    free(nameSlots);
+    nameSlotCount = nameSlotCount ? nameSlotCount * 2 : 1024;
+    nameSlots = (int*)malloc(nameSlotCount * sizeof(int));
+    memset(nameSlots, -1, nameSlotCount * sizeof(int));
+    for (i = 0; i < parsedNameCount; i++) {
+      slot = hashBytes(parsedNames[i], strlen(parsedNames[i])) & (nameSlotCount - 1);
+      while (nameSlots[slot] >= 0)
+        slot = (slot + 1) & (nameSlotCount - 1);
+      nameSlots[slot] = i;
+    }
+  }
+  slot = h & (nameSlotCount - 1);
+  while (nameSlots[slot] >= 0) {
+    if (strcmp(parsedNames[nameSlots[slot]], name) == 0)
+      return nameSlots[slot];
+    slot = (slot + 1) & (nameSlotCount - 1);
+  }
+  if (parsedNameCount == parsedNameCapacity) {
+    parsedNameCapacity = parsedNameCapacity ? parsedNameCapacity * 2 : 1024;
+    parsedNames = realloc(parsedNames, parsedNameCapacity * sizeof(*parsedNames));
+  }
+  // padded with zeros, as the index stores all of it
+  strncpy(parsedNames[parsedNameCount], name, MAX_IDENT_LEN + 1);
+  nameSlots[slot] = parsedNameCount;
+  return parsedNameCount ++;
+}
+
+// The referenceHook of the parses: a subroutine declared at one level opens
+// the scope of the next, which its parameters belong to already
+void collectReference(ReferenceKind kind, Token *name) {
+  ParsedRef *ref;
+
+  if (parsedRefCount == parsedRefCapacity) {
+    parsedRefCapacity = parsedRefCapacity ? parsedRefCapacity * 2 : 4096;
+    parsedRefs = (ParsedRef*)realloc(parsedRefs, parsedRefCapacity * sizeof(ParsedRef));
+  }
+  ref = &parsedRefs[parsedRefCount ++];
+  ref->name = internName(name->string);
+  ref->file = parsedFile;
+  ref->lineNo = name->lineNo;
+  ref->colNo = name->colNo;
+  ref->kind = kind;
+  switch (kind) {
+  case REF_PROGRAM:
+      ref->scope = -1;
+      openScopes[1] = ref->name;
+      break;
+  case REF_FUNCTION:
+  case REF_PROCEDURE:
+      ref->scope = openScopes[blockLevel];
+      openScopes[blockLevel + 1] = ref->name;
+      break;
+  case REF_PARAM:
+      ref->scope = openScopes[blockLevel + 1];
+      break;
+  default:
+      ref->scope = openScopes[blockLevel];
+      break;
+  }
+}
+
+// Parses fileName for its refs only; returns the compile() status
+int parseReferences(char *fileName, int file, FILE *errors) {
+  FILE *savedOutput = outputStream;
+  int savedTrace = traceEnabled;
+  int status;
+
+  parsedFile = file;
+  openScopes[0] = -1;
+  traceEnabled = 0;
+  outputStream = errors;
+  referenceHook = collectReference;
+  status = compile(fileName);
+  referenceHook = NULL;
+  outputStream = savedOutput;
+  traceEnabled = savedTrace;
+  if (status == COMPILE_ERROR)
+    fprintf(stderr, "%s:%d:%d: %s\n", fileName, lastErrorLineNo, lastErrorColNo, lastErrorMessage);
+  else if (status == IO_ERROR)
+    fprintf(stderr, "%s: cannot read\n", fileName);
+  return status;
+}
+
+/******************************************************************/
+
+// A section of count items of size bytes must lie within the mapping
+int xrefSectionFits(long mappingSize, int offset, int count, long size) {
+  return (offset >= (long)sizeof(XrefHeader)) && (offset % 8 == 0) && (count >= 0) &&
+    (offset + count * size <= mappingSize);
+}
+
+XrefIndex* loadIndex(char *fileName) {
+  struct stat st;
+  XrefHeader *header;
+  XrefIndex *index;
+  char *mapping;
+  int fd, i;
+
+  fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if ((fstat(fd, &st) != 0) || (st.st_size < (long)sizeof(XrefHeader))) {
+    close(fd);
+    return NULL;
+  }
+  mapping = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  header = (XrefHeader*)mapping;
+  if ((memcmp(header->magic, XREF_MAGIC, sizeof(XREF_MAGIC)) != 0) ||
+      (header->version != XREF_VERSION) || (header->byteOrder != BYTE_ORDER_MARK) ||
+      !xrefSectionFits(st.st_size, header->fileOffset, header->fileCount, sizeof(XrefFile)) ||
+      !xrefSectionFits(st.st_size, header->nameOffset, header->nameCount, sizeof(XrefName)) ||
+      !xrefSectionFits(st.st_size, header->refOffset, header->refCount, sizeof(XrefRef)) ||
+      !xrefSectionFits(st.st_size, header->poolOffset, header->poolSize, 1) ||
+      ((header->poolSize > 0) && (mapping[header->poolOffset + header->poolSize - 1] != '\0'))) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  index = (XrefIndex*)calloc(1, sizeof(XrefIndex));
+  index->mapping = mapping;
+  index->mappingSize = st.st_size;
+  index->files = (XrefFile*)(mapping + header->fileOffset);
+  index->fileCount = header->fileCount;
+  index->names = (XrefName*)(mapping + header->nameOffset);
+  index->nameCount = header->nameCount;
+  index->refs = (XrefRef*)(mapping + header->refOffset);
+  index->refCount = header->refCount;
+  index->pool = mapping + header->poolOffset;
+  // only the files are checked here; names and refs are checked as they are read
+  for (i = 0; i < index->fileCount; i++)
+    if ((index->files[i].path < 0) || (index->files[i].path >= header->poolSize)) {
+      closeIndex(index);
+      return NULL;
+    }
+  return index;
+}
+
+void closeIndex(XrefIndex *index) {
+  if (index == NULL)
+    return;
+  munmap(index->mapping, index->mappingSize);
+  free(index);
+}
+
+int nameRefsFit(XrefIndex *index, XrefName *entry) {
+  return (entry->firstRef >= 0) && (entry->refCount >= 0) &&
+    (entry->firstRef <= index->refCount - entry->refCount);
+}
+
+XrefName* findName(XrefIndex *index, char *spelling) {
+  char name[MAX_IDENT_LEN + 1];
+  int low = 0, high = index->nameCount - 1, middle, order;
+  XrefName *entry;
+
+  upperName(spelling, name);
+
+  while (low <= high) {
+    middle = (low + high) / 2;
+    entry = &index->names[middle];
+    order = strncmp(name, entry->name, sizeof(entry->name));
+    if (order == 0)
+      return nameRefsFit(index, entry) ? entry : NULL;
+    if (order < 0)
+      high = middle - 1;
+    else low = middle + 1;
+  }
+  return NULL;
+}
+
+/******************************************************************/
+
+int compareStrings(const void *a, const void *b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Where path is among old's files, or -1
+int findFile(XrefIndex *old, char *path) {
+  int low = 0, high, middle, order;
+
+  if (old == NULL)
+    return -1;
+  high = old->fileCount - 1;
+  while (low <= high) {
+    middle = (low + high) / 2;
+    order = strcmp(path, old->pool + old->files[middle].path);
+    if (order == 0)
+      return middle;
+    if (order < 0)
+      high = middle - 1;
+    else low = middle + 1;
+  }
+  return -1;
+}
+
+long alignIndexSection(long offset) {
+  return (offset + 7) & ~7L;
+}
+
+int writeIndexSection(FILE *f, void *data, long length) {
+  static const char padding[8];
+  long at = ftell(f);
+  if (fwrite(padding, 1, alignIndexSection(at) - at, f) != (size_t)(alignIndexSection(at) - at))
+    return 0;
+  return (length == 0) || (fwrite(data, 1, length, f) == (size_t)length);
+}
+
+int saveIndex(char *fileName, XrefFile *files, int fileCount, XrefName *names, int nameCount,
+              XrefRef *refs, int refCount, char *pool, int poolSize) {
+  char tmpName[MAX_PATH_LEN];
+  XrefHeader header;
+  long offset;
+  FILE *f;
+  int ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, XREF_MAGIC, sizeof(XREF_MAGIC));
+  header.version = XREF_VERSION;
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.fileCount = fileCount;
+  header.nameCount = nameCount;
+  header.refCount = refCount;
+  header.poolSize = poolSize;
+  offset = alignIndexSection(sizeof(XrefHeader));
+  header.fileOffset = offset;
+  offset = alignIndexSection(offset + fileCount * sizeof(XrefFile));
+  header.nameOffset = offset;
+  offset = alignIndexSection(offset + nameCount * sizeof(XrefName));
+  header.refOffset = offset;
+  offset = alignIndexSection(offset + (long)refCount * sizeof(XrefRef));
+  header.poolOffset = offset;
+
+  // published with rename(), so a query running meanwhile maps the old index or the new one
+  snprintf(tmpName, sizeof(tmpName), "%s.%ld", fileName, (long)getpid());
+  f = fopen(tmpName, "wb");
+  if (f == NULL)
+    return IO_ERROR;
+  ok = writeIndexSection(f, &header, sizeof(header)) &&
+    writeIndexSection(f, files, fileCount * sizeof(XrefFile)) &&
+    writeIndexSection(f, names, nameCount * sizeof(XrefName)) &&
+    writeIndexSection(f, refs, (long)refCount * sizeof(XrefRef)) &&
+    writeIndexSection(f, pool, poolSize);
+  if ((fclose(f) != 0) || !ok || (rename(tmpName, fileName) != 0)) {
+    unlink(tmpName);
+    return IO_ERROR;
+  }
+  return IO_SUCCESS;
+}
+
+int compareParsedNames(const void *a, const void *b) {
+  return strcmp(parsedNames[*(const int*)a], parsedNames[*(const int*)b]);
+}
+
+int updateIndex(XrefIndex *old, char **paths, int pathCount, char *fileName) {
+  char **sorted;
+  int sortedCount = 0;
+  XrefFile *files;
+  int fileCount = 0;
+  char *pool = NULL;
+  int poolSize = 0, poolCapacity = 0;
+  int *oldFiles;                 // new file id of each old one, -1 when parsed again or gone
+  int *oldNames, *newNames;      // new name id of each old and each parsed name
+  int *order, *rank, *firstParsed;
+  ParsedRef *grouped;
+  XrefName *names;
+  XrefRef *refs;
+  int nameCount = 0, refCount = 0, parsedFileCount = 0;
+  int oldCount = (old != NULL) ? old->fileCount : 0;
+  int oldNameCount = (old != NULL) ? old->nameCount : 0;
+  int i, j, k, o, n, f, count, order2, length, status, result;
+  long long modified;
+  XrefRef *ref;
+  struct stat st;
+  FILE *errors;
+
+  // the files of the new index: those of old and paths, by path
+  sorted = (char**)malloc((oldCount + pathCount + 1) * sizeof(char*));
+  for (i = 0; i < oldCount; i++)
+    sorted[sortedCount ++] = old->pool + old->files[i].path;
+  for (i = 0; i < pathCount; i++)
+    sorted[sortedCount ++] = paths[i];
+  qsort(sorted, sortedCount, sizeof(char*), compareStrings);
+
+  parsedNameCount = 0;
+  parsedRefCount = 0;
+  if (nameSlots != NULL)
+    memset(nameSlots, -1, nameSlotCount * sizeof(int));
+  errors = fopen("/dev/null", "w");
+  files = (XrefFile*)calloc(sortedCount + 1, sizeof(XrefFile));
+  oldFiles = (int*)malloc((oldCount + 1) * sizeof(int));
+  for (i = 0; i < oldCount; i++)
+    oldFiles[i] = -1;
+  for (i = 0; i < sortedCount; i++) {
+    if ((i > 0) && (strcmp(sorted[i], sorted[i - 1]) == 0))
+      continue;
+    if ((stat(sorted[i], &st) != 0) || !S_ISREG(st.st_mode))
+      continue;
+    modified = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    length = strlen(sorted[i]) + 1;
+    if (poolSize + length > poolCapacity) {
+      poolCapacity = 2 * (poolSize + length);
+      pool = (char*)realloc(pool, poolCapacity);
+    }
+    memcpy(pool + poolSize, sorted[i], length);
+    files[fileCount].path = poolSize;
+    files[fileCount].size = st.st_size;
+    files[fileCount].modified = modified;
+    poolSize += length;
+
+    o = findFile(old, sorted[i]);
+    if ((o >= 0) && (old->files[o].size == st.st_size) && (old->files[o].modified == modified)) {
+      oldFiles[o] = fileCount;
+      files[fileCount].status = old->files[o].status;
+    } else {
+      status = parseReferences(sorted[i], fileCount, errors);
+      files[fileCount].status = status;
+      parsedFileCount ++;
+    }
+    fileCount ++;
+  }
+  if (errors != NULL)
+    fclose(errors);
+
+  // the parsed refs grouped by name, in name order; each file was parsed in
+  // turn and read from start to end, so a stable counting sort keeps them by
+  // file, line and column. Those of the j-th name in order run from
+  // firstParsed[j] up to firstParsed[j + 1].
+  order = (int*)malloc((parsedNameCount + 1) * sizeof(int));
+  rank = (int*)malloc((parsedNameCount + 1) * sizeof(int));
+  for (i = 0; i < parsedNameCount; i++)
+    order[i] = i;
+  qsort(order, parsedNameCount, sizeof(int), compareParsedNames);
+  for (i = 0; i < parsedNameCount; i++)
+    rank[order[i]] = i;
+  firstParsed = (int*)calloc(parsedNameCount + 2, sizeof(int));
+  for (i = 0; i < parsedRefCount; i++)
+    firstParsed[rank[parsedRefs[i].name] + 2] ++;
+  for (i = 2; i <= parsedNameCount + 1; i++)
+    firstParsed[i] += firstParsed[i - 1];
+  grouped = (ParsedRef*)malloc((parsedRefCount + 1) * sizeof(ParsedRef));
+  for (i = 0; i < parsedRefCount; i++)
+    grouped[firstParsed[rank[parsedRefs[i].name] + 1] ++] = parsedRefs[i];
+
+  // first pass: merge the old names with the parsed ones, keeping those
+  // that still have refs
+  oldNames = (int*)malloc((oldNameCount + 1) * sizeof(int));
+  newNames = (int*)malloc((parsedNameCount + 1) * sizeof(int));
+  names = (XrefName*)calloc(oldNameCount + parsedNameCount + 1, sizeof(XrefName));
+  i = j = 0;
+  while ((i < oldNameCount) || (j < parsedNameCount)) {
+    if (i == oldNameCount)
+      order2 = 1;
+    else if (j == parsedNameCount)
+      order2 = -1;
+    else order2 = strncmp(old->names[i].name, parsedNames[order[j]], MAX_IDENT_LEN + 1);
+    count = 0;
+    if (order2 <= 0) {
+      oldNames[i] = -1;
+      if (nameRefsFit(old, &old->names[i]))
+        for (k = old->names[i].firstRef; k < old->names[i].firstRef + old->names[i].refCount; k++) {
+          f = old->refs[k].file;
+          if ((f >= 0) && (f < oldCount) && (oldFiles[f] >= 0))
+            count ++;
+        }
+    }
+    if (order2 >= 0) {
+      n = order[j];
+      newNames[n] = -1;
+      count += firstParsed[j + 1] - firstParsed[j];
+    }
+    if (count > 0) {
+      memcpy(names[nameCount].name, (order2 <= 0) ? old->names[i].name : parsedNames[order[j]], MAX_IDENT_LEN + 1);
+      names[nameCount].name[MAX_IDENT_LEN] = '\0';
+      names[nameCount].firstRef = refCount;
+      names[nameCount].refCount = count;
+      if (order2 <= 0)
+        oldNames[i] = nameCount;
+      if (order2 >= 0)
+        newNames[order[j]] = nameCount;
+      nameCount ++;
+      refCount += count;
+    }
+    if (order2 <= 0)
+      i ++;
+    if (order2 >= 0)
+      j ++;
+  }
+
+  // second pass: the refs of each name, those kept from old and those parsed
+  // merged by file
+  refs = (XrefRef*)malloc(((long)refCount + 1) * sizeof(XrefRef));
+  count = 0;
+  i = j = 0;
+  while ((i < oldNameCount) || (j < parsedNameCount)) {
+    if (i == oldNameCount)
+      order2 = 1;
+    else if (j == parsedNameCount)
+      order2 = -1;
+    else order2 = strncmp(old->names[i].name, parsedNames[order[j]], MAX_IDENT_LEN + 1);
+    o = k = n = 0;
+    if ((order2 <= 0) && (oldNames[i] >= 0)) {
+      o = old->names[i].firstRef;
+      k = o + old->names[i].refCount;
+    }
+    if (order2 >= 0) {
+      n = firstParsed[j];
+      length = firstParsed[j + 1];
+    } else length = 0;
+    while ((o < k) || (n < length)) {
+      // skip what old has of files gone or parsed again
+      if ((o < k) && ((old->refs[o].file < 0) || (old->refs[o].file >= oldCount) || (oldFiles[old->refs[o].file] < 0))) {
+        o ++;
+        continue;
+      }
+      ref = &refs[count ++];
+      if ((o < k) && ((n == length) || (oldFiles[old->refs[o].file] < grouped[n].file))) {
+        ref->file = oldFiles[old->refs[o].file];
+        ref->lineNo = old->refs[o].lineNo;
+        ref->colNo = old->refs[o].colNo;
+        ref->kind = old->refs[o].kind;
+        f = old->refs[o].scope;
+        ref->scope = ((f >= 0) && (f < oldNameCount)) ? oldNames[f] : -1;
+        o ++;
+      } else {
+        ref->file = grouped[n].file;
+        ref->lineNo = grouped[n].lineNo;
+        ref->colNo = grouped[n].colNo;
+        ref->kind = grouped[n].kind;
+        ref->scope = (grouped[n].scope >= 0) ? newNames[grouped[n].scope] : -1;
+        n ++;
+      }
+    }
+    if (order2 <= 0)
+      i ++;
+    if (order2 >= 0)
+      j ++;
+  }
+
+  result = saveIndex(fileName, files, fileCount, names, nameCount, refs, refCount, pool, poolSize);
+  fprintf(stderr, "kpl-xref: %d files, %d parsed, %d names, %d refs\n",
+          fileCount, parsedFileCount, nameCount, refCount);
+
+  free(sorted);
+  free(files);
+  free(pool);
+  free(oldFiles);
+  free(oldNames);
+  free(newNames);
+  free(order);
+  free(rank);
+  free(firstParsed);
+  free(grouped);
+  free(names);
+  free(refs);
+  return result;
+}
+
+/******************************************************************/
+
+char **sourcePaths;
+int sourcePathCount, sourcePathCapacity;
+
+// Adds path, or the .kpl files anywhere under it when it is a directory
+void addSources(char *path) {
+  char child[MAX_PATH_LEN];
+  struct dirent *d;
+  struct stat st;
+  DIR *dir;
+  int length;
+
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) {
+    dir = opendir(path);
+    while ((dir != NULL) && ((d = readdir(dir)) != NULL)) {
+      if (d->d_name[0] == '.')
+        continue;
+      snprintf(child, sizeof(child), "%s/%s", path, d->d_name);
+      length = strlen(d->d_name);
+      if ((stat(child, &st) == 0) &&
+          (S_ISDIR(st.st_mode) || ((length > 4) && (strcmp(d->d_name + length - 4, ".kpl") == 0))))
+        addSources(child);
+    }
+    if (dir != NULL)
+      closedir(dir);
+    return;
+  }
+  if (sourcePathCount == sourcePathCapacity) {
+    sourcePathCapacity = sourcePathCapacity ? sourcePathCapacity * 2 : 256;
+    sourcePaths = (char**)realloc(sourcePaths, sourcePathCapacity * sizeof(char*));
+  }
+  sourcePaths[sourcePathCount ++] = strdup(path);
+}
+
+// Prints the refs of name whose kind is in kinds, a set of 1 << kind;
+// returns how many
+int printReferences(XrefIndex *index, char *name, int kinds) {
+  XrefName *entry = findName(index, name);
+  XrefRef *ref;
+  int i, found = 0;
+
+  if (entry == NULL)
+    return 0;
+  for (i = entry->firstRef; i < entry->firstRef + entry->refCount; i++) {
+    ref = &index->refs[i];
+    if (!(kinds & (1 << ref->kind)) || (ref->file < 0) || (ref->file >= index->fileCount))
+      continue;
+    printf("%s:%d:%d: %s %s", index->pool + index->files[ref->file].path, ref->lineNo, ref->colNo,
+           referenceKindName(ref->kind), entry->name);
+    if ((ref->scope >= 0) && (ref->scope < index->nameCount))
+      printf(" in %.*s", MAX_IDENT_LEN, index->names[ref->scope].name);
+    printf("\n");
+    found ++;
+  }
+  return found;
+}
+
+int main(int argc, char *argv[]) {
+  char *indexName = XREF_DEFAULT_INDEX;
+  char *query = NULL;
+  int kinds = 0;
+  XrefIndex *index;
+  int i, result;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+      indexName = argv[++i];
+    else if (strcmp(argv[i], "--defs") == 0 && i + 1 < argc) {
+      query = argv[++i];
+      kinds = (1 << REF_PROGRAM) | (1 << REF_CONST) | (1 << REF_TYPE) | (1 << REF_VAR) |
+        (1 << REF_PARAM) | (1 << REF_FUNCTION) | (1 << REF_PROCEDURE);
+    } else if (strcmp(argv[i], "--calls") == 0 && i + 1 < argc) {
+      query = argv[++i];
+      kinds = 1 << REF_CALL;
+    } else if (strcmp(argv[i], "--assigns") == 0 && i + 1 < argc) {
+      query = argv[++i];
+      kinds = 1 << REF_ASSIGN;
+    } else if (strcmp(argv[i], "--uses") == 0 && i + 1 < argc) {
+      query = argv[++i];
+      kinds = (1 << REF_CALL) | (1 << REF_ASSIGN) | (1 << REF_READ);
+    } else if (strcmp(argv[i], "--refs") == 0 && i + 1 < argc) {
+      query = argv[++i];
+      kinds = ~0;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: kpl-xref [--index FILE] [PATH...]\n"
+              "       kpl-xref [--index FILE] --defs|--calls|--assigns|--uses|--refs NAME\n");
+      return -1;
+    } else addSources(argv[i]);
+  }
+
+  index = loadIndex(indexName);
+  if (query != NULL) {
+    if (index == NULL) {
+      fprintf(stderr, "kpl-xref: no index in %s\n", indexName);
+      return 2;
+    }
+    result = printReferences(index, query, kinds);
+    closeIndex(index);
+    return (result > 0) ? 0 : 1;
+  }
+
+  // without paths, the files already indexed are brought up to date
+  result = updateIndex(index, sourcePaths, sourcePathCount, indexName);
+  closeIndex(index);
+  if (result != IO_SUCCESS) {
+    fprintf(stderr, "kpl-xref: cannot write %s\n", indexName);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* Cross-reference index
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __XREF_H__
+#define __XREF_H__
+
+#include "token.h"
+#include "parser.h"
+
+#define XREF_MAGIC "KPLXREF"
+// Bumped whenever the layout below changes, or what it holds: version 2
+// keeps the names upper-cased
+#define XREF_VERSION 2
+#define XREF_DEFAULT_INDEX ".kplxref"
+
+// An index is this header followed by its sections, each aligned to 8 bytes,
+// in the byte order of the machine that wrote it. The offsets are in bytes
+// from the start of the file.
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;        // 0x01020304 as written
+  int fileCount, fileOffset;
+  int nameCount, nameOffset;
+  int refCount, refOffset;
+  int poolSize, poolOffset;      // file paths, in bytes
+} XrefHeader;
+
+// An indexed source, sorted by path. Its size and modification time tell
+// whether it must be parsed again.
+typedef struct {
+  int path;                      // offset in the pool
+  int status;                    // of compile(); refs stop at an error
+  long long size;
+  long long modified;            // in nanoseconds
+} XrefFile;
+
+// An identifier, upper-cased and sorted by name, and the refCount refs from
+// firstRef on
+typedef struct {
+  char name[MAX_IDENT_LEN + 1];
+  int firstRef, refCount;
+} XrefName;
+
+// Where a name is declared or used, sorted by file, line and column
+typedef struct {
+  int file;
+  int lineNo, colNo;
+  int kind;                      // a ReferenceKind
+  int scope;                     // name of the enclosing subroutine or program, -1 outside
+} XrefRef;
+
+// A mapped index; the tables point into the mapping
+typedef struct {
+  char *mapping;
+  long mappingSize;
+  XrefFile *files;
+  XrefName *names;
+  XrefRef *refs;
+  char *pool;
+  int fileCount, nameCount, refCount;
+} XrefIndex;
+
+// Maps the index in fileName. Returns NULL when it is missing, from another
+// version or malformed.
+XrefIndex* loadIndex(char *fileName);
+void closeIndex(XrefIndex *index);
+// The entry of name, found by binary search, or NULL
+XrefName* findName(XrefIndex *index, char *name);
+
+// Writes the index of old's files and paths to fileName, either of which may
+// be empty. Files missing on disk are dropped, those unchanged since old keep
+// their refs without being read, and the others are parsed again. Returns
+// IO_SUCCESS or IO_ERROR.
+int updateIndex(XrefIndex *old, char **paths, int pathCount, char *fileName);
+
+char* referenceKindName(int kind);
+
+#endif